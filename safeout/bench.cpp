@@ -0,0 +1,300 @@
+#include "safeout.hpp"
+#include "safeout_deferred.hpp"
+
+#include <benchmark/benchmark.h>
+#include <sys/mman.h>
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+// Cleanup written by hand against the safeout guards in a hot function
+// (see README for the commands and the results)
+
+namespace
+{
+  // the guard of safeout before scope_exit: a unique_ptr on a dummy object
+  // with the callable as deleter
+  template <typename Callable>
+  auto make_unique_ptr_guard(Callable c)
+  {
+    return std::unique_ptr<safeout::details::_unused, Callable>(&safeout::details::_, std::move(c));
+  }
+
+  int counter = 0;
+
+  __attribute__((noinline)) void release(int x) noexcept
+  {
+    benchmark::DoNotOptimize(counter += x);
+  }
+
+  __attribute__((noinline)) bool step(int x) noexcept
+  {
+    benchmark::DoNotOptimize(x);
+    return x >= 0;
+  }
+
+  __attribute__((noinline)) void may_throw(int x)
+  {
+    benchmark::DoNotOptimize(x);
+    if (x < 0) {
+      throw x;
+    }
+  }
+
+  __attribute__((noinline)) int hand_exit(int x)
+  {
+    if (!step(x)) {
+      release(x);
+      return 1;
+    }
+    release(x);
+    return 0;
+  }
+
+  __attribute__((noinline)) int guard_exit(int x)
+  {
+    _safeout_push([x]() noexcept { release(x); });
+    if (!step(x)) {
+      return 1;
+    }
+    return 0;
+  }
+
+  __attribute__((noinline)) int unique_ptr_exit(int x)
+  {
+    auto guard = make_unique_ptr_guard([x](safeout::details::_unused*) noexcept { release(x); });
+    if (!step(x)) {
+      return 1;
+    }
+    return 0;
+  }
+
+  __attribute__((noinline)) void hand_fail(int x)
+  {
+    try {
+      may_throw(x);
+    } catch (...) {
+      release(x);
+      throw;
+    }
+  }
+
+  __attribute__((noinline)) void guard_fail(int x)
+  {
+    _safeout_push_fail([x]() noexcept { release(x); });
+    may_throw(x);
+  }
+
+  __attribute__((noinline)) void hand_success(int x)
+  {
+    may_throw(x);
+    release(x);
+  }
+
+  __attribute__((noinline)) void guard_success(int x)
+  {
+    _safeout_push_success([x]() noexcept { release(x); });
+    may_throw(x);
+  }
+
+  template <auto Function>
+  void BM_Cleanup(benchmark::State& state)
+  {
+    int x = 1;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(x);
+      Function(x);
+    }
+  }
+
+  // the exception path, dominated by the unwinding itself
+  template <void (*Function)(int)>
+  void BM_Throw(benchmark::State& state)
+  {
+    for (auto _ : state) {
+      try {
+        Function(-1);
+      } catch (int) {
+      }
+    }
+  }
+}
+
+namespace
+{
+  // batch update of state.range(0) values, each step registering the
+  // rollback that restores the old value (24 bytes of captures, above the
+  // small buffer of std::function)
+  template <typename Stack>
+  void update(Stack& rollbacks, std::vector<double>& values, std::size_t steps)
+  {
+    for (std::size_t i = 0; i < steps; i++) {
+      auto rollback = [&values, i, old = values[i]]() noexcept { values[i] = old; };
+      if constexpr (std::is_same_v<Stack, safeout::guard_stack>) {
+        rollbacks.push(rollback);
+      } else {
+        rollbacks.emplace_back(rollback);
+      }
+      values[i] += 1.0;
+    }
+  }
+
+  void BM_BatchGuardStack(benchmark::State& state)
+  {
+    std::vector<double> values(state.range(0));
+    for (auto _ : state) {
+      safeout::guard_stack rollbacks;
+      update(rollbacks, values, values.size());
+      rollbacks.commit();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+  }
+
+  // the same stack for each batch, the arena is allocated once
+  void BM_BatchGuardStackReused(benchmark::State& state)
+  {
+    std::vector<double> values(state.range(0));
+    safeout::guard_stack rollbacks;
+    for (auto _ : state) {
+      update(rollbacks, values, values.size());
+      rollbacks.commit();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+  }
+
+  // rollbacks in a vector of std::function, called in reverse on failure
+  void BM_BatchFunctions(benchmark::State& state)
+  {
+    std::vector<double> values(state.range(0));
+    for (auto _ : state) {
+      std::vector<std::function<void()>> rollbacks;
+      update(rollbacks, values, values.size());
+      rollbacks.clear();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+  }
+
+  void BM_BatchRollback(benchmark::State& state)
+  {
+    std::vector<double> values(state.range(0));
+    safeout::guard_stack rollbacks;
+    for (auto _ : state) {
+      update(rollbacks, values, values.size());
+      rollbacks.rollback();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+  }
+}
+
+namespace
+{
+  // object updated transactionally, two scalars of a large state change
+  struct Vehicle
+  {
+    std::vector<double> history = std::vector<double>(4096);
+    std::vector<int> waypoints = std::vector<int>(1024);
+    unsigned fuel_level{3};
+    unsigned speed{0};
+  };
+
+  __attribute__((noinline)) unsigned sensor(unsigned x)
+  {
+    benchmark::DoNotOptimize(x);
+    return x;
+  }
+
+  // copy of the whole object, assigned back on error
+  void BM_UpdateSnapshot(benchmark::State& state)
+  {
+    Vehicle vehicle;
+    for (auto _ : state) {
+      auto guard = safeout::make_guard([&vehicle, tmp = vehicle]() { vehicle = tmp; });
+      vehicle.fuel_level = sensor(2);
+      vehicle.speed = sensor(10);
+      guard.release();
+    }
+  }
+
+  void BM_UpdateUndoLog(benchmark::State& state)
+  {
+    Vehicle vehicle;
+    for (auto _ : state) {
+      safeout::undo_log undo;
+      undo.save(vehicle.fuel_level) = sensor(2);
+      undo.save(vehicle.speed) = sensor(10);
+      undo.commit();
+    }
+  }
+}
+
+namespace
+{
+  // request handler with a 4 MB mapping: time spent releasing it at the end
+  // of the scope, the critical path of the handler
+  constexpr std::size_t kMapping = 4 << 20;
+
+  void unmap(char* mapping) noexcept
+  {
+    munmap(mapping, kMapping);
+  }
+
+  char* map()
+  {
+    void* mapping = mmap(nullptr, kMapping, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    // pages used by the handler
+    std::memset(mapping, 1, kMapping / 16);
+    return static_cast<char*>(mapping);
+  }
+
+  template <typename Guard>
+  void release_time(benchmark::State& state, Guard&& guard)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    {
+      auto released = std::move(guard);
+    }
+    state.SetIterationTime(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  void BM_ReleaseInline(benchmark::State& state)
+  {
+    for (auto _ : state) {
+      release_time(state, safeout::make_guard(map(), &unmap));
+    }
+  }
+
+  void BM_ReleaseDeferred(benchmark::State& state)
+  {
+    safeout::reclaimer reclaimer;
+    for (auto _ : state) {
+      release_time(state, safeout::make_deferred_guard(map(), &unmap, reclaimer));
+    }
+    reclaimer.drain();
+    state.counters["inline"] = benchmark::Counter(reclaimer.released_inline(), benchmark::Counter::kAvgIterations);
+  }
+}
+
+BENCHMARK(BM_ReleaseInline)->Name("release/inline")->UseManualTime()->Iterations(4000);
+BENCHMARK(BM_ReleaseDeferred)->Name("release/deferred")->UseManualTime()->Iterations(4000);
+
+BENCHMARK(BM_UpdateSnapshot)->Name("update/snapshot");
+BENCHMARK(BM_UpdateUndoLog)->Name("update/undo_log");
+
+BENCHMARK(BM_BatchGuardStack)->Name("batch/guard_stack")->Arg(8)->Arg(1024);
+BENCHMARK(BM_BatchGuardStackReused)->Name("batch/guard_stack/reused")->Arg(8)->Arg(1024);
+BENCHMARK(BM_BatchFunctions)->Name("batch/std::function")->Arg(8)->Arg(1024);
+BENCHMARK(BM_BatchRollback)->Name("batch/guard_stack/rollback")->Arg(8)->Arg(1024);
+
+BENCHMARK_TEMPLATE(BM_Cleanup, hand_exit)->Name("exit/hand");
+BENCHMARK_TEMPLATE(BM_Cleanup, guard_exit)->Name("exit/scope_exit");
+BENCHMARK_TEMPLATE(BM_Cleanup, unique_ptr_exit)->Name("exit/unique_ptr");
+BENCHMARK_TEMPLATE(BM_Cleanup, hand_fail)->Name("fail/hand");
+BENCHMARK_TEMPLATE(BM_Cleanup, guard_fail)->Name("fail/scope_fail");
+BENCHMARK_TEMPLATE(BM_Cleanup, hand_success)->Name("success/hand");
+BENCHMARK_TEMPLATE(BM_Cleanup, guard_success)->Name("success/scope_success");
+BENCHMARK_TEMPLATE(BM_Throw, hand_fail)->Name("fail/hand/throw");
+BENCHMARK_TEMPLATE(BM_Throw, guard_fail)->Name("fail/scope_fail/throw");
+
+BENCHMARK_MAIN();
@@ -0,0 +1,114 @@
+#include "safeout.hpp"
+
+#include <cstdio>
+
+// Pairs of functions, hand_* with the cleanup written by hand and guard_*
+// with a safeout guard, compared by codegen_check.sh once optimized. The
+// externals keep the calls in the code: step cannot throw, so that the hand
+// written early returns are complete, may_throw can.
+
+extern void release(int) noexcept;
+extern void rollback(int) noexcept;
+extern void commit(int);
+extern bool step(int) noexcept;
+extern int read_byte(std::FILE*) noexcept;
+extern void may_throw(int);
+
+// early returns: the cleanup copied on each path
+int hand_exit(int x)
+{
+  if (!step(x)) {
+    release(x);
+    return 1;
+  }
+  if (!step(x + 1)) {
+    release(x);
+    return 2;
+  }
+  release(x);
+  return 0;
+}
+
+int guard_exit(int x)
+{
+  _safeout_push([x]() noexcept { release(x); });
+  if (!step(x)) {
+    return 1;
+  }
+  if (!step(x + 1)) {
+    return 2;
+  }
+  return 0;
+}
+
+// released on success: the cleanup only on the error paths
+int hand_pop(int x)
+{
+  if (!step(x)) {
+    release(x);
+    return 1;
+  }
+  return 0;
+}
+
+int guard_pop(int x)
+{
+  _safeout_push([x]() noexcept { release(x); });
+  if (!step(x)) {
+    return 1;
+  }
+  _safeout_pop();
+  return 0;
+}
+
+// on exception only: a catch all that rethrows
+void hand_fail(int x)
+{
+  try {
+    may_throw(x);
+  } catch (...) {
+    rollback(x);
+    throw;
+  }
+}
+
+void guard_fail(int x)
+{
+  _safeout_push_fail([x]() noexcept { rollback(x); });
+  may_throw(x);
+}
+
+// without exception only: after the last call that can throw
+void hand_success(int x)
+{
+  may_throw(x);
+  commit(x);
+}
+
+void guard_success(int x)
+{
+  _safeout_push_success([x]() { commit(x); });
+  may_throw(x);
+}
+
+// resources: the guard holds the pointer
+int hand_file(const char* path)
+{
+  std::FILE* file = std::fopen(path, "r");
+  if (!file) {
+    return -1;
+  }
+  const int c = read_byte(file);
+  std::fclose(file);
+  return c;
+}
+
+int guard_file(const char* path)
+{
+  std::FILE* file = std::fopen(path, "r");
+  if (!file) {
+    return -1;
+  }
+  _safeout_push([file]() noexcept { std::fclose(file); });
+  return read_byte(file);
+}
@@ -0,0 +1,73 @@
+#!/bin/sh
+# Compiles codegen.cpp and compares the code of each hand_*/guard_* pair,
+# the arguments are passed to the compiler (default -std=c++17 -O2):
+# > CXX=clang++ sh codegen_check.sh -std=c++20 -O3
+#
+# scope_exit (exit, pop, file) must not cost anything: the guard function
+# has at most the instructions of the hand written one and calls nothing
+# else. scope_fail and scope_success have to read std::uncaught_exceptions()
+# at construction and destruction, as in the Library Fundamentals TS: those
+# calls (and the unwinding they replace the catch with) are the only new
+# calls allowed, the instructions added are reported.
+
+cd "$(dirname "$0")" || exit 1
+CXX=${CXX:-g++}
+[ $# -eq 0 ] && set -- -std=c++17 -O2
+asm=$(mktemp) || exit 1
+trap 'rm -f "$asm" "$asm".*' EXIT
+
+"$CXX" "$@" -S -fno-asynchronous-unwind-tables -o - codegen.cpp | c++filt > "$asm" || exit 1
+
+# instructions of a function and of its cold part, labels and directives
+# removed, local labels renamed
+body()
+{
+  awk -v f="$1" '
+    /^[^ \t.].*:$/ { name = $0; sub(/\(.*$/, "", name); inside = (name == f); next }
+    inside && /^\t[a-z]/ { print }
+  ' "$asm" | sed -e 's/\.L[A-Z]*[0-9]*/.L/g' -e 's/\t/ /g'
+}
+
+# functions called (or jumped to) by a body
+calls()
+{
+  grep -E '^ (call|jmp) [^.]' "$1" | awk '{ print $2 }' | sort -u
+}
+
+status=0
+for pair in exit pop file fail success; do
+  body "hand_$pair" > "$asm.hand"
+  body "guard_$pair" > "$asm.guard"
+  if [ ! -s "$asm.hand" ] || [ ! -s "$asm.guard" ]; then
+    echo "$pair: hand_$pair or guard_$pair not found"
+    status=1
+    continue
+  fi
+  hand=$(wc -l < "$asm.hand")
+  guard=$(wc -l < "$asm.guard")
+  calls "$asm.hand" > "$asm.hand_calls"
+  calls "$asm.guard" > "$asm.guard_calls"
+  extra=$(comm -13 "$asm.hand_calls" "$asm.guard_calls")
+  case $pair in
+    fail | success)
+      extra=$(printf '%s\n' "$extra" | grep -v -e 'uncaught_exceptions' -e '_Unwind_Resume')
+      echo "$pair: $guard instructions, $hand by hand, $(grep -c 'uncaught_exceptions' "$asm.guard") uncaught_exceptions calls"
+      ;;
+    *)
+      if cmp -s "$asm.hand" "$asm.guard"; then
+        echo "$pair: identical, $hand instructions"
+      else
+        echo "$pair: $guard instructions, $hand by hand"
+        if [ "$guard" -gt "$hand" ]; then
+          diff "$asm.hand" "$asm.guard"
+          status=1
+        fi
+      fi
+      ;;
+  esac
+  if [ -n "$extra" ]; then
+    echo "$pair: calls not in hand_$pair:" $extra
+    status=1
+  fi
+done
+exit $status
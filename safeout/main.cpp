@@ -1,6 +1,9 @@
 #include "safeout.hpp"
+#include "safeout_deferred.hpp"
 
 #include <iostream>
+#include <stdexcept>
+#include <vector>
 
 namespace
 {
@@ -49,6 +52,32 @@ namespace
     array[0] = 3;
   }
 
+  void deferred_resources()
+  {
+    // released by the reclaimer thread, not at the end of the scope
+    _safeout_push_deferred(new int[1 << 20], [](int* array) noexcept { delete[] array; });
+
+    auto* array = _safeout_get();
+    array[0] = 3;
+  }
+
+  // all the updates or none: one rollback per updated value
+  void apply_updates(std::vector<int>& values, const std::vector<int>& updates)
+  {
+    safeout::guard_stack rollbacks;
+    for (std::size_t i = 0; i < updates.size(); i++) {
+      if (updates[i] < 0) {
+        throw std::invalid_argument("negative value");
+      }
+      rollbacks.push([&values, i, old = values[i]]() noexcept
+      {
+        values[i] = old;
+      });
+      values[i] = updates[i];
+    }
+    rollbacks.commit();
+  }
+
   /// Fake engine class
   /// \invariant tank empty -> speed = 0; tank not empty -> speed >= 0
   class Engine
@@ -82,15 +111,11 @@ namespace
       //_fuel_level = fuel_level;
       //_speed = speed_cb();
 
-      _safeout_push([this, tmp = *this]()
-      {
-        *this = tmp;
-      });
-
-      _fuel_level = fuel_cb();
-      _speed = speed_cb();
-
-      _safeout_pop();
+      // undo log: only the modified fields are saved, and restored on error
+      safeout::undo_log undo;
+      undo.save(_fuel_level) = fuel_cb();
+      undo.save(_speed) = speed_cb();
+      undo.commit();
     }
 
     unsigned fuel_level() const
@@ -109,6 +134,16 @@ int main(int, char**)
   std::cout << "Safeout examples\n";
   //open_file();
   local_cpp_resources();
+  deferred_resources();
+
+  std::vector<int> values(4);
+  apply_updates(values, {1, 2, 3, 4});
+  try
+  {
+    apply_updates(values, {5, 6, -7, 8});
+  }
+  catch (...) {}
+  std::cout << "values: " << values[0] << " " << values[1] << " " << values[2] << " " << values[3] << "\n";
 
   // Test the engine
   Engine engine;
@@ -127,4 +162,6 @@ int main(int, char**)
 
   std::cout << "engine state: " << engine.fuel_level() << "L/" << engine.speed() << "km/h\n";
 
+  // shutdown: what is left to release
+  safeout::reclaimer::instance().drain();
 }
\ No newline at end of file
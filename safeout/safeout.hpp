@@ -1,6 +1,21 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <limits>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// constexpr destructors need C++20
+#if __cpp_constexpr >= 201907L
+#define SAFEOUT_CONSTEXPR_DTOR constexpr
+#else
+#define SAFEOUT_CONSTEXPR_DTOR
+#endif
 
 namespace safeout
 {
@@ -8,29 +23,462 @@ namespace safeout
   {
     struct _unused {};
     inline _unused _;
+
+    // Exit function construction of the Library Fundamentals TS v3 scope
+    // guards: EF is taken from Fn by forwarding when that cannot throw,
+    // copied otherwise (so that f is still there to be called), and f is
+    // called when the construction throws if CallOnThrow.
+    template <typename EF, bool CallOnThrow>
+    struct exit_function
+    {
+      template <typename Fn>
+      static constexpr bool nothrow = std::is_nothrow_constructible_v<EF, Fn> || std::is_nothrow_constructible_v<EF, Fn&>;
+
+      template <typename Fn>
+      static constexpr EF make(Fn&& f) noexcept(nothrow<Fn>)
+      {
+        if constexpr (!std::is_lvalue_reference_v<Fn> && std::is_nothrow_constructible_v<EF, Fn>) {
+          return EF(std::forward<Fn>(f));
+        } else if constexpr (std::is_nothrow_constructible_v<EF, Fn&>) {
+          return EF(f);
+        } else {
+          return copy(f);
+        }
+      }
+
+      // not constexpr, try blocks in constexpr functions are C++20
+      template <typename Fn>
+      static EF copy(Fn& f)
+      {
+        try {
+          return EF(f);
+        } catch (...) {
+          if constexpr (CallOnThrow) {
+            f();
+          }
+          throw;
+        }
+      }
+
+      // moved when that cannot throw, copied otherwise
+      static constexpr decltype(auto) from(EF& other) noexcept
+      {
+        if constexpr (std::is_nothrow_move_constructible_v<EF>) {
+          return std::move(other);
+        } else {
+          return static_cast<const EF&>(other);
+        }
+      }
+    };
+
+    template <typename EF>
+    constexpr bool movable = std::is_nothrow_move_constructible_v<EF> || std::is_copy_constructible_v<EF>;
+
+    template <typename EF>
+    constexpr bool nothrow_movable = std::is_nothrow_move_constructible_v<EF> || std::is_nothrow_copy_constructible_v<EF>;
   }
 
-  // This is a basic (and lazy) implementation to make use
-  // of already existing code (std::unique_ptr)
-  // ex of other impl: StackUnwinder https://github.com/latimagine/statismo/blob/master/modules/core/include/statismo/core/CommonTypes.h
-  template <typename Callable>
-  auto make_guard(Callable c)
+  // Scope guards of the Library Fundamentals TS v3 (<experimental/scope>):
+  // the exit function is called when the guard leaves its scope, always
+  // (scope_exit), only by an exception (scope_fail) or only without one
+  // (scope_success), unless release() was called first.
+  //
+  // They hold the callable plus what release() and the exception test need
+  // (a flag, the uncaught exceptions count at construction), no pointer and
+  // no deleter: once inlined the compiler folds them into the code a hand
+  // written cleanup would give (see bench.cpp and codegen_check.sh).
+
+  template <typename EF>
+  class scope_exit
   {
-    auto deleter = [del = std::move(c)](details::_unused*)
+  public:
+    template <typename Fn, typename = std::enable_if_t<!std::is_same_v<std::remove_cv_t<std::remove_reference_t<Fn>>, scope_exit>>>
+    constexpr explicit scope_exit(Fn&& f) noexcept(details::exit_function<EF, true>::template nothrow<Fn>)
+      : _f(details::exit_function<EF, true>::make(std::forward<Fn>(f)))
     {
-      del();
-    };
-    return std::unique_ptr<details::_unused, decltype(deleter)>(&details::_, deleter);
+    }
+
+    template <typename E = EF, typename = std::enable_if_t<details::movable<E>>>
+    constexpr scope_exit(scope_exit&& other) noexcept(details::nothrow_movable<EF>)
+      : _f(details::exit_function<EF, true>::from(other._f)), _active(other._active)
+    {
+      other.release();
+    }
+
+    scope_exit(const scope_exit&) = delete;
+    scope_exit& operator=(const scope_exit&) = delete;
+    scope_exit& operator=(scope_exit&&) = delete;
+
+    SAFEOUT_CONSTEXPR_DTOR ~scope_exit() noexcept
+    {
+      if (_active) {
+        _f();
+      }
+    }
+
+    constexpr void release() noexcept
+    {
+      _active = false;
+    }
+
+  private:
+    EF _f;
+    bool _active{true};
+  };
+
+  // the exception tests compare std::uncaught_exceptions() with the count
+  // at construction, release() moves the count out of reach
+  template <typename EF>
+  class scope_fail
+  {
+  public:
+    template <typename Fn, typename = std::enable_if_t<!std::is_same_v<std::remove_cv_t<std::remove_reference_t<Fn>>, scope_fail>>>
+    explicit scope_fail(Fn&& f) noexcept(details::exit_function<EF, true>::template nothrow<Fn>)
+      : _f(details::exit_function<EF, true>::make(std::forward<Fn>(f))), _uncaught(std::uncaught_exceptions())
+    {
+    }
+
+    template <typename E = EF, typename = std::enable_if_t<details::movable<E>>>
+    scope_fail(scope_fail&& other) noexcept(details::nothrow_movable<EF>)
+      : _f(details::exit_function<EF, true>::from(other._f)), _uncaught(other._uncaught)
+    {
+      other.release();
+    }
+
+    scope_fail(const scope_fail&) = delete;
+    scope_fail& operator=(const scope_fail&) = delete;
+    scope_fail& operator=(scope_fail&&) = delete;
+
+    ~scope_fail() noexcept
+    {
+      if (std::uncaught_exceptions() > _uncaught) {
+        _f();
+      }
+    }
+
+    void release() noexcept
+    {
+      _uncaught = std::numeric_limits<int>::max();
+    }
+
+  private:
+    EF _f;
+    int _uncaught;
+  };
+
+  template <typename EF>
+  class scope_success
+  {
+  public:
+    // f is not called when the construction throws (that is a failure)
+    template <typename Fn, typename = std::enable_if_t<!std::is_same_v<std::remove_cv_t<std::remove_reference_t<Fn>>, scope_success>>>
+    explicit scope_success(Fn&& f) noexcept(details::exit_function<EF, false>::template nothrow<Fn>)
+      : _f(details::exit_function<EF, false>::make(std::forward<Fn>(f))), _uncaught(std::uncaught_exceptions())
+    {
+    }
+
+    template <typename E = EF, typename = std::enable_if_t<details::movable<E>>>
+    scope_success(scope_success&& other) noexcept(details::nothrow_movable<EF>)
+      : _f(details::exit_function<EF, false>::from(other._f)), _uncaught(other._uncaught)
+    {
+      other.release();
+    }
+
+    scope_success(const scope_success&) = delete;
+    scope_success& operator=(const scope_success&) = delete;
+    scope_success& operator=(scope_success&&) = delete;
+
+    // may throw, like the exit function: no exception is in flight
+    ~scope_success() noexcept(noexcept(std::declval<EF&>()()))
+    {
+      if (std::uncaught_exceptions() <= _uncaught) {
+        _f();
+      }
+    }
+
+    void release() noexcept
+    {
+      _uncaught = -1;
+    }
+
+  private:
+    EF _f;
+    int _uncaught;
+  };
+
+  template <typename EF>
+  scope_exit(EF) -> scope_exit<EF>;
+  template <typename EF>
+  scope_fail(EF) -> scope_fail<EF>;
+  template <typename EF>
+  scope_success(EF) -> scope_success<EF>;
+
+  template <typename Callable>
+  constexpr auto make_guard(Callable&& c) noexcept(std::is_nothrow_constructible_v<std::decay_t<Callable>, Callable>)
+  {
+    return scope_exit<std::decay_t<Callable>>(std::forward<Callable>(c));
   }
 
-  template <typename T, typename Deleter = std::default_delete<T>>
+  template <typename Callable>
+  auto make_fail_guard(Callable&& c) noexcept(std::is_nothrow_constructible_v<std::decay_t<Callable>, Callable>)
+  {
+    return scope_fail<std::decay_t<Callable>>(std::forward<Callable>(c));
+  }
+
+  template <typename Callable>
+  auto make_success_guard(Callable&& c) noexcept(std::is_nothrow_constructible_v<std::decay_t<Callable>, Callable>)
+  {
+    return scope_success<std::decay_t<Callable>>(std::forward<Callable>(c));
+  }
+
+  // owned resources stay with std::unique_ptr (get() gives the resource)
+  template <typename T, typename Deleter = std::default_delete<T>, typename = std::enable_if_t<!std::is_function_v<T>>>
   auto make_guard(T* ptr, Deleter && del = Deleter {})
   {
     return std::unique_ptr<T, Deleter>(ptr, std::forward<Deleter>(del));
   }
+
+  // Any number of rollbacks, called in reverse order by rollback() or the
+  // destructor unless commit() was called first, for the loops the 8 slots
+  // of the macros cannot handle.
+  //
+  // The callables are stored in place, type erased behind a function
+  // pointer: in the InlineBytes of the object first, then in chunks of an
+  // arena that grows geometrically and is kept by commit() and rollback(),
+  // so a stack reused for each batch stops allocating after the first ones.
+  // commit() only has to destroy the callables that are not trivially
+  // destructible (chained apart), it is O(1) for lambdas capturing
+  // references, pointers or scalars.
+  //
+  // Rollbacks must not throw (they run from the destructor, std::terminate
+  // is called otherwise). When push() throws (allocation or copy of the
+  // callable), the callable is called first, like scope_exit.
+  template <std::size_t InlineBytes = 512>
+  class basic_guard_stack
+  {
+  public:
+    basic_guard_stack() noexcept = default;
+
+    basic_guard_stack(const basic_guard_stack&) = delete;
+    basic_guard_stack& operator=(const basic_guard_stack&) = delete;
+
+    ~basic_guard_stack() noexcept
+    {
+      rollback();
+      while (_chunks) {
+        chunk* next = _chunks->next;
+        ::operator delete(_chunks);
+        _chunks = next;
+      }
+    }
+
+    template <typename Fn>
+    void push(Fn&& f)
+    {
+      using N = node<std::decay_t<Fn>>;
+      static_assert(alignof(N) <= alignof(std::max_align_t), "over aligned rollbacks are not supported");
+
+      void* where;
+      try {
+        where = space(sizeof(N), alignof(N));
+      } catch (...) {
+        f();
+        throw;
+      }
+      N* n = ::new (where) N(std::forward<Fn>(f));
+      _cursor = static_cast<std::byte*>(where) + sizeof(N);
+
+      n->prev = _top;
+      n->unwind = &N::call_and_destroy;
+      _top = n;
+      if constexpr (N::owning) {
+        n->prev_owning = _owning;
+        _owning = n;
+      }
+      _size++;
+    }
+
+    // drops the rollbacks without calling them
+    void commit() noexcept
+    {
+      for (owning_entry* e = _owning; e; e = e->prev_owning) {
+        e->unwind(e, false);
+      }
+      reset();
+    }
+
+    // calls the rollbacks, last pushed first
+    void rollback() noexcept
+    {
+      for (entry* e = _top; e; e = e->prev) {
+        e->unwind(e, true);
+      }
+      reset();
+    }
+
+    bool empty() const noexcept
+    {
+      return !_top;
+    }
+
+    std::size_t size() const noexcept
+    {
+      return _size;
+    }
+
+    // bytes allocated beyond InlineBytes
+    std::size_t arena_bytes() const noexcept
+    {
+      std::size_t bytes = 0;
+      for (const chunk* c = _chunks; c; c = c->next) {
+        bytes += c->bytes;
+      }
+      return bytes;
+    }
+
+  private:
+    struct entry
+    {
+      entry* prev;
+      // calls (if call) and destroys the callable
+      void (*unwind)(entry*, bool call) noexcept;
+    };
+
+    struct owning_entry : entry
+    {
+      owning_entry* prev_owning;
+    };
+
+    template <typename EF>
+    struct node : std::conditional_t<std::is_trivially_destructible_v<EF>, entry, owning_entry>
+    {
+      static constexpr bool owning = !std::is_trivially_destructible_v<EF>;
+
+      template <typename Fn>
+      explicit node(Fn&& fn) : f(details::exit_function<EF, true>::make(std::forward<Fn>(fn)))
+      {
+      }
+
+      static void call_and_destroy(entry* e, bool call) noexcept
+      {
+        node* self = static_cast<node*>(e);
+        if (call) {
+          self->f();
+        }
+        self->f.~EF();
+      }
+
+      EF f;
+    };
+
+    // arena chunk, the bytes follow the header
+    struct chunk
+    {
+      chunk* next;
+      std::size_t bytes;
+    };
+
+    static constexpr std::size_t chunk_header = (sizeof(chunk) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+    // aligned space for bytes after the cursor, in the next chunk (grown if
+    // needed) when the current one is full
+    void* space(std::size_t bytes, std::size_t align)
+    {
+      for (;;) {
+        const std::size_t pad = (align - reinterpret_cast<std::uintptr_t>(_cursor) % align) % align;
+        if (static_cast<std::size_t>(_end - _cursor) >= pad + bytes) {
+          return _cursor + pad;
+        }
+
+        chunk* next = _chunk ? _chunk->next : _chunks;
+        if (!next || next->bytes < bytes) {
+          const std::size_t last = _chunk ? _chunk->bytes : InlineBytes;
+          const std::size_t size = std::max(2 * last, bytes);
+          chunk* grown = static_cast<chunk*>(::operator new(chunk_header + size));
+          grown->bytes = size;
+          grown->next = next;
+          (_chunk ? _chunk->next : _chunks) = grown;
+          next = grown;
+        }
+        _chunk = next;
+        _cursor = reinterpret_cast<std::byte*>(next) + chunk_header;
+        _end = _cursor + next->bytes;
+      }
+    }
+
+    void reset() noexcept
+    {
+      _top = nullptr;
+      _owning = nullptr;
+      _size = 0;
+      _chunk = nullptr;
+      _cursor = _inline;
+      _end = _inline + InlineBytes;
+    }
+
+    alignas(std::max_align_t) std::byte _inline[InlineBytes];
+    std::byte* _cursor{_inline};
+    std::byte* _end{_inline + InlineBytes};
+    // chunk of the cursor (nullptr: inline), and the first one
+    chunk* _chunk{nullptr};
+    chunk* _chunks{nullptr};
+    entry* _top{nullptr};
+    owning_entry* _owning{nullptr};
+    std::size_t _size{0};
+  };
+
+  using guard_stack = basic_guard_stack<>;
+
+  // Undo log of the fields modified in a guarded region: save(field)
+  // records the address and the old value before the field is assigned,
+  // rollback() or the destructor restores the saved fields (last saved
+  // first, so a field saved twice gets its oldest value back) unless
+  // commit() was called. Unlike a copy of the whole object, the cost is one
+  // copy per modified field, the entries of a guard_stack (in place, commit()
+  // is O(1) for trivially destructible fields).
+  template <std::size_t InlineBytes = 512>
+  class basic_undo_log
+  {
+  public:
+    // the field, to be assigned: log.save(_speed) = speed;
+    template <typename T>
+    T& save(T& field)
+    {
+      static_assert(std::is_nothrow_move_assignable_v<T>, "restoring a field must not throw");
+      _stack.push([&field, old = field]() mutable noexcept { field = std::move(old); });
+      return field;
+    }
+
+    void commit() noexcept
+    {
+      _stack.commit();
+    }
+
+    void rollback() noexcept
+    {
+      _stack.rollback();
+    }
+
+    std::size_t size() const noexcept
+    {
+      return _stack.size();
+    }
+
+  private:
+    basic_guard_stack<InlineBytes> _stack;
+  };
+
+  using undo_log = basic_undo_log<>;
 }
 
 // List of macros
+//
+// _safeout_push*: scope_exit of a callable, or unique_ptr of a resource
+// (pointer and optional deleter)
+// _safeout_push_fail*: scope_fail, the callable only runs on an exception
+// _safeout_push_success*: scope_success, only without exception
+// _safeout_pop*: releases the guard of the slot, _safeout_get*: resource of
+// the slot
 
 #define _safeout_push_at(val, args...) auto _safeout_##val = safeout::make_guard(args);
 #define _safeout_push_0(args...) _safeout_push_at(0, args)
@@ -43,6 +491,28 @@ namespace safeout
 #define _safeout_push_7(args...) _safeout_push_at(7, args)
 #define _safeout_push _safeout_push_0
 
+#define _safeout_push_fail_at(val, args...) auto _safeout_##val = safeout::make_fail_guard(args);
+#define _safeout_push_fail_0(args...) _safeout_push_fail_at(0, args)
+#define _safeout_push_fail_1(args...) _safeout_push_fail_at(1, args)
+#define _safeout_push_fail_2(args...) _safeout_push_fail_at(2, args)
+#define _safeout_push_fail_3(args...) _safeout_push_fail_at(3, args)
+#define _safeout_push_fail_4(args...) _safeout_push_fail_at(4, args)
+#define _safeout_push_fail_5(args...) _safeout_push_fail_at(5, args)
+#define _safeout_push_fail_6(args...) _safeout_push_fail_at(6, args)
+#define _safeout_push_fail_7(args...) _safeout_push_fail_at(7, args)
+#define _safeout_push_fail _safeout_push_fail_0
+
+#define _safeout_push_success_at(val, args...) auto _safeout_##val = safeout::make_success_guard(args);
+#define _safeout_push_success_0(args...) _safeout_push_success_at(0, args)
+#define _safeout_push_success_1(args...) _safeout_push_success_at(1, args)
+#define _safeout_push_success_2(args...) _safeout_push_success_at(2, args)
+#define _safeout_push_success_3(args...) _safeout_push_success_at(3, args)
+#define _safeout_push_success_4(args...) _safeout_push_success_at(4, args)
+#define _safeout_push_success_5(args...) _safeout_push_success_at(5, args)
+#define _safeout_push_success_6(args...) _safeout_push_success_at(6, args)
+#define _safeout_push_success_7(args...) _safeout_push_success_at(7, args)
+#define _safeout_push_success _safeout_push_success_0
+
 #define _safeout_pop_at(val) _safeout_##val.release();
 #define _safeout_pop_0() _safeout_pop_at(0)
 #define _safeout_pop_1() _safeout_pop_at(1)
@@ -0,0 +1,362 @@
+#pragma once
+
+#include "safeout.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Deferred release of guarded resources: the deleter of the guard runs on a
+// background thread instead of at the end of the scope (fclose, munmap,
+// free of large buffers off the critical path). Separate from safeout.hpp
+// for the threads it brings.
+
+namespace safeout
+{
+  struct reclaimer_options
+  {
+    // resources waiting per producing thread (rounded up to a power of 2),
+    // above it the producer releases them itself
+    std::size_t queue_capacity{1024};
+    // longest wait of a resource in a queue, the reclaimer is also woken
+    // when a queue is half full
+    std::chrono::milliseconds interval{2};
+  };
+
+  // Background thread releasing the resources pushed by release(), in
+  // batches. Each producing thread has a queue of its own, a bounded single
+  // producer/single consumer ring: pushing is a few stores and never locks
+  // (a mutex is only taken by the first push of a thread, to register its
+  // queue). A full queue is the backpressure: the producer releases the
+  // resource inline, as without reclaimer, until the reclaimer caught up.
+  //
+  // Deleters must not throw (std::terminate is called) and are run on the
+  // reclaimer thread, they must be trivially copied and destroyed and at
+  // most 2 pointers large (function pointers, lambdas capturing a size).
+  class reclaimer
+  {
+  public:
+    explicit reclaimer(const reclaimer_options& options = reclaimer_options())
+      : _options(options), _id(next_id())
+    {
+      std::size_t capacity = 2;
+      while (capacity < _options.queue_capacity) {
+        capacity *= 2;
+      }
+      _options.queue_capacity = capacity;
+      _thread = std::thread([this]() { run(); });
+    }
+
+    reclaimer(const reclaimer&) = delete;
+    reclaimer& operator=(const reclaimer&) = delete;
+
+    ~reclaimer()
+    {
+      drain();
+    }
+
+    // reclaimer of the process
+    static reclaimer& instance()
+    {
+      static reclaimer global;
+      return global;
+    }
+
+    // deleter(ptr) on the reclaimer thread, inline if the queue of the
+    // thread is full or the reclaimer drained
+    template <typename T, typename Deleter>
+    void release(T* ptr, const Deleter& deleter) noexcept
+    {
+      static_assert(std::is_trivially_copy_constructible_v<Deleter> && std::is_trivially_destructible_v<Deleter> && sizeof(Deleter) <= sizeof(entry::deleter) && alignof(Deleter) <= alignof(void*),
+                    "deferred deleters are trivially copied and destroyed, and at most 2 pointers large");
+
+      queue* q = _stopped.load(std::memory_order_acquire) ? nullptr : local_queue();
+      if (!q || !q->push(ptr, deleter)) {
+        if (q) {
+          wake();
+        }
+        deleter(ptr);
+        _released_inline.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      if (q->size() == _options.queue_capacity / 2) {
+        wake();
+      }
+    }
+
+    // returns once the resources pushed before the call are released
+    void flush()
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      const std::uint64_t cycle = ++_requested;
+      _wake.notify_one();
+      _done.wait(lock, [&]() { return _completed >= cycle || _stopping; });
+    }
+
+    // releases everything and stops the reclaimer, for shutdown once the
+    // producers stopped: release() is inline afterwards
+    void drain()
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stopping) {
+          return;
+        }
+        _stopping = true;
+        _stopped.store(true, std::memory_order_release);
+      }
+      _wake.notify_one();
+      _thread.join();
+      // pushes that raced with the last cycle
+      for (const std::shared_ptr<queue>& q : _queues) {
+        _released.fetch_add(q->pop_all(), std::memory_order_relaxed);
+      }
+      _done.notify_all();
+    }
+
+    // resources released by the reclaimer, and inline by the producers
+    std::size_t released() const noexcept
+    {
+      return _released.load(std::memory_order_relaxed);
+    }
+
+    std::size_t released_inline() const noexcept
+    {
+      return _released_inline.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct entry
+    {
+      void (*release)(void* ptr, const void* deleter) noexcept;
+      void* ptr;
+      alignas(void*) unsigned char deleter[2 * sizeof(void*)];
+    };
+
+    // single producer (its thread), single consumer (the reclaimer) ring
+    class queue
+    {
+    public:
+      explicit queue(std::size_t capacity)
+        : _entries(new entry[capacity]), _mask(capacity - 1)
+      {
+      }
+
+      template <typename T, typename Deleter>
+      bool push(T* ptr, const Deleter& deleter) noexcept
+      {
+        const std::size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head_seen > _mask) {
+          _head_seen = _head.load(std::memory_order_acquire);
+          if (tail - _head_seen > _mask) {
+            return false;
+          }
+        }
+        entry& e = _entries[tail & _mask];
+        e.release = [](void* p, const void* d) noexcept {
+          (*std::launder(static_cast<const Deleter*>(d)))(static_cast<T*>(p));
+        };
+        e.ptr = const_cast<std::remove_cv_t<T>*>(ptr);
+        ::new (e.deleter) Deleter(deleter);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+      }
+
+      // consumer side, returns the count released
+      std::size_t pop_all() noexcept
+      {
+        const std::size_t head = _head.load(std::memory_order_relaxed);
+        const std::size_t tail = _tail.load(std::memory_order_acquire);
+        for (std::size_t i = head; i != tail; i++) {
+          entry& e = _entries[i & _mask];
+          e.release(e.ptr, e.deleter);
+        }
+        _head.store(tail, std::memory_order_release);
+        return tail - head;
+      }
+
+      // producer side
+      std::size_t size() const noexcept
+      {
+        return _tail.load(std::memory_order_relaxed) - _head.load(std::memory_order_relaxed);
+      }
+
+      bool empty() const noexcept
+      {
+        return _tail.load(std::memory_order_acquire) == _head.load(std::memory_order_relaxed);
+      }
+
+    private:
+      std::unique_ptr<entry[]> _entries;
+      const std::size_t _mask;
+      // written by the consumer
+      alignas(64) std::atomic<std::size_t> _head{0};
+      // written by the producer, with its last read of _head
+      alignas(64) std::atomic<std::size_t> _tail{0};
+      std::size_t _head_seen{0};
+    };
+
+    // queues of the thread, shared with the reclaimers, which delete them
+    // once the thread ended and they are empty
+    struct thread_queues
+    {
+      std::uint64_t last_id{0};
+      queue* last{nullptr};
+      std::vector<std::pair<std::uint64_t, std::shared_ptr<queue>>> queues;
+    };
+
+    static std::uint64_t next_id()
+    {
+      static std::atomic<std::uint64_t> ids{0};
+      return ++ids;
+    }
+
+    queue* local_queue() noexcept
+    {
+      thread_local thread_queues local;
+      if (local.last_id == _id) {
+        return local.last;
+      }
+      for (const auto& [id, q] : local.queues) {
+        if (id == _id) {
+          local.last_id = id;
+          local.last = q.get();
+          return local.last;
+        }
+      }
+
+      // no queue (out of memory) is a full queue
+      try {
+        auto q = std::make_shared<queue>(_options.queue_capacity);
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          if (_stopping) {
+            return nullptr;
+          }
+          _queues.push_back(q);
+        }
+        local.queues.emplace_back(_id, std::move(q));
+      } catch (...) {
+        return nullptr;
+      }
+      local.last_id = _id;
+      local.last = local.queues.back().second.get();
+      return local.last;
+    }
+
+    void wake() noexcept
+    {
+      _pressure.store(true, std::memory_order_relaxed);
+      _wake.notify_one();
+    }
+
+    void run()
+    {
+      std::vector<std::shared_ptr<queue>> queues;
+      std::unique_lock<std::mutex> lock(_mutex);
+      for (;;) {
+        _wake.wait_for(lock, _options.interval, [&]() {
+          return _requested != _completed || _stopping || _pressure.load(std::memory_order_relaxed);
+        });
+        _pressure.store(false, std::memory_order_relaxed);
+        const std::uint64_t cycle = _requested;
+        const bool stopping = _stopping;
+
+        // released without the lock: deleters can push to a reclaimer
+        queues = _queues;
+        lock.unlock();
+        std::size_t released = 0;
+        for (const std::shared_ptr<queue>& q : queues) {
+          released += q->pop_all();
+        }
+        _released.fetch_add(released, std::memory_order_relaxed);
+        queues.clear();
+        lock.lock();
+
+        // queues of the threads that ended
+        for (std::size_t i = 0; i < _queues.size();) {
+          if (_queues[i].use_count() == 1 && _queues[i]->empty()) {
+            _queues[i] = std::move(_queues.back());
+            _queues.pop_back();
+          } else {
+            i++;
+          }
+        }
+
+        _completed = cycle;
+        _done.notify_all();
+        if (stopping) {
+          return;
+        }
+      }
+    }
+
+    reclaimer_options _options;
+    const std::uint64_t _id;
+    std::atomic<bool> _stopped{false};
+    std::atomic<bool> _pressure{false};
+    std::atomic<std::size_t> _released{0};
+    std::atomic<std::size_t> _released_inline{0};
+
+    // guards the queues and the cycles
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    std::vector<std::shared_ptr<queue>> _queues;
+    std::uint64_t _requested{0};
+    std::uint64_t _completed{0};
+    bool _stopping{false};
+    std::thread _thread;
+  };
+
+  // deleter of unique_ptr handing the resource to a reclaimer
+  template <typename Deleter>
+  class deferred_deleter
+  {
+  public:
+    deferred_deleter(Deleter deleter, reclaimer& to) noexcept
+      : _deleter(deleter), _reclaimer(&to)
+    {
+    }
+
+    template <typename T>
+    void operator()(T* ptr) const noexcept
+    {
+      _reclaimer->release(ptr, _deleter);
+    }
+
+  private:
+    Deleter _deleter;
+    reclaimer* _reclaimer;
+  };
+
+  // make_guard(ptr, deleter) with the deleter run by the reclaimer
+  template <typename T, typename Deleter = std::default_delete<T>, typename = std::enable_if_t<!std::is_function_v<T>>>
+  auto make_deferred_guard(T* ptr, Deleter deleter = Deleter {}, reclaimer& to = reclaimer::instance())
+  {
+    return std::unique_ptr<T, deferred_deleter<Deleter>>(ptr, deferred_deleter<Deleter>(deleter, to));
+  }
+}
+
+// _safeout_push_deferred*: _safeout_push* of a resource released by the
+// reclaimer of the process, same slots (_safeout_get*, _safeout_pop*)
+
+#define _safeout_push_deferred_at(val, args...) auto _safeout_##val = safeout::make_deferred_guard(args);
+#define _safeout_push_deferred_0(args...) _safeout_push_deferred_at(0, args)
+#define _safeout_push_deferred_1(args...) _safeout_push_deferred_at(1, args)
+#define _safeout_push_deferred_2(args...) _safeout_push_deferred_at(2, args)
+#define _safeout_push_deferred_3(args...) _safeout_push_deferred_at(3, args)
+#define _safeout_push_deferred_4(args...) _safeout_push_deferred_at(4, args)
+#define _safeout_push_deferred_5(args...) _safeout_push_deferred_at(5, args)
+#define _safeout_push_deferred_6(args...) _safeout_push_deferred_at(6, args)
+#define _safeout_push_deferred_7(args...) _safeout_push_deferred_at(7, args)
+#define _safeout_push_deferred _safeout_push_deferred_0
@@ -0,0 +1,737 @@
+#include "compute.h"
+#include "compute_strassen.h"
+#include "compute_verify.h"
+#include "matrix.h"
+#include "matrix_file.h"
+
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+// Benchmarks of computeLib (see README)
+//
+// $ ./bench --benchmark_out=bench.json --benchmark_out_format=json
+// $ compare.py benchmarks before.json after.json
+//
+// Every run is repeated so that mean/median/stddev/cv aggregates are
+// reported, gflops counts the 2*n^3 flops of the multiplication.
+
+namespace
+{
+  struct Operands
+  {
+    Operands(size_t rows, size_t cols)
+      : a(rows, cols), b(rows, cols), c(rows, cols)
+    {
+      a.fill_random(1, 0, 1024);
+      b.fill_random(2, 0, 1024);
+    }
+
+    explicit Operands(size_t count) : Operands(count, count) {}
+
+    Matrix<float> a;
+    Matrix<float> b;
+    Matrix<float> c;
+  };
+
+  // including non powers of two to catch edge tile regressions
+  const std::vector<int64_t> kSizes{64, 100, 128, 255, 256, 500, 512, 1000, 1024, 1536};
+
+  void set_counters(benchmark::State& state, size_t count, const ComputeTimings& total)
+  {
+    const double n = static_cast<double>(count);
+    const double iterations = static_cast<double>(state.iterations());
+    state.counters["gflops"] = benchmark::Counter(2.0 * n * n * n * 1e-9, benchmark::Counter::kIsIterationInvariantRate);
+    state.counters["setup_ms"] = 1e3 * total.setup / iterations;
+    state.counters["transfer_ms"] = 1e3 * total.transfer / iterations;
+    state.counters["compute_ms"] = 1e3 * total.compute / iterations;
+  }
+
+  template <bool UseLib>
+  void BM_Compute(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    ComputeSession& session = default_session();
+    if (UseLib && !session.has_external_lib())
+    {
+      state.SkipWithError("no external lib for this backend");
+      return;
+    }
+
+    Operands ops(count);
+    ComputeTimings total;
+    for (auto _ : state)
+    {
+      if (UseLib)
+      {
+        session.test_mul_from_external_lib(ops.a.data(), ops.b.data(), ops.c.data(), count);
+      }
+      else
+      {
+        session.compute_with_acc_wrapper(ops.a.data(), ops.b.data(), ops.c.data(), count);
+      }
+      const ComputeTimings& timings = session.last_timings();
+      total.setup += timings.setup;
+      total.transfer += timings.transfer;
+      total.compute += timings.compute;
+      benchmark::DoNotOptimize(ops.c.data());
+      benchmark::ClobberMemory();
+    }
+
+    set_counters(state, count, total);
+    state.SetLabel(session.backend());
+  }
+
+  // session creation included: what a caller without a session pays
+  void BM_ComputeColdSession(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    Operands ops(count);
+    ComputeTimings total;
+    const char* backend = "";
+    for (auto _ : state)
+    {
+      ComputeSession session;
+      session.compute_with_acc_wrapper(ops.a.data(), ops.b.data(), ops.c.data(), count);
+      const ComputeTimings& timings = session.last_timings();
+      total.setup += timings.setup;
+      total.transfer += timings.transfer;
+      total.compute += timings.compute;
+      backend = session.backend();
+      benchmark::DoNotOptimize(ops.c.data());
+      benchmark::ClobberMemory();
+    }
+
+    set_counters(state, count, total);
+    state.SetLabel(backend);
+  }
+
+  // naive ijk loop of main.cpp, kept as a baseline
+  void BM_Reference(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    Operands ops(count);
+    for (auto _ : state)
+    {
+      for (size_t row = 0; row < count; row++)
+      {
+        for (size_t col = 0; col < count; col++)
+        {
+          float res{};
+          for (size_t s = 0; s < count; s++)
+          {
+            res += ops.a(row, s) * ops.b(s, col);
+          }
+          ops.c(row, col) = 2 * res;
+        }
+      }
+      benchmark::DoNotOptimize(ops.c.data());
+      benchmark::ClobberMemory();
+    }
+
+    set_counters(state, count, ComputeTimings());
+  }
+
+  // Freivalds' check of a count x count product (default two trials), to
+  // compare with the multiply itself and the naive reference
+  void BM_Verify(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    Operands ops(count);
+    sgemm(Transpose::No, Transpose::No, count, count, count, 1.0f, ops.a.data(), count, ops.b.data(), count,
+          0.0f, ops.c.data(), count);
+    for (auto _ : state)
+    {
+      const Verification res = verify_gemm(Transpose::No, Transpose::No, count, count, count, 1.0f,
+                                           ops.a.data(), count, ops.b.data(), count, 0.0f, nullptr, 0,
+                                           ops.c.data(), count);
+      if (!res.passed)
+      {
+        state.SkipWithError("verification failed");
+        return;
+      }
+    }
+    // operands read per trial
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * VerifyOptions().trials * 3 * count * count * sizeof(float)));
+  }
+
+  // many small multiplications, one call per item against one batched call
+  // (the batch is about 2^24 flops so that every size runs in similar time)
+  template <bool Batched>
+  void BM_Small(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    const size_t batch = std::max<size_t>(8, (size_t{1} << 23) / (count * count * count));
+    const size_t elements = count * count;
+    Operands ops(batch, elements);
+    ops.a.fill(1.0f);
+    ops.b.fill(1.0f);
+
+    ComputeSession& session = default_session();
+    ComputeTimings total;
+    for (auto _ : state)
+    {
+      if (Batched)
+      {
+        session.sgemm_strided_batched(Transpose::No, Transpose::No, count, count, count,
+                                      1.0f, ops.a.data(), count, elements, ops.b.data(), count, elements,
+                                      0.0f, ops.c.data(), count, elements, batch);
+        const ComputeTimings& timings = session.last_timings();
+        total.setup += timings.setup;
+        total.transfer += timings.transfer;
+        total.compute += timings.compute;
+      }
+      else
+      {
+        for (size_t i = 0; i < batch; i++)
+        {
+          session.sgemm(Transpose::No, Transpose::No, count, count, count,
+                        1.0f, ops.a.data() + i * elements, count, ops.b.data() + i * elements, count,
+                        0.0f, ops.c.data() + i * elements, count);
+          const ComputeTimings& timings = session.last_timings();
+          total.setup += timings.setup;
+          total.transfer += timings.transfer;
+          total.compute += timings.compute;
+        }
+      }
+      benchmark::DoNotOptimize(ops.c.data());
+      benchmark::ClobberMemory();
+    }
+
+    const double n = static_cast<double>(count);
+    const double iterations = static_cast<double>(state.iterations());
+    state.counters["gflops"] = benchmark::Counter(2.0 * n * n * n * batch * 1e-9, benchmark::Counter::kIsIterationInvariantRate);
+    state.counters["batch"] = static_cast<double>(batch);
+    state.counters["setup_ms"] = 1e3 * total.setup / iterations;
+    state.counters["transfer_ms"] = 1e3 * total.transfer / iterations;
+    state.counters["compute_ms"] = 1e3 * total.compute / iterations;
+    state.SetLabel(session.backend());
+  }
+
+  // sgemm_async, the device phases of the pipeline overlap: overlap is
+  // (transfer + compute) / elapsed, above 1 when they do (at most 1 on the
+  // cpu and wasm backends, computed in place without a pipeline)
+  void BM_Async(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    ComputeSession& session = default_session();
+    Operands ops(count);
+    ComputeTimings total;
+    double elapsed = 0.0;
+    for (auto _ : state)
+    {
+      const auto begin = std::chrono::steady_clock::now();
+      const ComputeTimings timings = session.sgemm_async(Transpose::No, Transpose::No, count, count, count,
+                                                         1.0f, ops.a.data(), count, ops.b.data(), count,
+                                                         0.0f, ops.c.data(), count).get();
+      elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+      total.setup += timings.setup;
+      total.transfer += timings.transfer;
+      total.compute += timings.compute;
+      benchmark::DoNotOptimize(ops.c.data());
+      benchmark::ClobberMemory();
+    }
+
+    set_counters(state, count, total);
+    state.counters["overlap"] = (total.transfer + total.compute) / elapsed;
+    state.SetLabel(session.backend());
+  }
+
+  // sgemm_split against compute/lib: the whole machine on one multiply
+  void BM_Split(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    ComputeSession& session = default_session();
+    Operands ops(count);
+    ComputeTimings total;
+    for (auto _ : state)
+    {
+      session.sgemm_split(Transpose::No, Transpose::No, count, count, count,
+                          1.0f, ops.a.data(), count, ops.b.data(), count, 0.0f, ops.c.data(), count);
+      const ComputeTimings& timings = session.last_timings();
+      total.setup += timings.setup;
+      total.transfer += timings.transfer;
+      total.compute += timings.compute;
+      benchmark::DoNotOptimize(ops.c.data());
+      benchmark::ClobberMemory();
+    }
+
+    set_counters(state, count, total);
+    state.SetLabel(session.backend());
+  }
+
+  // sgemm_out_of_core on matrix files in $TMPDIR with a working set of an
+  // eighth of the operands: against compute/lib, the cost of streaming the
+  // panels through the mappings (transfer_ms is the time waiting for panels
+  // not read ahead in time). The files stay in the page cache between
+  // iterations, drop it (echo 1 > /proc/sys/vm/drop_caches) for disk bound
+  // numbers.
+  void BM_OutOfCore(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    const char* tmp = std::getenv("TMPDIR");
+    const std::string prefix = std::string(tmp ? tmp : "/tmp") + "/compute_bench_" + std::to_string(getpid());
+    MatrixFile a, b, c;
+    if (!a.create(prefix + "_a.mat", count, count) || !b.create(prefix + "_b.mat", count, count) ||
+        !c.create(prefix + "_c.mat", count, count))
+    {
+      state.SkipWithError("cannot create the matrix files");
+      return;
+    }
+    {
+      Operands ops(count);
+      std::copy(ops.a.data(), ops.a.data() + ops.a.size(), a.data_as<float>());
+      std::copy(ops.b.data(), ops.b.data() + ops.b.size(), b.data_as<float>());
+    }
+
+    OutOfCoreOptions options;
+    options.memory = 3 * count * count * sizeof(float) / 8;
+    ComputeTimings total;
+    for (auto _ : state)
+    {
+      ComputeTimings timings;
+      sgemm_out_of_core(1.0f, a, b, 0.0f, c, options, &timings);
+      total.transfer += timings.transfer;
+      total.compute += timings.compute;
+      benchmark::ClobberMemory();
+    }
+
+    set_counters(state, count, total);
+    state.SetLabel(default_session().backend());
+    a.close();
+    b.close();
+    c.close();
+    for (const char* name : {"_a.mat", "_b.mat", "_c.mat"})
+    {
+      std::remove((prefix + name).c_str());
+    }
+  }
+
+  // Strassen-Winograd with the cutoff of the second argument against the
+  // sgemm of the session (strassen/classic), gflops counts the 2*n^3 flops
+  // of the classic algorithm so that the two compare directly
+  template <bool UseStrassen>
+  void BM_Strassen(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    ComputeSession& session = default_session();
+    StrassenOptions options;
+    options.cutoff = static_cast<size_t>(state.range(1));
+    StrassenMultiplier strassen(session, options);
+    if (UseStrassen)
+    {
+      strassen.reserve(count, count, count);
+    }
+    Operands ops(count);
+    for (auto _ : state)
+    {
+      if (UseStrassen)
+      {
+        strassen.sgemm(count, count, count, 1.0f, ops.a.data(), count, ops.b.data(), count, 0.0f, ops.c.data(), count);
+      }
+      else
+      {
+        session.sgemm(Transpose::No, Transpose::No, count, count, count,
+                      1.0f, ops.a.data(), count, ops.b.data(), count, 0.0f, ops.c.data(), count);
+      }
+      benchmark::DoNotOptimize(ops.c.data());
+      benchmark::ClobberMemory();
+    }
+
+    set_counters(state, count, ComputeTimings());
+    state.counters["workspace_mb"] = strassen.workspace_bytes() * 1e-6;
+    state.SetLabel(session.backend());
+  }
+
+  // session of BM_Tuned, its winners go to a temporary tuning cache (the
+  // one of the user is left alone), removed at exit
+  struct TunedSession
+  {
+    std::string path;
+    ComputeSession session;
+    std::map<size_t, TuneResult> tuned;
+
+    TunedSession()
+    {
+      const char* tmp = std::getenv("TMPDIR");
+      path = std::string(tmp ? tmp : "/tmp") + "/compute_bench_" + std::to_string(getpid()) + "_tuning.txt";
+    }
+
+    ~TunedSession()
+    {
+      std::remove(path.c_str());
+      std::remove((path + ".lock").c_str());
+    }
+
+    // tuned on the first call for the size only, not on each run of the
+    // benchmark
+    const TuneResult& tune(size_t count)
+    {
+      auto it = tuned.find(count);
+      if (it == tuned.end())
+      {
+        const char* userPath = std::getenv("COMPUTE_TUNE_FILE");
+        const std::string saved = userPath ? userPath : "";
+        setenv("COMPUTE_TUNE_FILE", path.c_str(), 1);
+        it = tuned.insert(std::make_pair(count, session.autotune(Transpose::No, Transpose::No, count, count, count))).first;
+        if (userPath)
+        {
+          setenv("COMPUTE_TUNE_FILE", saved.c_str(), 1);
+        }
+        else
+        {
+          unsetenv("COMPUTE_TUNE_FILE");
+        }
+      }
+      return it->second;
+    }
+  };
+
+  // sgemm with the configuration the autotuner picks for the size (tuned
+  // once per run on a session of its own, the label shows the winner)
+  void BM_Tuned(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    static TunedSession tunedSession;
+    ComputeSession& session = tunedSession.session;
+    const TuneResult& tuned = tunedSession.tune(count);
+    Operands ops(count);
+    ComputeTimings total;
+    for (auto _ : state)
+    {
+      session.sgemm(Transpose::No, Transpose::No, count, count, count,
+                    1.0f, ops.a.data(), count, ops.b.data(), count, 0.0f, ops.c.data(), count);
+      const ComputeTimings& timings = session.last_timings();
+      total.setup += timings.setup;
+      total.transfer += timings.transfer;
+      total.compute += timings.compute;
+      benchmark::DoNotOptimize(ops.c.data());
+      benchmark::ClobberMemory();
+    }
+
+    set_counters(state, count, total);
+    state.SetLabel(std::string(session.backend()) + " " + to_string(tuned.config));
+  }
+
+  template <typename T>
+  T convert(float v)
+  {
+    return T(v);
+  }
+
+  template <>
+  int8_t convert<int8_t>(float v)
+  {
+    return static_cast<int8_t>(static_cast<int>(v) % 256 - 128);
+  }
+
+  // gemm<T>: the same multiplication with float, bfloat16 or int8 operands
+  // (bytes_per_element shows what is moved)
+  template <typename T>
+  void BM_Precision(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    ComputeSession& session = default_session();
+    Operands ops(count);
+    std::vector<T> a(count * count), b(count * count);
+    std::transform(ops.a.data(), ops.a.data() + ops.a.size(), a.begin(), convert<T>);
+    std::transform(ops.b.data(), ops.b.data() + ops.b.size(), b.begin(), convert<T>);
+
+    ComputeTimings total;
+    for (auto _ : state)
+    {
+      session.gemm<T>(Transpose::No, Transpose::No, count, count, count,
+                      1.0f, a.data(), count, b.data(), count, 0.0f, ops.c.data(), count);
+      const ComputeTimings& timings = session.last_timings();
+      total.setup += timings.setup;
+      total.transfer += timings.transfer;
+      total.compute += timings.compute;
+      benchmark::DoNotOptimize(ops.c.data());
+      benchmark::ClobberMemory();
+    }
+
+    set_counters(state, count, total);
+    state.counters["bytes_per_element"] = sizeof(T);
+    state.SetLabel(session.backend());
+  }
+
+  // column order walk of a 4096 x 4096 float matrix: every access is on
+  // another 4k page (16k rows), 128 rows share a 2M one. Shows the TLB
+  // misses saved by the huge pages (bytes_per_second, pages reports the
+  // backing obtained).
+  template <HugePages Pages>
+  void BM_Pages(benchmark::State& state)
+  {
+    const size_t count = 4096;
+    Matrix<float> m(count, count, Pages);
+    m.fill_random(3, 0, 16);
+    for (auto _ : state)
+    {
+      float sum = 0.0f;
+      for (size_t col = 0; col < count; col += 16)
+      {
+        for (size_t row = 0; row < count; row++)
+        {
+          sum += m(row, col);
+        }
+      }
+      benchmark::DoNotOptimize(sum);
+    }
+    // one cache line per access
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * count * count / 16 * 64));
+    state.counters["pages"] = static_cast<double>(m.pages());
+  }
+
+  // allocation, parallel first touch and counter based fill of a count x
+  // count matrix: bandwidth of the initialization (on a NUMA host each
+  // thread writes its rows on its own node)
+  void BM_FirstTouch(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    for (auto _ : state)
+    {
+      Matrix<float> m(count, count);
+      m.fill_random(4, 0, 1024);
+      benchmark::DoNotOptimize(m.data());
+    }
+    // zeroing first touch + fill
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * 2 * count * count * sizeof(float)));
+  }
+
+  // count x count A with the given density of nonzeros, scattered (block 1)
+  // or clustered in block x block squares placed at random
+  Matrix<float> sparse_operand(size_t count, double density, size_t block)
+  {
+    Matrix<float> a(count, count);
+    const size_t blocks = (count + block - 1) / block;
+    const uint64_t threshold = static_cast<uint64_t>(density * 18446744073709551615.0);
+    for (size_t i = 0; i < count; i++)
+    {
+      for (size_t j = 0; j < count; j++)
+      {
+        if (counter_random(5, i / block * blocks + j / block) < threshold)
+        {
+          a(i, j) = static_cast<float>(counter_random(6, i * count + j) % 1024);
+        }
+      }
+    }
+    return a;
+  }
+
+  enum class SparsePath
+  {
+    Csr,
+    Bsr,
+    Dense,
+    Auto
+  };
+
+  // count x count x count product with A of density range(1) / 1000,
+  // nonzeros in blocks of range(2) squared. gflops counts the 2*n^3 flops
+  // of the dense product whatever the path, so the paths compare directly:
+  // the crossover is the density where sparse/csr meets sparse/dense. The
+  // conversions are outside of the timed loop except for sparse/auto.
+  template <SparsePath Path>
+  void BM_Sparse(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    const double density = state.range(1) * 1e-3;
+    ComputeSession& session = default_session();
+    const Matrix<float> a = sparse_operand(count, density, static_cast<size_t>(state.range(2)));
+    const CsrMatrix csr = CsrMatrix::from_dense(count, count, a.data(), count);
+    const BsrMatrix bsr = BsrMatrix::from_dense(count, count, a.data(), count);
+    Operands ops(count);
+    ComputeTimings total;
+    for (auto _ : state)
+    {
+      switch (Path)
+      {
+      case SparsePath::Csr:
+        session.spmm(1.0f, csr, ops.b.data(), count, count, 0.0f, ops.c.data(), count);
+        break;
+      case SparsePath::Bsr:
+        session.spmm(1.0f, bsr, ops.b.data(), count, count, 0.0f, ops.c.data(), count);
+        break;
+      case SparsePath::Dense:
+        session.sgemm(Transpose::No, Transpose::No, count, count, count,
+                      1.0f, a.data(), count, ops.b.data(), count, 0.0f, ops.c.data(), count);
+        break;
+      case SparsePath::Auto:
+        sgemm_auto(session, count, count, count, 1.0f, a.data(), count, ops.b.data(), count, 0.0f, ops.c.data(), count);
+        break;
+      }
+      const ComputeTimings& timings = session.last_timings();
+      total.setup += timings.setup;
+      total.transfer += timings.transfer;
+      total.compute += timings.compute;
+      benchmark::DoNotOptimize(ops.c.data());
+      benchmark::ClobberMemory();
+    }
+
+    set_counters(state, count, total);
+    state.counters["density"] = csr.density();
+    state.counters["bsr_fill"] = bsr.density();
+    state.SetLabel(session.backend());
+  }
+
+  // best of a few runs of f, seconds
+  template <typename F>
+  double best_time(F&& f)
+  {
+    double best = 1e30;
+    for (int run = 0; run < 3; run++)
+    {
+      const auto begin = std::chrono::steady_clock::now();
+      f();
+      best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+    }
+    return best;
+  }
+
+  // density where the csr spmm becomes slower than sgemm on count x count
+  // operands with scattered nonzeros: the densities are doubled from 1/1024
+  // until spmm loses, the crossing is interpolated on the log of the
+  // density. crossover is the measured one, heuristic the one sgemm_auto
+  // uses (sparse_crossover)
+  void BM_SparseCrossover(benchmark::State& state)
+  {
+    const size_t count = static_cast<size_t>(state.range(0));
+    ComputeSession& session = default_session();
+    Operands ops(count);
+    double crossover = 1.0;
+    for (auto _ : state)
+    {
+      const Matrix<float> dense = sparse_operand(count, 0.5, 1);
+      const double denseTime = best_time([&] {
+        session.sgemm(Transpose::No, Transpose::No, count, count, count,
+                      1.0f, dense.data(), count, ops.b.data(), count, 0.0f, ops.c.data(), count);
+      });
+
+      double previous = 0.0;
+      double previousRatio = 0.0;
+      crossover = 1.0;
+      for (double density = 1.0 / 1024; density <= 1.0; density *= 2.0)
+      {
+        const Matrix<float> a = sparse_operand(count, density, 1);
+        const CsrMatrix csr = CsrMatrix::from_dense(count, count, a.data(), count);
+        const double ratio = best_time([&] {
+          session.spmm(1.0f, csr, ops.b.data(), count, count, 0.0f, ops.c.data(), count);
+        }) / denseTime;
+        if (ratio >= 1.0)
+        {
+          crossover = previous == 0.0 ? density
+                                      : previous * std::pow(density / previous,
+                                                            std::log(1.0 / previousRatio) / std::log(ratio / previousRatio));
+          break;
+        }
+        previous = density;
+        previousRatio = ratio;
+      }
+    }
+
+    state.counters["crossover"] = crossover;
+    state.counters["heuristic"] = sparse_crossover(session);
+    state.SetLabel(session.backend());
+  }
+
+  // ms, real time (the devices are asynchronous) and repetitions for the
+  // variance
+  void configure(benchmark::internal::Benchmark* bench, int64_t size)
+  {
+    bench->Arg(size)->Unit(benchmark::kMillisecond)->UseRealTime()->Repetitions(3);
+  }
+
+  void register_benchmarks()
+  {
+    for (int64_t size : kSizes)
+    {
+      configure(benchmark::RegisterBenchmark("compute/raw", BM_Compute<false>), size);
+      configure(benchmark::RegisterBenchmark("compute/lib", BM_Compute<true>), size);
+      configure(benchmark::RegisterBenchmark("compute/cold_session", BM_ComputeColdSession), size);
+      if (size <= 512)
+      {
+        configure(benchmark::RegisterBenchmark("reference", BM_Reference), size);
+      }
+    }
+    for (int64_t size : {256, 512, 1024, 1536})
+    {
+      configure(benchmark::RegisterBenchmark("pipeline/async", BM_Async), size);
+      configure(benchmark::RegisterBenchmark("split/all_devices", BM_Split), size);
+      configure(benchmark::RegisterBenchmark("tune/autotuned", BM_Tuned), size);
+      configure(benchmark::RegisterBenchmark("verify/freivalds", BM_Verify), size);
+    }
+    for (int64_t size : {1024, 2048, 4096})
+    {
+      configure(benchmark::RegisterBenchmark("out_of_core/files", BM_OutOfCore), size);
+      benchmark::RegisterBenchmark("strassen/classic", BM_Strassen<false>)->Args({size, 0})
+        ->Unit(benchmark::kMillisecond)->UseRealTime()->Repetitions(3);
+      for (int64_t cutoff : {512, 1024})
+      {
+        benchmark::RegisterBenchmark("strassen/winograd", BM_Strassen<true>)->Args({size, cutoff})
+          ->Unit(benchmark::kMillisecond)->UseRealTime()->Repetitions(3);
+      }
+    }
+    for (int64_t size : {512, 2048})
+    {
+      // scattered nonzeros, then 4x4 blocks (where bsr applies)
+      for (int64_t block : {1, 4})
+      {
+        for (int64_t permille : {5, 10, 20, 50, 100, 200, 400})
+        {
+          const std::vector<int64_t> args{size, permille, block};
+          benchmark::RegisterBenchmark("sparse/csr", BM_Sparse<SparsePath::Csr>)->Args(args)
+            ->Unit(benchmark::kMillisecond)->UseRealTime()->Repetitions(3);
+          if (block > 1)
+          {
+            benchmark::RegisterBenchmark("sparse/bsr", BM_Sparse<SparsePath::Bsr>)->Args(args)
+              ->Unit(benchmark::kMillisecond)->UseRealTime()->Repetitions(3);
+          }
+          benchmark::RegisterBenchmark("sparse/dense", BM_Sparse<SparsePath::Dense>)->Args(args)
+            ->Unit(benchmark::kMillisecond)->UseRealTime()->Repetitions(3);
+          benchmark::RegisterBenchmark("sparse/auto", BM_Sparse<SparsePath::Auto>)->Args(args)
+            ->Unit(benchmark::kMillisecond)->UseRealTime()->Repetitions(3);
+        }
+      }
+      benchmark::RegisterBenchmark("sparse/crossover", BM_SparseCrossover)->Arg(size)
+        ->Unit(benchmark::kMillisecond)->UseRealTime()->Iterations(1);
+    }
+    for (int64_t size : {256, 512, 1024, 1536})
+    {
+      configure(benchmark::RegisterBenchmark("precision/fp32", BM_Precision<float>), size);
+      configure(benchmark::RegisterBenchmark("precision/bf16", BM_Precision<BFloat16>), size);
+      configure(benchmark::RegisterBenchmark("precision/int8", BM_Precision<int8_t>), size);
+    }
+    configure(benchmark::RegisterBenchmark("matrix/pages/4k", BM_Pages<HugePages::None>), 4096);
+    configure(benchmark::RegisterBenchmark("matrix/pages/transparent", BM_Pages<HugePages::Transparent>), 4096);
+    configure(benchmark::RegisterBenchmark("matrix/pages/explicit", BM_Pages<HugePages::Explicit>), 4096);
+    for (int64_t size : {1024, 4096})
+    {
+      configure(benchmark::RegisterBenchmark("matrix/first_touch", BM_FirstTouch), size);
+    }
+    for (int64_t size : {8, 16, 32, 64, 128})
+    {
+      configure(benchmark::RegisterBenchmark("small/loop", BM_Small<false>), size);
+      configure(benchmark::RegisterBenchmark("small/batched", BM_Small<true>), size);
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  register_benchmarks();
+
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -1,29 +1,272 @@
+// Tiled matrix multiplication C = alpha * op(A) * op(B) + beta * C
+// (row major, op(A) is m x k, op(B) is k x n, leading dimensions lda/ldb/ldc)
+// - https://cnugteren.github.io/tutorial/pages/page1.html
+//
+// A work-group computes a TS x TS tile of C. The TS x TSK slices of op(A)
+// and TSK x TS slices of op(B) are staged in local memory with loads of VW
+// floats (1, 2, 4, 8) along the contiguous dimension of the stored matrix,
+// each work-item then keeps a WPT x WPT block of C in registers, the loop
+// over the TSK slice being unrolled UNROLL times (0 leaves it to the
+// compiler). Edge tiles are zero padded. Local size must be
+// (TS / WPT, TS / WPT). The autotuner picks these per device and shape.
+//
+// The epilogue x = relu?(scale * x + bias[col] + D[row * ldd + col]) is
+// applied on the registers before the store, bias and D are only read when
+// hasBias/hasAddend are set (any valid buffer can be bound otherwise).
+//
+// Batches are a third dimension of work-groups, item get_group_id(2) is at
+// A + item * strideA, B + item * strideB and C + item * strideC.
 
-__kernel void add(__global float* arr1, __global const float* arr2, const unsigned int size)
+#ifndef TS
+#define TS 64
+#endif
+
+#ifndef TSK
+#define TSK 16
+#endif
+
+#ifndef WPT
+#define WPT 4
+#endif
+
+#ifndef VW
+#define VW 4
+#endif
+
+#ifndef UNROLL
+#define UNROLL 0
+#endif
+
+#define RTS (TS / WPT)
+
+#define CONCAT_(a, b) a##b
+#define CONCAT(a, b) CONCAT_(a, b)
+#define DO_PRAGMA(x) _Pragma(#x)
+#define UNROLL_LOOP(n) DO_PRAGMA(unroll n)
+
+// VW consecutive elements of a row of a rows x cols matrix, zero padded
+// outside of the matrix
+void loadv(__global const float* arr, const unsigned int rows, const unsigned int cols, const unsigned int ld,
+           const int row, const int col, float* out)
 {
-  int gid = get_global_id(0);
-  if (gid < size)
-    arr1[gid] = arr1[gid] + arr2[gid];
+  if (row >= rows) {
+    for (int v = 0; v < VW; v++) {
+      out[v] = 0.0f;
+    }
+    return;
+  }
+#if VW > 1
+  // vloadn needs rows aligned to VW elements
+  if ((ld % VW) == 0 && (col % VW) == 0 && col + VW - 1 < cols) {
+    CONCAT(vstore, VW)(CONCAT(vload, VW)((row * ld + col) / VW, arr), 0, out);
+    return;
+  }
+#endif
+  const int idx = row * ld;
+  for (int v = 0; v < VW; v++) {
+    out[v] = col + v < cols ? arr[idx + col + v] : 0.0f;
+  }
 }
 
-/*void mul(uint64_t size, float* __restrict__ arr1, float* __restrict__  arr2, float* __restrict__ out)
+__kernel void sgemm(const int transA, const int transB,
+                    const unsigned int m, const unsigned int n, const unsigned int k,
+                    const float alpha, __global const float* A, const unsigned int lda,
+                    __global const float* B, const unsigned int ldb,
+                    const float beta, __global float* C, const unsigned int ldc,
+                    const float scale, const int hasBias, __global const float* bias,
+                    const int hasAddend, __global const float* D, const unsigned int ldd,
+                    const int relu,
+                    const unsigned int strideA, const unsigned int strideB, const unsigned int strideC)
 {
-  float res = 0.0;
-  {
-    {
-      for (uint64_t row = 0; row < size; row++)
-      {
-        for (uint64_t col = 0; col < size; col++)
-        {
-          res = 0.0f;
-          // reduction -> updating the same variable at each loop
-          for (uint64_t s = 0; s < size; s++)
-          {
-            res += arr1[row * size + s] * arr2[s * size + col];
-          }
-          out[row * size + col] = res;
+  const int item = get_group_id(2);
+  A += item * strideA;
+  B += item * strideB;
+  C += item * strideC;
+
+  const int tx = get_local_id(0);
+  const int ty = get_local_id(1);
+  const int tid = ty * RTS + tx;
+  const int colBase = get_group_id(0) * TS;
+  const int rowBase = get_group_id(1) * TS;
+
+  __local float Asub[TS][TSK];
+  __local float Bsub[TSK][TS];
+
+  float acc[WPT][WPT];
+  for (int i = 0; i < WPT; i++) {
+    for (int j = 0; j < WPT; j++) {
+      acc[i][j] = 0.0f;
+    }
+  }
+
+  for (int k0 = 0; k0 < k; k0 += TSK) {
+    // TS x TSK slice of op(A)
+    float v[VW];
+    if (!transA) {
+      for (int l = tid; l < TS * TSK / VW; l += RTS * RTS) {
+        const int row = l / (TSK / VW);
+        const int col = (l % (TSK / VW)) * VW;
+        loadv(A, m, k, lda, rowBase + row, k0 + col, v);
+        for (int e = 0; e < VW; e++) {
+          Asub[row][col + e] = v[e];
+        }
+      }
+    } else {
+      for (int l = tid; l < TS * TSK / VW; l += RTS * RTS) {
+        const int p = l / (TS / VW);
+        const int i = (l % (TS / VW)) * VW;
+        loadv(A, k, m, lda, k0 + p, rowBase + i, v);
+        for (int e = 0; e < VW; e++) {
+          Asub[i + e][p] = v[e];
+        }
+      }
+    }
+
+    // TSK x TS slice of op(B)
+    if (!transB) {
+      for (int l = tid; l < TSK * TS / VW; l += RTS * RTS) {
+        const int row = l / (TS / VW);
+        const int col = (l % (TS / VW)) * VW;
+        loadv(B, k, n, ldb, k0 + row, colBase + col, v);
+        for (int e = 0; e < VW; e++) {
+          Bsub[row][col + e] = v[e];
+        }
+      }
+    } else {
+      for (int l = tid; l < TSK * TS / VW; l += RTS * RTS) {
+        const int j = l / (TSK / VW);
+        const int p = (l % (TSK / VW)) * VW;
+        loadv(B, n, k, ldb, colBase + j, k0 + p, v);
+        for (int e = 0; e < VW; e++) {
+          Bsub[p + e][j] = v[e];
+        }
+      }
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+#if UNROLL > 0
+    UNROLL_LOOP(UNROLL)
+#endif
+    for (int kk = 0; kk < TSK; kk++) {
+      float breg[WPT];
+      for (int j = 0; j < WPT; j++) {
+        breg[j] = Bsub[kk][tx + j * RTS];
+      }
+      for (int i = 0; i < WPT; i++) {
+        const float areg = Asub[ty + i * RTS][kk];
+        for (int j = 0; j < WPT; j++) {
+          acc[i][j] += areg * breg[j];
         }
       }
     }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  for (int i = 0; i < WPT; i++) {
+    const int row = rowBase + ty + i * RTS;
+    for (int j = 0; j < WPT; j++) {
+      const int col = colBase + tx + j * RTS;
+      if (row < m && col < n) {
+        // C is not read when beta is 0 (blas semantic)
+        const int idx = row * ldc + col;
+        float res = beta == 0.0f ? alpha * acc[i][j] : alpha * acc[i][j] + beta * C[idx];
+        res *= scale;
+        if (hasBias) res += bias[col];
+        if (hasAddend) res += D[row * ldd + col];
+        C[idx] = relu ? fmax(res, 0.0f) : res;
+      }
+    }
+  }
+}
+
+// C = alpha * A * B + beta * C with a CSR A (m x k, see CsrMatrix in
+// compute.h), B k x n and C m x n row major. A work-group of SG work-items
+// covers SG columns of a row of C: the nonzeros of the row are staged SG at
+// a time in local memory (one load per work-item), then each work-item
+// reads the rows of B they select at its column, coalesced over the group.
+// Local size must be (SG, 1), the global one (n rounded up to SG, m).
+
+#ifndef SG
+#define SG 64
+#endif
+
+__kernel void spmm_csr(const unsigned int n, const float alpha,
+                       __global const unsigned int* rowPtr, __global const unsigned int* colIdx,
+                       __global const float* values,
+                       __global const float* B, const unsigned int ldb,
+                       const float beta, __global float* C, const unsigned int ldc)
+{
+  const unsigned int lx = get_local_id(0);
+  const unsigned int col = get_global_id(0);
+  const unsigned int row = get_global_id(1);
+
+  __local unsigned int cols[SG];
+  __local float vals[SG];
+
+  const unsigned int begin = rowPtr[row];
+  const unsigned int end = rowPtr[row + 1];
+  float acc = 0.0f;
+  // every work-item of the group takes part in the staging, the ones past
+  // the last column included
+  for (unsigned int p0 = begin; p0 < end; p0 += SG) {
+    const unsigned int count = min((unsigned int)SG, end - p0);
+    if (lx < count) {
+      cols[lx] = colIdx[p0 + lx];
+      vals[lx] = values[p0 + lx];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (col < n) {
+      for (unsigned int p = 0; p < count; p++) {
+        acc += vals[p] * B[cols[p] * ldb + col];
+      }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
   }
-}*/
+
+  if (col < n) {
+    const unsigned int idx = row * ldc + col;
+    C[idx] = beta == 0.0f ? alpha * acc : alpha * acc + beta * C[idx];
+  }
+}
+
+// same with a BSR A (BsrMatrix in compute.h, blocks of br x bc, br at most
+// 16): get_global_id(1) is a block row, each work-item keeps the br
+// accumulators of its column and reads each row of B once per block.
+__kernel void spmm_bsr(const unsigned int m, const unsigned int n, const unsigned int k, const float alpha,
+                       const unsigned int br, const unsigned int bc,
+                       __global const unsigned int* rowPtr, __global const unsigned int* colIdx,
+                       __global const float* values,
+                       __global const float* B, const unsigned int ldb,
+                       const float beta, __global float* C, const unsigned int ldc)
+{
+  const unsigned int col = get_global_id(0);
+  const unsigned int blockRow = get_global_id(1);
+  if (col >= n) {
+    return;
+  }
+
+  float acc[16];
+  for (int r = 0; r < 16; r++) {
+    acc[r] = 0.0f;
+  }
+  const unsigned int rows = min(br, m - blockRow * br);
+
+  for (unsigned int blk = rowPtr[blockRow]; blk < rowPtr[blockRow + 1]; blk++) {
+    const unsigned int col0 = colIdx[blk] * bc;
+    const unsigned int cols = min(bc, k - col0);
+    __global const float* block = values + blk * br * bc;
+    for (unsigned int q = 0; q < cols; q++) {
+      const float b = B[(col0 + q) * ldb + col];
+      for (unsigned int r = 0; r < rows; r++) {
+        acc[r] += block[r * bc + q] * b;
+      }
+    }
+  }
+
+  for (unsigned int r = 0; r < rows; r++) {
+    const unsigned int idx = (blockRow * br + r) * ldc + col;
+    C[idx] = beta == 0.0f ? alpha * acc[r] : alpha * acc[r] + beta * C[idx];
+  }
+}
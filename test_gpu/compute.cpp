@@ -0,0 +1,70 @@
+#include "compute.h"
+
+// Backend independent entry points, the backend specific parts live in
+// compute.cu, compute_acc.cpp, compute_cl.cpp, compute_cpu.cpp and
+// compute_wasm.cpp
+
+ComputeSession& default_session()
+{
+  static ComputeSession session;
+  return session;
+}
+
+void compute_with_acc_wrapper(float* a, float* b, float* c, size_t count)
+{
+  default_session().compute_with_acc_wrapper(a, b, c, count);
+}
+
+void test_mul_from_external_lib(float* a, float* b, float* c, size_t count)
+{
+  default_session().test_mul_from_external_lib(a, b, c, count);
+}
+
+void sgemm(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+           float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+           float beta, float* c, size_t ldc, const Epilogue& epilogue)
+{
+  default_session().sgemm(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, epilogue);
+}
+
+void sgemm_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                   float alpha, const float* const* a, size_t lda, const float* const* b, size_t ldb,
+                   float beta, float* const* c, size_t ldc, size_t batch)
+{
+  default_session().sgemm_batched(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, batch);
+}
+
+void sgemm_strided_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                           float alpha, const float* a, size_t lda, size_t strideA,
+                           const float* b, size_t ldb, size_t strideB,
+                           float beta, float* c, size_t ldc, size_t strideC, size_t batch)
+{
+  default_session().sgemm_strided_batched(transA, transB, m, n, k, alpha, a, lda, strideA,
+                                          b, ldb, strideB, beta, c, ldc, strideC, batch);
+}
+
+std::future<ComputeTimings> sgemm_async(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                        float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                        float beta, float* c, size_t ldc)
+{
+  return default_session().sgemm_async(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+}
+
+void sgemm_split(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                 float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                 float beta, float* c, size_t ldc)
+{
+  default_session().sgemm_split(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+}
+
+void spmm(float alpha, const CsrMatrix& a, const float* b, size_t ldb, size_t n,
+          float beta, float* c, size_t ldc)
+{
+  default_session().spmm(alpha, a, b, ldb, n, beta, c, ldc);
+}
+
+void spmm(float alpha, const BsrMatrix& a, const float* b, size_t ldb, size_t n,
+          float beta, float* c, size_t ldc)
+{
+  default_session().spmm(alpha, a, b, ldb, n, beta, c, ldc);
+}
@@ -4,9 +4,17 @@
 #include <thrust/sequence.h>
 #include <cublas_v2.h>
 
+#include "compute.h"
+#include "compute_timer.h"
+#include "compute_trace.h"
+#include "compute_widen.h"
+#include "compute_worker.h"
+
 #include <iostream>
 #include <cmath>
 #include <algorithm>
+#include <sstream>
+#include <vector>
 
 #if __CUDA_ARCH__ == 500
 
@@ -52,12 +60,8 @@ void mul(uint64_t size, float* arr1, float* arr2, float* out) {
 
 __global__
 void mul_tile(uint64_t size, float* arr1, float* arr2, float* out) {
-  int realRow = threadIdx.y + blockIdx.y * blockDim.y; 
-  int realCol = threadIdx.x + blockIdx.x * blockDim.x;
-
-  if (realRow > size || realCol > size) {
-    return;
-  }
+  uint64_t realRow = threadIdx.y + blockIdx.y * blockDim.y; 
+  uint64_t realCol = threadIdx.x + blockIdx.x * blockDim.x;
 
   int row = threadIdx.y;
   int col = threadIdx.x;
@@ -65,147 +69,1118 @@ void mul_tile(uint64_t size, float* arr1, float* arr2, float* out) {
   float Cvalue = 0;
   // for each sublocks, load Asubi and Bsubi to shared memory
   // compute multiplication
-  for (uint64_t sub = 0; sub < size / 16U; sub++) {
+  // out of range threads cannot return early: they have to reach the
+  // __syncthreads and load the zero padding of the last sublocks
+  for (uint64_t sub = 0; sub < (size + 15U) / 16U; sub++) {
     // load Asubi et bsubi
     __shared__ float Asubi[16][16];
     __shared__ float Bsubi[16][16];
-    Asubi[row][col] = arr1[realRow*size+col+sub*16];
-    Bsubi[row][col] = arr2[(row+sub*16)*size+realCol];
+    uint64_t aCol = col + sub*16;
+    uint64_t bRow = row + sub*16;
+    Asubi[row][col] = (realRow < size && aCol < size) ? arr1[realRow*size+aCol] : 0.0f;
+    Bsubi[row][col] = (bRow < size && realCol < size) ? arr2[bRow*size+realCol] : 0.0f;
     __syncthreads();
     for (uint64_t e = 0; e < 16; e++) {
       Cvalue += Asubi[row][e] * Bsubi[e][col];
     }
     __syncthreads();
   }
-  out[realRow*size+realCol] = Cvalue;
+
+  if (realRow < size && realCol < size) {
+    out[realRow*size+realCol] = Cvalue;
+  }
+}
+
+// C = alpha * op(A) * op(B) + beta * C, same tiling as mul_tile with
+// TILE x TILE blocks (16 by default, the autotuner picks 8, 16 or 32) and
+// the loop over a shared tile unrolled UNROLL times
+// op(A) is m x k, op(B) is k x n, C is m x n (row major, leading dimensions)
+// The epilogue (see Epilogue in compute.h) is applied before the store,
+// bias and addend are device pointers or null
+template <int TILE, int UNROLL>
+__device__
+void sgemm_tile_block(bool transA, bool transB, uint64_t m, uint64_t n, uint64_t k,
+                      float alpha, const float* A, uint64_t lda, const float* B, uint64_t ldb,
+                      float beta, float* C, uint64_t ldc,
+                      float scale, const float* bias, const float* addend, uint64_t ldd, bool relu) {
+  uint64_t realRow = threadIdx.y + blockIdx.y * blockDim.y;
+  uint64_t realCol = threadIdx.x + blockIdx.x * blockDim.x;
+
+  int row = threadIdx.y;
+  int col = threadIdx.x;
+
+  __shared__ float Asubi[TILE][TILE];
+  __shared__ float Bsubi[TILE][TILE];
+
+  float Cvalue = 0;
+  for (uint64_t sub = 0; sub < (k + TILE - 1) / TILE; sub++) {
+    uint64_t aCol = col + sub*TILE;
+    uint64_t bRow = row + sub*TILE;
+    float av = 0.0f;
+    float bv = 0.0f;
+    if (realRow < m && aCol < k) {
+      av = transA ? A[aCol*lda+realRow] : A[realRow*lda+aCol];
+    }
+    if (bRow < k && realCol < n) {
+      bv = transB ? B[realCol*ldb+bRow] : B[bRow*ldb+realCol];
+    }
+    Asubi[row][col] = av;
+    Bsubi[row][col] = bv;
+    __syncthreads();
+#pragma unroll (UNROLL)
+    for (int e = 0; e < TILE; e++) {
+      Cvalue += Asubi[row][e] * Bsubi[e][col];
+    }
+    __syncthreads();
+  }
+
+  if (realRow < m && realCol < n) {
+    float* out = C + realRow*ldc + realCol;
+    // C is not read when beta is 0 (blas semantic)
+    float res = beta == 0.0f ? alpha * Cvalue : alpha * Cvalue + beta * (*out);
+    res *= scale;
+    if (bias) {
+      res += bias[realCol];
+    }
+    if (addend) {
+      res += addend[realRow*ldd + realCol];
+    }
+    *out = relu ? fmaxf(res, 0.0f) : res;
+  }
+}
+
+template <int TILE, int UNROLL>
+__global__
+void sgemm_tile(bool transA, bool transB, uint64_t m, uint64_t n, uint64_t k,
+                float alpha, const float* A, uint64_t lda, const float* B, uint64_t ldb,
+                float beta, float* C, uint64_t ldc,
+                float scale, const float* bias, const float* addend, uint64_t ldd, bool relu) {
+  sgemm_tile_block<TILE, UNROLL>(transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, scale, bias, addend, ldd, relu);
 }
 
-void mul_blas(const int size, const float *A, const float *B, float *C) {
+// batch of sgemm in one launch, blockIdx.z selects the item
+__global__
+void sgemm_tile_batched(bool transA, bool transB, uint64_t m, uint64_t n, uint64_t k,
+                        float alpha, const float* A, uint64_t lda, uint64_t strideA,
+                        const float* B, uint64_t ldb, uint64_t strideB,
+                        float beta, float* C, uint64_t ldc, uint64_t strideC) {
+  const uint64_t item = blockIdx.z;
+  sgemm_tile_block<16, 16>(transA, transB, m, n, k, alpha, A + item*strideA, lda, B + item*strideB, ldb,
+                   beta, C + item*strideC, ldc, 1.0f, nullptr, nullptr, 0, false);
+}
+
+// C = alpha * A * B + beta * C with a CSR A (see CsrMatrix in compute.h),
+// one thread per element of C: the threads of a block share the row (the
+// nonzeros are broadcast) and read consecutive columns of B. Row
+// firstRow + blockIdx.y, gridDim.y is limited to 65535
+__global__
+void spmm_csr(uint64_t m, uint64_t n, float alpha, const uint32_t* rowPtr, const uint32_t* colIdx,
+              const float* values, const float* B, uint64_t ldb, float beta, float* C, uint64_t ldc,
+              uint64_t firstRow) {
+  uint64_t row = firstRow + blockIdx.y;
+  uint64_t col = threadIdx.x + blockIdx.x * blockDim.x;
+
+  if (row < m && col < n) {
+    float res = 0.0f;
+    for (uint32_t p = rowPtr[row]; p < rowPtr[row + 1]; p++) {
+      res += values[p] * B[colIdx[p]*ldb + col];
+    }
+    float* out = C + row*ldc + col;
+    *out = beta == 0.0f ? alpha * res : alpha * res + beta * (*out);
+  }
+}
+
+// same with a BSR A (br x bc blocks, br at most 16), one thread per column
+// of a block row of C, block row firstBlockRow + blockIdx.y
+__global__
+void spmm_bsr(uint64_t m, uint64_t n, uint64_t k, float alpha, uint64_t br, uint64_t bc,
+              const uint32_t* rowPtr, const uint32_t* colIdx, const float* values,
+              const float* B, uint64_t ldb, float beta, float* C, uint64_t ldc,
+              uint64_t firstBlockRow) {
+  uint64_t blockRow = firstBlockRow + blockIdx.y;
+  uint64_t col = threadIdx.x + blockIdx.x * blockDim.x;
+  if (col >= n) {
+    return;
+  }
+
+  float res[16] = {};
+  const uint64_t rows = m - blockRow*br < br ? m - blockRow*br : br;
+  for (uint32_t blk = rowPtr[blockRow]; blk < rowPtr[blockRow + 1]; blk++) {
+    const uint64_t col0 = colIdx[blk]*bc;
+    const uint64_t cols = k - col0 < bc ? k - col0 : bc;
+    const float* block = values + blk*br*bc;
+    for (uint64_t q = 0; q < cols; q++) {
+      const float b = B[(col0 + q)*ldb + col];
+      for (uint64_t r = 0; r < rows; r++) {
+        res[r] += block[r*bc + q] * b;
+      }
+    }
+  }
+
+  for (uint64_t r = 0; r < rows; r++) {
+    float* out = C + (blockRow*br + r)*ldc + col;
+    *out = beta == 0.0f ? alpha * res[r] : alpha * res[r] + beta * (*out);
+  }
+}
+
+// sgemm_tile instance of a block shape, on the default stream
+template <int TILE, int UNROLL>
+void launch_tile(bool transA, bool transB, uint64_t m, uint64_t n, uint64_t k,
+                 float alpha, const float* A, uint64_t lda, const float* B, uint64_t ldb,
+                 float beta, float* C, uint64_t ldc,
+                 float scale, const float* bias, const float* addend, uint64_t ldd, bool relu) {
+  dim3 threadsPerBlock(TILE, TILE);
+  dim3 numBlocks((n + threadsPerBlock.x - 1) / threadsPerBlock.x,
+                 (m + threadsPerBlock.y - 1) / threadsPerBlock.y);
+  sgemm_tile<TILE, UNROLL><<<numBlocks, threadsPerBlock>>>(transA, transB, m, n, k, alpha, A, lda, B, ldb,
+                                                            beta, C, ldc, scale, bias, addend, ldd, relu);
+}
+
+// the instances the autotuner chooses from (tile and unroll knobs, the
+// block is tile x tile), false for a configuration not compiled in
+bool launch_tuned(const TuneConfig& knobs, bool transA, bool transB, uint64_t m, uint64_t n, uint64_t k,
+                  float alpha, const float* A, uint64_t lda, const float* B, uint64_t ldb,
+                  float beta, float* C, uint64_t ldc,
+                  float scale, const float* bias, const float* addend, uint64_t ldd, bool relu) {
+  typedef void (*launcher)(bool, bool, uint64_t, uint64_t, uint64_t, float, const float*, uint64_t,
+                           const float*, uint64_t, float, float*, uint64_t,
+                           float, const float*, const float*, uint64_t, bool);
+  struct instance {
+    size_t tile;
+    size_t unroll;
+    launcher launch;
+  };
+  static const instance instances[] = {
+    {8, 1, &launch_tile<8, 1>}, {8, 4, &launch_tile<8, 4>}, {8, 8, &launch_tile<8, 8>},
+    {16, 1, &launch_tile<16, 1>}, {16, 4, &launch_tile<16, 4>}, {16, 16, &launch_tile<16, 16>},
+    {32, 1, &launch_tile<32, 1>}, {32, 4, &launch_tile<32, 4>}, {32, 32, &launch_tile<32, 32>},
+  };
+  const size_t tile = tune_value(knobs, "tile", 16);
+  const size_t unroll = tune_value(knobs, "unroll", tile);
+  for (const instance& it : instances) {
+    if (it.tile == tile && it.unroll == unroll) {
+      it.launch(transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, scale, bias, addend, ldd, relu);
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<TuneConfig> tuning_candidates() {
+  std::vector<TuneConfig> candidates;
+  for (size_t tile : {8, 16, 32}) {
+    for (size_t unroll : {size_t{1}, size_t{4}, tile}) {
+      TuneConfig knobs;
+      knobs["tile"] = tile;
+      knobs["unroll"] = unroll;
+      candidates.push_back(knobs);
+    }
+  }
+  return candidates;
+}
+
+void mul_blas(cublasHandle_t handle, const int size, const float alf, const float *A, const float *B, float *C) {
      int lda=size,ldb=size,ldc=size;
-     const float alf = 1;
      const float bet = 0;
      const float *alpha = &alf;
      const float *beta = &bet;
  
-     // Create a handle for CUBLAS
-     cublasHandle_t handle;
-     auto res = cublasCreate(&handle);
-
-     if (res != CUBLAS_STATUS_SUCCESS) {
-      std::cout << "cublas handle error " << res << std::endl;
-     }
- 
      // Do the actual multiplication
      // https://stackoverflow.com/questions/56043539/cublassgemm-row-major-multiplication
      // for the row major operation
      cublasSgemm(handle, CUBLAS_OP_N, CUBLAS_OP_N, size, size, size, alpha, B, lda, A, ldb, beta, C, ldc);
- 
-     // Destroy the handle
-     cublasDestroy(handle);
 }
 
-void compute(float*a, float*b, float*c, size_t count, bool useLib = false) {
-  const uint64_t kCount = count;
+// rows x cols block of a host matrix with leading dimension ld to a tightly
+// packed buffer and back
+void pack(float* dst, const float* src, size_t rows, size_t cols, size_t ld) {
+  for (size_t row = 0; row < rows; row++) {
+    std::copy(src + row*ld, src + row*ld + cols, dst + row*cols);
+  }
+}
 
-  /////////////////////////////////////////////////////////////////////////////
-  /////////////////////////////// Initialization
-  /////////////////////////////////////////////////////////////////////////////
+void unpack(float* dst, size_t ld, const float* src, size_t rows, size_t cols) {
+  for (size_t row = 0; row < rows; row++) {
+    std::copy(src + row*cols, src + (row + 1)*cols, dst + row*ld);
+  }
+}
 
-  // check config before
-  // cudaGetDeviceCount
-  // SM Version
-  int devicesCount{-666};
-  auto cudaStatus = cudaGetDeviceCount(&devicesCount);
-  
-  if (cudaStatus != cudaSuccess) {
-      std::cerr << "Failed to get device count with error " << static_cast<int>(cudaStatus) << std::endl;
-      return;
+#ifdef COMPUTE_TRACE
+// device time of the work queued on a stream from the construction to
+// record (cuda events), anchored on the host time of the construction
+struct TracedRange
+{
+  cudaStream_t stream;
+  cudaEvent_t start{nullptr};
+  cudaEvent_t stop{nullptr};
+  double queued;
+
+  explicit TracedRange(cudaStream_t s = 0) : stream(s), queued(trace_now()) {
+    cudaEventCreate(&start);
+    cudaEventCreate(&stop);
+    cudaEventRecord(start, stream);
   }
 
-  std::cout << "device count: " << devicesCount << std::endl;
+  ~TracedRange() {
+    cudaEventDestroy(start);
+    cudaEventDestroy(stop);
+  }
 
-  cudaDeviceProp prop;
-  cudaGetDeviceProperties(&prop, 0);
+  void record(const char* lane, const char* category, const char* name, double bytes, double flops) {
+    cudaEventRecord(stop, stream);
+    cudaEventSynchronize(stop);
+    float elapsed = 0.0f;
+    cudaEventElapsedTime(&elapsed, start, stop);
+    trace_record(category, name, queued, elapsed * 1e3, bytes, flops, lane);
+  }
+};
+#else
+struct TracedRange
+{
+  explicit TracedRange(cudaStream_t = 0) {}
+  void record(const char*, const char*, const char*, double, double) {}
+};
+#endif
 
-  // 6.1 on my quadro = Pascal
-  std::cout << "compute cap: " << prop.major << "." << prop.minor << std::endl;
-  //std::cout << "the cuda api version: " << CUDA_VERSION << std::endl;
+// one of the two buffers of the asynchronous pipeline: its stream, device
+// tiles, pinned staging buffers and the row tile of C in flight
+struct AsyncSlot
+{
+  cudaStream_t stream{nullptr};
+  cudaEvent_t start{nullptr};
+  cudaEvent_t uploaded{nullptr};
+  cudaEvent_t computed{nullptr};
+  cudaEvent_t done{nullptr};
 
-  // check the concurrent kernel prop
-  std::cout << "concurrent kernel: " << prop.concurrentKernels << std::endl;
+  float*tileA{nullptr};
+  float*tileC{nullptr};
+  size_t capacityA{0};
+  size_t capacityC{0};
+  float*hostA{nullptr};
+  float*hostC{nullptr};
+  size_t capacityHostA{0};
+  size_t capacityHostC{0};
 
-  /////////////////////////////////////////////////////////////////////////////
-  /////////////////////////////// Create device container
-  /////////////////////////////////////////////////////////////////////////////
+  bool pending{false};
+  uint64_t row0{0};
+  uint64_t rows{0};
+#ifdef COMPUTE_TRACE
+  // host time at which the tile was queued, lane of the stream, bytes
+  // uploaded and k of the multiply
+  double queuedAt{0.0};
+  const char* lane{nullptr};
+  double uploadBytes{0.0};
+  uint64_t depth{0};
+#endif
+};
 
-  std::cout << "start computation" << std::endl;
+struct ComputeSession::Impl
+{
+  cudaDeviceProp prop;
+  cublasHandle_t handle{nullptr};
 
   float*arr1{nullptr};
   float*arr2{nullptr};
   float*mulResult{nullptr};
-  cudaStatus = cudaMallocManaged(&arr1, kCount*kCount*sizeof(float));
+  size_t capacity1{0};
+  size_t capacity2{0};
+  size_t capacity3{0};
+  // epilogue operands
+  float*biasArr{nullptr};
+  float*addendArr{nullptr};
+  size_t capacity4{0};
+  size_t capacity5{0};
+  // sparse A of spmm
+  uint32_t*rowPtr{nullptr};
+  uint32_t*colIdx{nullptr};
+  float*values{nullptr};
+  size_t capacity6{0};
+  size_t capacity7{0};
+  size_t capacity8{0};
 
-  if (cudaStatus != cudaSuccess) {
-      std::cerr << "Failed to allocated first memory with error " << static_cast<int>(cudaStatus) << std::endl;
-      return;
+  ComputeTimings timings;
+  bool ready{false};
+
+  // asynchronous pipeline, created on first use and reused
+  AsyncSlot slots[2];
+  float*asyncB{nullptr};
+  float*hostB{nullptr};
+  size_t capacityAsyncB{0};
+  size_t capacityHostB{0};
+  cudaEvent_t bStart{nullptr};
+  cudaEvent_t bReady{nullptr};
+  std::unique_ptr<AsyncWorker> worker;
+
+  // tuned sgemm_tile instance per shape class, keyed by the device name
+  std::unique_ptr<TuningTable> tuningTable;
+
+  Impl() {
+    /////////////////////////////////////////////////////////////////////////////
+    /////////////////////////////// Initialization
+    /////////////////////////////////////////////////////////////////////////////
+
+    // check config before
+    // cudaGetDeviceCount
+    // SM Version
+    int devicesCount{-666};
+    auto cudaStatus = cudaGetDeviceCount(&devicesCount);
+    
+    if (cudaStatus != cudaSuccess) {
+        std::cerr << "Failed to get device count with error " << static_cast<int>(cudaStatus) << std::endl;
+        return;
+    }
+
+    std::cout << "device count: " << devicesCount << std::endl;
+
+    cudaGetDeviceProperties(&prop, 0);
+
+    // 6.1 on my quadro = Pascal
+    std::cout << "compute cap: " << prop.major << "." << prop.minor << std::endl;
+    //std::cout << "the cuda api version: " << CUDA_VERSION << std::endl;
+
+    // check the concurrent kernel prop
+    std::cout << "concurrent kernel: " << prop.concurrentKernels << std::endl;
+
+    // Create a handle for CUBLAS once, it is the costly part of a cublas call
+    auto res = cublasCreate(&handle);
+
+    if (res != CUBLAS_STATUS_SUCCESS) {
+      std::cout << "cublas handle error " << res << std::endl;
+      handle = nullptr;
+    }
+
+    std::ostringstream name;
+    name << prop.name << " sm_" << prop.major << prop.minor;
+    tuningTable.reset(new TuningTable(name.str()));
+    ready = true;
   }
 
-  cudaStatus = cudaMallocManaged(&arr2, kCount*kCount*sizeof(float));
+  ~Impl() {
+    // pending asynchronous calls still use the buffers
+    worker.reset();
+    release_async();
+    release();
 
-  if (cudaStatus != cudaSuccess) {
-      std::cerr << "Failed to allocated second memory with error " << static_cast<int>(cudaStatus) << std::endl;
-      return;
+    if (handle) {
+      cublasDestroy(handle);
+    }
+
+    cudaProfilerStop();
+  }
+
+  void release() {
+    cudaFree(arr1);
+    cudaFree(arr2);
+    cudaFree(mulResult);
+    cudaFree(biasArr);
+    cudaFree(addendArr);
+    cudaFree(rowPtr);
+    cudaFree(colIdx);
+    cudaFree(values);
+    arr1 = arr2 = mulResult = biasArr = addendArr = values = nullptr;
+    rowPtr = colIdx = nullptr;
+    capacity1 = capacity2 = capacity3 = capacity4 = capacity5 = capacity6 = capacity7 = capacity8 = 0;
+  }
+
+  // device containers only grow
+  template <typename T>
+  bool grow(T*& arr, size_t& capacity, size_t count, const char* name) {
+    if (count <= capacity) {
+      return true;
+    }
+
+    cudaFree(arr);
+    arr = nullptr;
+    capacity = 0;
+
+    // device memory: the copies are explicit, managed memory would migrate
+    // the pages a second time
+    auto cudaStatus = cudaMalloc(&arr, count*sizeof(T));
+
+    if (cudaStatus != cudaSuccess) {
+        std::cerr << "Failed to allocated " << name << " memory with error " << static_cast<int>(cudaStatus) << std::endl;
+        return false;
+    }
+
+    capacity = count;
+    return true;
+  }
+
+  bool reserve(size_t count1, size_t count2, size_t count3) {
+    return grow(arr1, capacity1, count1, "first") &&
+           grow(arr2, capacity2, count2, "second") &&
+           grow(mulResult, capacity3, count3, "third");
+  }
+
+  // page locked host memory, needed for the copies to be asynchronous
+  bool grow_pinned(float*& arr, size_t& capacity, size_t count) {
+    if (count <= capacity) {
+      return true;
+    }
+
+    cudaFreeHost(arr);
+    arr = nullptr;
+    capacity = 0;
+
+    auto cudaStatus = cudaHostAlloc(&arr, count*sizeof(float), cudaHostAllocDefault);
+
+    if (cudaStatus != cudaSuccess) {
+        std::cerr << "Failed to allocated pinned memory with error " << static_cast<int>(cudaStatus) << std::endl;
+        return false;
+    }
+
+    capacity = count;
+    return true;
+  }
+
+  // countA/countC: op(A)/C elements of a row tile, countB: op(B) elements
+  bool reserve_async(size_t countA, size_t countC, size_t countB) {
+    if (!slots[0].stream) {
+      for (AsyncSlot& slot : slots) {
+        cudaStreamCreateWithFlags(&slot.stream, cudaStreamNonBlocking);
+        cudaEventCreate(&slot.start);
+        cudaEventCreate(&slot.uploaded);
+        cudaEventCreate(&slot.computed);
+        cudaEventCreate(&slot.done);
+#ifdef COMPUTE_TRACE
+        slot.lane = &slot == slots ? "cuda async stream 0" : "cuda async stream 1";
+#endif
+      }
+      cudaEventCreate(&bStart);
+      cudaEventCreate(&bReady);
+    }
+
+    for (AsyncSlot& slot : slots) {
+      if (!grow(slot.tileA, slot.capacityA, countA, "tile A") ||
+          !grow(slot.tileC, slot.capacityC, countC, "tile C") ||
+          !grow_pinned(slot.hostA, slot.capacityHostA, countA) ||
+          !grow_pinned(slot.hostC, slot.capacityHostC, countC)) {
+        return false;
+      }
+    }
+    return grow(asyncB, capacityAsyncB, countB, "async B") &&
+           grow_pinned(hostB, capacityHostB, countB);
+  }
+
+  void release_async() {
+    for (AsyncSlot& slot : slots) {
+      if (slot.stream) {
+        cudaStreamDestroy(slot.stream);
+        cudaEventDestroy(slot.start);
+        cudaEventDestroy(slot.uploaded);
+        cudaEventDestroy(slot.computed);
+        cudaEventDestroy(slot.done);
+      }
+      cudaFree(slot.tileA);
+      cudaFree(slot.tileC);
+      cudaFreeHost(slot.hostA);
+      cudaFreeHost(slot.hostC);
+      slot = AsyncSlot();
+    }
+    if (bStart) {
+      cudaEventDestroy(bStart);
+      cudaEventDestroy(bReady);
+    }
+    cudaFree(asyncB);
+    cudaFreeHost(hostB);
+    asyncB = hostB = nullptr;
+    capacityAsyncB = capacityHostB = 0;
+    bStart = bReady = nullptr;
+  }
+
+  AsyncWorker& async_worker() {
+    if (!worker) {
+      worker.reset(new AsyncWorker);
+    }
+    return *worker;
+  }
+
+  // the items of a batch are packed one after the other in a host staging
+  // buffer so that the whole batch is a single copy
+  std::vector<float> staging;
+
+  template <typename Item>
+  void upload_batch(float* device, const Item& item, size_t rows, size_t cols, size_t ld, size_t batch) {
+    staging.resize(rows*cols*batch);
+    for (size_t i = 0; i < batch; i++) {
+      const float* src = item(i);
+      for (size_t row = 0; row < rows; row++) {
+        std::copy(src + row*ld, src + row*ld + cols, staging.data() + (i*rows + row)*cols);
+      }
+    }
+    cudaMemcpy(device, staging.data(), staging.size()*sizeof(float), cudaMemcpyHostToDevice);
+  }
+
+  template <typename Item>
+  void download_batch(const float* device, const Item& item, size_t rows, size_t cols, size_t ld, size_t batch) {
+    staging.resize(rows*cols*batch);
+    cudaMemcpy(staging.data(), device, staging.size()*sizeof(float), cudaMemcpyDeviceToHost);
+    for (size_t i = 0; i < batch; i++) {
+      float* dst = item(i);
+      for (size_t row = 0; row < rows; row++) {
+        std::copy(staging.data() + (i*rows + row)*cols, staging.data() + (i*rows + row + 1)*cols, dst + row*ld);
+      }
+    }
+  }
+};
+
+// waits for the tile in flight in the slot, adds its device timings and
+// copies it to C
+void finish_tile(AsyncSlot& slot, float* c, uint64_t n, uint64_t ldc, ComputeTimings& timings) {
+  if (!slot.pending) {
+    return;
+  }
+
+  cudaEventSynchronize(slot.done);
+  float upload = 0.0f, kernel = 0.0f, download = 0.0f;
+  cudaEventElapsedTime(&upload, slot.start, slot.uploaded);
+  cudaEventElapsedTime(&kernel, slot.uploaded, slot.computed);
+  cudaEventElapsedTime(&download, slot.computed, slot.done);
+  timings.transfer += (upload + download) * 1e-3;
+  timings.compute += kernel * 1e-3;
+#ifdef COMPUTE_TRACE
+  // the stream is idle when the tile is queued, its commands start then
+  trace_record("h2d", "tile A C", slot.queuedAt, upload * 1e3, slot.uploadBytes, 0, slot.lane);
+  trace_record("kernel", "sgemm tile", slot.queuedAt + upload * 1e3, kernel * 1e3,
+               0, 2.0 * slot.rows * n * slot.depth, slot.lane);
+  trace_record("d2h", "tile C", slot.queuedAt + (upload + kernel) * 1e3, download * 1e3,
+               sizeof(float) * slot.rows * n, 0, slot.lane);
+#endif
+
+  unpack(c + slot.row0*ldc, ldc, slot.hostC, slot.rows, n);
+  slot.pending = false;
+}
+
+// row tiles of C alternate between the two slots: while a tile is uploaded
+// on one stream, the previous one is computed and downloaded on the other,
+// and the host packs the next one in pinned memory
+ComputeTimings sgemm_pipelined(ComputeSession::Impl& s, bool tA, bool tB, uint64_t m, uint64_t n, uint64_t k,
+                               float alpha, const float* a, uint64_t lda, const float* b, uint64_t ldb,
+                               float beta, float* c, uint64_t ldc) {
+  ComputeTimings timings;
+  if (!s.ready || m == 0 || n == 0) {
+    return timings;
+  }
+
+  const uint64_t rowsB = tB ? n : k;
+  const uint64_t colsB = tB ? k : n;
+  // at least 8 tiles, multiple of the 16 rows of a thread block
+  const uint64_t tile = std::max<uint64_t>(16, (m / 8 + 15) / 16 * 16);
+
+  {
+    PhaseTimer timer(timings.setup);
+    COMPUTE_TRACE_SCOPE("alloc", "async buffers", 0, 0);
+    if (!s.reserve_async(tile*k, tile*n, rowsB*colsB)) {
+      return timings;
+    }
+  }
+
+  // B once on the first stream, the second one waits for it
+  AsyncSlot* slots = s.slots;
+#ifdef COMPUTE_TRACE
+  const double bQueued = trace_now();
+#endif
+  cudaEventRecord(s.bStart, slots[0].stream);
+  if (k > 0) {
+    pack(s.hostB, b, rowsB, colsB, ldb);
+    cudaMemcpyAsync(s.asyncB, s.hostB, rowsB*colsB*sizeof(float), cudaMemcpyHostToDevice, slots[0].stream);
+  }
+  cudaEventRecord(s.bReady, slots[0].stream);
+  cudaStreamWaitEvent(slots[1].stream, s.bReady, 0);
+
+  uint64_t index = 0;
+  for (uint64_t row0 = 0; row0 < m; row0 += tile, index++) {
+    AsyncSlot& slot = slots[index % 2];
+    // the staging buffers of the slot are free once its previous tile is done
+    finish_tile(slot, c, n, ldc, timings);
+
+    // op(A) rows of the tile, stored k x rows when A is transposed
+    const uint64_t rows = std::min(tile, m - row0);
+    if (tA) {
+      pack(slot.hostA, a + row0, k, rows, lda);
+    } else {
+      pack(slot.hostA, a + row0*lda, rows, k, lda);
+    }
+
+#ifdef COMPUTE_TRACE
+    slot.queuedAt = trace_now();
+    slot.uploadBytes = sizeof(float) * rows * (k + (beta != 0.0f ? n : 0));
+    slot.depth = k;
+#endif
+    cudaEventRecord(slot.start, slot.stream);
+    if (k > 0) {
+      cudaMemcpyAsync(slot.tileA, slot.hostA, rows*k*sizeof(float), cudaMemcpyHostToDevice, slot.stream);
+    }
+    if (beta != 0.0f) {
+      pack(slot.hostC, c + row0*ldc, rows, n, ldc);
+      cudaMemcpyAsync(slot.tileC, slot.hostC, rows*n*sizeof(float), cudaMemcpyHostToDevice, slot.stream);
+    }
+    cudaEventRecord(slot.uploaded, slot.stream);
+
+    dim3 threadsPerBlock(16, 16);
+    dim3 numBlocks((n + threadsPerBlock.x - 1) / threadsPerBlock.x,
+                   (rows + threadsPerBlock.y - 1) / threadsPerBlock.y);
+    sgemm_tile<16, 16><<<numBlocks, threadsPerBlock, 0, slot.stream>>>(tA, tB, rows, n, k, alpha, slot.tileA, tA ? rows : k,
+                                                               s.asyncB, colsB, beta, slot.tileC, n,
+                                                               1.0f, nullptr, nullptr, 0, false);
+    cudaEventRecord(slot.computed, slot.stream);
+
+    cudaMemcpyAsync(slot.hostC, slot.tileC, rows*n*sizeof(float), cudaMemcpyDeviceToHost, slot.stream);
+    cudaEventRecord(slot.done, slot.stream);
+
+    slot.pending = true;
+    slot.row0 = row0;
+    slot.rows = rows;
+  }
+
+  finish_tile(slots[0], c, n, ldc, timings);
+  finish_tile(slots[1], c, n, ldc, timings);
+
+  float upload = 0.0f;
+  cudaEventElapsedTime(&upload, s.bStart, s.bReady);
+  timings.transfer += upload * 1e-3;
+#ifdef COMPUTE_TRACE
+  trace_record("h2d", "B", bQueued, upload * 1e3, sizeof(float) * rowsB * colsB, 0, slots[0].lane);
+#endif
+  return timings;
+}
+
+// pointers of the items of a pointer-array or strided batch
+template <typename T>
+struct ItemPointers {
+  T* const* ptrs;
+  ItemPointers(T* const* p) : ptrs(p) {}
+  T* operator()(size_t i) const { return ptrs[i]; }
+};
+
+template <typename T>
+struct ItemStride {
+  T* base;
+  size_t stride;
+  ItemStride(T* b, size_t s) : base(b), stride(s) {}
+  T* operator()(size_t i) const { return base + i*stride; }
+};
+
+template <typename ItemA, typename ItemB, typename ItemC>
+void gemm_batched(ComputeSession::Impl& s, bool tA, bool tB, uint64_t m, uint64_t n, uint64_t k,
+                  float alpha, const ItemA& itemA, size_t lda, const ItemB& itemB, size_t ldb,
+                  float beta, const ItemC& itemC, size_t ldc, size_t batch) {
+  s.timings = ComputeTimings();
+  if (!s.ready || m == 0 || n == 0 || batch == 0) {
+    return;
   }
 
-  cudaStatus = cudaMallocManaged(&mulResult, kCount*kCount*sizeof(float));
+  // the device copies are tightly packed items
+  const uint64_t rowsA = tA ? k : m;
+  const uint64_t colsA = tA ? m : k;
+  const uint64_t rowsB = tB ? n : k;
+  const uint64_t colsB = tB ? k : n;
 
-  if (cudaStatus != cudaSuccess) {
-      std::cerr << "Failed to allocated third memory with error " << static_cast<int>(cudaStatus) << std::endl;
+  {
+    PhaseTimer timer(s.timings.setup);
+    COMPUTE_TRACE_SCOPE("alloc", "device buffers", 0, 0);
+    if (!s.reserve(rowsA*colsA*batch, rowsB*colsB*batch, m*n*batch)) {
       return;
+    }
   }
 
-  std::cout << "memory allocated" << std::endl;
+  {
+    PhaseTimer timer(s.timings.transfer);
+    COMPUTE_TRACE_SCOPE("h2d", "batch operands",
+                        sizeof(float) * batch * ((k > 0 ? rowsA*colsA + rowsB*colsB : 0) + (beta != 0.0f ? m*n : 0)), 0);
+    if (k > 0) {
+      s.upload_batch(s.arr1, itemA, rowsA, colsA, lda, batch);
+      s.upload_batch(s.arr2, itemB, rowsB, colsB, ldb, batch);
+    }
+    if (beta != 0.0f) {
+      s.upload_batch(s.mulResult, itemC, m, n, ldc, batch);
+    }
+  }
 
-  cudaMemcpy(arr1, a, sizeof(float) * kCount * kCount, cudaMemcpyHostToDevice);
-  cudaMemcpy(arr2, b, sizeof(float) * kCount * kCount, cudaMemcpyHostToDevice);
+  {
+    PhaseTimer timer(s.timings.compute);
+    TracedRange trace;
+    dim3 threadsPerBlock(16, 16);
+    // gridDim.z is limited to 65535, larger batches take a few launches
+    for (size_t first = 0; first < batch; first += 65535) {
+      const size_t count = std::min<size_t>(65535, batch - first);
+      dim3 numBlocks((n + threadsPerBlock.x - 1) / threadsPerBlock.x,
+                     (m + threadsPerBlock.y - 1) / threadsPerBlock.y, count);
+      sgemm_tile_batched<<<numBlocks, threadsPerBlock>>>(tA, tB, m, n, k, alpha,
+                                                         s.arr1 + first*rowsA*colsA, colsA, rowsA*colsA,
+                                                         s.arr2 + first*rowsB*colsB, colsB, rowsB*colsB,
+                                                         beta, s.mulResult + first*m*n, n, m*n);
+    }
+    cudaDeviceSynchronize();
+    trace.record("cuda stream", "kernel", "sgemm batched", 0, 2.0 * m * n * k * batch);
+  }
+
+  PhaseTimer timer(s.timings.transfer);
+  COMPUTE_TRACE_SCOPE("d2h", "batch C", sizeof(float) * batch * m * n, 0);
+  s.download_batch(s.mulResult, itemC, m, n, ldc, batch);
+}
+
+// device copies of the sparse A of spmm, of B (k x n) and of C (m x n,
+// when beta is not 0), B and C tightly packed
+template <typename Sparse>
+bool upload_sparse(ComputeSession::Impl& s, const Sparse& a, uint64_t n, const float* b, uint64_t ldb,
+                   float beta, const float* c, uint64_t ldc) {
+  const uint64_t m = a.rows;
+  const uint64_t k = a.cols;
+  {
+    PhaseTimer timer(s.timings.setup);
+    COMPUTE_TRACE_SCOPE("alloc", "device buffers", 0, 0);
+    if (!s.grow(s.rowPtr, s.capacity6, a.rowPtr.size(), "row offsets") ||
+        !s.grow(s.colIdx, s.capacity7, std::max<size_t>(a.colIdx.size(), 1), "column indices") ||
+        !s.grow(s.values, s.capacity8, std::max<size_t>(a.values.size(), 1), "values") ||
+        !s.reserve(1, std::max<uint64_t>(k*n, 1), m*n)) {
+      return false;
+    }
+  }
+
+  PhaseTimer timer(s.timings.transfer);
+  COMPUTE_TRACE_SCOPE("h2d", "spmm operands",
+                      sizeof(float) * (a.rowPtr.size() + a.colIdx.size() + a.values.size() + k*n +
+                                       (beta != 0.0f ? m*n : 0)), 0);
+  cudaMemcpy(s.rowPtr, a.rowPtr.data(), a.rowPtr.size()*sizeof(uint32_t), cudaMemcpyHostToDevice);
+  if (!a.values.empty()) {
+    cudaMemcpy(s.colIdx, a.colIdx.data(), a.colIdx.size()*sizeof(uint32_t), cudaMemcpyHostToDevice);
+    cudaMemcpy(s.values, a.values.data(), a.values.size()*sizeof(float), cudaMemcpyHostToDevice);
+  }
+  if (k > 0) {
+    cudaMemcpy2D(s.arr2, n*sizeof(float), b, ldb*sizeof(float), n*sizeof(float), k, cudaMemcpyHostToDevice);
+  }
+  if (beta != 0.0f) {
+    cudaMemcpy2D(s.mulResult, n*sizeof(float), c, ldc*sizeof(float), n*sizeof(float), m, cudaMemcpyHostToDevice);
+  }
+  return true;
+}
 
-  std::cout << "array initialized" << std::endl;
+void compute(ComputeSession::Impl& s, float*a, float*b, float*c, size_t count, bool useLib = false) {
+  const uint64_t kCount = count;
+
+  s.timings = ComputeTimings();
+  if (!s.ready) {
+    return;
+  }
 
   /////////////////////////////////////////////////////////////////////////////
-  /////////////////////////////// Perform arithmetic operation
+  /////////////////////////////// Create device container
   /////////////////////////////////////////////////////////////////////////////
 
-  dim3 threadsPerBlock(16, 16);
-  dim3 numBlocks(kCount / threadsPerBlock.x, kCount / threadsPerBlock.y);
+  {
+    PhaseTimer timer(s.timings.setup);
+    COMPUTE_TRACE_SCOPE("alloc", "device buffers", 0, 0);
+    if (!s.reserve(kCount*kCount, kCount*kCount, kCount*kCount)) {
+      return;
+    }
+  }
 
-  if (!useLib) {
-    std::cout << "using raw cuda" << std::endl;
-    mul_tile<<<numBlocks, threadsPerBlock>>>(kCount, arr1, arr2, mulResult);
-  } else {
-    std::cout << "using cublas lib" << std::endl;
-    mul_blas(kCount, arr1, arr2, mulResult);
+  float*arr1 = s.arr1;
+  float*arr2 = s.arr2;
+  float*mulResult = s.mulResult;
+
+  {
+    PhaseTimer timer(s.timings.transfer);
+    COMPUTE_TRACE_SCOPE("h2d", "A B", 2 * sizeof(float) * kCount * kCount, 0);
+    cudaMemcpy(arr1, a, sizeof(float) * kCount * kCount, cudaMemcpyHostToDevice);
+    cudaMemcpy(arr2, b, sizeof(float) * kCount * kCount, cudaMemcpyHostToDevice);
   }
-  
-  cudaDeviceSynchronize();
-  add<<<numBlocks, threadsPerBlock>>>(kCount, mulResult, mulResult);
 
-  // Wait for GPU to finish before accessing on host
-  cudaDeviceSynchronize();
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////// Perform arithmetic operation
+  /////////////////////////////////////////////////////////////////////////////
+
+  {
+    PhaseTimer timer(s.timings.compute);
+    TracedRange trace;
+
+    dim3 threadsPerBlock(16, 16);
+    dim3 numBlocks((kCount + threadsPerBlock.x - 1) / threadsPerBlock.x,
+                   (kCount + threadsPerBlock.y - 1) / threadsPerBlock.y);
+
+    // the doubling is fused in the multiplication, no separate add pass
+    if (!useLib) {
+      sgemm_tile<16, 16><<<numBlocks, threadsPerBlock>>>(false, false, kCount, kCount, kCount, 1.0f, arr1, kCount, arr2, kCount,
+                                                 0.0f, mulResult, kCount, 2.0f, nullptr, nullptr, 0, false);
+    } else {
+      mul_blas(s.handle, kCount, 2.0f, arr1, arr2, mulResult);
+    }
+
+    // Wait for GPU to finish before accessing on host
+    cudaDeviceSynchronize();
+    trace.record("cuda stream", "kernel", useLib ? "cublasSgemm" : "sgemm", 0, 2.0 * kCount * kCount * kCount);
+  }
 
   // transfer the result in c
+  PhaseTimer timer(s.timings.transfer);
+  COMPUTE_TRACE_SCOPE("d2h", "C", sizeof(float) * kCount * kCount, 0);
   cudaMemcpy(c, mulResult, sizeof(float) * kCount * kCount, cudaMemcpyDeviceToHost);
+}
+
+ComputeSession::ComputeSession() {
+  COMPUTE_TRACE_SCOPE("setup", "session", 0, 0);
+  _impl.reset(new Impl);
+}
+
+ComputeSession::~ComputeSession() {
+  COMPUTE_TRACE_SCOPE("teardown", "session", 0, 0);
+  _impl.reset();
+}
+
+const char* ComputeSession::backend() const {
+  return "cuda";
+}
+
+bool ComputeSession::has_external_lib() const {
+  return true;
+}
+
+const ComputeTimings& ComputeSession::last_timings() const {
+  return _impl->timings;
+}
+
+void ComputeSession::compute_with_acc_wrapper(float*a, float*b, float*c, size_t count) {
+  compute(*_impl, a,b,c,count);
+}
+
+void ComputeSession::sgemm_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                   float alpha, const float* const* a, size_t lda, const float* const* b, size_t ldb,
+                                   float beta, float* const* c, size_t ldc, size_t batch) {
+  gemm_batched(*_impl, transA == Transpose::Yes, transB == Transpose::Yes, m, n, k,
+               alpha, ItemPointers<const float>(a), lda, ItemPointers<const float>(b), ldb,
+               beta, ItemPointers<float>(c), ldc, batch);
+}
+
+void ComputeSession::sgemm_strided_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const float* a, size_t lda, size_t strideA,
+                                           const float* b, size_t ldb, size_t strideB,
+                                           float beta, float* c, size_t ldc, size_t strideC, size_t batch) {
+  gemm_batched(*_impl, transA == Transpose::Yes, transB == Transpose::Yes, m, n, k,
+               alpha, ItemStride<const float>(a, strideA), lda, ItemStride<const float>(b, strideB), ldb,
+               beta, ItemStride<float>(c, strideC), ldc, batch);
+}
+
+std::future<ComputeTimings> ComputeSession::sgemm_async(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                                        float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                                        float beta, float* c, size_t ldc) {
+  Impl& s = *_impl;
+  const bool tA = transA == Transpose::Yes;
+  const bool tB = transB == Transpose::Yes;
+  return s.async_worker().submit([=, &s]() {
+    return sgemm_pipelined(s, tA, tB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+  });
+}
+
+// a single device, the host cores stay with the caller
+void ComputeSession::sgemm_split(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                 float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                 float beta, float* c, size_t ldc) {
+  sgemm(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+}
+
+// the operands of the class shape (capped at 1024) stay on the device,
+// only the kernels are timed
+TuneResult ComputeSession::autotune(Transpose transA, Transpose transB, size_t m, size_t n, size_t k) {
+  Impl& s = *_impl;
+  COMPUTE_TRACE_SCOPE("setup", "autotune", 0, 0);
+  const uint64_t tm = tuning_extent(m);
+  const uint64_t tn = tuning_extent(n);
+  const uint64_t tk = tuning_extent(k);
+  if (!s.ready || !s.reserve(tm*tk, tk*tn, tm*tn)) {
+    return TuneResult();
+  }
+  std::vector<float> ones(std::max(tm*tk, tk*tn), 1.0f);
+  cudaMemcpy(s.arr1, ones.data(), tm*tk*sizeof(float), cudaMemcpyHostToDevice);
+  cudaMemcpy(s.arr2, ones.data(), tk*tn*sizeof(float), cudaMemcpyHostToDevice);
+
+  const bool tA = transA == Transpose::Yes;
+  const bool tB = transB == Transpose::Yes;
+  const TuneResult best = pick_fastest(tuning_candidates(), 2.0 * tm * tn * tk, [&](const TuneConfig& knobs) {
+    if (!launch_tuned(knobs, tA, tB, tm, tn, tk, 1.0f, s.arr1, tA ? tm : tk, s.arr2, tB ? tk : tn,
+                      0.0f, s.mulResult, tn, 1.0f, nullptr, nullptr, 0, false)) {
+      return false;
+    }
+    return cudaDeviceSynchronize() == cudaSuccess && cudaGetLastError() == cudaSuccess;
+  });
+
+  if (best.gflops > 0.0) {
+    s.tuningTable->store(shape_class(tA, tB, m, n, k), best);
+  }
+  return best;
+}
+
+TuneConfig ComputeSession::tuned_config(Transpose transA, Transpose transB, size_t m, size_t n, size_t k) {
+  TuneConfig config;
+  if (_impl->tuningTable) {
+    _impl->tuningTable->find(shape_class(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k), config);
+  }
+  return config;
+}
 
-  cudaFree(arr1);
-  cudaFree(arr2);
-  cudaFree(mulResult);
+// no reduced precision kernels: float goes straight to sgemm, the others
+// are widened on the host (compute_widen.h)
+template <>
+void ComputeSession::gemm<float, float>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                        float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                        float beta, float* c, size_t ldc, const Scales& scales) {
+  if (scales.row || scales.col) {
+    gemm_widened(*this, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
+  } else {
+    sgemm(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+  }
+}
+
+template <>
+void ComputeSession::gemm<BFloat16, float>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const BFloat16* a, size_t lda, const BFloat16* b, size_t ldb,
+                                           float beta, float* c, size_t ldc, const Scales& scales) {
+  gemm_widened(*this, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
+}
 
-  cudaProfilerStop();
+template <>
+void ComputeSession::gemm<int8_t, int32_t>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const int8_t* a, size_t lda, const int8_t* b, size_t ldb,
+                                           float beta, float* c, size_t ldc, const Scales& scales) {
+  gemm_widened(*this, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
 }
 
-void compute_with_acc_wrapper(float*a, float*b, float*c, size_t count) {
-  compute(a,b,c,count);
+void ComputeSession::test_mul_from_external_lib(float*a, float*b, float*c, size_t count) {
+  compute(*_impl, a,b,c,count, true);
 }
 
-void test_mul_from_external_lib(float*a, float*b, float*c, size_t count) {
-  compute(a,b,c,count, true);
-}
\ No newline at end of file
+void ComputeSession::sgemm(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                           float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                           float beta, float* c, size_t ldc, const Epilogue& epilogue) {
+  Impl& s = *_impl;
+  s.timings = ComputeTimings();
+  if (!s.ready || m == 0 || n == 0) {
+    return;
+  }
+
+  // the device copies are tightly packed (leading dimension = columns)
+  const bool tA = transA == Transpose::Yes;
+  const bool tB = transB == Transpose::Yes;
+  const uint64_t rowsA = tA ? k : m;
+  const uint64_t colsA = tA ? m : k;
+  const uint64_t rowsB = tB ? n : k;
+  const uint64_t colsB = tB ? k : n;
+
+  const std::string shape = shape_class(tA, tB, m, n, k);
+  TuneConfig knobs;
+  if (autotune_on_miss() && !s.tuningTable->find(shape, knobs)) {
+    autotune(transA, transB, m, n, k);
+  }
+
+  {
+    PhaseTimer timer(s.timings.setup);
+    COMPUTE_TRACE_SCOPE("alloc", "device buffers", 0, 0);
+    s.tuningTable->find(shape, knobs);
+    if (!s.reserve(rowsA*colsA, rowsB*colsB, m*n)) {
+      return;
+    }
+    if (epilogue.bias && !s.grow(s.biasArr, s.capacity4, n, "bias")) {
+      return;
+    }
+    if (epilogue.addend && !s.grow(s.addendArr, s.capacity5, m*n, "addend")) {
+      return;
+    }
+  }
+
+  {
+    PhaseTimer timer(s.timings.transfer);
+    COMPUTE_TRACE_SCOPE("h2d", "sgemm operands",
+                        sizeof(float) * ((k > 0 ? rowsA*colsA + rowsB*colsB : 0) + (beta != 0.0f ? m*n : 0) +
+                                         (epilogue.bias ? n : 0) + (epilogue.addend ? m*n : 0)), 0);
+    if (k > 0) {
+      cudaMemcpy2D(s.arr1, colsA*sizeof(float), a, lda*sizeof(float), colsA*sizeof(float), rowsA, cudaMemcpyHostToDevice);
+      cudaMemcpy2D(s.arr2, colsB*sizeof(float), b, ldb*sizeof(float), colsB*sizeof(float), rowsB, cudaMemcpyHostToDevice);
+    }
+    if (beta != 0.0f) {
+      cudaMemcpy2D(s.mulResult, n*sizeof(float), c, ldc*sizeof(float), n*sizeof(float), m, cudaMemcpyHostToDevice);
+    }
+    if (epilogue.bias) {
+      cudaMemcpy(s.biasArr, epilogue.bias, n*sizeof(float), cudaMemcpyHostToDevice);
+    }
+    if (epilogue.addend) {
+      cudaMemcpy2D(s.addendArr, n*sizeof(float), epilogue.addend, epilogue.ldd*sizeof(float), n*sizeof(float), m, cudaMemcpyHostToDevice);
+    }
+  }
+
+  {
+    // the tuned instance of the shape class, 16 x 16 blocks otherwise
+    PhaseTimer timer(s.timings.compute);
+    TracedRange trace;
+    launch_tuned(knobs, tA, tB, m, n, k, alpha, s.arr1, colsA, s.arr2, colsB, beta, s.mulResult, n,
+                 epilogue.scale,
+                 epilogue.bias ? s.biasArr : nullptr,
+                 epilogue.addend ? s.addendArr : nullptr, n,
+                 epilogue.activation == Activation::Relu);
+    cudaDeviceSynchronize();
+    trace.record("cuda stream", "kernel", "sgemm", 0, 2.0 * m * n * k);
+  }
+
+  PhaseTimer timer(s.timings.transfer);
+  COMPUTE_TRACE_SCOPE("d2h", "C", sizeof(float) * m * n, 0);
+  cudaMemcpy2D(c, ldc*sizeof(float), s.mulResult, n*sizeof(float), n*sizeof(float), m, cudaMemcpyDeviceToHost);
+}
+
+// 256 columns per block, one row (block row) of C per block row of the grid
+void ComputeSession::spmm(float alpha, const CsrMatrix& a, const float* b, size_t ldb, size_t n,
+                          float beta, float* c, size_t ldc) {
+  Impl& s = *_impl;
+  s.timings = ComputeTimings();
+  const uint64_t m = a.rows;
+  if (!s.ready || m == 0 || n == 0 || !upload_sparse(s, a, n, b, ldb, beta, c, ldc)) {
+    return;
+  }
+
+  {
+    PhaseTimer timer(s.timings.compute);
+    TracedRange trace;
+    dim3 threadsPerBlock(256, 1);
+    // gridDim.y is limited to 65535, taller matrices take a few launches
+    for (uint64_t first = 0; first < m; first += 65535) {
+      const uint64_t count = std::min<uint64_t>(65535, m - first);
+      dim3 numBlocks((n + threadsPerBlock.x - 1) / threadsPerBlock.x, count);
+      spmm_csr<<<numBlocks, threadsPerBlock>>>(m, n, alpha, s.rowPtr, s.colIdx, s.values, s.arr2, n,
+                                              beta, s.mulResult, n, first);
+    }
+    cudaDeviceSynchronize();
+    trace.record("cuda stream", "kernel", "spmm csr", 0, 2.0 * a.nnz() * n);
+  }
+
+  PhaseTimer timer(s.timings.transfer);
+  COMPUTE_TRACE_SCOPE("d2h", "C", sizeof(float) * m * n, 0);
+  cudaMemcpy2D(c, ldc*sizeof(float), s.mulResult, n*sizeof(float), n*sizeof(float), m, cudaMemcpyDeviceToHost);
+}
+
+void ComputeSession::spmm(float alpha, const BsrMatrix& a, const float* b, size_t ldb, size_t n,
+                          float beta, float* c, size_t ldc) {
+  Impl& s = *_impl;
+  s.timings = ComputeTimings();
+  const uint64_t m = a.rows;
+  if (!s.ready || m == 0 || n == 0 || !upload_sparse(s, a, n, b, ldb, beta, c, ldc)) {
+    return;
+  }
+
+  {
+    PhaseTimer timer(s.timings.compute);
+    TracedRange trace;
+    dim3 threadsPerBlock(256, 1);
+    const uint64_t blockRows = a.block_rows();
+    for (uint64_t first = 0; first < blockRows; first += 65535) {
+      const uint64_t count = std::min<uint64_t>(65535, blockRows - first);
+      dim3 numBlocks((n + threadsPerBlock.x - 1) / threadsPerBlock.x, count);
+      spmm_bsr<<<numBlocks, threadsPerBlock>>>(m, n, a.cols, alpha, a.blockRows, a.blockCols,
+                                              s.rowPtr, s.colIdx, s.values, s.arr2, n, beta, s.mulResult, n,
+                                              first);
+    }
+    cudaDeviceSynchronize();
+    trace.record("cuda stream", "kernel", "spmm bsr", 0, 2.0 * a.values.size() * n);
+  }
+
+  PhaseTimer timer(s.timings.transfer);
+  COMPUTE_TRACE_SCOPE("d2h", "C", sizeof(float) * m * n, 0);
+  cudaMemcpy2D(c, ldc*sizeof(float), s.mulResult, n*sizeof(float), n*sizeof(float), m, cudaMemcpyDeviceToHost);
+}
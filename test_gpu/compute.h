@@ -1,4 +1,349 @@
+#pragma once
+
+#include "compute_tune.h"
+
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <vector>
+
+/// op(X) = X or X^T
+enum class Transpose
+{
+  No,
+  Yes
+};
+
+/// activation applied last by the epilogue
+enum class Activation
+{
+  None,
+  Relu
+};
+
+///
+/// @brief Elementwise operations fused in the store of the multiplication
+///
+/// Applied on each element x = alpha * op(A) * op(B) + beta * C while the
+/// result tile is still hot, so that C makes a single trip through memory:
+/// x = activation(scale * x + bias[col] + D[row * ldd + col])
+///
+struct Epilogue
+{
+  float scale{1.0f};
+  const float* bias{nullptr};    // one value per column of C, optional
+  const float* addend{nullptr};  // m x n matrix D, optional
+  size_t ldd{0};
+  Activation activation{Activation::None};
+
+  bool empty() const
+  {
+    return scale == 1.0f && !bias && !addend && activation == Activation::None;
+  }
+};
+
+///
+/// @brief bfloat16 storage: the upper half of a float
+///
+/// Same exponent range as float with a 8 bits mantissa, half the bytes to
+/// move. Only a storage type, arithmetic is done in float.
+///
+struct BFloat16
+{
+  uint16_t bits{0};
+
+  BFloat16() = default;
+
+  /// rounded to nearest even, nan stays nan
+  explicit BFloat16(float value)
+  {
+    uint32_t u;
+    std::memcpy(&u, &value, sizeof(u));
+    if ((u & 0x7fffffffu) > 0x7f800000u) {
+      bits = static_cast<uint16_t>((u >> 16) | 0x40u);
+    } else {
+      bits = static_cast<uint16_t>((u + 0x7fffu + ((u >> 16) & 1u)) >> 16);
+    }
+  }
+
+  explicit operator float() const
+  {
+    const uint32_t u = static_cast<uint32_t>(bits) << 16;
+    float value;
+    std::memcpy(&value, &u, sizeof(value));
+    return value;
+  }
+};
+
+/// accumulator type of the multiplication of T elements
+template <typename T>
+struct accumulator
+{
+  using type = T;
+};
+
+template <>
+struct accumulator<BFloat16>
+{
+  using type = float;
+};
+
+template <>
+struct accumulator<int8_t>
+{
+  using type = int32_t;
+};
+
+/// per row of op(A) / per column of op(B) scales, typically the
+/// dequantization factors of int8 operands (null: 1)
+struct Scales
+{
+  const float* row{nullptr};  // m values
+  const float* col{nullptr};  // n values
+};
+
+///
+/// @brief Compressed sparse row matrix (CSR)
+///
+/// The nonzeros of row i are values[rowPtr[i]] .. values[rowPtr[i + 1] - 1],
+/// sorted by column, colIdx holding their columns. 32 bits indices: at most
+/// 2^32 - 1 nonzeros and columns.
+///
+struct CsrMatrix
+{
+  size_t rows{0};
+  size_t cols{0};
+  std::vector<uint32_t> rowPtr;  // rows + 1 offsets, rowPtr[0] = 0
+  std::vector<uint32_t> colIdx;  // nnz
+  std::vector<float> values;     // nnz
+
+  size_t nnz() const { return values.size(); }
+  /// nonzeros over rows * cols
+  double density() const { return rows && cols ? static_cast<double>(nnz()) / rows / cols : 0.0; }
+
+  /// the nonzeros of the row major rows x cols matrix a
+  static CsrMatrix from_dense(size_t rows, size_t cols, const float* a, size_t lda);
+};
+
+///
+/// @brief Blocked CSR matrix (BSR)
+///
+/// CSR of dense blockRows x blockCols blocks: the blocks of block row i are
+/// blocks rowPtr[i] .. rowPtr[i + 1] - 1, block b at block column colIdx[b]
+/// with its elements row major at values[b * blockRows * blockCols]. The
+/// blocks on the last block row/column are zero padded past rows/cols. The
+/// multiplication loads a row of B once per block instead of once per
+/// nonzero, the win when the nonzeros are clustered.
+///
+struct BsrMatrix
+{
+  size_t rows{0};
+  size_t cols{0};
+  size_t blockRows{4};  // 1 to 16
+  size_t blockCols{4};
+  std::vector<uint32_t> rowPtr;  // block rows + 1 offsets
+  std::vector<uint32_t> colIdx;  // block column of each block
+  std::vector<float> values;     // blocks * blockRows * blockCols
+
+  size_t blocks() const { return colIdx.size(); }
+  size_t block_rows() const { return (rows + blockRows - 1) / blockRows; }
+  /// stored elements (zeros of the blocks included) over rows * cols
+  double density() const { return rows && cols ? static_cast<double>(values.size()) / rows / cols : 0.0; }
+
+  /// the blocks of the row major rows x cols matrix a with a nonzero
+  static BsrMatrix from_dense(size_t rows, size_t cols, const float* a, size_t lda,
+                              size_t blockRows = 4, size_t blockCols = 4);
+};
+
+/// time spent in each phase of the last call, in seconds
+struct ComputeTimings
+{
+  double setup{};     // device/buffer (re)allocation
+  double transfer{};  // host <-> device copies
+  double compute{};   // kernels, including the device synchronization
+};
+
+///
+/// @brief Keeps the backend state alive between calls
+///
+/// Device queries, contexts, queues, built programs, library handles and
+/// device buffers are created once and reused by every call made through
+/// the session. Each backend defines its own Impl.
+///
+class ComputeSession
+{
+public:
+  ComputeSession();
+  ~ComputeSession();
+
+  ComputeSession(const ComputeSession&) = delete;
+  ComputeSession& operator=(const ComputeSession&) = delete;
+
+  void compute_with_acc_wrapper(float* a, float* b, float* c, size_t count);
+  void test_mul_from_external_lib(float* a, float* b, float* c, size_t count);
+
+  /// BLAS like C = alpha * op(A) * op(B) + beta * C on row major host memory
+  /// op(A) is m x k, op(B) is k x n and C is m x n, lda/ldb/ldc are the row
+  /// strides of the stored matrices so sub-views can be used in place.
+  /// C is not read when beta is 0.
+  void sgemm(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+             float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+             float beta, float* c, size_t ldc, const Epilogue& epilogue = Epilogue());
+
+  /// sgemm on a batch of independent matrices sharing shape, transposes,
+  /// leading dimensions and scalars, in a single call (one launch on the
+  /// devices). Item i is a[i], b[i], c[i].
+  void sgemm_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                     float alpha, const float* const* a, size_t lda, const float* const* b, size_t ldb,
+                     float beta, float* const* c, size_t ldc, size_t batch);
+
+  /// same with item i at a + i * strideA, b + i * strideB, c + i * strideC
+  void sgemm_strided_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                             float alpha, const float* a, size_t lda, size_t strideA,
+                             const float* b, size_t ldb, size_t strideB,
+                             float beta, float* c, size_t ldc, size_t strideC, size_t batch);
+
+  /// Asynchronous sgemm, returns once the call is queued. C is complete when
+  /// the future is ready, it then holds the timings of the call (phases
+  /// overlap, they can add up to more than the elapsed time). The operands
+  /// must stay alive and C untouched until then. The cuda, OpenCL and
+  /// OpenACC backends pipeline the row tiles of C: the upload of a tile,
+  /// the kernel of the previous one and the download of the one before run
+  /// concurrently on two queues/streams through pinned staging buffers. The
+  /// cpu and wasm backends have no copies to overlap: they do not tile,
+  /// the whole product is computed in place on the worker thread (the
+  /// OpenCL backend on a cpu runtime, pocl, measures the pipeline without
+  /// a GPU).
+  std::future<ComputeTimings> sgemm_async(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                          float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                          float beta, float* c, size_t ldc);
+
+  /// sgemm (no epilogue) on the whole machine: the rows of C are cut in
+  /// panels handed to every device of the backend plus host threads, in
+  /// proportion to the throughput measured by the previous calls, and the
+  /// workers done early steal the panels left to the others. Backends with
+  /// a single device run sgemm.
+  void sgemm_split(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                   float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                   float beta, float* c, size_t ldc);
+
+  /// C = alpha * A * B + beta * C with a sparse A (m x k, m = a.rows and
+  /// k = a.cols), B k x n and C m x n row major dense. The work is nnz * n
+  /// multiply-adds instead of m * n * k, see sgemm_auto for the choice
+  /// between the two. C is not read when beta is 0.
+  void spmm(float alpha, const CsrMatrix& a, const float* b, size_t ldb, size_t n,
+            float beta, float* c, size_t ldc);
+  void spmm(float alpha, const BsrMatrix& a, const float* b, size_t ldb, size_t n,
+            float beta, float* c, size_t ldc);
+
+  /// Benchmarks the kernel configurations of the backend (tile, vector
+  /// width, unroll, work-group shape, see README) on the shape class of
+  /// op(A) m x k times op(B) k x n and stores the fastest in the tuning
+  /// cache (compute_tune.h). The next sgemm calls of the class, in this run
+  /// and the later ones, use it. With COMPUTE_AUTOTUNE=1 sgemm tunes each
+  /// class missing from the cache on first use.
+  TuneResult autotune(Transpose transA, Transpose transB, size_t m, size_t n, size_t k);
+  /// configuration used by sgemm for the shape class of the call, empty
+  /// when the class was never tuned for the device of the session
+  TuneConfig tuned_config(Transpose transA, Transpose transB, size_t m, size_t n, size_t k);
+
+  /// C = alpha * diag(scales.row) * op(A) * op(B) * diag(scales.col) + beta * C
+  /// with T elements multiplied and summed in Acc, C stays float:
+  /// - gemm<float, float>
+  /// - gemm<BFloat16, float>: bfloat16, half the bytes of float for the operands
+  /// - gemm<int8_t, int32_t>: quantized operands, exact integer sums,
+  ///   dequantized with the scales
+  /// The native cpu backend has kernels for each of them, the other
+  /// backends widen the operands to float on the host, run sgemm and apply
+  /// the scales to the product (int8 sums are then exact while they stay
+  /// below 2^24).
+  template <typename T, typename Acc = typename accumulator<T>::type>
+  void gemm(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+            float alpha, const T* a, size_t lda, const T* b, size_t ldb,
+            float beta, float* c, size_t ldc, const Scales& scales = Scales());
+
+  /// name of the backend compiled in (cuda, openacc, opencl, cpu, wasm)
+  const char* backend() const;
+  /// false when test_mul_from_external_lib is not implemented by the backend
+  bool has_external_lib() const;
+  const ComputeTimings& last_timings() const;
+
+  struct Impl;
+
+private:
+  std::unique_ptr<Impl> _impl;
+};
+
+// the supported element/accumulator pairs, defined by each backend
+template <>
+void ComputeSession::gemm<float, float>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                        float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                        float beta, float* c, size_t ldc, const Scales& scales);
+template <>
+void ComputeSession::gemm<BFloat16, float>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const BFloat16* a, size_t lda, const BFloat16* b, size_t ldb,
+                                           float beta, float* c, size_t ldc, const Scales& scales);
+template <>
+void ComputeSession::gemm<int8_t, int32_t>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const int8_t* a, size_t lda, const int8_t* b, size_t ldb,
+                                           float beta, float* c, size_t ldc, const Scales& scales);
+
+/// process wide session used by the free functions
+ComputeSession& default_session();
+
+/// Threads of the host side computations: the OpenMP threads of the cpu
+/// backend, the worker pool of the wasm backend and of parallel_chunks
+/// otherwise (compute_pool.h). $COMPUTE_THREADS, else all the cores, by
+/// default. The OpenMP count is the one of the calling thread. Not to be
+/// called while a computation runs.
+size_t compute_threads();
+/// 0 goes back to the default
+void set_compute_threads(size_t threads);
 
 void compute_with_acc_wrapper(float*a, float*b, float*c, size_t count);
-void test_mul_from_external_lib(float*a, float*b, float*c, size_t count);
\ No newline at end of file
+void test_mul_from_external_lib(float*a, float*b, float*c, size_t count);
+void sgemm(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+           float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+           float beta, float* c, size_t ldc, const Epilogue& epilogue = Epilogue());
+void sgemm_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                   float alpha, const float* const* a, size_t lda, const float* const* b, size_t ldb,
+                   float beta, float* const* c, size_t ldc, size_t batch);
+void sgemm_strided_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                           float alpha, const float* a, size_t lda, size_t strideA,
+                           const float* b, size_t ldb, size_t strideB,
+                           float beta, float* c, size_t ldc, size_t strideC, size_t batch);
+std::future<ComputeTimings> sgemm_async(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                        float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                        float beta, float* c, size_t ldc);
+void sgemm_split(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                 float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                 float beta, float* c, size_t ldc);
+void spmm(float alpha, const CsrMatrix& a, const float* b, size_t ldb, size_t n,
+          float beta, float* c, size_t ldc);
+void spmm(float alpha, const BsrMatrix& a, const float* b, size_t ldb, size_t n,
+          float beta, float* c, size_t ldc);
+
+/// Density of A below which spmm beats sgemm on the backend of the session
+/// (bench sparse/*, see README), COMPUTE_SPARSE_CROSSOVER overrides it
+double sparse_crossover(const ComputeSession& session);
+
+/// C = alpha * A * B + beta * C (row major, no transposes) with the dense A
+/// m x k: when the density of A is below sparse_crossover it is converted to
+/// CSR and multiplied with spmm, sgemm runs otherwise. Counting the
+/// nonzeros reads A once, m * k against the m * n * k of the product.
+void sgemm_auto(ComputeSession& session, size_t m, size_t n, size_t k,
+                float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                float beta, float* c, size_t ldc);
+/// same on the default session
+void sgemm_auto(size_t m, size_t n, size_t k, float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                float beta, float* c, size_t ldc);
+
+template <typename T, typename Acc = typename accumulator<T>::type>
+void gemm(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+          float alpha, const T* a, size_t lda, const T* b, size_t ldb,
+          float beta, float* c, size_t ldc, const Scales& scales = Scales())
+{
+  default_session().gemm<T, Acc>(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
+}
@@ -1,7 +1,13 @@
 #include "compute.h"
+#include "compute_timer.h"
+#include "compute_trace.h"
+#include "compute_widen.h"
+#include "compute_worker.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
+#include <vector>
 
 #ifdef USE_PARALLEL
   #define ACC_TYPE parallel
@@ -9,50 +15,571 @@
   #define ACC_TYPE kernels
 #endif
 
-void add(uint64_t size, float* arr1, float* arr2)
+// element (row, col) of the sgemm below
+#pragma acc routine seq
+inline void sgemm_element(bool transA, bool transB, uint64_t row, uint64_t col, uint64_t k,
+                          float alpha, const float* __restrict__ A, uint64_t lda,
+                          const float* __restrict__ B, uint64_t ldb,
+                          float beta, float* __restrict__ C, uint64_t ldc,
+                          float scale, const float* __restrict__ bias,
+                          const float* __restrict__ D, uint64_t ldd, bool relu)
 {
-  int n = size * size;
-  for (uint64_t i = 0; i < n; i++)
+  float res = 0.0f;
+  for (uint64_t s = 0; s < k; s++)
   {
-    arr1[i] = 2 * arr1[i];
+    const float a = transA ? A[s * lda + row] : A[row * lda + s];
+    const float b = transB ? B[col * ldb + s] : B[s * ldb + col];
+    res += a * b;
   }
+  // C is not read when beta is 0 (blas semantic)
+  res = beta == 0.0f ? alpha * res : alpha * res + beta * C[row * ldc + col];
+  res *= scale;
+  if (bias) {
+    res += bias[col];
+  }
+  if (D) {
+    res += D[row * ldd + col];
+  }
+  C[row * ldc + col] = relu && res < 0.0f ? 0.0f : res;
 }
 
-void mul(uint64_t size, float* __restrict__ arr1, float* __restrict__  arr2, float* __restrict__ out)
+// C = alpha * op(A) * op(B) + beta * C, row major with leading dimensions
+// followed by the epilogue (see Epilogue in compute.h)
+// if not independant loop, needs to be transformed in independant
+// loop to be run in parallel
+// The compiler maps the loops unless a tuned shape is given: rows over
+// gangs of workers (num_workers), columns over the vector lanes
+// (vector_length).
+void sgemm(bool transA, bool transB, uint64_t m, uint64_t n, uint64_t k,
+           float alpha, const float* __restrict__ A, uint64_t lda,
+           const float* __restrict__ B, uint64_t ldb,
+           float beta, float* __restrict__ C, uint64_t ldc,
+           float scale, const float* __restrict__ bias,
+           const float* __restrict__ D, uint64_t ldd, bool relu,
+           int workers = 0, int vector = 0)
 {
-  float res = 0.0;
-  // if not independant loop, needs to be transformed in independant
-  // loop to be run in parallel
-#pragma acc data copyin(arr1[0:size*size], arr2[0:size*size]) copy(out[0:size*size])
+  // extents of the stored matrices (last row only up to the last column)
+  const uint64_t sizeA = transA ? (k - 1) * lda + m : (m - 1) * lda + k;
+  const uint64_t sizeB = transB ? (n - 1) * ldb + k : (k - 1) * ldb + n;
+  const uint64_t sizeC = (m - 1) * ldc + n;
+  // zero length sections for the missing epilogue operands
+  const uint64_t sizeBias = bias ? n : 0;
+  const uint64_t sizeD = D ? (m - 1) * ldd + n : 0;
+
+#pragma acc data copyin(A[0:sizeA], B[0:sizeB], bias[0:sizeBias], D[0:sizeD]) copy(C[0:sizeC])
   {
-#pragma acc kernels
+    if (vector > 0)
     {
-#pragma acc loop independent
-      for (uint64_t row = 0; row < size; row++)
+#pragma acc parallel loop gang worker num_workers(workers) vector_length(vector)
+      for (uint64_t row = 0; row < m; row++)
+      {
+#pragma acc loop vector
+        for (uint64_t col = 0; col < n; col++)
+        {
+          sgemm_element(transA, transB, row, col, k, alpha, A, lda, B, ldb, beta, C, ldc, scale, bias, D, ldd, relu);
+        }
+      }
+    }
+    else
+    {
+#pragma acc kernels
       {
 #pragma acc loop independent
-        for (uint64_t col = 0; col < size; col++)
+        for (uint64_t row = 0; row < m; row++)
         {
-          res = 0.0f;
-          // reduction -> updating the same variable at each loop
+#pragma acc loop independent
+          for (uint64_t col = 0; col < n; col++)
+          {
+            sgemm_element(transA, transB, row, col, k, alpha, A, lda, B, ldb, beta, C, ldc, scale, bias, D, ldd, relu);
+          }
+        }
+      }
+    }
+  }
+}
+
+// batch of C = alpha * op(A) * op(B) + beta * C in a single region, item i
+// at A + i * strideA, B + i * strideB and C + i * strideC
+void sgemm_strided_batched(bool transA, bool transB, uint64_t m, uint64_t n, uint64_t k,
+                           float alpha, const float* __restrict__ A, uint64_t lda, uint64_t strideA,
+                           const float* __restrict__ B, uint64_t ldb, uint64_t strideB,
+                           float beta, float* __restrict__ C, uint64_t ldc, uint64_t strideC, uint64_t batch)
+{
+  const uint64_t sizeA = (batch - 1) * strideA + (transA ? (k - 1) * lda + m : (m - 1) * lda + k);
+  const uint64_t sizeB = (batch - 1) * strideB + (transB ? (n - 1) * ldb + k : (k - 1) * ldb + n);
+  const uint64_t sizeC = (batch - 1) * strideC + (m - 1) * ldc + n;
+
+#pragma acc data copyin(A[0:sizeA], B[0:sizeB]) copy(C[0:sizeC])
+  {
+#pragma acc kernels
+    {
+#pragma acc loop independent collapse(3)
+      for (uint64_t item = 0; item < batch; item++)
+      {
+        for (uint64_t row = 0; row < m; row++)
+        {
+          for (uint64_t col = 0; col < n; col++)
+          {
+            const float* a = A + item * strideA;
+            const float* b = B + item * strideB;
+            float* c = C + item * strideC;
+            float res = 0.0f;
 #pragma acc loop reduction(+:res)
-          for (uint64_t s = 0; s < size; s++)
+            for (uint64_t s = 0; s < k; s++)
+            {
+              res += (transA ? a[s * lda + row] : a[row * lda + s]) * (transB ? b[col * ldb + s] : b[s * ldb + col]);
+            }
+            c[row * ldc + col] = beta == 0.0f ? alpha * res : alpha * res + beta * c[row * ldc + col];
+          }
+        }
+      }
+    }
+  }
+}
+
+// C = alpha * A * B + beta * C with a CSR A (m x k, nnz nonzeros), rows
+// over the gangs, columns of B over the vector lanes
+void spmm_csr(uint64_t m, uint64_t n, uint64_t k, uint64_t nnz, float alpha,
+              const uint32_t* __restrict__ rowPtr, const uint32_t* __restrict__ colIdx,
+              const float* __restrict__ values, const float* __restrict__ B, uint64_t ldb,
+              float beta, float* __restrict__ C, uint64_t ldc)
+{
+  const uint64_t sizeB = k > 0 ? (k - 1) * ldb + n : 0;
+  const uint64_t sizeC = (m - 1) * ldc + n;
+
+#pragma acc data copyin(rowPtr[0:m + 1], colIdx[0:nnz], values[0:nnz], B[0:sizeB]) copy(C[0:sizeC])
+  {
+#pragma acc parallel loop gang
+    for (uint64_t row = 0; row < m; row++)
+    {
+#pragma acc loop vector
+      for (uint64_t col = 0; col < n; col++)
+      {
+        float res = 0.0f;
+        for (uint32_t p = rowPtr[row]; p < rowPtr[row + 1]; p++)
+        {
+          res += values[p] * B[colIdx[p] * ldb + col];
+        }
+        C[row * ldc + col] = beta == 0.0f ? alpha * res : alpha * res + beta * C[row * ldc + col];
+      }
+    }
+  }
+}
+
+// same with a BSR A (BsrMatrix in compute.h), block rows over the gangs
+void spmm_bsr(const BsrMatrix& a, uint64_t n, float alpha, const float* __restrict__ B, uint64_t ldb,
+              float beta, float* __restrict__ C, uint64_t ldc)
+{
+  const uint64_t m = a.rows;
+  const uint64_t k = a.cols;
+  const uint64_t br = a.blockRows;
+  const uint64_t bc = a.blockCols;
+  const uint64_t blockRows = a.block_rows();
+  const uint64_t blocks = a.blocks();
+  const uint32_t* rowPtr = a.rowPtr.data();
+  const uint32_t* colIdx = a.colIdx.data();
+  const float* values = a.values.data();
+  const uint64_t sizeValues = a.values.size();
+  const uint64_t sizeB = k > 0 ? (k - 1) * ldb + n : 0;
+  const uint64_t sizeC = (m - 1) * ldc + n;
+
+#pragma acc data copyin(rowPtr[0:blockRows + 1], colIdx[0:blocks], values[0:sizeValues], B[0:sizeB]) copy(C[0:sizeC])
+  {
+#pragma acc parallel loop gang
+    for (uint64_t ib = 0; ib < blockRows; ib++)
+    {
+#pragma acc loop vector
+      for (uint64_t col = 0; col < n; col++)
+      {
+        const uint64_t rows = std::min(br, m - ib * br);
+        for (uint64_t r = 0; r < rows; r++)
+        {
+          float res = 0.0f;
+          for (uint32_t blk = rowPtr[ib]; blk < rowPtr[ib + 1]; blk++)
           {
-            res += arr1[row * size + s] * arr2[s * size + col];
+            const uint64_t col0 = colIdx[blk] * bc;
+            const uint64_t cols = std::min(bc, k - col0);
+            for (uint64_t q = 0; q < cols; q++)
+            {
+              res += values[blk * br * bc + r * bc + q] * B[(col0 + q) * ldb + col];
+            }
           }
-          out[row * size + col] = res;
+          const uint64_t row = ib * br + r;
+          C[row * ldc + col] = beta == 0.0f ? alpha * res : alpha * res + beta * C[row * ldc + col];
         }
       }
     }
   }
 }
 
-void compute_with_acc_wrapper(float* a, float* b, float* c, size_t count)
+// C = alpha * op(A) * op(B) + beta * C by row tiles of C alternating
+// between two async queues, the copies of a tile overlap with the kernel of
+// the previous one. B stays on the device for the whole call. The columns
+// of a transposed A overlap from a tile to the next one, which cannot be
+// mapped twice at once: its tiles are packed (rows x k) in a host buffer
+// per queue.
+void sgemm_pipelined(bool transA, bool transB, uint64_t m, uint64_t n, uint64_t k,
+                     float alpha, const float* __restrict__ A, uint64_t lda,
+                     const float* __restrict__ B, uint64_t ldb,
+                     float beta, float* __restrict__ C, uint64_t ldc)
 {
-  mul(count, a, b, c);
-  add(count, c, c);
+  const uint64_t sizeB = transB ? (n - 1) * ldb + k : (k - 1) * ldb + n;
+  // at least 8 tiles
+  const uint64_t tile = std::max<uint64_t>(64, (m / 8 + 63) / 64 * 64);
+  std::vector<float> packed[2];
+
+#pragma acc enter data copyin(B[0:sizeB])
+  for (uint64_t row0 = 0; row0 < m; row0 += tile)
+  {
+    const uint64_t rows = std::min(tile, m - row0);
+    const int queue = static_cast<int>((row0 / tile) % 2);
+    // extents of the tile in the stored matrices
+    const float* a = A + row0 * lda;
+    uint64_t ldTile = lda;
+    if (transA)
+    {
+      // the previous copy from the buffer of the queue is done
+#pragma acc wait(queue)
+      std::vector<float>& buffer = packed[queue];
+      buffer.resize(rows * k);
+      for (uint64_t s = 0; s < k; s++)
+      {
+        for (uint64_t row = 0; row < rows; row++)
+        {
+          buffer[row * k + s] = A[s * lda + row0 + row];
+        }
+      }
+      a = buffer.data();
+      ldTile = k;
+    }
+    const uint64_t sizeA = (rows - 1) * ldTile + k;
+    float* c = C + row0 * ldc;
+    const uint64_t sizeC = (rows - 1) * ldc + n;
+
+#pragma acc parallel loop collapse(2) async(queue) copyin(a[0:sizeA]) copy(c[0:sizeC]) present(B[0:sizeB])
+    for (uint64_t row = 0; row < rows; row++)
+    {
+      for (uint64_t col = 0; col < n; col++)
+      {
+        float res = 0.0f;
+#pragma acc loop reduction(+:res)
+        for (uint64_t s = 0; s < k; s++)
+        {
+          res += a[row * ldTile + s] * (transB ? B[col * ldb + s] : B[s * ldb + col]);
+        }
+        c[row * ldc + col] = beta == 0.0f ? alpha * res : alpha * res + beta * c[row * ldc + col];
+      }
+    }
+  }
+#pragma acc wait
+#pragma acc exit data delete(B[0:sizeB])
 }
 
-void test_mul_from_external_lib(float*a, float*b, float*c, size_t count) {
+// nothing to multiply (k = 0), C = epilogue(beta * C) on the host
+void scale(size_t m, size_t n, float beta, float* c, size_t ldc, const Epilogue& epilogue)
+{
+  const bool relu = epilogue.activation == Activation::Relu;
+  for (size_t row = 0; row < m; row++) {
+    for (size_t col = 0; col < n; col++) {
+      float res = beta == 0.0f ? 0.0f : beta * c[row * ldc + col];
+      res *= epilogue.scale;
+      if (epilogue.bias) {
+        res += epilogue.bias[col];
+      }
+      if (epilogue.addend) {
+        res += epilogue.addend[row * epilogue.ldd + col];
+      }
+      c[row * ldc + col] = relu && res < 0.0f ? 0.0f : res;
+    }
+  }
+}
+
+// nothing to keep between calls for now, the data regions are scoped to sgemm
+struct ComputeSession::Impl
+{
+  ComputeTimings timings;
+
+  // tuned num_workers x vector_length per shape class
+  TuningTable tuningTable{"openacc"};
+
+  // created on first use, destroyed first
+  std::unique_ptr<AsyncWorker> worker;
+
+  AsyncWorker& async_worker()
+  {
+    if (!worker) {
+      worker.reset(new AsyncWorker);
+    }
+    return *worker;
+  }
+};
+
+ComputeSession::ComputeSession()
+{
+  COMPUTE_TRACE_SCOPE("setup", "session", 0, 0);
+  _impl.reset(new Impl);
+}
+
+ComputeSession::~ComputeSession()
+{
+  COMPUTE_TRACE_SCOPE("teardown", "session", 0, 0);
+  _impl.reset();
+}
+
+const char* ComputeSession::backend() const
+{
+  return "openacc";
+}
+
+bool ComputeSession::has_external_lib() const
+{
+  return false;
+}
+
+const ComputeTimings& ComputeSession::last_timings() const
+{
+  return _impl->timings;
+}
+
+// the copies are done by the data region of sgemm, they are part of compute
+// the doubling is fused in the store of the multiplication
+void ComputeSession::compute_with_acc_wrapper(float* a, float* b, float* c, size_t count)
+{
+  _impl->timings = {};
+  PhaseTimer timer(_impl->timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "sgemm data region", 3 * sizeof(float) * count * count, 2.0 * count * count * count);
+  ::sgemm(false, false, count, count, count, 1.0f, a, count, b, count, 0.0f, c, count,
+          2.0f, nullptr, nullptr, 0, false);
+}
+
+void ComputeSession::sgemm(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                           float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                           float beta, float* c, size_t ldc, const Epilogue& epilogue)
+{
+  _impl->timings = {};
+  if (m == 0 || n == 0) {
+    return;
+  }
+  if (k == 0) {
+    scale(m, n, beta, c, ldc, epilogue);
+    return;
+  }
+
+  const std::string shape = shape_class(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k);
+  TuneConfig knobs;
+  if (autotune_on_miss() && !_impl->tuningTable.find(shape, knobs)) {
+    autotune(transA, transB, m, n, k);
+  }
+  _impl->tuningTable.find(shape, knobs);
+
+  PhaseTimer timer(_impl->timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "sgemm data region",
+                      sizeof(float) * (m * k + k * n + (beta != 0.0f ? 2 : 1) * m * n +
+                                       (epilogue.bias ? n : 0) + (epilogue.addend ? m * n : 0)),
+                      2.0 * m * n * k);
+  ::sgemm(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc,
+          epilogue.scale, epilogue.bias, epilogue.addend, epilogue.ldd, epilogue.activation == Activation::Relu,
+          static_cast<int>(tune_value(knobs, "workers", 0)), static_cast<int>(tune_value(knobs, "vector", 0)));
+}
+
+// the knobs are the work-group shape, num_workers x vector_length (the
+// copies of the data region are part of the timings)
+TuneResult ComputeSession::autotune(Transpose transA, Transpose transB, size_t m, size_t n, size_t k)
+{
+  COMPUTE_TRACE_SCOPE("setup", "autotune", 0, 0);
+  const size_t tm = tuning_extent(m);
+  const size_t tn = tuning_extent(n);
+  const size_t tk = tuning_extent(k);
+  std::vector<float> a(tm * tk, 1.0f);
+  std::vector<float> b(tk * tn, 1.0f);
+  std::vector<float> c(tm * tn);
+
+  std::vector<TuneConfig> candidates;
+  for (size_t workers : {1, 2, 4, 8}) {
+    for (size_t vector : {32, 64, 128, 256}) {
+      if (workers * vector <= 1024) {
+        candidates.push_back({{"workers", workers}, {"vector", vector}});
+      }
+    }
+  }
+
+  const bool tA = transA == Transpose::Yes;
+  const bool tB = transB == Transpose::Yes;
+  const TuneResult best = pick_fastest(candidates, 2.0 * tm * tn * tk, [&](const TuneConfig& knobs) {
+    ::sgemm(tA, tB, tm, tn, tk, 1.0f, a.data(), tA ? tm : tk, b.data(), tB ? tk : tn, 0.0f, c.data(), tn,
+            1.0f, nullptr, nullptr, 0, false,
+            static_cast<int>(tune_value(knobs, "workers", 1)), static_cast<int>(tune_value(knobs, "vector", 32)));
+    return true;
+  });
+
+  if (best.gflops > 0.0) {
+    _impl->tuningTable.store(shape_class(tA, tB, m, n, k), best);
+  }
+  return best;
+}
+
+TuneConfig ComputeSession::tuned_config(Transpose transA, Transpose transB, size_t m, size_t n, size_t k)
+{
+  TuneConfig config;
+  _impl->tuningTable.find(shape_class(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k), config);
+  return config;
+}
+
+// the copies are done by the data regions of the tiles, they are part of
+// compute
+std::future<ComputeTimings> ComputeSession::sgemm_async(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                                        float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                                        float beta, float* c, size_t ldc)
+{
+  return _impl->async_worker().submit([=]() {
+    ComputeTimings timings;
+    if (m == 0 || n == 0) {
+      return timings;
+    }
+    {
+      PhaseTimer timer(timings.compute);
+      COMPUTE_TRACE_SCOPE("kernel", "sgemm async tiles", 0, 2.0 * m * n * k);
+      if (k == 0) {
+        scale(m, n, beta, c, ldc, Epilogue());
+      } else {
+        sgemm_pipelined(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+      }
+    }
+    return timings;
+  });
+}
+
+void ComputeSession::sgemm_strided_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const float* a, size_t lda, size_t strideA,
+                                           const float* b, size_t ldb, size_t strideB,
+                                           float beta, float* c, size_t ldc, size_t strideC, size_t batch)
+{
+  _impl->timings = {};
+  if (batch == 0) {
+    return;
+  }
+  if (m == 0 || n == 0 || k == 0) {
+    // nothing to multiply, C = beta * C through sgemm
+    for (size_t i = 0; i < batch; i++) {
+      sgemm(transA, transB, m, n, k, alpha, a + i * strideA, lda, b + i * strideB, ldb, beta, c + i * strideC, ldc);
+    }
+    return;
+  }
+
+  PhaseTimer timer(_impl->timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "sgemm batched data region",
+                      sizeof(float) * batch * (m * k + k * n + (beta != 0.0f ? 2 : 1) * m * n),
+                      2.0 * m * n * k * batch);
+  ::sgemm_strided_batched(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k,
+                          alpha, a, lda, strideA, b, ldb, strideB, beta, c, ldc, strideC, batch);
+}
+
+// the items are gathered in contiguous buffers so that the data region
+// is a single copy per operand
+void ComputeSession::sgemm_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                   float alpha, const float* const* a, size_t lda, const float* const* b, size_t ldb,
+                                   float beta, float* const* c, size_t ldc, size_t batch)
+{
+  if (m == 0 || n == 0 || k == 0) {
+    for (size_t i = 0; i < batch; i++) {
+      sgemm(transA, transB, m, n, k, alpha, a[i], lda, b[i], ldb, beta, c[i], ldc);
+    }
+    return;
+  }
+
+  // extents of the stored matrices (last row only up to the last column)
+  const bool tA = transA == Transpose::Yes;
+  const bool tB = transB == Transpose::Yes;
+  const size_t sizeA = tA ? (k - 1) * lda + m : (m - 1) * lda + k;
+  const size_t sizeB = tB ? (n - 1) * ldb + k : (k - 1) * ldb + n;
+  const size_t sizeC = (m - 1) * ldc + n;
+
+  std::vector<float> packedA(batch * sizeA);
+  std::vector<float> packedB(batch * sizeB);
+  std::vector<float> packedC(batch * sizeC);
+  for (size_t i = 0; i < batch; i++) {
+    std::copy(a[i], a[i] + sizeA, packedA.data() + i * sizeA);
+    std::copy(b[i], b[i] + sizeB, packedB.data() + i * sizeB);
+    std::copy(c[i], c[i] + sizeC, packedC.data() + i * sizeC);
+  }
+
+  sgemm_strided_batched(transA, transB, m, n, k, alpha, packedA.data(), lda, sizeA,
+                        packedB.data(), ldb, sizeB, beta, packedC.data(), ldc, sizeC, batch);
+
+  for (size_t i = 0; i < batch; i++) {
+    std::copy(packedC.data() + i * sizeC, packedC.data() + (i + 1) * sizeC, c[i]);
+  }
+}
+
+// a single device, the host cores stay with the caller
+void ComputeSession::sgemm_split(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                 float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                 float beta, float* c, size_t ldc)
+{
+  sgemm(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+}
+
+// the copies are part of the data region, counted as compute like sgemm
+void ComputeSession::spmm(float alpha, const CsrMatrix& a, const float* b, size_t ldb, size_t n,
+                          float beta, float* c, size_t ldc)
+{
+  _impl->timings = {};
+  if (a.rows == 0 || n == 0) {
+    return;
+  }
+
+  PhaseTimer timer(_impl->timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "spmm csr data region",
+                      sizeof(float) * (a.rowPtr.size() + 2 * a.nnz() + a.cols * n + (beta != 0.0f ? 2 : 1) * a.rows * n),
+                      2.0 * a.nnz() * n);
+  ::spmm_csr(a.rows, n, a.cols, a.nnz(), alpha, a.rowPtr.data(), a.colIdx.data(), a.values.data(), b, ldb,
+             beta, c, ldc);
+}
+
+void ComputeSession::spmm(float alpha, const BsrMatrix& a, const float* b, size_t ldb, size_t n,
+                          float beta, float* c, size_t ldc)
+{
+  _impl->timings = {};
+  if (a.rows == 0 || n == 0) {
+    return;
+  }
+
+  PhaseTimer timer(_impl->timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "spmm bsr data region",
+                      sizeof(float) * (a.rowPtr.size() + a.blocks() + a.values.size() + a.cols * n +
+                                       (beta != 0.0f ? 2 : 1) * a.rows * n),
+                      2.0 * a.values.size() * n);
+  ::spmm_bsr(a, n, alpha, b, ldb, beta, c, ldc);
+}
+
+// no reduced precision kernels: float goes straight to sgemm, the others
+// are widened on the host (compute_widen.h)
+template <>
+void ComputeSession::gemm<float, float>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                        float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                        float beta, float* c, size_t ldc, const Scales& scales) {
+  if (scales.row || scales.col) {
+    gemm_widened(*this, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
+  } else {
+    sgemm(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+  }
+}
+
+template <>
+void ComputeSession::gemm<BFloat16, float>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const BFloat16* a, size_t lda, const BFloat16* b, size_t ldb,
+                                           float beta, float* c, size_t ldc, const Scales& scales) {
+  gemm_widened(*this, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
+}
+
+template <>
+void ComputeSession::gemm<int8_t, int32_t>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const int8_t* a, size_t lda, const int8_t* b, size_t ldb,
+                                           float beta, float* c, size_t ldc, const Scales& scales) {
+  gemm_widened(*this, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
+}
+
+void ComputeSession::test_mul_from_external_lib(float*a, float*b, float*c, size_t count) {
+  _impl->timings = {};
   std::cout << "not implemented" << std::endl;
-}
\ No newline at end of file
+}
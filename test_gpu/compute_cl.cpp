@@ -1,73 +1,1377 @@
+#include "compute.h"
+#include "compute_split.h"
+#include "compute_timer.h"
+#include "compute_trace.h"
+#include "compute_widen.h"
+#include "compute_worker.h"
+
 #include <CL/cl2.hpp>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
+#include <map>
+#include <thread>
+
+namespace
+{
+#ifdef COMPUTE_TRACE
+  // the device phases of the trace come from the profiling events
+  const cl_command_queue_properties kQueueProperties = CL_QUEUE_PROFILING_ENABLE;
+#else
+  const cl_command_queue_properties kQueueProperties = 0;
+#endif
+
+  std::string read_file(const std::string& path)
+  {
+    std::ifstream fin(path, std::ios::binary);
+    std::ostringstream ostrm;
+    ostrm << fin.rdbuf();
+    return ostrm.str();
+  }
+
+  // fnv-1a, stable across runs and compilers (unlike std::hash)
+  uint64_t fnv1a(const std::string& str, uint64_t hash = 14695981039346656037ULL)
+  {
+    for (unsigned char ch : str) {
+      hash ^= ch;
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  // COMPUTE_CL_CACHE_DIR, then $XDG_CACHE_HOME/computeLib, then ~/.cache/computeLib
+  std::string cache_dir()
+  {
+    if (const char* dir = std::getenv("COMPUTE_CL_CACHE_DIR")) {
+      return dir;
+    }
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME")) {
+      return std::string(xdg) + "/computeLib";
+    }
+    if (const char* home = std::getenv("HOME")) {
+      return std::string(home) + "/.cache/computeLib";
+    }
+    return ".";
+  }
+
+  // the binary is only valid for the same device, driver and source
+  std::string cache_path(const cl::Device& device, const std::string& source, const std::string& options)
+  {
+    uint64_t hash = fnv1a(device.getInfo<CL_DEVICE_NAME>());
+    hash = fnv1a(device.getInfo<CL_DEVICE_VENDOR>(), hash);
+    hash = fnv1a(device.getInfo<CL_DRIVER_VERSION>(), hash);
+    hash = fnv1a(device.getInfo<CL_DEVICE_VERSION>(), hash);
+    hash = fnv1a(options, hash);
+    hash = fnv1a(source, hash);
+
+    std::ostringstream name;
+    name << cache_dir() << "/compute_" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+    return name.str();
+  }
+
+  cl::Program build_from_cache(const cl::Context& context, const cl::Device& device, const std::string& path)
+  {
+    std::string binary = read_file(path);
+    if (binary.empty()) {
+      return cl::Program();
+    }
+
+    cl::Program::Binaries binaries;
+    binaries.push_back(std::vector<unsigned char>(binary.begin(), binary.end()));
+
+    cl_int err = CL_SUCCESS;
+    cl::Program program(context, {device}, binaries, nullptr, &err);
+    if (err != CL_SUCCESS || program.build({device}) != CL_SUCCESS) {
+      std::cout << "invalid opencl binary cache " << path << std::endl;
+      return cl::Program();
+    }
+    return program;
+  }
+
+  void store_in_cache(const cl::Program& program, const std::string& path)
+  {
+    auto binaries = program.getInfo<CL_PROGRAM_BINARIES>();
+    if (binaries.empty() || binaries[0].empty()) {
+      return;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(cache_dir(), ec);
+    // written aside then renamed, a concurrent run never loads a partial binary
+    static std::atomic<unsigned> counter{0};
+    const std::string tmp = path + "." + std::to_string(getpid()) + "." + std::to_string(counter++) + ".tmp";
+    bool written = false;
+    {
+      std::ofstream fout(tmp, std::ios::binary);
+      fout.write(reinterpret_cast<const char*>(binaries[0].data()), binaries[0].size());
+      written = static_cast<bool>(fout.flush());
+    }
+    if (written) {
+      std::filesystem::rename(tmp, path, ec);
+    }
+    if (!written || ec) {
+      std::filesystem::remove(tmp, ec);
+    }
+  }
+
+  // compute.cl built for the device, from the binary cache when possible
+  cl::Program build_program(const cl::Context& context, const cl::Device& device, const std::string& options)
+  {
+    COMPUTE_TRACE_SCOPE("setup", "build program", 0, 0);
+    const std::string source = read_file("compute.cl");
+    const std::string path = cache_path(device, source, options);
+
+    cl::Program program = build_from_cache(context, device, path);
+    if (program()) {
+      std::cout << "opencl program loaded from " << path << std::endl;
+      return program;
+    }
+
+    cl::Program::Sources sources;
+    sources.push_back({ source.c_str(), source.length() });
+    program = cl::Program(context, sources);
+    if (program.build({device}, options.c_str()) != CL_SUCCESS) {
+      std::cout << "opencl build failed (" << options << ")" << std::endl;
+      return cl::Program();
+    }
+    store_in_cache(program, path);
+    return program;
+  }
+
+  // compile time knobs of compute.cl: output tile per work-group (TS),
+  // per work-item (WPT, the work-group is TS / WPT squared), load width
+  // (VW) and unrolling of the k loop (UNROLL, 0 for the compiler's choice)
+  struct KernelConfig
+  {
+    size_t tile{64};
+    size_t workPerThread{4};
+    size_t vector{4};
+    size_t unroll{0};
+
+    size_t group() const
+    {
+      return tile / workPerThread;
+    }
+
+    std::string options() const
+    {
+      std::ostringstream opts;
+      opts << "-DTS=" << tile << " -DWPT=" << workPerThread << " -DVW=" << vector << " -DUNROLL=" << unroll;
+      return opts.str();
+    }
+
+    TuneConfig knobs() const
+    {
+      return {{"tile", tile}, {"wpt", workPerThread}, {"vector", vector}, {"unroll", unroll}};
+    }
+
+    static KernelConfig from_knobs(const TuneConfig& knobs, const KernelConfig& fallback)
+    {
+      KernelConfig config;
+      config.tile = tune_value(knobs, "tile", fallback.tile);
+      config.workPerThread = tune_value(knobs, "wpt", fallback.workPerThread);
+      config.vector = tune_value(knobs, "vector", fallback.vector);
+      config.unroll = tune_value(knobs, "unroll", fallback.unroll);
+      return config;
+    }
+  };
+
+  // 16x16 work-groups computing 4x4 outputs each, 8x8 work-groups
+  // computing 8x8 outputs on devices with small work-groups
+  KernelConfig default_config(const cl::Device& device)
+  {
+    KernelConfig config;
+    if (device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>() < 256) {
+      config.workPerThread = 8;
+    }
+    return config;
+  }
+
+  // the tuning candidates the device can run (work-group within its limit)
+  std::vector<TuneConfig> tuning_candidates(const cl::Device& device)
+  {
+    const size_t maxGroup = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+    std::vector<TuneConfig> candidates;
+    for (size_t tile : {32, 64, 128}) {
+      for (size_t wpt : {2, 4, 8}) {
+        for (size_t vector : {1, 4}) {
+          for (size_t unroll : {0, 16}) {
+            KernelConfig config;
+            config.tile = tile;
+            config.workPerThread = wpt;
+            config.vector = vector;
+            config.unroll = unroll;
+            if (config.group() * config.group() <= maxGroup) {
+              candidates.push_back(config.knobs());
+            }
+          }
+        }
+      }
+    }
+    return candidates;
+  }
+
+  // platform, device and driver, the tuning cache key
+  std::string device_name(const cl::Device& device)
+  {
+    cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+    return platform.getInfo<CL_PLATFORM_NAME>() + " / " + device.getInfo<CL_DEVICE_NAME>() + " / " +
+           device.getInfo<CL_DRIVER_VERSION>();
+  }
+
+  // rows x cols block of a host matrix with leading dimension ld, the
+  // device copy is tightly packed
+  void write_rect(const cl::CommandQueue& q, const cl::Buffer& buffer, const float* host,
+                  size_t rows, size_t cols, size_t ld, cl::Event* event = nullptr)
+  {
+    q.enqueueWriteBufferRect(buffer, CL_FALSE, {0, 0, 0}, {0, 0, 0},
+                             {cols * sizeof(float), rows, 1},
+                             cols * sizeof(float), 0, ld * sizeof(float), 0, host, nullptr, event);
+  }
+
+  void read_rect(const cl::CommandQueue& q, const cl::Buffer& buffer, float* host,
+                 size_t rows, size_t cols, size_t ld, cl::Event* event = nullptr)
+  {
+    q.enqueueReadBufferRect(buffer, CL_TRUE, {0, 0, 0}, {0, 0, 0},
+                            {cols * sizeof(float), rows, 1},
+                            cols * sizeof(float), 0, ld * sizeof(float), 0, host, nullptr, event);
+  }
+
+  // rows x cols block of a host matrix with leading dimension ld to a
+  // tightly packed buffer and back
+  void pack(float* dst, const float* src, size_t rows, size_t cols, size_t ld)
+  {
+    for (size_t row = 0; row < rows; row++) {
+      std::copy(src + row * ld, src + row * ld + cols, dst + row * cols);
+    }
+  }
+
+  void unpack(float* dst, size_t ld, const float* src, size_t rows, size_t cols)
+  {
+    for (size_t row = 0; row < rows; row++) {
+      std::copy(src + row * cols, src + (row + 1) * cols, dst + row * ld);
+    }
+  }
+
+  // seconds between the start and the end of a command (profiling queue)
+  double elapsed(const cl::Event& event)
+  {
+    const cl_ulong start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    const cl_ulong end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    return 1e-9 * static_cast<double>(end - start);
+  }
+
+#ifdef COMPUTE_TRACE
+  // Completed command of a profiling queue on the trace timeline: the
+  // device clock is anchored on the host clock by a command queued at host
+  // time hostOrigin (microseconds) and device time deviceOrigin.
+  void trace_event(const cl::Event& event, double hostOrigin, cl_ulong deviceOrigin, const char* lane,
+                   const char* category, const char* name, double bytes, double flops)
+  {
+    const cl_ulong start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    const cl_ulong end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    trace_record(category, name, hostOrigin + 1e-3 * static_cast<double>(start - deviceOrigin),
+                 1e-3 * static_cast<double>(end - start), bytes, flops, lane);
+  }
+
+  // one command anchored on the host time at which it is queued, created
+  // before the command is: its own event (get) or the one of the caller
+  struct TracedCommand
+  {
+    cl::Event event;
+    double queued{trace_now()};
+
+    cl::Event* get() { return &event; }
+
+    void record(const cl::Event& command, const char* lane, const char* category, const char* name,
+                double bytes, double flops)
+    {
+      command.wait();
+      trace_event(command, queued, command.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>(), lane,
+                  category, name, bytes, flops);
+    }
 
+    void record(const char* lane, const char* category, const char* name, double bytes, double flops)
+    {
+      record(event, lane, category, name, bytes, flops);
+    }
+  };
+#else
+  struct TracedCommand
+  {
+    cl::Event* get() { return nullptr; }
+    void record(const cl::Event&, const char*, const char*, const char*, double, double) {}
+    void record(const char*, const char*, const char*, double, double) {}
+  };
+#endif
+
+  // one of the two buffers of the asynchronous pipeline: its queue, device
+  // tiles, staging buffers and the row tile of C in flight
+  struct AsyncSlot
+  {
+    cl::CommandQueue queue;
+    // one kernel object per queue, the arguments are set at each launch
+    cl::Kernel kernel;
+
+    cl::Buffer tileA;
+    cl::Buffer tileC;
+    size_t capacityA{0};
+    size_t capacityC{0};
+    // CL_MEM_ALLOC_HOST_PTR buffers mapped once: pinned memory on the gpu
+    // runtimes, the copies from/to them are asynchronous
+    cl::Buffer stagingA;
+    cl::Buffer stagingC;
+    float* hostA{nullptr};
+    float* hostC{nullptr};
+    size_t capacityHostA{0};
+    size_t capacityHostC{0};
+
+    std::vector<cl::Event> uploads;
+    cl::Event computed;
+    cl::Event done;
+    bool pending{false};
+    size_t row0{0};
+    size_t rows{0};
+#ifdef COMPUTE_TRACE
+    // host time at which the tile was queued, lane of the queue and k of
+    // the multiply (the uploads are op(A) when k > 0, then C)
+    double queuedAt{0.0};
+    const char* lane{nullptr};
+    size_t depth{0};
+#endif
+  };
+
+  // one device of sgemm_split, with its own context, queue, program and
+  // buffers (driven by its own host thread)
+  struct SplitDevice
+  {
+    cl::Context context;
+    cl::Device device;
+    cl::CommandQueue queue;
+    cl::Program program;
+    cl::Kernel kernel;
+    KernelConfig config;
+
+    cl::Buffer A;
+    cl::Buffer B;
+    cl::Buffer C;
+    size_t capacityA{0};
+    size_t capacityB{0};
+    size_t capacityC{0};
 
-void compute_with_acc_wrapper(float* a, float* b, float* c, size_t count)
+    void grow(cl::Buffer& buffer, size_t& capacity, size_t count, cl_mem_flags flags)
+    {
+      if (count <= capacity) {
+        return;
+      }
+      buffer = cl::Buffer(context, flags, sizeof(float) * count);
+      capacity = count;
+    }
+  };
+
+  // host share of sgemm_split: rows [row0, row0 + rows) of C, the inner
+  // loops run along contiguous memory
+  void host_sgemm_rows(bool tA, bool tB, size_t row0, size_t rows, size_t n, size_t k,
+                       float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                       float beta, float* c, size_t ldc, std::vector<float>& acc)
+  {
+    acc.resize(n);
+    for (size_t row = row0; row < row0 + rows; row++) {
+      std::fill(acc.begin(), acc.end(), 0.0f);
+      if (tB) {
+        for (size_t j = 0; j < n; j++) {
+          float sum = 0.0f;
+          for (size_t p = 0; p < k; p++) {
+            sum += (tA ? a[p * lda + row] : a[row * lda + p]) * b[j * ldb + p];
+          }
+          acc[j] = sum;
+        }
+      } else {
+        for (size_t p = 0; p < k; p++) {
+          const float av = tA ? a[p * lda + row] : a[row * lda + p];
+          const float* brow = b + p * ldb;
+          for (size_t j = 0; j < n; j++) {
+            acc[j] += av * brow[j];
+          }
+        }
+      }
+      float* out = c + row * ldc;
+      for (size_t j = 0; j < n; j++) {
+        out[j] = beta == 0.0f ? alpha * acc[j] : alpha * acc[j] + beta * out[j];
+      }
+    }
+  }
+}
+
+struct ComputeSession::Impl
 {
-  std::vector<cl::Platform> platforms;
-  cl::Platform::get(&platforms);
-  if (platforms.size() == 0)
+  cl::Context context;
+  cl::Device device;
+  cl::CommandQueue queue;
+  cl::Program program;
+  cl::Kernel sgemmKernel;
+
+  // knobs of sgemmKernel (see compute.cl), the other calls use it as is
+  KernelConfig config;
+
+  // sgemm kernels of the tuned configurations, by build options, and the
+  // tuned configuration of each shape class (compute_tune.h)
+  std::map<std::string, cl::Kernel> variants;
+  std::unique_ptr<TuningTable> tuningTable;
+
+  cl::Buffer A_d;
+  cl::Buffer B_d;
+  cl::Buffer C_d;
+  size_t capacityA{0};
+  size_t capacityB{0};
+  size_t capacityC{0};
+  // epilogue operands
+  cl::Buffer bias_d;
+  cl::Buffer D_d;
+  size_t capacityBias{0};
+  size_t capacityD{0};
+  // sparse A of spmm, the indices are 4 bytes like the floats grow counts
+  cl::Kernel spmmCsrKernel;
+  cl::Kernel spmmBsrKernel;
+  cl::Buffer rowPtr_d;
+  cl::Buffer colIdx_d;
+  cl::Buffer values_d;
+  size_t capacityRowPtr{0};
+  size_t capacityColIdx{0};
+  size_t capacityValues{0};
+
+  ComputeTimings timings;
+  bool ready{false};
+
+  // asynchronous pipeline, created on first use and reused
+  AsyncSlot slots[2];
+  cl::Buffer asyncB;
+  size_t capacityAsyncB{0};
+  cl::Buffer stagingB;
+  float* hostB{nullptr};
+  size_t capacityHostB{0};
+  std::unique_ptr<AsyncWorker> worker;
+
+  Impl()
+  {
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+    if (platforms.size() == 0)
+    {
+      std::cout << "Platform size 0\n";
+      return;
+    }
+
+    // Print number of platforms and list of platforms
+    std::cout << "Platform count: " << platforms.size() << std::endl;
+    std::string platformVendor;
+    for (unsigned int i = 0; i < platforms.size(); ++i)
+    {
+      platforms[i].getInfo((cl_platform_info)CL_PLATFORM_VENDOR, &platformVendor);
+      std::cout << "Platform from: " << platformVendor << std::endl;
+    }
+
+    cl_context_properties properties[] =
+    {
+      CL_CONTEXT_PLATFORM,
+      (cl_context_properties)(platforms[0])(),
+      0
+    };
+    context = cl::Context(CL_DEVICE_TYPE_ALL, properties);
+
+    std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+
+    // Print number of devices and list of devices
+    std::cout << "Device count: " << devices.size() << std::endl;
+    for (unsigned int i = 0; i < devices.size(); ++i)
+    {
+      std::cout << "Device #" << i << ": " << devices[i].getInfo<CL_DEVICE_NAME>() << std::endl;
+    }
+
+    device = devices[0];
+    queue = cl::CommandQueue(context, device, kQueueProperties);
+
+    // skip the jit compilation when a binary is cached for this device
+    config = default_config(device);
+    program = build_program(context, device, config.options());
+
+    cl_int err = CL_SUCCESS;
+    sgemmKernel = cl::Kernel(program, "sgemm", &err);
+    ready = err == CL_SUCCESS;
+    if (ready) {
+      spmmCsrKernel = cl::Kernel(program, "spmm_csr");
+      spmmBsrKernel = cl::Kernel(program, "spmm_bsr");
+    }
+    tuningTable.reset(new TuningTable(device_name(device)));
+  }
+
+  ~Impl()
+  {
+    // pending asynchronous calls still use the buffers
+    worker.reset();
+    for (AsyncSlot& slot : slots) {
+      unmap(slot.queue, slot.stagingA, slot.hostA);
+      unmap(slot.queue, slot.stagingC, slot.hostC);
+    }
+    unmap(slots[0].queue, stagingB, hostB);
+  }
+
+  // device buffers only grow
+  void grow(cl::Buffer& buffer, size_t& capacity, size_t count, cl_mem_flags flags)
+  {
+    if (count <= capacity) {
+      return;
+    }
+    buffer = cl::Buffer(context, flags, sizeof(float) * count);
+    capacity = count;
+  }
+
+  void reserve(size_t countA, size_t countB, size_t countC)
+  {
+    grow(A_d, capacityA, std::max<size_t>(countA, 1), CL_MEM_READ_ONLY);
+    grow(B_d, capacityB, std::max<size_t>(countB, 1), CL_MEM_READ_ONLY);
+    grow(C_d, capacityC, std::max<size_t>(countC, 1), CL_MEM_READ_WRITE);
+  }
+
+  // one work-group per output tile, padded to cover the edges
+  // bias_d and D_d hold the epilogue operands when they are set (D_d is
+  // tightly packed), the items of a batch are tightly packed one after the
+  // other in A, B and C
+  cl_int launch_sgemm(const cl::CommandQueue& q, cl::Kernel& kernel, const KernelConfig& knobs,
+                    const cl::Buffer& A, const cl::Buffer& B, const cl::Buffer& C,
+                    bool transA, bool transB, size_t m, size_t n, size_t k,
+                    float alpha, size_t lda, size_t ldb, float beta, size_t ldc,
+                    const Epilogue& epilogue, size_t batch, cl::Event* event)
+  {
+    const size_t threads = knobs.group();
+    const size_t groupsX = (n + knobs.tile - 1) / knobs.tile;
+    const size_t groupsY = (m + knobs.tile - 1) / knobs.tile;
+
+    kernel.setArg(0, static_cast<int>(transA));
+    kernel.setArg(1, static_cast<int>(transB));
+    kernel.setArg(2, static_cast<unsigned>(m));
+    kernel.setArg(3, static_cast<unsigned>(n));
+    kernel.setArg(4, static_cast<unsigned>(k));
+    kernel.setArg(5, alpha);
+    kernel.setArg(6, A);
+    kernel.setArg(7, static_cast<unsigned>(lda));
+    kernel.setArg(8, B);
+    kernel.setArg(9, static_cast<unsigned>(ldb));
+    kernel.setArg(10, beta);
+    kernel.setArg(11, C);
+    kernel.setArg(12, static_cast<unsigned>(ldc));
+    kernel.setArg(13, epilogue.scale);
+    kernel.setArg(14, static_cast<int>(epilogue.bias != nullptr));
+    kernel.setArg(15, epilogue.bias ? bias_d : C);
+    kernel.setArg(16, static_cast<int>(epilogue.addend != nullptr));
+    kernel.setArg(17, epilogue.addend ? D_d : C);
+    kernel.setArg(18, static_cast<unsigned>(n));
+    kernel.setArg(19, static_cast<int>(epilogue.activation == Activation::Relu));
+    kernel.setArg(20, static_cast<unsigned>(m * k));
+    kernel.setArg(21, static_cast<unsigned>(k * n));
+    kernel.setArg(22, static_cast<unsigned>(m * n));
+    return q.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                  cl::NDRange(groupsX * threads, groupsY * threads, batch),
+                                  cl::NDRange(threads, threads, 1), nullptr, event);
+  }
+
+  void enqueue_sgemm(bool transA, bool transB, size_t m, size_t n, size_t k,
+                     float alpha, size_t lda, size_t ldb, float beta, size_t ldc,
+                     const Epilogue& epilogue, size_t batch = 1, cl::Event* event = nullptr)
+  {
+    launch_sgemm(queue, sgemmKernel, config, A_d, B_d, C_d, transA, transB, m, n, k,
+                 alpha, lda, ldb, beta, ldc, epilogue, batch, event);
+  }
+
+  // sgemm kernel of a configuration, built on first use, null when the
+  // device cannot build it or run its work-groups
+  cl::Kernel* variant(const KernelConfig& knobs)
+  {
+    const std::string options = knobs.options();
+    if (options == config.options()) {
+      return &sgemmKernel;
+    }
+
+    auto it = variants.find(options);
+    if (it == variants.end()) {
+      cl::Kernel kernel;
+      const size_t threads = knobs.group() * knobs.group();
+      if (threads <= device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>()) {
+        cl_int err = CL_SUCCESS;
+        cl::Kernel built(build_program(context, device, options), "sgemm", &err);
+        if (err == CL_SUCCESS && built.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device) >= threads) {
+          kernel = built;
+        }
+      }
+      it = variants.emplace(options, kernel).first;
+    }
+    return it->second() ? &it->second : nullptr;
+  }
+
+  // tuned kernel of the shape class, sgemmKernel when not tuned
+  cl::Kernel& kernel_for(const std::string& shape, KernelConfig& used)
+  {
+    TuneConfig knobs;
+    if (tuningTable->find(shape, knobs)) {
+      const KernelConfig tuned = KernelConfig::from_knobs(knobs, config);
+      if (cl::Kernel* kernel = variant(tuned)) {
+        used = tuned;
+        return *kernel;
+      }
+    }
+    used = config;
+    return sgemmKernel;
+  }
+
+  void write_rect(const cl::Buffer& buffer, const float* host, size_t rows, size_t cols, size_t ld,
+                  cl::Event* event = nullptr)
+  {
+    ::write_rect(queue, buffer, host, rows, cols, ld, event);
+  }
+
+  void read_rect(const cl::Buffer& buffer, float* host, size_t rows, size_t cols, size_t ld,
+                 cl::Event* event = nullptr)
+  {
+    ::read_rect(queue, buffer, host, rows, cols, ld, event);
+  }
+
+  // uploads the sparse A (rows + 1 offsets, indices and values), B k x n
+  // and C m x n when beta is not 0, B and C tightly packed
+  void upload_sparse(const std::vector<uint32_t>& rowPtr, const std::vector<uint32_t>& colIdx,
+                     const std::vector<float>& values, size_t m, size_t n, size_t k,
+                     const float* b, size_t ldb, float beta, const float* c, size_t ldc)
+  {
+    {
+      PhaseTimer timer(timings.setup);
+      COMPUTE_TRACE_SCOPE("alloc", "device buffers", 0, 0);
+      grow(rowPtr_d, capacityRowPtr, rowPtr.size(), CL_MEM_READ_ONLY);
+      grow(colIdx_d, capacityColIdx, std::max<size_t>(colIdx.size(), 1), CL_MEM_READ_ONLY);
+      grow(values_d, capacityValues, std::max<size_t>(values.size(), 1), CL_MEM_READ_ONLY);
+      reserve(0, k * n, m * n);
+    }
+
+    PhaseTimer timer(timings.transfer);
+    COMPUTE_TRACE_SCOPE("h2d", "spmm operands",
+                        sizeof(float) * (rowPtr.size() + colIdx.size() + values.size() + k * n +
+                                         (beta != 0.0f ? m * n : 0)), 0);
+    queue.enqueueWriteBuffer(rowPtr_d, CL_FALSE, 0, sizeof(uint32_t) * rowPtr.size(), rowPtr.data());
+    if (!values.empty()) {
+      queue.enqueueWriteBuffer(colIdx_d, CL_FALSE, 0, sizeof(uint32_t) * colIdx.size(), colIdx.data());
+      queue.enqueueWriteBuffer(values_d, CL_FALSE, 0, sizeof(float) * values.size(), values.data());
+    }
+    if (k > 0) {
+      write_rect(B_d, b, k, n, ldb);
+    }
+    if (beta != 0.0f) {
+      write_rect(C_d, c, m, n, ldc);
+    }
+    queue.finish();
+  }
+
+  void grow_staging(const cl::CommandQueue& q, cl::Buffer& buffer, float*& host, size_t& capacity, size_t count)
+  {
+    if (count <= capacity) {
+      return;
+    }
+    unmap(q, buffer, host);
+    buffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sizeof(float) * count);
+    host = static_cast<float*>(q.enqueueMapBuffer(buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, sizeof(float) * count));
+    capacity = count;
+  }
+
+  void unmap(const cl::CommandQueue& q, const cl::Buffer& buffer, float*& host)
   {
-    std::cout << "Platform size 0\n";
+    if (host) {
+      q.enqueueUnmapMemObject(buffer, host);
+      q.finish();
+      host = nullptr;
+    }
+  }
+
+  // countA/countC: op(A)/C elements of a row tile, countB: op(B) elements
+  void reserve_async(size_t countA, size_t countC, size_t countB)
+  {
+    if (!slots[0].queue()) {
+      for (AsyncSlot& slot : slots) {
+        slot.queue = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+        slot.kernel = cl::Kernel(program, "sgemm");
+#ifdef COMPUTE_TRACE
+        slot.lane = &slot == slots ? "opencl async queue 0" : "opencl async queue 1";
+#endif
+      }
+    }
+
+    countA = std::max<size_t>(countA, 1);
+    countB = std::max<size_t>(countB, 1);
+    for (AsyncSlot& slot : slots) {
+      grow(slot.tileA, slot.capacityA, countA, CL_MEM_READ_ONLY);
+      grow(slot.tileC, slot.capacityC, countC, CL_MEM_READ_WRITE);
+      grow_staging(slot.queue, slot.stagingA, slot.hostA, slot.capacityHostA, countA);
+      grow_staging(slot.queue, slot.stagingC, slot.hostC, slot.capacityHostC, countC);
+    }
+    grow(asyncB, capacityAsyncB, countB, CL_MEM_READ_ONLY);
+    grow_staging(slots[0].queue, stagingB, hostB, capacityHostB, countB);
+  }
+
+  // waits for the tile in flight in the slot, adds its device timings and
+  // copies it to C
+  void finish_tile(AsyncSlot& slot, float* c, size_t n, size_t ldc, ComputeTimings& res)
+  {
+    if (!slot.pending) {
+      return;
+    }
+
+    slot.done.wait();
+    for (const cl::Event& upload : slot.uploads) {
+      res.transfer += elapsed(upload);
+    }
+    res.compute += elapsed(slot.computed);
+    res.transfer += elapsed(slot.done);
+#ifdef COMPUTE_TRACE
+    const cl::Event& first = slot.uploads.empty() ? slot.computed : slot.uploads.front();
+    const cl_ulong origin = first.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+    for (size_t i = 0; i < slot.uploads.size(); i++) {
+      const bool tileA = i == 0 && slot.depth > 0;
+      trace_event(slot.uploads[i], slot.queuedAt, origin, slot.lane, "h2d", tileA ? "tile A" : "tile C",
+                  sizeof(float) * slot.rows * (tileA ? slot.depth : n), 0);
+    }
+    trace_event(slot.computed, slot.queuedAt, origin, slot.lane, "kernel", "sgemm tile",
+                0, 2.0 * slot.rows * n * slot.depth);
+    trace_event(slot.done, slot.queuedAt, origin, slot.lane, "d2h", "tile C", sizeof(float) * slot.rows * n, 0);
+#endif
+
+    unpack(c + slot.row0 * ldc, ldc, slot.hostC, slot.rows, n);
+    slot.pending = false;
+  }
+
+  // row tiles of C alternate between the two queues: while a tile is
+  // uploaded on one queue, the previous one is computed and downloaded on
+  // the other, and the host packs the next one in the staging buffers
+  ComputeTimings sgemm_pipelined(bool tA, bool tB, size_t m, size_t n, size_t k,
+                                 float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                 float beta, float* c, size_t ldc)
+  {
+    ComputeTimings res;
+    if (!ready || m == 0 || n == 0) {
+      return res;
+    }
+
+    const size_t rowsB = tB ? n : k;
+    const size_t colsB = tB ? k : n;
+    // at least 8 tiles, multiple of the work-group tile
+    const size_t tile = std::max(config.tile, (m / 8 + config.tile - 1) / config.tile * config.tile);
+
+    {
+      PhaseTimer timer(res.setup);
+      COMPUTE_TRACE_SCOPE("alloc", "async buffers", 0, 0);
+      reserve_async(tile * k, tile * n, rowsB * colsB);
+    }
+
+    // B once on the first queue, the second one waits for it
+    TracedCommand bTrace;
+    cl::Event bReady;
+    if (k > 0) {
+      pack(hostB, b, rowsB, colsB, ldb);
+      slots[0].queue.enqueueWriteBuffer(asyncB, CL_FALSE, 0, sizeof(float) * rowsB * colsB, hostB, nullptr, &bReady);
+      std::vector<cl::Event> waitB{bReady};
+      slots[1].queue.enqueueBarrierWithWaitList(&waitB);
+    }
+
+    size_t index = 0;
+    for (size_t row0 = 0; row0 < m; row0 += tile, index++) {
+      AsyncSlot& slot = slots[index % 2];
+      // the staging buffers of the slot are free once its previous tile is done
+      finish_tile(slot, c, n, ldc, res);
+
+      // op(A) rows of the tile, stored k x rows when A is transposed
+      const size_t rows = std::min(tile, m - row0);
+      slot.uploads.clear();
+#ifdef COMPUTE_TRACE
+      slot.queuedAt = trace_now();
+      slot.depth = k;
+#endif
+      if (k > 0) {
+        if (tA) {
+          pack(slot.hostA, a + row0, k, rows, lda);
+        } else {
+          pack(slot.hostA, a + row0 * lda, rows, k, lda);
+        }
+        slot.uploads.emplace_back();
+        slot.queue.enqueueWriteBuffer(slot.tileA, CL_FALSE, 0, sizeof(float) * rows * k, slot.hostA,
+                                      nullptr, &slot.uploads.back());
+      }
+      if (beta != 0.0f) {
+        pack(slot.hostC, c + row0 * ldc, rows, n, ldc);
+        slot.uploads.emplace_back();
+        slot.queue.enqueueWriteBuffer(slot.tileC, CL_FALSE, 0, sizeof(float) * rows * n, slot.hostC,
+                                      nullptr, &slot.uploads.back());
+      }
+
+      launch_sgemm(slot.queue, slot.kernel, config, slot.tileA, asyncB, slot.tileC, tA, tB, rows, n, k,
+                   alpha, tA ? rows : k, colsB, beta, n, Epilogue(), 1, &slot.computed);
+      slot.queue.enqueueReadBuffer(slot.tileC, CL_FALSE, 0, sizeof(float) * rows * n, slot.hostC,
+                                   nullptr, &slot.done);
+      slot.queue.flush();
+
+      slot.pending = true;
+      slot.row0 = row0;
+      slot.rows = rows;
+    }
+
+    finish_tile(slots[0], c, n, ldc, res);
+    finish_tile(slots[1], c, n, ldc, res);
+    if (k > 0) {
+      res.transfer += elapsed(bReady);
+      bTrace.record(bReady, "opencl async queue 0", "h2d", "B", sizeof(float) * rowsB * colsB, 0);
+    }
+    return res;
+  }
+
+  // sgemm_split, set up on first use: every device of every platform plus
+  // host threads (none when a cpu device already runs on the cores,
+  // COMPUTE_SPLIT_HOST_THREADS overrides). The rates (rows per second of
+  // each worker) carry over from call to call.
+  std::vector<SplitDevice> splitDevices;
+  size_t hostWorkers{0};
+  std::vector<double> splitRates;
+  // a thread per worker, kept between the calls
+  std::unique_ptr<WorkerPool> splitPool;
+
+  void init_split()
+  {
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+    bool cpuDevice = false;
+    for (const cl::Platform& platform : platforms) {
+      std::vector<cl::Device> devices;
+      platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+      for (const cl::Device& dev : devices) {
+        SplitDevice split;
+        split.device = dev;
+        split.context = cl::Context(dev);
+        split.queue = cl::CommandQueue(split.context, dev, kQueueProperties);
+        split.config = default_config(dev);
+        split.program = build_program(split.context, dev, split.config.options());
+        split.kernel = cl::Kernel(split.program, "sgemm");
+        cpuDevice = cpuDevice || (dev.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU) != 0;
+        splitDevices.push_back(std::move(split));
+      }
+    }
+
+    const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    hostWorkers = cpuDevice ? 0 : cores - std::min(cores - 1, splitDevices.size());
+    if (const char* forced = std::getenv("COMPUTE_SPLIT_HOST_THREADS")) {
+      hostWorkers = std::strtoul(forced, nullptr, 10);
+    }
+    if (splitDevices.empty() && hostWorkers == 0) {
+      hostWorkers = 1;
+    }
+    splitRates.assign(splitDevices.size() + hostWorkers, 0.0);
+    splitPool.reset(new WorkerPool(splitRates.size()));
+
+    std::cout << "sgemm_split on " << splitDevices.size() << " device(s) and "
+              << hostWorkers << " host thread(s)" << std::endl;
+  }
+
+  // workers [0, devices) are the devices, the next ones host threads. A
+  // device gets B once, then for each of its panels the rows of op(A) (and
+  // of C when beta is not 0) and sends back the rows of C.
+  void sgemm_split(bool tA, bool tB, size_t m, size_t n, size_t k,
+                   float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                   float beta, float* c, size_t ldc)
+  {
+    timings = {};
+    if (m == 0 || n == 0) {
+      return;
+    }
+
+    {
+      PhaseTimer timer(timings.setup);
+      COMPUTE_TRACE_SCOPE("setup", "split devices", 0, 0);
+      if (splitRates.empty()) {
+        init_split();
+      }
+    }
+
+    const size_t rowsB = tB ? n : k;
+    const size_t colsB = tB ? k : n;
+    const size_t workers = splitRates.size();
+    // about 8 panels per worker to steal from, multiple of the work-group tile
+    const size_t panel = std::max(config.tile, (m / (8 * workers) + config.tile - 1) / config.tile * config.tile);
+
+    std::vector<std::vector<float>> hostAcc(workers);
+
+    PhaseTimer timer(timings.compute);
+    run_split(*splitPool, m, panel, splitRates,
+      [&](size_t w) {
+        if (w >= splitDevices.size()) {
+          return;
+        }
+        SplitDevice& dev = splitDevices[w];
+        dev.grow(dev.A, dev.capacityA, std::max<size_t>(panel * k, 1), CL_MEM_READ_ONLY);
+        dev.grow(dev.B, dev.capacityB, std::max<size_t>(rowsB * colsB, 1), CL_MEM_READ_ONLY);
+        dev.grow(dev.C, dev.capacityC, panel * n, CL_MEM_READ_WRITE);
+        if (k > 0) {
+          ::write_rect(dev.queue, dev.B, b, rowsB, colsB, ldb);
+        }
+      },
+      [&](size_t w, size_t row0, size_t rows) {
+        // per worker thread: upload, kernel and download of the panel
+        COMPUTE_TRACE_SCOPE("kernel", w < splitDevices.size() ? "split panel (device)" : "split panel (host)",
+                            0, 2.0 * rows * n * k);
+        if (w >= splitDevices.size()) {
+          host_sgemm_rows(tA, tB, row0, rows, n, k, alpha, a, lda, b, ldb, beta, c, ldc, hostAcc[w]);
+          return;
+        }
+        SplitDevice& dev = splitDevices[w];
+        if (k > 0) {
+          // op(A) rows of the panel, stored k x rows when A is transposed
+          if (tA) {
+            ::write_rect(dev.queue, dev.A, a + row0, k, rows, lda);
+          } else {
+            ::write_rect(dev.queue, dev.A, a + row0 * lda, rows, k, lda);
+          }
+        }
+        if (beta != 0.0f) {
+          ::write_rect(dev.queue, dev.C, c + row0 * ldc, rows, n, ldc);
+        }
+        launch_sgemm(dev.queue, dev.kernel, dev.config, dev.A, dev.B, dev.C, tA, tB, rows, n, k,
+                     alpha, tA ? rows : k, colsB, beta, n, Epilogue(), 1, nullptr);
+        ::read_rect(dev.queue, dev.C, c + row0 * ldc, rows, n, ldc);
+      });
+  }
+
+  AsyncWorker& async_worker()
+  {
+    if (!worker) {
+      worker.reset(new AsyncWorker);
+    }
+    return *worker;
+  }
+
+  // the items of a batch go through a host staging buffer so that the
+  // whole batch is a single transfer
+  std::vector<float> staging;
+
+  template <typename Item>
+  void write_batch(const cl::Buffer& buffer, const Item& item, size_t rows, size_t cols, size_t ld, size_t batch)
+  {
+    staging.resize(rows * cols * batch);
+    for (size_t i = 0; i < batch; i++) {
+      const float* src = item(i);
+      for (size_t row = 0; row < rows; row++) {
+        std::copy(src + row * ld, src + row * ld + cols, staging.data() + (i * rows + row) * cols);
+      }
+    }
+    queue.enqueueWriteBuffer(buffer, CL_TRUE, 0, sizeof(float) * staging.size(), staging.data());
+  }
+
+  template <typename Item>
+  void read_batch(const cl::Buffer& buffer, const Item& item, size_t rows, size_t cols, size_t ld, size_t batch)
+  {
+    staging.resize(rows * cols * batch);
+    queue.enqueueReadBuffer(buffer, CL_TRUE, 0, sizeof(float) * staging.size(), staging.data());
+    for (size_t i = 0; i < batch; i++) {
+      float* dst = item(i);
+      for (size_t row = 0; row < rows; row++) {
+        const float* src = staging.data() + (i * rows + row) * cols;
+        std::copy(src, src + cols, dst + row * ld);
+      }
+    }
+  }
+
+  // itemA(i), itemB(i) and itemC(i) are the host operands of item i
+  template <typename ItemA, typename ItemB, typename ItemC>
+  void sgemm_batched(bool tA, bool tB, size_t m, size_t n, size_t k,
+                     float alpha, const ItemA& itemA, size_t lda, const ItemB& itemB, size_t ldb,
+                     float beta, const ItemC& itemC, size_t ldc, size_t batch)
+  {
+    timings = {};
+    if (!ready || m == 0 || n == 0 || batch == 0) {
+      return;
+    }
+
+    const size_t rowsA = tA ? k : m;
+    const size_t colsA = tA ? m : k;
+    const size_t rowsB = tB ? n : k;
+    const size_t colsB = tB ? k : n;
+
+    {
+      PhaseTimer timer(timings.setup);
+      COMPUTE_TRACE_SCOPE("alloc", "device buffers", 0, 0);
+      reserve(rowsA * colsA * batch, rowsB * colsB * batch, m * n * batch);
+    }
+
+    {
+      PhaseTimer timer(timings.transfer);
+      COMPUTE_TRACE_SCOPE("h2d", "batch operands",
+                          sizeof(float) * batch * ((k > 0 ? rowsA * colsA + rowsB * colsB : 0) + (beta != 0.0f ? m * n : 0)), 0);
+      if (k > 0) {
+        write_batch(A_d, itemA, rowsA, colsA, lda, batch);
+        write_batch(B_d, itemB, rowsB, colsB, ldb, batch);
+      }
+      if (beta != 0.0f) {
+        write_batch(C_d, itemC, m, n, ldc, batch);
+      }
+    }
+
+    {
+      PhaseTimer timer(timings.compute);
+      TracedCommand trace;
+      enqueue_sgemm(tA, tB, m, n, k, alpha, colsA, colsB, beta, n, Epilogue(), batch, trace.get());
+      queue.finish();
+      trace.record("opencl queue", "kernel", "sgemm batched", 0, 2.0 * m * n * k * batch);
+    }
+
+    PhaseTimer timer(timings.transfer);
+    COMPUTE_TRACE_SCOPE("d2h", "batch C", sizeof(float) * batch * m * n, 0);
+    read_batch(C_d, itemC, m, n, ldc, batch);
+  }
+};
+
+ComputeSession::ComputeSession()
+{
+  COMPUTE_TRACE_SCOPE("setup", "session", 0, 0);
+  _impl.reset(new Impl);
+}
+
+ComputeSession::~ComputeSession()
+{
+  COMPUTE_TRACE_SCOPE("teardown", "session", 0, 0);
+  _impl.reset();
+}
+
+const char* ComputeSession::backend() const
+{
+  return "opencl";
+}
+
+bool ComputeSession::has_external_lib() const
+{
+  return false;
+}
+
+const ComputeTimings& ComputeSession::last_timings() const
+{
+  return _impl->timings;
+}
+
+void ComputeSession::compute_with_acc_wrapper(float* a, float* b, float* c, size_t count)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  if (!s.ready) {
     return;
   }
 
-  // Print number of platforms and list of platforms
-  std::cout << "Platform count: " << platforms.size() << std::endl;
-  std::string platformVendor;
-  for (unsigned int i = 0; i < platforms.size(); ++i)
+  const size_t bytes = sizeof(float) * count * count;
   {
-    platforms[i].getInfo((cl_platform_info)CL_PLATFORM_VENDOR, &platformVendor);
-    std::cout << "Platform from: " << platformVendor << std::endl;
+    PhaseTimer timer(s.timings.setup);
+    COMPUTE_TRACE_SCOPE("alloc", "device buffers", 0, 0);
+    s.reserve(count * count, count * count, count * count);
   }
 
-  cl_context_properties properties[] =
   {
-    CL_CONTEXT_PLATFORM,
-    (cl_context_properties)(platforms[0])(),
-    0
-  };
-  cl::Context context(CL_DEVICE_TYPE_ALL, properties);
+    PhaseTimer timer(s.timings.transfer);
+    COMPUTE_TRACE_SCOPE("h2d", "A B", 2 * bytes, 0);
+    s.queue.enqueueWriteBuffer(s.A_d, CL_FALSE, 0, bytes, a);
+    s.queue.enqueueWriteBuffer(s.B_d, CL_FALSE, 0, bytes, b);
+    s.queue.finish();
+  }
+
+  {
+    PhaseTimer timer(s.timings.compute);
+
+    // the doubling is fused in the store of the multiplication
+    Epilogue twice;
+    twice.scale = 2.0f;
+    TracedCommand trace;
+    s.enqueue_sgemm(false, false, count, count, count, 1.0f, count, count, 0.0f, count, twice, 1, trace.get());
+    s.queue.finish();
+    trace.record("opencl queue", "kernel", "sgemm", 0, 2.0 * count * count * count);
+  }
+
+  PhaseTimer timer(s.timings.transfer);
+  COMPUTE_TRACE_SCOPE("d2h", "C", bytes, 0);
+  s.queue.enqueueReadBuffer(s.C_d, CL_TRUE, 0, bytes, c);
+}
+
+void ComputeSession::sgemm(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                           float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                           float beta, float* c, size_t ldc, const Epilogue& epilogue)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  if (!s.ready || m == 0 || n == 0) {
+    return;
+  }
+
+  const bool tA = transA == Transpose::Yes;
+  const bool tB = transB == Transpose::Yes;
+  const size_t rowsA = tA ? k : m;
+  const size_t colsA = tA ? m : k;
+  const size_t rowsB = tB ? n : k;
+  const size_t colsB = tB ? k : n;
+
+  const std::string shape = shape_class(tA, tB, m, n, k);
+  TuneConfig knobs;
+  if (autotune_on_miss() && !s.tuningTable->find(shape, knobs)) {
+    autotune(transA, transB, m, n, k);
+  }
+
+  KernelConfig used;
+  cl::Kernel* kernel = nullptr;
+  {
+    PhaseTimer timer(s.timings.setup);
+    COMPUTE_TRACE_SCOPE("alloc", "device buffers", 0, 0);
+    kernel = &s.kernel_for(shape, used);
+    s.reserve(rowsA * colsA, rowsB * colsB, m * n);
+    if (epilogue.bias) {
+      s.grow(s.bias_d, s.capacityBias, n, CL_MEM_READ_ONLY);
+    }
+    if (epilogue.addend) {
+      s.grow(s.D_d, s.capacityD, m * n, CL_MEM_READ_ONLY);
+    }
+  }
+
+  {
+    PhaseTimer timer(s.timings.transfer);
+    COMPUTE_TRACE_SCOPE("h2d", "sgemm operands",
+                        sizeof(float) * ((k > 0 ? rowsA * colsA + rowsB * colsB : 0) + (beta != 0.0f ? m * n : 0) +
+                                         (epilogue.bias ? n : 0) + (epilogue.addend ? m * n : 0)), 0);
+    if (k > 0) {
+      s.write_rect(s.A_d, a, rowsA, colsA, lda);
+      s.write_rect(s.B_d, b, rowsB, colsB, ldb);
+    }
+    if (beta != 0.0f) {
+      s.write_rect(s.C_d, c, m, n, ldc);
+    }
+    if (epilogue.bias) {
+      s.queue.enqueueWriteBuffer(s.bias_d, CL_FALSE, 0, sizeof(float) * n, epilogue.bias);
+    }
+    if (epilogue.addend) {
+      s.write_rect(s.D_d, epilogue.addend, m, n, epilogue.ldd);
+    }
+    s.queue.finish();
+  }
+
+  {
+    PhaseTimer timer(s.timings.compute);
+    TracedCommand trace;
+    s.launch_sgemm(s.queue, *kernel, used, s.A_d, s.B_d, s.C_d, tA, tB, m, n, k,
+                   alpha, colsA, colsB, beta, n, epilogue, 1, trace.get());
+    s.queue.finish();
+    trace.record("opencl queue", "kernel", "sgemm", 0, 2.0 * m * n * k);
+  }
+
+  PhaseTimer timer(s.timings.transfer);
+  COMPUTE_TRACE_SCOPE("d2h", "C", sizeof(float) * m * n, 0);
+  s.read_rect(s.C_d, c, m, n, ldc);
+}
+
+// one work-group of 64 columns (SG in compute.cl) per row of C
+void ComputeSession::spmm(float alpha, const CsrMatrix& a, const float* b, size_t ldb, size_t n,
+                          float beta, float* c, size_t ldc)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  if (!s.ready || a.rows == 0 || n == 0) {
+    return;
+  }
+  const size_t m = a.rows;
+  s.upload_sparse(a.rowPtr, a.colIdx, a.values, m, n, a.cols, b, ldb, beta, c, ldc);
+
+  {
+    PhaseTimer timer(s.timings.compute);
+    TracedCommand trace;
+    cl::Kernel& kernel = s.spmmCsrKernel;
+    kernel.setArg(0, static_cast<unsigned>(n));
+    kernel.setArg(1, alpha);
+    kernel.setArg(2, s.rowPtr_d);
+    kernel.setArg(3, s.colIdx_d);
+    kernel.setArg(4, s.values_d);
+    kernel.setArg(5, s.B_d);
+    kernel.setArg(6, static_cast<unsigned>(n));
+    kernel.setArg(7, beta);
+    kernel.setArg(8, s.C_d);
+    kernel.setArg(9, static_cast<unsigned>(n));
+    s.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange((n + 63) / 64 * 64, m),
+                                 cl::NDRange(64, 1), nullptr, trace.get());
+    s.queue.finish();
+    trace.record("opencl queue", "kernel", "spmm csr", 0, 2.0 * a.nnz() * n);
+  }
+
+  PhaseTimer timer(s.timings.transfer);
+  COMPUTE_TRACE_SCOPE("d2h", "C", sizeof(float) * m * n, 0);
+  s.read_rect(s.C_d, c, m, n, ldc);
+}
 
-  std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+// one work-item per column of a block row of C
+void ComputeSession::spmm(float alpha, const BsrMatrix& a, const float* b, size_t ldb, size_t n,
+                          float beta, float* c, size_t ldc)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  if (!s.ready || a.rows == 0 || n == 0) {
+    return;
+  }
+  const size_t m = a.rows;
+  s.upload_sparse(a.rowPtr, a.colIdx, a.values, m, n, a.cols, b, ldb, beta, c, ldc);
 
-  // Print number of devices and list of devices
-  std::cout << "Device count: " << devices.size() << std::endl;
-  for (unsigned int i = 0; i < devices.size(); ++i)
   {
-    std::cout << "Device #" << i << ": " << devices[i].getInfo<CL_DEVICE_NAME>() << std::endl;
+    PhaseTimer timer(s.timings.compute);
+    TracedCommand trace;
+    cl::Kernel& kernel = s.spmmBsrKernel;
+    kernel.setArg(0, static_cast<unsigned>(m));
+    kernel.setArg(1, static_cast<unsigned>(n));
+    kernel.setArg(2, static_cast<unsigned>(a.cols));
+    kernel.setArg(3, alpha);
+    kernel.setArg(4, static_cast<unsigned>(a.blockRows));
+    kernel.setArg(5, static_cast<unsigned>(a.blockCols));
+    kernel.setArg(6, s.rowPtr_d);
+    kernel.setArg(7, s.colIdx_d);
+    kernel.setArg(8, s.values_d);
+    kernel.setArg(9, s.B_d);
+    kernel.setArg(10, static_cast<unsigned>(n));
+    kernel.setArg(11, beta);
+    kernel.setArg(12, s.C_d);
+    kernel.setArg(13, static_cast<unsigned>(n));
+    s.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange((n + 63) / 64 * 64, a.block_rows()),
+                                 cl::NDRange(64, 1), nullptr, trace.get());
+    s.queue.finish();
+    trace.record("opencl queue", "kernel", "spmm bsr", 0, 2.0 * a.values.size() * n);
+  }
+
+  PhaseTimer timer(s.timings.transfer);
+  COMPUTE_TRACE_SCOPE("d2h", "C", sizeof(float) * m * n, 0);
+  s.read_rect(s.C_d, c, m, n, ldc);
+}
+
+void ComputeSession::sgemm_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                   float alpha, const float* const* a, size_t lda, const float* const* b, size_t ldb,
+                                   float beta, float* const* c, size_t ldc, size_t batch)
+{
+  _impl->sgemm_batched(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k,
+                       alpha, [a](size_t i) { return a[i]; }, lda, [b](size_t i) { return b[i]; }, ldb,
+                       beta, [c](size_t i) { return c[i]; }, ldc, batch);
+}
+
+void ComputeSession::sgemm_strided_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const float* a, size_t lda, size_t strideA,
+                                           const float* b, size_t ldb, size_t strideB,
+                                           float beta, float* c, size_t ldc, size_t strideC, size_t batch)
+{
+  _impl->sgemm_batched(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k,
+                       alpha, [=](size_t i) { return a + i * strideA; }, lda,
+                       [=](size_t i) { return b + i * strideB; }, ldb,
+                       beta, [=](size_t i) { return c + i * strideC; }, ldc, batch);
+}
+
+std::future<ComputeTimings> ComputeSession::sgemm_async(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                                        float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                                        float beta, float* c, size_t ldc)
+{
+  Impl& s = *_impl;
+  const bool tA = transA == Transpose::Yes;
+  const bool tB = transB == Transpose::Yes;
+  return s.async_worker().submit([=, &s]() {
+    return s.sgemm_pipelined(tA, tB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+  });
+}
+
+// the operands of the class shape (capped at 1024) are uploaded once, only
+// the kernels are timed (the first run of a candidate builds it)
+TuneResult ComputeSession::autotune(Transpose transA, Transpose transB, size_t m, size_t n, size_t k)
+{
+  Impl& s = *_impl;
+  if (!s.ready) {
+    return TuneResult();
   }
+  COMPUTE_TRACE_SCOPE("setup", "autotune", 0, 0);
 
-  std::ifstream fin("compute.cl", std::ios::binary);
-  std::ostringstream ostrm;
-  ostrm << fin.rdbuf();
-  std::string str{ostrm.str()};
-  cl::Program::Sources sources;
-  sources.push_back({ str.c_str(), str.length() });
+  const bool tA = transA == Transpose::Yes;
+  const bool tB = transB == Transpose::Yes;
+  const size_t tm = tuning_extent(m);
+  const size_t tn = tuning_extent(n);
+  const size_t tk = tuning_extent(k);
+  std::vector<float> ones(std::max(tm * tk, tk * tn), 1.0f);
+  s.reserve(tm * tk, tk * tn, tm * tn);
+  s.queue.enqueueWriteBuffer(s.A_d, CL_TRUE, 0, sizeof(float) * tm * tk, ones.data());
+  s.queue.enqueueWriteBuffer(s.B_d, CL_TRUE, 0, sizeof(float) * tk * tn, ones.data());
 
-  cl::Program program(context, sources);
-  program.build(devices);
+  const TuneResult best = pick_fastest(tuning_candidates(s.device), 2.0 * tm * tn * tk, [&](const TuneConfig& knobs) {
+    const KernelConfig config = KernelConfig::from_knobs(knobs, s.config);
+    cl::Kernel* kernel = s.variant(config);
+    if (!kernel || s.launch_sgemm(s.queue, *kernel, config, s.A_d, s.B_d, s.C_d, tA, tB, tm, tn, tk,
+                                  1.0f, tA ? tm : tk, tB ? tk : tn, 0.0f, tn, Epilogue(), 1, nullptr) != CL_SUCCESS) {
+      return false;
+    }
+    return s.queue.finish() == CL_SUCCESS;
+  });
 
-  cl_int err = CL_SUCCESS;
-  // should add try catch for opencl extension
-  cl::Kernel kernel(program, "add", &err);
-  cl::compatibility::make_kernel<cl::Buffer, cl::Buffer, unsigned>addKernel(program, "add");
+  if (best.gflops > 0.0) {
+    s.tuningTable->store(shape_class(tA, tB, m, n, k), best);
+  }
+  return best;
+}
 
-  cl::Buffer A_d(context, CL_MEM_READ_WRITE, sizeof(float) * count * count);
-  cl::Buffer B_d(context, CL_MEM_READ_ONLY, sizeof(float) * count * count);
-  cl::Buffer C_d(context, CL_MEM_READ_WRITE, sizeof(float) * count * count);
+TuneConfig ComputeSession::tuned_config(Transpose transA, Transpose transB, size_t m, size_t n, size_t k)
+{
+  TuneConfig config;
+  if (_impl->tuningTable) {
+    _impl->tuningTable->find(shape_class(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k), config);
+  }
+  return config;
+}
 
-  cl::CommandQueue queue(context, devices[0]);
-  cl::NDRange global(count * count / 64);
-  cl::NDRange local(64);
-  addKernel(cl::EnqueueArgs(queue, global, local), A_d, B_d, count * count);
+void ComputeSession::sgemm_split(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                 float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                 float beta, float* c, size_t ldc)
+{
+  _impl->sgemm_split(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k,
+                     alpha, a, lda, b, ldb, beta, c, ldc);
+}
 
-  queue.enqueueReadBuffer(C_d, CL_TRUE, 0,  sizeof(float) * count * count, c);
+// no reduced precision kernels: float goes straight to sgemm, the others
+// are widened on the host (compute_widen.h)
+template <>
+void ComputeSession::gemm<float, float>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                        float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                        float beta, float* c, size_t ldc, const Scales& scales)
+{
+  if (scales.row || scales.col) {
+    gemm_widened(*this, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
+  } else {
+    sgemm(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+  }
+}
+
+template <>
+void ComputeSession::gemm<BFloat16, float>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const BFloat16* a, size_t lda, const BFloat16* b, size_t ldb,
+                                           float beta, float* c, size_t ldc, const Scales& scales)
+{
+  gemm_widened(*this, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
 }
 
-void test_mul_from_external_lib(float* a, float* b, float* c, size_t count)
+template <>
+void ComputeSession::gemm<int8_t, int32_t>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const int8_t* a, size_t lda, const int8_t* b, size_t ldb,
+                                           float beta, float* c, size_t ldc, const Scales& scales)
 {
+  gemm_widened(*this, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
+}
+
+void ComputeSession::test_mul_from_external_lib(float* a, float* b, float* c, size_t count)
+{
+  _impl->timings = {};
   std::cout << "not implemented" << std::endl;
-}
\ No newline at end of file
+}
@@ -0,0 +1,1680 @@
+#include "compute.h"
+#include "compute_timer.h"
+#include "compute_trace.h"
+#include "compute_worker.h"
+
+#include <immintrin.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef COMPUTE_HAS_CBLAS
+#include <cblas.h>
+#endif
+
+// Native cpu backend, goto/blis like sgemm
+// - https://www.cs.utexas.edu/~flame/pubs/GotoTOMS_revision.pdf
+// - https://github.com/flame/blis/blob/master/docs/KernelsHowTo.md
+//
+// jc loop: NC wide column panels of B/C (B block stays in L3)
+// pc loop: KC deep slices of A/B (micro-panels of B stay in L1)
+// ic loop: MC high row blocks of A (packed A block stays in L2)
+// jr/ir loops: MR x NR register tiles computed by the micro-kernel
+
+namespace
+{
+  struct aligned_deleter
+  {
+    void operator()(float* p) const { std::free(p); }
+  };
+  using aligned_ptr = std::unique_ptr<float[], aligned_deleter>;
+
+  aligned_ptr make_aligned(size_t count)
+  {
+    size_t bytes = (count * sizeof(float) + 63) & ~size_t{63};
+    return aligned_ptr(static_cast<float*>(std::aligned_alloc(64, bytes)));
+  }
+
+  // C[MR x NR] = alpha * packed A[MR x kc] * packed B[kc x NR] + beta * C
+  // When alpha = beta = 1 (every k slice but the first) the accumulators
+  // start from C: this keeps the summation order of the reference loop, so
+  // integer-valued inputs give bitwise identical results.
+  using ukernel_t = void (*)(size_t kc, const float* a, const float* b,
+                             float* c, size_t ldc, float alpha, float beta);
+
+  constexpr size_t kMaxMR = 12;
+  constexpr size_t kMaxNR = 32;
+
+  struct kernel_desc
+  {
+    const char* name;
+    size_t mr;
+    size_t nr;
+    ukernel_t ukr;
+  };
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////// Micro-kernels
+  /////////////////////////////////////////////////////////////////////////////
+
+  template <size_t MR, size_t NR>
+  void ukernel_generic(size_t kc, const float* __restrict__ a, const float* __restrict__ b,
+                       float* __restrict__ c, size_t ldc, float alpha, float beta)
+  {
+    const bool accumulate = alpha == 1.0f && beta == 1.0f;
+    float acc[MR][NR];
+    for (size_t i = 0; i < MR; i++) {
+      for (size_t j = 0; j < NR; j++) {
+        acc[i][j] = accumulate ? c[i * ldc + j] : 0.0f;
+      }
+    }
+
+    for (size_t p = 0; p < kc; p++) {
+      for (size_t i = 0; i < MR; i++) {
+        const float ai = a[p * MR + i];
+        for (size_t j = 0; j < NR; j++) {
+          acc[i][j] += ai * b[p * NR + j];
+        }
+      }
+    }
+
+    for (size_t i = 0; i < MR; i++) {
+      for (size_t j = 0; j < NR; j++) {
+        if (accumulate) {
+          c[i * ldc + j] = acc[i][j];
+        } else if (beta == 0.0f) {
+          c[i * ldc + j] = alpha * acc[i][j];
+        } else {
+          c[i * ldc + j] = alpha * acc[i][j] + beta * c[i * ldc + j];
+        }
+      }
+    }
+  }
+
+  // 6x16: 12 ymm accumulators + 2 for B + 1 broadcast
+  __attribute__((target("avx2,fma")))
+  void ukernel_avx2_6x16(size_t kc, const float* __restrict__ a, const float* __restrict__ b,
+                         float* __restrict__ c, size_t ldc, float alpha, float beta)
+  {
+    constexpr size_t MR = 6;
+    const bool accumulate = alpha == 1.0f && beta == 1.0f;
+    __m256 acc[MR][2];
+
+#pragma GCC unroll 6
+    for (size_t i = 0; i < MR; i++) {
+      acc[i][0] = accumulate ? _mm256_loadu_ps(c + i * ldc) : _mm256_setzero_ps();
+      acc[i][1] = accumulate ? _mm256_loadu_ps(c + i * ldc + 8) : _mm256_setzero_ps();
+    }
+
+    for (size_t p = 0; p < kc; p++) {
+      const __m256 b0 = _mm256_load_ps(b);
+      const __m256 b1 = _mm256_load_ps(b + 8);
+      _mm_prefetch(reinterpret_cast<const char*>(b + 64), _MM_HINT_T0);
+#pragma GCC unroll 6
+      for (size_t i = 0; i < MR; i++) {
+        const __m256 ai = _mm256_broadcast_ss(a + i);
+        acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+        acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+      }
+      a += MR;
+      b += 16;
+    }
+
+    if (!accumulate) {
+      const __m256 va = _mm256_set1_ps(alpha);
+      const __m256 vb = _mm256_set1_ps(beta);
+#pragma GCC unroll 6
+      for (size_t i = 0; i < MR; i++) {
+        acc[i][0] = _mm256_mul_ps(va, acc[i][0]);
+        acc[i][1] = _mm256_mul_ps(va, acc[i][1]);
+        if (beta != 0.0f) {
+          acc[i][0] = _mm256_fmadd_ps(vb, _mm256_loadu_ps(c + i * ldc), acc[i][0]);
+          acc[i][1] = _mm256_fmadd_ps(vb, _mm256_loadu_ps(c + i * ldc + 8), acc[i][1]);
+        }
+      }
+    }
+
+#pragma GCC unroll 6
+    for (size_t i = 0; i < MR; i++) {
+      _mm256_storeu_ps(c + i * ldc, acc[i][0]);
+      _mm256_storeu_ps(c + i * ldc + 8, acc[i][1]);
+    }
+  }
+
+  // 12x32: 24 zmm accumulators + 2 for B + 1 broadcast
+  __attribute__((target("avx512f")))
+  void ukernel_avx512_12x32(size_t kc, const float* __restrict__ a, const float* __restrict__ b,
+                            float* __restrict__ c, size_t ldc, float alpha, float beta)
+  {
+    constexpr size_t MR = 12;
+    const bool accumulate = alpha == 1.0f && beta == 1.0f;
+    __m512 acc[MR][2];
+
+#pragma GCC unroll 12
+    for (size_t i = 0; i < MR; i++) {
+      acc[i][0] = accumulate ? _mm512_loadu_ps(c + i * ldc) : _mm512_setzero_ps();
+      acc[i][1] = accumulate ? _mm512_loadu_ps(c + i * ldc + 16) : _mm512_setzero_ps();
+    }
+
+    for (size_t p = 0; p < kc; p++) {
+      const __m512 b0 = _mm512_load_ps(b);
+      const __m512 b1 = _mm512_load_ps(b + 16);
+      _mm_prefetch(reinterpret_cast<const char*>(b + 128), _MM_HINT_T0);
+#pragma GCC unroll 12
+      for (size_t i = 0; i < MR; i++) {
+        const __m512 ai = _mm512_set1_ps(a[i]);
+        acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+        acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+      }
+      a += MR;
+      b += 32;
+    }
+
+    if (!accumulate) {
+      const __m512 va = _mm512_set1_ps(alpha);
+      const __m512 vb = _mm512_set1_ps(beta);
+#pragma GCC unroll 12
+      for (size_t i = 0; i < MR; i++) {
+        acc[i][0] = _mm512_mul_ps(va, acc[i][0]);
+        acc[i][1] = _mm512_mul_ps(va, acc[i][1]);
+        if (beta != 0.0f) {
+          acc[i][0] = _mm512_fmadd_ps(vb, _mm512_loadu_ps(c + i * ldc), acc[i][0]);
+          acc[i][1] = _mm512_fmadd_ps(vb, _mm512_loadu_ps(c + i * ldc + 16), acc[i][1]);
+        }
+      }
+    }
+
+#pragma GCC unroll 12
+    for (size_t i = 0; i < MR; i++) {
+      _mm512_storeu_ps(c + i * ldc, acc[i][0]);
+      _mm512_storeu_ps(c + i * ldc + 16, acc[i][1]);
+    }
+  }
+
+  // kernel of a vector width (floats per register: 16 avx512, 8 avx2, 1 for
+  // the portable one), null when the cpu does not support it
+  const kernel_desc* kernel_for_vector(size_t vector)
+  {
+    static const kernel_desc kGeneric{"generic", 4, 16, &ukernel_generic<4, 16>};
+    static const kernel_desc kAvx2{"avx2", 6, 16, &ukernel_avx2_6x16};
+    static const kernel_desc kAvx512{"avx512", 12, 32, &ukernel_avx512_12x32};
+
+    __builtin_cpu_init();
+    switch (vector) {
+    case 16:
+      return __builtin_cpu_supports("avx512f") ? &kAvx512 : nullptr;
+    case 8:
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? &kAvx2 : nullptr;
+    case 1:
+      return &kGeneric;
+    default:
+      return nullptr;
+    }
+  }
+
+  // runtime dispatch, COMPUTE_CPU_ISA=generic|avx2|avx512 forces a kernel
+  const kernel_desc& select_kernel()
+  {
+    static const kernel_desc& selected = []() -> const kernel_desc& {
+      const kernel_desc* avx512 = kernel_for_vector(16);
+      const kernel_desc* avx2 = kernel_for_vector(8);
+
+      const char* forced = std::getenv("COMPUTE_CPU_ISA");
+      std::string isa = forced ? forced : "";
+      if (isa == "generic") {
+        return *kernel_for_vector(1);
+      }
+      if (isa == "avx2" && avx2) {
+        return *avx2;
+      }
+      if (avx512 && (isa.empty() || isa == "avx512")) {
+        return *avx512;
+      }
+      if (avx2) {
+        return *avx2;
+      }
+      return *kernel_for_vector(1);
+    }();
+
+    return selected;
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////// Small fixed shapes
+  /////////////////////////////////////////////////////////////////////////////
+
+  // C[S x S] = alpha * A[S x S] * B[S x S] + beta * C without packing, for
+  // the batched calls: with the shape known at compile time the loops are
+  // fully unrolled/vectorized and 4 rows of C stay in registers
+  using small_kernel_t = void (*)(const float* a, size_t lda, const float* b, size_t ldb,
+                                  float* c, size_t ldc, float alpha, float beta);
+
+  template <size_t S>
+  inline __attribute__((always_inline))
+  void small_gemm(const float* __restrict__ a, size_t lda, const float* __restrict__ b, size_t ldb,
+                  float* __restrict__ c, size_t ldc, float alpha, float beta)
+  {
+    constexpr size_t RB = 4;
+    for (size_t i = 0; i < S; i += RB) {
+      float acc[RB][S] = {};
+      for (size_t p = 0; p < S; p++) {
+        const float* brow = b + p * ldb;
+        for (size_t r = 0; r < RB; r++) {
+          const float ai = a[(i + r) * lda + p];
+#pragma omp simd
+          for (size_t j = 0; j < S; j++) {
+            acc[r][j] += ai * brow[j];
+          }
+        }
+      }
+      for (size_t r = 0; r < RB; r++) {
+        float* out = c + (i + r) * ldc;
+#pragma omp simd
+        for (size_t j = 0; j < S; j++) {
+          out[j] = beta == 0.0f ? alpha * acc[r][j] : alpha * acc[r][j] + beta * out[j];
+        }
+      }
+    }
+  }
+
+  // the same body compiled for each isa of select_kernel
+  template <size_t S>
+  void small_generic(const float* a, size_t lda, const float* b, size_t ldb, float* c, size_t ldc, float alpha, float beta)
+  {
+    small_gemm<S>(a, lda, b, ldb, c, ldc, alpha, beta);
+  }
+
+  template <size_t S>
+  __attribute__((target("avx2,fma")))
+  void small_avx2(const float* a, size_t lda, const float* b, size_t ldb, float* c, size_t ldc, float alpha, float beta)
+  {
+    small_gemm<S>(a, lda, b, ldb, c, ldc, alpha, beta);
+  }
+
+  template <size_t S>
+  __attribute__((target("avx512f")))
+  void small_avx512(const float* a, size_t lda, const float* b, size_t ldb, float* c, size_t ldc, float alpha, float beta)
+  {
+    small_gemm<S>(a, lda, b, ldb, c, ldc, alpha, beta);
+  }
+
+  // null when the shape has no specialization (the packed path is used)
+  small_kernel_t select_small_kernel(Transpose transA, Transpose transB, size_t m, size_t n, size_t k)
+  {
+    // 8, 16, 32 and 64
+    static const small_kernel_t kGeneric[] = {&small_generic<8>, &small_generic<16>, &small_generic<32>, &small_generic<64>};
+    static const small_kernel_t kAvx2[] = {&small_avx2<8>, &small_avx2<16>, &small_avx2<32>, &small_avx2<64>};
+    static const small_kernel_t kAvx512[] = {&small_avx512<8>, &small_avx512<16>, &small_avx512<32>, &small_avx512<64>};
+
+    if (transA != Transpose::No || transB != Transpose::No || m != n || m != k) {
+      return nullptr;
+    }
+    const size_t idx = m == 8 ? 0 : m == 16 ? 1 : m == 32 ? 2 : m == 64 ? 3 : 4;
+    if (idx == 4) {
+      return nullptr;
+    }
+
+    const std::string isa = select_kernel().name;
+    if (isa == "avx512") {
+      return kAvx512[idx];
+    }
+    if (isa == "avx2") {
+      return kAvx2[idx];
+    }
+    return kGeneric[idx];
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////// Cache blocking
+  /////////////////////////////////////////////////////////////////////////////
+
+  struct blocking
+  {
+    size_t kc;
+    size_t mc;
+    size_t nc;
+  };
+
+  size_t cache_size(int name, size_t fallback)
+  {
+    long size = sysconf(name);
+    return size > 0 ? static_cast<size_t>(size) : fallback;
+  }
+
+  size_t round_down(size_t value, size_t multiple, size_t min)
+  {
+    return std::max(min, value / multiple * multiple);
+  }
+
+  // kc (and mc) of 0 are derived from the caches
+  blocking compute_blocking(const kernel_desc& k, size_t kc = 0, size_t mc = 0)
+  {
+    const size_t l1 = cache_size(_SC_LEVEL1_DCACHE_SIZE, 32 * 1024);
+    const size_t l2 = cache_size(_SC_LEVEL2_CACHE_SIZE, 1024 * 1024);
+    const size_t l3 = std::min(cache_size(_SC_LEVEL3_CACHE_SIZE, 8 * 1024 * 1024),
+                               size_t{32} * 1024 * 1024);
+
+    blocking bl{};
+    // one A and one B micro-panel in half of L1
+    bl.kc = kc ? kc : std::min<size_t>(round_down(l1 / 2 / ((k.mr + k.nr) * sizeof(float)), 8, 64), 512);
+    // packed A block in half of L2
+    bl.mc = round_down(mc ? mc : l2 / 2 / (bl.kc * sizeof(float)), k.mr, k.mr);
+    // packed B block in half of L3
+    bl.nc = std::min<size_t>(round_down(l3 / 2 / (bl.kc * sizeof(float)), k.nr, k.nr), 8192);
+    return bl;
+  }
+
+  // kernel and blocking of a call: the default ones, or the tuned ones of
+  // the shape class (knobs vector, kc and mc)
+  struct tuning
+  {
+    const kernel_desc* kern;
+    blocking bl;
+  };
+
+  const tuning& default_tuning()
+  {
+    static const tuning t{&select_kernel(), compute_blocking(select_kernel())};
+    return t;
+  }
+
+  // null kern when the cpu does not have the vector width
+  tuning make_tuning(const TuneConfig& config)
+  {
+    const kernel_desc* kern = kernel_for_vector(tune_value(config, "vector", 0));
+    if (!kern) {
+      return tuning{nullptr, blocking{}};
+    }
+    return tuning{kern, compute_blocking(*kern, tune_value(config, "kc", 0), tune_value(config, "mc", 0))};
+  }
+
+  // the vector widths the cpu has (the portable kernel only without simd),
+  // each with kc around the L1 bound and mc around the L2 one
+  std::vector<TuneConfig> tuning_candidates()
+  {
+    std::vector<TuneConfig> candidates;
+    const size_t l2 = cache_size(_SC_LEVEL2_CACHE_SIZE, 1024 * 1024);
+    for (size_t vector : {16, 8, 1}) {
+      const kernel_desc* kern = kernel_for_vector(vector);
+      if (!kern || (vector == 1 && !candidates.empty())) {
+        continue;
+      }
+      for (size_t kc : {128, 256, 384}) {
+        const size_t mc = l2 / 2 / (kc * sizeof(float));
+        for (size_t scaled : {mc / 2, mc, mc * 2}) {
+          candidates.push_back({{"vector", vector}, {"kc", kc}, {"mc", round_down(scaled, kern->mr, kern->mr)}});
+        }
+      }
+    }
+    return candidates;
+  }
+
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////// Packing
+  /////////////////////////////////////////////////////////////////////////////
+
+  inline float to_float(float v)
+  {
+    return v;
+  }
+
+  inline float to_float(BFloat16 v)
+  {
+    return static_cast<float>(v);
+  }
+
+  // element (i, p) of op(A) is at a[i * rsa + p * csa], the loop order
+  // follows the contiguous dimension of the stored matrix. bfloat16 is
+  // widened here, so only the packed copy is float. rowScale (optional)
+  // multiplies row i.
+  template <typename T>
+  void pack_a(size_t mr, size_t mc, size_t kc, const T* a, size_t rsa, size_t csa, float* out,
+              const float* rowScale = nullptr)
+  {
+    for (size_t ir = 0; ir < mc; ir += mr) {
+      const size_t mrEff = std::min(mr, mc - ir);
+      if (csa == 1) {
+        for (size_t i = 0; i < mrEff; i++) {
+          const T* src = a + (ir + i) * rsa;
+          const float s = rowScale ? rowScale[ir + i] : 1.0f;
+          for (size_t p = 0; p < kc; p++) {
+            out[p * mr + i] = rowScale ? to_float(src[p]) * s : to_float(src[p]);
+          }
+        }
+      } else {
+        for (size_t p = 0; p < kc; p++) {
+          const T* src = a + ir * rsa + p * csa;
+          for (size_t i = 0; i < mrEff; i++) {
+            out[p * mr + i] = rowScale ? to_float(src[i * rsa]) * rowScale[ir + i] : to_float(src[i * rsa]);
+          }
+        }
+      }
+      for (size_t i = mrEff; i < mr; i++) {
+        for (size_t p = 0; p < kc; p++) {
+          out[p * mr + i] = 0.0f;
+        }
+      }
+      out += mr * kc;
+    }
+  }
+
+  // element (p, j) of op(B) is at b[p * rsb + j * csb], colScale (optional)
+  // multiplies column j
+  template <typename T>
+  void pack_b(size_t nr, size_t kc, size_t nc, const T* b, size_t rsb, size_t csb, float* out,
+              const float* colScale = nullptr)
+  {
+    const size_t nrEff = std::min(nr, nc);
+    if (csb == 1) {
+      for (size_t p = 0; p < kc; p++) {
+        const T* src = b + p * rsb;
+        for (size_t j = 0; j < nrEff; j++) {
+          out[p * nr + j] = colScale ? to_float(src[j]) * colScale[j] : to_float(src[j]);
+        }
+      }
+    } else {
+      for (size_t j = 0; j < nrEff; j++) {
+        const T* src = b + j * csb;
+        const float s = colScale ? colScale[j] : 1.0f;
+        for (size_t p = 0; p < kc; p++) {
+          out[p * nr + j] = colScale ? to_float(src[p * rsb]) * s : to_float(src[p * rsb]);
+        }
+      }
+    }
+    for (size_t p = 0; p < kc; p++) {
+      for (size_t j = nrEff; j < nr; j++) {
+        out[p * nr + j] = 0.0f;
+      }
+    }
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////// Epilogues
+  /////////////////////////////////////////////////////////////////////////////
+
+  // applied on a mr x nr tile of C starting at (row, col) of the full matrix
+  // right after the micro-kernel stored it (still in L1)
+  struct no_epilogue
+  {
+    void operator()(float*, size_t, size_t, size_t, size_t, size_t) const {}
+  };
+
+  // one instantiation per combination, no per element branch
+  template <bool HasBias, bool HasAddend, Activation Act>
+  struct fused_epilogue
+  {
+    const Epilogue& e;
+
+    void operator()(float* c, size_t ldc, size_t mr, size_t nr, size_t row, size_t col) const
+    {
+      const float scale = e.scale;
+      for (size_t i = 0; i < mr; i++) {
+        float* __restrict__ out = c + i * ldc;
+        const float* bias = HasBias ? e.bias + col : nullptr;
+        const float* addend = HasAddend ? e.addend + (row + i) * e.ldd + col : nullptr;
+#pragma omp simd
+        for (size_t j = 0; j < nr; j++) {
+          float x = scale * out[j];
+          if (HasBias) {
+            x += bias[j];
+          }
+          if (HasAddend) {
+            x += addend[j];
+          }
+          if (Act == Activation::Relu) {
+            x = x > 0.0f ? x : 0.0f;
+          }
+          out[j] = x;
+        }
+      }
+    }
+  };
+
+  template <bool HasBias, bool HasAddend, typename F>
+  void with_activation(const Epilogue& e, F&& f)
+  {
+    if (e.activation == Activation::Relu) {
+      f(fused_epilogue<HasBias, HasAddend, Activation::Relu>{e});
+    } else {
+      f(fused_epilogue<HasBias, HasAddend, Activation::None>{e});
+    }
+  }
+
+  // calls f with the functor matching the runtime description
+  template <typename F>
+  void with_epilogue(const Epilogue& e, F&& f)
+  {
+    if (e.empty()) {
+      f(no_epilogue{});
+    } else if (e.bias && e.addend) {
+      with_activation<true, true>(e, f);
+    } else if (e.bias) {
+      with_activation<true, false>(e, f);
+    } else if (e.addend) {
+      with_activation<false, true>(e, f);
+    } else {
+      with_activation<false, false>(e, f);
+    }
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////// Macro kernel
+  /////////////////////////////////////////////////////////////////////////////
+
+  // (row, col): position of c in the full matrix, the epilogue only runs
+  // with the last k slice
+  template <typename Epi>
+  void macro_kernel(const kernel_desc& k, size_t mc, size_t nc, size_t kc,
+                    const float* apack, const float* bpack, float* c, size_t ldc, float alpha, float beta,
+                    const Epi& epi, bool last, size_t row, size_t col)
+  {
+    alignas(64) float tile[kMaxMR * kMaxNR];
+
+    for (size_t jr = 0; jr < nc; jr += k.nr) {
+      const size_t nrEff = std::min(k.nr, nc - jr);
+      for (size_t ir = 0; ir < mc; ir += k.mr) {
+        const size_t mrEff = std::min(k.mr, mc - ir);
+        const float* ap = apack + ir * kc;
+        const float* bp = bpack + jr * kc;
+        float* cp = c + ir * ldc + jr;
+
+        if (mrEff == k.mr && nrEff == k.nr) {
+          k.ukr(kc, ap, bp, cp, ldc, alpha, beta);
+          if (last) {
+            epi(cp, ldc, mrEff, nrEff, row + ir, col + jr);
+          }
+          continue;
+        }
+
+        // edge tile: go through a full size scratch tile
+        if (beta != 0.0f) {
+          for (size_t i = 0; i < mrEff; i++) {
+            std::memcpy(tile + i * k.nr, cp + i * ldc, nrEff * sizeof(float));
+          }
+        }
+        k.ukr(kc, ap, bp, tile, k.nr, alpha, beta);
+        if (last) {
+          epi(tile, k.nr, mrEff, nrEff, row + ir, col + jr);
+        }
+        for (size_t i = 0; i < mrEff; i++) {
+          std::memcpy(cp + i * ldc, tile + i * k.nr, nrEff * sizeof(float));
+        }
+      }
+    }
+  }
+
+  int max_threads()
+  {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+  }
+
+  int thread_id()
+  {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+  }
+
+  // packing buffers, only grow so that repeated calls do not allocate
+  struct workspace
+  {
+    tuning tune{default_tuning()};
+    aligned_ptr bpack;
+    size_t bpackSize{0};
+    std::vector<aligned_ptr> apack;
+    size_t apackSize{0};
+
+    void reserve(size_t bsize, size_t asize, size_t threads)
+    {
+      if (bsize > bpackSize) {
+        bpack = make_aligned(bsize);
+        bpackSize = bsize;
+      }
+      if (asize > apackSize || apack.size() < threads) {
+        apack.resize(std::max(apack.size(), threads));
+        for (auto& buffer : apack) {
+          buffer = make_aligned(std::max(asize, apackSize));
+        }
+        apackSize = std::max(asize, apackSize);
+      }
+    }
+  };
+
+  void reserve(workspace& ws, size_t m, size_t n, size_t threads = max_threads())
+  {
+    const kernel_desc& kern = *ws.tune.kern;
+    const blocking& bl = ws.tune.bl;
+    const size_t ncMax = std::min(bl.nc, (n + kern.nr - 1) / kern.nr * kern.nr);
+    const size_t mcMax = std::min(bl.mc, (m + kern.mr - 1) / kern.mr * kern.mr);
+    ws.reserve(bl.kc * ncMax, mcMax * bl.kc, threads);
+  }
+
+  // model name of /proc/cpuinfo and thread count, the tuning cache key
+  std::string cpu_name()
+  {
+    std::ifstream fin("/proc/cpuinfo");
+    std::string line;
+    std::string name = "cpu";
+    while (std::getline(fin, line)) {
+      if (line.compare(0, 10, "model name") == 0 && line.find(':') != std::string::npos) {
+        name = line.substr(line.find(':') + 2);
+        break;
+      }
+    }
+    std::ostringstream out;
+    out << name << " x" << max_threads();
+    return out.str();
+  }
+
+  // C = beta * C, C is not read when beta is 0 (blas semantic)
+  void scale(size_t m, size_t n, float beta, float* c, size_t ldc)
+  {
+    for (size_t i = 0; i < m; i++) {
+      float* row = c + i * ldc;
+      if (beta == 0.0f) {
+        std::fill(row, row + n, 0.0f);
+      } else if (beta != 1.0f) {
+        for (size_t j = 0; j < n; j++) {
+          row[j] *= beta;
+        }
+      }
+    }
+  }
+
+  // row major C[m x n] = epi(alpha * op(A)[m x k] * op(B)[k x n] + beta * C)
+  // parallel = false runs on the calling thread only (one batch item per
+  // thread), ws then needs a single A buffer. T is float or BFloat16 (fp32
+  // kernels on the widened packed copies), the scales are folded in the
+  // packing.
+  template <typename T, typename Epi>
+  void packed_gemm(workspace& ws, Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+            float alpha, const T* a, size_t lda, const T* b, size_t ldb,
+            float beta, float* c, size_t ldc, const Epi& epi, bool parallel = true,
+            const Scales& scales = Scales())
+  {
+    const kernel_desc& kern = *ws.tune.kern;
+    const blocking& bl = ws.tune.bl;
+
+    if (m == 0 || n == 0) {
+      return;
+    }
+    if (k == 0 || alpha == 0.0f) {
+      scale(m, n, beta, c, ldc);
+      epi(c, ldc, m, n, 0, 0);
+      return;
+    }
+
+    // strides of op(A) and op(B) elements
+    const size_t rsa = transA == Transpose::No ? lda : 1;
+    const size_t csa = transA == Transpose::No ? 1 : lda;
+    const size_t rsb = transB == Transpose::No ? ldb : 1;
+    const size_t csb = transB == Transpose::No ? 1 : ldb;
+
+    reserve(ws, m, n, parallel ? max_threads() : 1);
+    float* bpack = ws.bpack.get();
+
+#pragma omp parallel if(parallel)
+    {
+      float* apack = ws.apack[thread_id()].get();
+
+      for (size_t jc = 0; jc < n; jc += bl.nc) {
+        const size_t nc = std::min(bl.nc, n - jc);
+        for (size_t pc = 0; pc < k; pc += bl.kc) {
+          const size_t kc = std::min(bl.kc, k - pc);
+
+          // implicit barriers: B is packed before use and kept until every
+          // thread is done with it
+#pragma omp for schedule(static)
+          for (size_t jr = 0; jr < nc; jr += kern.nr) {
+            pack_b(kern.nr, kc, nc - jr, b + pc * rsb + (jc + jr) * csb, rsb, csb, bpack + jr * kc,
+                   scales.col ? scales.col + jc + jr : nullptr);
+          }
+
+#pragma omp for schedule(dynamic)
+          for (size_t ic = 0; ic < m; ic += bl.mc) {
+            const size_t mc = std::min(bl.mc, m - ic);
+            pack_a(kern.mr, mc, kc, a + ic * rsa + pc * csa, rsa, csa, apack,
+                   scales.row ? scales.row + ic : nullptr);
+            // the next k slices accumulate in C
+            macro_kernel(kern, mc, nc, kc, apack, bpack, c + ic * ldc + jc, ldc,
+                         alpha, pc == 0 ? beta : 1.0f, epi, pc + kc == k, ic, jc);
+          }
+        }
+      }
+    }
+  }
+
+  void packed_gemm(workspace& ws, Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+            float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+            float beta, float* c, size_t ldc, const Epilogue& epilogue)
+  {
+    with_epilogue(epilogue, [&](const auto& epi) {
+      packed_gemm(ws, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, epi);
+    });
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////// Batches
+  /////////////////////////////////////////////////////////////////////////////
+
+  struct batch_item
+  {
+    const float* a;
+    const float* b;
+    float* c;
+  };
+
+  // items(i) gives the operands of item i. The items are spread over the
+  // threads, each one computed by a single thread (small kernel or packed
+  // path with the thread's own workspace). A batch of a few large items is
+  // computed item by item with every thread on each item instead.
+  template <typename Items>
+  void gemm_batched(workspace& ws, std::vector<workspace>& pool,
+                    Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                    float alpha, size_t lda, size_t ldb, float beta, size_t ldc,
+                    size_t batch, const Items& items)
+  {
+    if (batch == 0 || m == 0 || n == 0) {
+      return;
+    }
+
+    const small_kernel_t small = alpha != 0.0f ? select_small_kernel(transA, transB, m, n, k) : nullptr;
+    const size_t threads = static_cast<size_t>(max_threads());
+    const blocking& bl = default_tuning().bl;
+
+    if (!small && batch < threads && m >= bl.mc && n >= bl.mc) {
+      for (size_t i = 0; i < batch; i++) {
+        const batch_item item = items(i);
+        packed_gemm(ws, transA, transB, m, n, k, alpha, item.a, lda, item.b, ldb, beta, item.c, ldc, no_epilogue{});
+      }
+      return;
+    }
+
+    if (pool.size() < threads) {
+      pool.resize(threads);
+    }
+
+    const long long count = static_cast<long long>(batch);
+#pragma omp parallel for schedule(static)
+    for (long long i = 0; i < count; i++) {
+      const batch_item item = items(static_cast<size_t>(i));
+      if (small) {
+        small(item.a, lda, item.b, ldb, item.c, ldc, alpha, beta);
+      } else {
+        packed_gemm(pool[thread_id()], transA, transB, m, n, k, alpha, item.a, lda, item.b, ldb, beta, item.c, ldc,
+             no_epilogue{}, false);
+      }
+    }
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////// Reduced precision
+  /////////////////////////////////////////////////////////////////////////////
+
+  // The bfloat16 (avx512-bf16) and int8 kernels work on pairs of k:
+  // vdpbf16ps, vpdpwssd (avx512-vnni) and vpmaddwd multiply two adjacent k
+  // of a row of A with the same two of a column of B and add both products
+  // to a 32 bits accumulator. The packed micro-panels interleave the pairs,
+  // element (i, p) of an A micro-panel is at [(p / 2 * mr + i) * 2 + p % 2]
+  // (same for B with j), an odd k is padded with 0. int8 is widened to int16
+  // by the packing, vpdpwssd being signed x signed.
+  template <typename T>
+  struct pair_traits;
+
+  template <>
+  struct pair_traits<BFloat16>
+  {
+    using packed = uint16_t;
+    using acc = float;
+
+    static packed pack(BFloat16 v) { return v.bits; }
+    static acc widen(packed v)
+    {
+      BFloat16 x;
+      x.bits = v;
+      return static_cast<float>(x);
+    }
+  };
+
+  template <>
+  struct pair_traits<int8_t>
+  {
+    using packed = int16_t;
+    using acc = int32_t;
+
+    static packed pack(int8_t v) { return v; }
+    static acc widen(packed v) { return v; }
+  };
+
+  // acc[MR x NR] (+)= packed A[MR x 2kp] * packed B[2kp x NR], the tile is
+  // dense (row stride NR) and 64 bytes aligned, accumulate adds to it (the
+  // next k slices)
+  using pair_ukernel_t = void (*)(size_t kp, const void* a, const void* b, void* acc, bool accumulate);
+
+  struct pair_kernel_desc
+  {
+    const char* name;
+    size_t mr;
+    size_t nr;
+    pair_ukernel_t ukr;
+  };
+
+  template <typename T, size_t MR, size_t NR>
+  void pair_ukernel_generic(size_t kp, const void* a, const void* b, void* acc, bool accumulate)
+  {
+    using traits = pair_traits<T>;
+    using P = typename traits::packed;
+    const P* __restrict__ pa = static_cast<const P*>(a);
+    const P* __restrict__ pb = static_cast<const P*>(b);
+
+    typename traits::acc sum[MR][NR] = {};
+    if (accumulate) {
+      std::memcpy(sum, acc, sizeof(sum));
+    }
+    for (size_t p = 0; p < kp; p++) {
+      for (size_t i = 0; i < MR; i++) {
+        const auto a0 = traits::widen(pa[2 * i]);
+        const auto a1 = traits::widen(pa[2 * i + 1]);
+        for (size_t j = 0; j < NR; j++) {
+          sum[i][j] += a0 * traits::widen(pb[2 * j]) + a1 * traits::widen(pb[2 * j + 1]);
+        }
+      }
+      pa += 2 * MR;
+      pb += 2 * NR;
+    }
+    std::memcpy(acc, sum, sizeof(sum));
+  }
+
+  inline int32_t load_pair(const void* p)
+  {
+    int32_t pair;
+    std::memcpy(&pair, p, sizeof(pair));
+    return pair;
+  }
+
+  // 6x16 int8: vpmaddwd + vpaddd, 12 ymm accumulators
+  __attribute__((target("avx2")))
+  void pair_ukernel_int8_avx2_6x16(size_t kp, const void* a, const void* b, void* acc, bool accumulate)
+  {
+    constexpr size_t MR = 6;
+    const int16_t* pa = static_cast<const int16_t*>(a);
+    const int16_t* pb = static_cast<const int16_t*>(b);
+    __m256i* out = static_cast<__m256i*>(acc);
+    __m256i sum[MR][2];
+
+#pragma GCC unroll 6
+    for (size_t i = 0; i < MR; i++) {
+      sum[i][0] = accumulate ? _mm256_load_si256(out + 2 * i) : _mm256_setzero_si256();
+      sum[i][1] = accumulate ? _mm256_load_si256(out + 2 * i + 1) : _mm256_setzero_si256();
+    }
+
+    for (size_t p = 0; p < kp; p++) {
+      const __m256i b0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(pb));
+      const __m256i b1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(pb + 16));
+#pragma GCC unroll 6
+      for (size_t i = 0; i < MR; i++) {
+        const __m256i ai = _mm256_set1_epi32(load_pair(pa + 2 * i));
+        sum[i][0] = _mm256_add_epi32(sum[i][0], _mm256_madd_epi16(ai, b0));
+        sum[i][1] = _mm256_add_epi32(sum[i][1], _mm256_madd_epi16(ai, b1));
+      }
+      pa += 2 * MR;
+      pb += 32;
+    }
+
+#pragma GCC unroll 6
+    for (size_t i = 0; i < MR; i++) {
+      _mm256_store_si256(out + 2 * i, sum[i][0]);
+      _mm256_store_si256(out + 2 * i + 1, sum[i][1]);
+    }
+  }
+
+  // 12x32 int8: vpdpwssd, 24 zmm accumulators
+  __attribute__((target("avx512f,avx512vnni")))
+  void pair_ukernel_int8_vnni_12x32(size_t kp, const void* a, const void* b, void* acc, bool accumulate)
+  {
+    constexpr size_t MR = 12;
+    const int16_t* pa = static_cast<const int16_t*>(a);
+    const int16_t* pb = static_cast<const int16_t*>(b);
+    int32_t* out = static_cast<int32_t*>(acc);
+    __m512i sum[MR][2];
+
+#pragma GCC unroll 12
+    for (size_t i = 0; i < MR; i++) {
+      sum[i][0] = accumulate ? _mm512_load_si512(out + i * 32) : _mm512_setzero_si512();
+      sum[i][1] = accumulate ? _mm512_load_si512(out + i * 32 + 16) : _mm512_setzero_si512();
+    }
+
+    for (size_t p = 0; p < kp; p++) {
+      const __m512i b0 = _mm512_load_si512(pb);
+      const __m512i b1 = _mm512_load_si512(pb + 32);
+      _mm_prefetch(reinterpret_cast<const char*>(pb + 256), _MM_HINT_T0);
+#pragma GCC unroll 12
+      for (size_t i = 0; i < MR; i++) {
+        const __m512i ai = _mm512_set1_epi32(load_pair(pa + 2 * i));
+        sum[i][0] = _mm512_dpwssd_epi32(sum[i][0], ai, b0);
+        sum[i][1] = _mm512_dpwssd_epi32(sum[i][1], ai, b1);
+      }
+      pa += 2 * MR;
+      pb += 64;
+    }
+
+#pragma GCC unroll 12
+    for (size_t i = 0; i < MR; i++) {
+      _mm512_store_si512(out + i * 32, sum[i][0]);
+      _mm512_store_si512(out + i * 32 + 16, sum[i][1]);
+    }
+  }
+
+  // 12x32 BFloat16: vdpbf16ps, 24 zmm accumulators
+  __attribute__((target("avx512f,avx512bf16")))
+  void pair_ukernel_bf16_12x32(size_t kp, const void* a, const void* b, void* acc, bool accumulate)
+  {
+    constexpr size_t MR = 12;
+    const uint16_t* pa = static_cast<const uint16_t*>(a);
+    const uint16_t* pb = static_cast<const uint16_t*>(b);
+    float* out = static_cast<float*>(acc);
+    __m512 sum[MR][2];
+
+#pragma GCC unroll 12
+    for (size_t i = 0; i < MR; i++) {
+      sum[i][0] = accumulate ? _mm512_load_ps(out + i * 32) : _mm512_setzero_ps();
+      sum[i][1] = accumulate ? _mm512_load_ps(out + i * 32 + 16) : _mm512_setzero_ps();
+    }
+
+    for (size_t p = 0; p < kp; p++) {
+      const __m512bh b0 = (__m512bh)_mm512_load_si512(pb);
+      const __m512bh b1 = (__m512bh)_mm512_load_si512(pb + 32);
+      _mm_prefetch(reinterpret_cast<const char*>(pb + 256), _MM_HINT_T0);
+#pragma GCC unroll 12
+      for (size_t i = 0; i < MR; i++) {
+        const __m512bh ai = (__m512bh)_mm512_set1_epi32(load_pair(pa + 2 * i));
+        sum[i][0] = _mm512_dpbf16_ps(sum[i][0], ai, b0);
+        sum[i][1] = _mm512_dpbf16_ps(sum[i][1], ai, b1);
+      }
+      pa += 2 * MR;
+      pb += 64;
+    }
+
+#pragma GCC unroll 12
+    for (size_t i = 0; i < MR; i++) {
+      _mm512_store_ps(out + i * 32, sum[i][0]);
+      _mm512_store_ps(out + i * 32 + 16, sum[i][1]);
+    }
+  }
+
+  // follows the isa of select_kernel (COMPUTE_CPU_ISA). Null without
+  // avx512-bf16: bfloat16 then goes through the fp32 kernels, widened by
+  // the packing.
+  const pair_kernel_desc* select_bf16_kernel()
+  {
+    static const pair_kernel_desc kAvx512{"avx512-bf16", 12, 32, &pair_ukernel_bf16_12x32};
+
+    static const pair_kernel_desc* selected = []() -> const pair_kernel_desc* {
+      const std::string isa = select_kernel().name;
+      return isa == "avx512" && __builtin_cpu_supports("avx512bf16") ? &kAvx512 : nullptr;
+    }();
+
+    return selected;
+  }
+
+  const pair_kernel_desc& select_int8_kernel()
+  {
+    static const pair_kernel_desc kGeneric{"generic", 4, 16, &pair_ukernel_generic<int8_t, 4, 16>};
+    static const pair_kernel_desc kAvx2{"avx2", 6, 16, &pair_ukernel_int8_avx2_6x16};
+    static const pair_kernel_desc kVnni{"avx512-vnni", 12, 32, &pair_ukernel_int8_vnni_12x32};
+
+    static const pair_kernel_desc& selected = []() -> const pair_kernel_desc& {
+      const std::string isa = select_kernel().name;
+      if (isa == "avx512" && __builtin_cpu_supports("avx512vnni")) {
+        return kVnni;
+      }
+      if (isa == "avx512" || isa == "avx2") {
+        return kAvx2;
+      }
+      return kGeneric;
+    }();
+
+    return selected;
+  }
+
+  // op(A) rows [0, mc) and all of k, by micro-panels of mr rows
+  template <typename T>
+  void pack_pairs_a(size_t mr, size_t mc, size_t k, const T* a, size_t rsa, size_t csa,
+                    typename pair_traits<T>::packed* out)
+  {
+    const size_t kp = (k + 1) / 2;
+    for (size_t ir = 0; ir < mc; ir += mr) {
+      const size_t mrEff = std::min(mr, mc - ir);
+      std::fill(out, out + 2 * mr * kp, 0);
+      if (csa == 1) {
+        for (size_t i = 0; i < mrEff; i++) {
+          const T* src = a + (ir + i) * rsa;
+          for (size_t p = 0; p < k; p++) {
+            out[(p / 2 * mr + i) * 2 + p % 2] = pair_traits<T>::pack(src[p]);
+          }
+        }
+      } else {
+        for (size_t p = 0; p < k; p++) {
+          const T* src = a + ir * rsa + p * csa;
+          for (size_t i = 0; i < mrEff; i++) {
+            out[(p / 2 * mr + i) * 2 + p % 2] = pair_traits<T>::pack(src[i * rsa]);
+          }
+        }
+      }
+      out += 2 * mr * kp;
+    }
+  }
+
+  // one micro-panel: op(B) columns [0, min(nr, nc)) and all of k
+  template <typename T>
+  void pack_pairs_b(size_t nr, size_t k, size_t nc, const T* b, size_t rsb, size_t csb,
+                    typename pair_traits<T>::packed* out)
+  {
+    const size_t nrEff = std::min(nr, nc);
+    std::fill(out, out + 2 * nr * ((k + 1) / 2), 0);
+    if (csb == 1) {
+      for (size_t p = 0; p < k; p++) {
+        const T* src = b + p * rsb;
+        for (size_t j = 0; j < nrEff; j++) {
+          out[(p / 2 * nr + j) * 2 + p % 2] = pair_traits<T>::pack(src[j]);
+        }
+      }
+    } else {
+      for (size_t j = 0; j < nrEff; j++) {
+        const T* src = b + j * csb;
+        for (size_t p = 0; p < k; p++) {
+          out[(p / 2 * nr + j) * 2 + p % 2] = pair_traits<T>::pack(src[p * rsb]);
+        }
+      }
+    }
+  }
+
+  // C[mr x nr] = alpha * row[i] * col[j] * acc + beta * C (row/col optional)
+  template <typename Acc>
+  void store_pairs_tile(const Acc* acc, size_t ldacc, size_t mr, size_t nr, float alpha, float beta,
+                        float* c, size_t ldc, const float* row, const float* col)
+  {
+    for (size_t i = 0; i < mr; i++) {
+      const float s = row ? alpha * row[i] : alpha;
+      const Acc* src = acc + i * ldacc;
+      float* __restrict__ out = c + i * ldc;
+#pragma omp simd
+      for (size_t j = 0; j < nr; j++) {
+        float x = s * static_cast<float>(src[j]);
+        if (col) {
+          x *= col[j];
+        }
+        out[j] = beta == 0.0f ? x : x + beta * out[j];
+      }
+    }
+  }
+
+  // C = alpha * diag(scales.row) * op(A) * op(B) * diag(scales.col) + beta * C
+  // with the native pair kernels. The sums must stay in the accumulator type
+  // until the dequantization (exact int32), so A and B are packed for the
+  // whole k, mc and nc shrinking with k instead (packed A block in L2,
+  // packed B block in L3). The k slices (A and B micro-panel slices in L1)
+  // are looped inside a jr column, in a per thread mc x nr accumulator
+  // column that is stored to C once complete.
+  template <typename T>
+  void pairs_gemm(workspace& ws, const pair_kernel_desc& kern, Transpose transA, Transpose transB,
+                  size_t m, size_t n, size_t k, float alpha, const T* a, size_t lda, const T* b, size_t ldb,
+                  float beta, float* c, size_t ldc, const Scales& scales)
+  {
+    using P = typename pair_traits<T>::packed;
+    using Acc = typename pair_traits<T>::acc;
+
+    if (m == 0 || n == 0) {
+      return;
+    }
+    if (k == 0 || alpha == 0.0f) {
+      scale(m, n, beta, c, ldc);
+      return;
+    }
+
+    const size_t rsa = transA == Transpose::No ? lda : 1;
+    const size_t csa = transA == Transpose::No ? 1 : lda;
+    const size_t rsb = transB == Transpose::No ? ldb : 1;
+    const size_t csb = transB == Transpose::No ? 1 : ldb;
+
+    static const size_t l2 = cache_size(_SC_LEVEL2_CACHE_SIZE, 1024 * 1024);
+    static const size_t l3 = std::min(cache_size(_SC_LEVEL3_CACHE_SIZE, 8 * 1024 * 1024),
+                                      size_t{32} * 1024 * 1024);
+    static const size_t l1 = cache_size(_SC_LEVEL1_DCACHE_SIZE, 32 * 1024);
+    const size_t kp = (k + 1) / 2;
+    const size_t line = 2 * kp * sizeof(P);  // one packed row of A / column of B
+    const size_t kpc = std::min<size_t>(round_down(l1 / 2 / ((kern.mr + kern.nr) * 2 * sizeof(P)), 8, 32), 256);
+    const size_t mcMax = std::min(round_down(l2 / 2 / line, kern.mr, kern.mr), (m + kern.mr - 1) / kern.mr * kern.mr);
+    const size_t ncMax = std::min(round_down(l3 / 2 / line, kern.nr, kern.nr), (n + kern.nr - 1) / kern.nr * kern.nr);
+
+    // the workspace counts floats, the accumulator column follows the packed
+    // A block (64 bytes aligned)
+    const size_t apackSize = (mcMax * line + 63) / 64 * 16;
+    ws.reserve((ncMax * line + sizeof(float) - 1) / sizeof(float),
+               apackSize + mcMax * kern.nr * sizeof(Acc) / sizeof(float), max_threads());
+    P* bpack = reinterpret_cast<P*>(ws.bpack.get());
+
+#pragma omp parallel
+    {
+      P* apack = reinterpret_cast<P*>(ws.apack[thread_id()].get());
+      Acc* tiles = reinterpret_cast<Acc*>(ws.apack[thread_id()].get() + apackSize);
+
+      for (size_t jc = 0; jc < n; jc += ncMax) {
+        const size_t nc = std::min(ncMax, n - jc);
+
+#pragma omp for schedule(static)
+        for (size_t jr = 0; jr < nc; jr += kern.nr) {
+          pack_pairs_b(kern.nr, k, nc - jr, b + (jc + jr) * csb, rsb, csb, bpack + jr * 2 * kp);
+        }
+
+#pragma omp for schedule(dynamic)
+        for (size_t ic = 0; ic < m; ic += mcMax) {
+          const size_t mc = std::min(mcMax, m - ic);
+          pack_pairs_a(kern.mr, mc, k, a + ic * rsa, rsa, csa, apack);
+          for (size_t jr = 0; jr < nc; jr += kern.nr) {
+            const size_t nrEff = std::min(kern.nr, nc - jr);
+            for (size_t pc = 0; pc < kp; pc += kpc) {
+              const size_t kpEff = std::min(kpc, kp - pc);
+              for (size_t ir = 0; ir < mc; ir += kern.mr) {
+                kern.ukr(kpEff, apack + (ir * kp + pc * kern.mr) * 2, bpack + (jr * kp + pc * kern.nr) * 2,
+                         tiles + ir * kern.nr, pc > 0);
+              }
+            }
+            for (size_t ir = 0; ir < mc; ir += kern.mr) {
+              store_pairs_tile(tiles + ir * kern.nr, kern.nr, std::min(kern.mr, mc - ir), nrEff, alpha, beta,
+                               c + (ic + ir) * ldc + jc + jr, ldc,
+                               scales.row ? scales.row + ic + ir : nullptr,
+                               scales.col ? scales.col + jc + jr : nullptr);
+            }
+          }
+        }
+      }
+    }
+  }
+  /////////////////////////////////////////////////////////////////////////////
+  /////////////////////////////// Sparse
+  /////////////////////////////////////////////////////////////////////////////
+
+  // C = alpha * A * B + beta * C for the rows [row0, row1) of a CSR A. Each
+  // row of C is computed by column chunks of kSparseNB accumulators (a few
+  // vector registers): every nonzero a(i, p) adds a(i, p) * B[p, chunk], the
+  // row of B it needs is prefetched a few nonzeros ahead since the rows come
+  // in no particular order.
+  constexpr size_t kSparseNB = 64;
+  constexpr size_t kSparseMaxBlock = 16;
+  constexpr size_t kSparseAhead = 4;
+
+  using spmm_csr_t = void (*)(const CsrMatrix& a, size_t row0, size_t row1, float alpha,
+                              const float* b, size_t ldb, size_t n, float beta, float* c, size_t ldc);
+  using spmm_bsr_t = void (*)(const BsrMatrix& a, size_t block0, size_t block1, float alpha,
+                              const float* b, size_t ldb, size_t n, float beta, float* c, size_t ldc);
+
+  // out[j] = alpha * acc[j] + beta * out[j], out not read when beta is 0
+  inline __attribute__((always_inline))
+  void store_sparse_row(const float* __restrict__ acc, size_t nb, float alpha, float beta, float* __restrict__ out)
+  {
+    if (beta == 0.0f) {
+#pragma omp simd
+      for (size_t j = 0; j < nb; j++) {
+        out[j] = alpha * acc[j];
+      }
+    } else {
+#pragma omp simd
+      for (size_t j = 0; j < nb; j++) {
+        out[j] = alpha * acc[j] + beta * out[j];
+      }
+    }
+  }
+
+  inline __attribute__((always_inline))
+  void spmm_csr_body(const CsrMatrix& a, size_t row0, size_t row1, float alpha,
+                     const float* __restrict__ b, size_t ldb, size_t n, float beta, float* __restrict__ c, size_t ldc)
+  {
+    const uint32_t* rowPtr = a.rowPtr.data();
+    const uint32_t* colIdx = a.colIdx.data();
+    const float* values = a.values.data();
+
+    for (size_t i = row0; i < row1; i++) {
+      const size_t begin = rowPtr[i];
+      const size_t end = rowPtr[i + 1];
+      for (size_t jc = 0; jc < n; jc += kSparseNB) {
+        const size_t nb = std::min(kSparseNB, n - jc);
+        alignas(64) float acc[kSparseNB] = {};
+        for (size_t p = begin; p < end; p++) {
+          if (p + kSparseAhead < end) {
+            __builtin_prefetch(b + colIdx[p + kSparseAhead] * ldb + jc);
+          }
+          const float v = values[p];
+          const float* __restrict__ brow = b + colIdx[p] * ldb + jc;
+#pragma omp simd aligned(acc : 64)
+          for (size_t j = 0; j < nb; j++) {
+            acc[j] += v * brow[j];
+          }
+        }
+        store_sparse_row(acc, nb, alpha, beta, c + i * ldc + jc);
+      }
+    }
+  }
+
+  // same for the block rows [block0, block1) of a BSR A: the blocks of a
+  // block row update blockRows accumulator rows, each row of B read once
+  // per block
+  inline __attribute__((always_inline))
+  void spmm_bsr_body(const BsrMatrix& a, size_t block0, size_t block1, float alpha,
+                     const float* __restrict__ b, size_t ldb, size_t n, float beta, float* __restrict__ c, size_t ldc)
+  {
+    constexpr size_t NB = kSparseNB / 2;
+    const size_t br = a.blockRows;
+    const size_t bc = a.blockCols;
+    const uint32_t* rowPtr = a.rowPtr.data();
+    const uint32_t* colIdx = a.colIdx.data();
+
+    for (size_t ib = block0; ib < block1; ib++) {
+      const size_t rows = std::min(br, a.rows - ib * br);
+      for (size_t jc = 0; jc < n; jc += NB) {
+        const size_t nb = std::min(NB, n - jc);
+        alignas(64) float acc[kSparseMaxBlock][NB] = {};
+        for (size_t blk = rowPtr[ib]; blk < rowPtr[ib + 1]; blk++) {
+          const size_t col0 = colIdx[blk] * bc;
+          const size_t cols = std::min(bc, a.cols - col0);
+          const float* block = a.values.data() + blk * br * bc;
+          for (size_t q = 0; q < cols; q++) {
+            const float* __restrict__ brow = b + (col0 + q) * ldb + jc;
+            for (size_t r = 0; r < rows; r++) {
+              const float v = block[r * bc + q];
+#pragma omp simd aligned(acc : 64)
+              for (size_t j = 0; j < nb; j++) {
+                acc[r][j] += v * brow[j];
+              }
+            }
+          }
+        }
+        for (size_t r = 0; r < rows; r++) {
+          store_sparse_row(acc[r], nb, alpha, beta, c + (ib * br + r) * ldc + jc);
+        }
+      }
+    }
+  }
+
+  // the same bodies compiled for each isa of select_kernel
+  void spmm_csr_generic(const CsrMatrix& a, size_t row0, size_t row1, float alpha,
+                        const float* b, size_t ldb, size_t n, float beta, float* c, size_t ldc)
+  {
+    spmm_csr_body(a, row0, row1, alpha, b, ldb, n, beta, c, ldc);
+  }
+
+  __attribute__((target("avx2,fma")))
+  void spmm_csr_avx2(const CsrMatrix& a, size_t row0, size_t row1, float alpha,
+                     const float* b, size_t ldb, size_t n, float beta, float* c, size_t ldc)
+  {
+    spmm_csr_body(a, row0, row1, alpha, b, ldb, n, beta, c, ldc);
+  }
+
+  __attribute__((target("avx512f")))
+  void spmm_csr_avx512(const CsrMatrix& a, size_t row0, size_t row1, float alpha,
+                       const float* b, size_t ldb, size_t n, float beta, float* c, size_t ldc)
+  {
+    spmm_csr_body(a, row0, row1, alpha, b, ldb, n, beta, c, ldc);
+  }
+
+  void spmm_bsr_generic(const BsrMatrix& a, size_t block0, size_t block1, float alpha,
+                        const float* b, size_t ldb, size_t n, float beta, float* c, size_t ldc)
+  {
+    spmm_bsr_body(a, block0, block1, alpha, b, ldb, n, beta, c, ldc);
+  }
+
+  __attribute__((target("avx2,fma")))
+  void spmm_bsr_avx2(const BsrMatrix& a, size_t block0, size_t block1, float alpha,
+                     const float* b, size_t ldb, size_t n, float beta, float* c, size_t ldc)
+  {
+    spmm_bsr_body(a, block0, block1, alpha, b, ldb, n, beta, c, ldc);
+  }
+
+  __attribute__((target("avx512f")))
+  void spmm_bsr_avx512(const BsrMatrix& a, size_t block0, size_t block1, float alpha,
+                       const float* b, size_t ldb, size_t n, float beta, float* c, size_t ldc)
+  {
+    spmm_bsr_body(a, block0, block1, alpha, b, ldb, n, beta, c, ldc);
+  }
+
+  template <typename Kernel>
+  Kernel select_sparse_kernel(Kernel generic, Kernel avx2, Kernel avx512)
+  {
+    const std::string isa = select_kernel().name;
+    return isa == "avx512" ? avx512 : isa == "avx2" ? avx2 : generic;
+  }
+
+  // rows (block rows) go to the threads by groups of grain, dynamically
+  // since their nonzeros vary
+  template <typename Matrix, typename Kernel>
+  void spmm_rows(Kernel kern, const Matrix& a, size_t count, size_t grain, float alpha,
+                 const float* b, size_t ldb, size_t n, float beta, float* c, size_t ldc)
+  {
+    const long long groups = static_cast<long long>((count + grain - 1) / grain);
+#pragma omp parallel for schedule(dynamic)
+    for (long long g = 0; g < groups; g++) {
+      const size_t first = static_cast<size_t>(g) * grain;
+      kern(a, first, std::min(count, first + grain), alpha, b, ldb, n, beta, c, ldc);
+    }
+  }
+
+}
+
+struct ComputeSession::Impl
+{
+  workspace ws;
+  // one workspace per thread for the batches
+  std::vector<workspace> pool;
+  ComputeTimings timings;
+
+  // asynchronous calls: no transfer to pipeline, they run on the worker
+  // thread with their own workspace (the worker is created on first use
+  // and destroyed first)
+  workspace asyncWs;
+  std::unique_ptr<AsyncWorker> worker;
+
+  // tuned kernel and blocking per shape class, decoded once
+  TuningTable tuningTable{cpu_name()};
+  std::map<std::string, tuning> tunings;
+
+  const tuning& tuning_for(const std::string& shape)
+  {
+    auto it = tunings.find(shape);
+    if (it == tunings.end()) {
+      TuneConfig config;
+      tuning t = tuningTable.find(shape, config) ? make_tuning(config) : default_tuning();
+      it = tunings.insert(std::make_pair(shape, t.kern ? t : default_tuning())).first;
+    }
+    return it->second;
+  }
+
+  AsyncWorker& async_worker()
+  {
+    if (!worker) {
+      worker.reset(new AsyncWorker);
+    }
+    return *worker;
+  }
+};
+
+ComputeSession::ComputeSession()
+{
+  COMPUTE_TRACE_SCOPE("setup", "session", 0, 0);
+  _impl.reset(new Impl);
+  static bool once = (std::cout << "using native cpu (" << select_kernel().name
+                                << ", int8 " << select_int8_kernel().name
+                                << ", bf16 " << (select_bf16_kernel() ? select_bf16_kernel()->name : "widened")
+                                << ")" << std::endl, true);
+  (void)once;
+}
+
+ComputeSession::~ComputeSession()
+{
+  COMPUTE_TRACE_SCOPE("teardown", "session", 0, 0);
+  _impl.reset();
+}
+
+const char* ComputeSession::backend() const
+{
+  return "cpu";
+}
+
+bool ComputeSession::has_external_lib() const
+{
+#ifdef COMPUTE_HAS_CBLAS
+  return true;
+#else
+  return false;
+#endif
+}
+
+const ComputeTimings& ComputeSession::last_timings() const
+{
+  return _impl->timings;
+}
+
+// no transfer phase, the operands are used in place
+void ComputeSession::compute_with_acc_wrapper(float* a, float* b, float* c, size_t count)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  {
+    PhaseTimer timer(s.timings.setup);
+    COMPUTE_TRACE_SCOPE("alloc", "workspace", 0, 0);
+    reserve(s.ws, count, count);
+  }
+
+  // a*b + a*b, the doubling is fused in the store
+  Epilogue twice;
+  twice.scale = 2.0f;
+
+  PhaseTimer timer(s.timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "sgemm", 0, 2.0 * count * count * count);
+  packed_gemm(s.ws, Transpose::No, Transpose::No, count, count, count, 1.0f, a, count, b, count, 0.0f, c, count, twice);
+}
+
+void ComputeSession::sgemm(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                           float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                           float beta, float* c, size_t ldc, const Epilogue& epilogue)
+{
+  Impl& s = *_impl;
+  const std::string shape = shape_class(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k);
+  TuneConfig config;
+  if (autotune_on_miss() && !s.tuningTable.find(shape, config)) {
+    autotune(transA, transB, m, n, k);
+  }
+
+  s.timings = {};
+  {
+    PhaseTimer timer(s.timings.setup);
+    COMPUTE_TRACE_SCOPE("alloc", "workspace", 0, 0);
+    s.ws.tune = s.tuning_for(shape);
+    reserve(s.ws, m, n);
+  }
+
+  PhaseTimer timer(s.timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "sgemm", 0, 2.0 * m * n * k);
+  packed_gemm(s.ws, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, epilogue);
+}
+
+// the candidates run on copies of the class shape (capped at 1024) with
+// their own workspace
+TuneResult ComputeSession::autotune(Transpose transA, Transpose transB, size_t m, size_t n, size_t k)
+{
+  Impl& s = *_impl;
+  COMPUTE_TRACE_SCOPE("setup", "autotune", 0, 0);
+  const size_t tm = tuning_extent(m);
+  const size_t tn = tuning_extent(n);
+  const size_t tk = tuning_extent(k);
+  std::vector<float> a(tm * tk, 1.0f);
+  std::vector<float> b(tk * tn, 1.0f);
+  std::vector<float> c(tm * tn);
+
+  workspace ws;
+  const TuneResult best = pick_fastest(tuning_candidates(), 2.0 * tm * tn * tk, [&](const TuneConfig& config) {
+    ws.tune = make_tuning(config);
+    if (!ws.tune.kern) {
+      return false;
+    }
+    packed_gemm(ws, transA, transB, tm, tn, tk, 1.0f, a.data(), transA == Transpose::No ? tk : tm,
+                b.data(), transB == Transpose::No ? tn : tk, 0.0f, c.data(), tn, no_epilogue{});
+    return true;
+  });
+
+  if (best.gflops > 0.0) {
+    const std::string shape = shape_class(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k);
+    s.tuningTable.store(shape, best);
+    s.tunings.erase(shape);
+  }
+  return best;
+}
+
+TuneConfig ComputeSession::tuned_config(Transpose transA, Transpose transB, size_t m, size_t n, size_t k)
+{
+  TuneConfig config;
+  _impl->tuningTable.find(shape_class(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k), config);
+  return config;
+}
+
+void ComputeSession::sgemm_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                   float alpha, const float* const* a, size_t lda, const float* const* b, size_t ldb,
+                                   float beta, float* const* c, size_t ldc, size_t batch)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  PhaseTimer timer(s.timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "sgemm batched", 0, 2.0 * m * n * k * batch);
+  gemm_batched(s.ws, s.pool, transA, transB, m, n, k, alpha, lda, ldb, beta, ldc, batch,
+               [&](size_t i) { return batch_item{a[i], b[i], c[i]}; });
+}
+
+void ComputeSession::sgemm_strided_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const float* a, size_t lda, size_t strideA,
+                                           const float* b, size_t ldb, size_t strideB,
+                                           float beta, float* c, size_t ldc, size_t strideC, size_t batch)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  PhaseTimer timer(s.timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "sgemm batched", 0, 2.0 * m * n * k * batch);
+  gemm_batched(s.ws, s.pool, transA, transB, m, n, k, alpha, lda, ldb, beta, ldc, batch,
+               [&](size_t i) { return batch_item{a + i * strideA, b + i * strideB, c + i * strideC}; });
+}
+
+std::future<ComputeTimings> ComputeSession::sgemm_async(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                                        float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                                        float beta, float* c, size_t ldc)
+{
+  Impl& s = *_impl;
+  return s.async_worker().submit([=, &s]() {
+    ComputeTimings timings;
+    {
+      PhaseTimer timer(timings.compute);
+      COMPUTE_TRACE_SCOPE("kernel", "sgemm async", 0, 2.0 * m * n * k);
+      packed_gemm(s.asyncWs, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, no_epilogue{});
+    }
+    return timings;
+  });
+}
+
+// the cores are the only device, sgemm already uses all of them
+void ComputeSession::sgemm_split(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                 float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                 float beta, float* c, size_t ldc)
+{
+  sgemm(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+}
+
+// rows of C by groups of 16 (4 block rows), no workspace
+void ComputeSession::spmm(float alpha, const CsrMatrix& a, const float* b, size_t ldb, size_t n,
+                          float beta, float* c, size_t ldc)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  if (a.rows == 0 || n == 0) {
+    return;
+  }
+
+  PhaseTimer timer(s.timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "spmm csr", 0, 2.0 * a.nnz() * n);
+  static const spmm_csr_t kern = select_sparse_kernel<spmm_csr_t>(&spmm_csr_generic, &spmm_csr_avx2, &spmm_csr_avx512);
+  spmm_rows(kern, a, a.rows, 16, alpha, b, ldb, n, beta, c, ldc);
+}
+
+void ComputeSession::spmm(float alpha, const BsrMatrix& a, const float* b, size_t ldb, size_t n,
+                          float beta, float* c, size_t ldc)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  if (a.rows == 0 || n == 0) {
+    return;
+  }
+
+  PhaseTimer timer(s.timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "spmm bsr", 0, 2.0 * a.values.size() * n);
+  static const spmm_bsr_t kern = select_sparse_kernel<spmm_bsr_t>(&spmm_bsr_generic, &spmm_bsr_avx2, &spmm_bsr_avx512);
+  spmm_rows(kern, a, a.block_rows(), 4, alpha, b, ldb, n, beta, c, ldc);
+}
+
+template <>
+void ComputeSession::gemm<float, float>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                        float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                        float beta, float* c, size_t ldc, const Scales& scales)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  {
+    PhaseTimer timer(s.timings.setup);
+    COMPUTE_TRACE_SCOPE("alloc", "workspace", 0, 0);
+    reserve(s.ws, m, n);
+  }
+
+  PhaseTimer timer(s.timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "gemm float", 0, 2.0 * m * n * k);
+  packed_gemm(s.ws, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, no_epilogue{}, true, scales);
+}
+
+template <>
+void ComputeSession::gemm<BFloat16, float>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const BFloat16* a, size_t lda, const BFloat16* b, size_t ldb,
+                                           float beta, float* c, size_t ldc, const Scales& scales)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  PhaseTimer timer(s.timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "gemm bf16", 0, 2.0 * m * n * k);
+  if (const pair_kernel_desc* kern = select_bf16_kernel()) {
+    pairs_gemm(s.ws, *kern, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
+  } else {
+    packed_gemm(s.ws, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, no_epilogue{}, true, scales);
+  }
+}
+
+template <>
+void ComputeSession::gemm<int8_t, int32_t>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const int8_t* a, size_t lda, const int8_t* b, size_t ldb,
+                                           float beta, float* c, size_t ldc, const Scales& scales)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  PhaseTimer timer(s.timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "gemm int8", 0, 2.0 * m * n * k);
+  pairs_gemm(s.ws, select_int8_kernel(), transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
+}
+
+void ComputeSession::test_mul_from_external_lib(float* a, float* b, float* c, size_t count)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+#ifdef COMPUTE_HAS_CBLAS
+  // a*b + a*b through alpha
+  PhaseTimer timer(s.timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "cblas_sgemm", 0, 2.0 * count * count * count);
+  const int n = static_cast<int>(count);
+  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, n, n, n, 2.0f, a, n, b, n, 0.0f, c, n);
+#else
+  std::cout << "no external blas, using native cpu" << std::endl;
+  compute_with_acc_wrapper(a, b, c, count);
+#endif
+}
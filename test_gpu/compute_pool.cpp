@@ -0,0 +1,181 @@
+#include "compute.h"
+#include "compute_pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <system_error>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Host threads of the backends without OpenMP (wasm, parallel_chunks of the
+// device backends)
+
+namespace
+{
+  // set for the workers, and for the caller while it runs its tasks
+  thread_local bool insidePool = false;
+
+  size_t default_threads()
+  {
+    if (const char* forced = std::getenv("COMPUTE_THREADS")) {
+      const long value = std::atol(forced);
+      if (value > 0) {
+        return static_cast<size_t>(value);
+      }
+      std::cerr << "ignoring COMPUTE_THREADS=" << forced << ", expected a positive count" << std::endl;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+}
+
+WorkerPool::WorkerPool(size_t threads)
+{
+  start(threads);
+}
+
+WorkerPool::~WorkerPool()
+{
+  stop();
+}
+
+WorkerPool& WorkerPool::instance()
+{
+  static WorkerPool pool(default_threads());
+  return pool;
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)>& task)
+{
+  std::unique_lock<std::mutex> call(_call, std::defer_lock);
+  if (count < 2 || insidePool || !call.try_lock() || _workers.empty()) {
+    for (size_t i = 0; i < count; i++) {
+      task(i);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _task = &task;
+    _count = count;
+    _next = 0;
+    _running = _workers.size();
+    _generation++;
+  }
+  _wake.notify_all();
+
+  insidePool = true;
+  drain();
+  insidePool = false;
+
+  // the workers still read the call until they are all back
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this] { return _running == 0; });
+    _task = nullptr;
+    std::swap(error, _error);
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void WorkerPool::resize(size_t threads)
+{
+  std::lock_guard<std::mutex> call(_call);
+  stop();
+  start(threads);
+}
+
+void WorkerPool::start(size_t threads)
+{
+  for (size_t id = 1; id < threads; id++) {
+    try {
+      // no call runs while the pool starts, the worker waits for the next one
+      _workers.emplace_back([this, seen = _generation] { work(seen); });
+    } catch (const std::system_error& e) {
+      std::cerr << "compute pool limited to " << id << " threads: " << e.what() << std::endl;
+      break;
+    }
+  }
+}
+
+void WorkerPool::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _done = true;
+  }
+  _wake.notify_all();
+  for (auto& worker : _workers) {
+    worker.join();
+  }
+  _workers.clear();
+  _done = false;
+}
+
+void WorkerPool::work(size_t seen)
+{
+  insidePool = true;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _wake.wait(lock, [&] { return _done || _generation != seen; });
+      if (_done) {
+        return;
+      }
+      seen = _generation;
+    }
+    drain();
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (--_running == 0) {
+        _idle.notify_one();
+      }
+    }
+  }
+}
+
+void WorkerPool::drain()
+{
+  for (;;) {
+    const size_t i = _next.fetch_add(1);
+    if (i >= _count) {
+      return;
+    }
+    try {
+      (*_task)(i);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (!_error) {
+        _error = std::current_exception();
+      }
+      _next = _count;
+    }
+  }
+}
+
+size_t compute_threads()
+{
+#ifdef _OPENMP
+  return static_cast<size_t>(omp_get_max_threads());
+#else
+  return WorkerPool::instance().threads();
+#endif
+}
+
+void set_compute_threads(size_t threads)
+{
+  if (threads == 0) {
+    threads = default_threads();
+  }
+#ifdef _OPENMP
+  omp_set_num_threads(static_cast<int>(threads));
+#else
+  WorkerPool::instance().resize(threads);
+#endif
+}
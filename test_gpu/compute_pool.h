@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///
+/// @brief Persistent threads sharing the tiles of a call with the caller
+///
+/// The workers are started once and wait between the calls, a call wakes
+/// them instead of creating threads: with Emscripten pthreads a thread is a
+/// web worker, far too slow to start per call. run() hands out the tasks
+/// one at a time from a shared counter, so that uneven tiles balance
+/// across the workers. Calls from a worker, or made while another call
+/// runs, are run inline by their thread.
+///
+class WorkerPool
+{
+public:
+  /// threads - 1 workers, the caller is the last thread
+  explicit WorkerPool(size_t threads);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  /// task(i) for each i < count, returns once they are all done. The
+  /// first exception thrown by a task is rethrown, the tasks not started
+  /// yet are skipped.
+  void run(size_t count, const std::function<void(size_t)>& task);
+
+  /// workers plus the caller
+  size_t threads() const { return _workers.size() + 1; }
+  /// stops the workers and starts threads - 1 new ones
+  void resize(size_t threads);
+
+  /// process wide pool of compute_threads() threads
+  static WorkerPool& instance();
+
+private:
+  void start(size_t threads);
+  void stop();
+  // seen: the generation of the last call before the worker started
+  void work(size_t seen);
+  // tasks of the current call until the counter is past the end
+  void drain();
+
+  // one call at a time, the others run inline
+  std::mutex _call;
+
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _idle;
+  // incremented by each call, the workers wait for a new one
+  size_t _generation{0};
+  size_t _running{0};
+  bool _done{false};
+
+  // current call
+  const std::function<void(size_t)>* _task{nullptr};
+  size_t _count{0};
+  std::atomic<size_t> _next{0};
+  std::exception_ptr _error;
+
+  std::vector<std::thread> _workers;
+};
@@ -0,0 +1,187 @@
+#include "compute.h"
+#include "compute_trace.h"
+#include "matrix.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Sparse formats and the choice between spmm and sgemm, backend independent
+// (the spmm kernels live with each backend)
+
+namespace
+{
+  // offsets[i + 1] = count[i] summed, offsets[0] = 0
+  void prefix_sum(std::vector<uint32_t>& offsets)
+  {
+    uint32_t sum = 0;
+    for (uint32_t& offset : offsets) {
+      const uint32_t count = offset;
+      offset = sum;
+      sum += count;
+    }
+  }
+
+  // density of A below which spmm wins, measured with bench sparse/* on
+  // the backend (see README)
+  double default_crossover(const std::string& backend)
+  {
+    // wasm: host kernels as well, not measured under a wasm engine yet
+    if (backend == "cpu" || backend == "wasm") {
+      return 0.15;
+    }
+    // the device kernels read B from global memory once per nonzero, they
+    // lose against the tiled sgemm sooner
+    return 0.05;
+  }
+}
+
+CsrMatrix CsrMatrix::from_dense(size_t rows, size_t cols, const float* a, size_t lda)
+{
+  COMPUTE_TRACE_SCOPE("convert", "dense to csr", sizeof(float) * rows * cols, 0);
+  CsrMatrix csr;
+  csr.rows = rows;
+  csr.cols = cols;
+  // nonzeros per row first, then each row is filled at its offset
+  csr.rowPtr.assign(rows + 1, 0);
+  parallel_chunks(rows, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      const float* row = a + i * lda;
+      csr.rowPtr[i] = static_cast<uint32_t>(std::count_if(row, row + cols, [](float x) { return x != 0.0f; }));
+    }
+  });
+  prefix_sum(csr.rowPtr);
+
+  csr.colIdx.resize(csr.rowPtr[rows]);
+  csr.values.resize(csr.rowPtr[rows]);
+  parallel_chunks(rows, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      const float* row = a + i * lda;
+      size_t p = csr.rowPtr[i];
+      for (size_t j = 0; j < cols; j++) {
+        if (row[j] != 0.0f) {
+          csr.colIdx[p] = static_cast<uint32_t>(j);
+          csr.values[p] = row[j];
+          p++;
+        }
+      }
+    }
+  });
+  return csr;
+}
+
+BsrMatrix BsrMatrix::from_dense(size_t rows, size_t cols, const float* a, size_t lda,
+                                size_t blockRows, size_t blockCols)
+{
+  COMPUTE_TRACE_SCOPE("convert", "dense to bsr", sizeof(float) * rows * cols, 0);
+  BsrMatrix bsr;
+  bsr.rows = rows;
+  bsr.cols = cols;
+  bsr.blockRows = std::min<size_t>(std::max<size_t>(blockRows, 1), 16);
+  bsr.blockCols = std::max<size_t>(blockCols, 1);
+  const size_t br = bsr.blockRows;
+  const size_t bc = bsr.blockCols;
+  const size_t blockRowsCount = bsr.block_rows();
+  const size_t blockColsCount = (cols + bc - 1) / bc;
+
+  // whether block (i, j) has a nonzero
+  auto nonzero = [&](size_t i, size_t j) {
+    const size_t rowEnd = std::min(rows, (i + 1) * br);
+    const size_t colEnd = std::min(cols, (j + 1) * bc);
+    for (size_t r = i * br; r < rowEnd; r++) {
+      const float* row = a + r * lda;
+      for (size_t q = j * bc; q < colEnd; q++) {
+        if (row[q] != 0.0f) {
+          return true;
+        }
+      }
+    }
+    return false;
+  };
+
+  bsr.rowPtr.assign(blockRowsCount + 1, 0);
+  parallel_chunks(blockRowsCount, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      uint32_t count = 0;
+      for (size_t j = 0; j < blockColsCount; j++) {
+        count += nonzero(i, j) ? 1 : 0;
+      }
+      bsr.rowPtr[i] = count;
+    }
+  });
+  prefix_sum(bsr.rowPtr);
+
+  bsr.colIdx.resize(bsr.rowPtr[blockRowsCount]);
+  bsr.values.assign(bsr.colIdx.size() * br * bc, 0.0f);
+  parallel_chunks(blockRowsCount, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      size_t b = bsr.rowPtr[i];
+      const size_t rowEnd = std::min(rows, (i + 1) * br);
+      for (size_t j = 0; j < blockColsCount; j++) {
+        if (!nonzero(i, j)) {
+          continue;
+        }
+        bsr.colIdx[b] = static_cast<uint32_t>(j);
+        float* block = bsr.values.data() + b * br * bc;
+        const size_t width = std::min(cols, (j + 1) * bc) - j * bc;
+        for (size_t r = i * br; r < rowEnd; r++) {
+          std::memcpy(block + (r - i * br) * bc, a + r * lda + j * bc, width * sizeof(float));
+        }
+        b++;
+      }
+    }
+  });
+  return bsr;
+}
+
+double sparse_crossover(const ComputeSession& session)
+{
+  if (const char* forced = std::getenv("COMPUTE_SPARSE_CROSSOVER")) {
+    const double value = std::atof(forced);
+    if (value >= 0.0 && value <= 1.0) {
+      return value;
+    }
+    std::cerr << "ignoring COMPUTE_SPARSE_CROSSOVER=" << forced << ", expected a density in [0, 1]" << std::endl;
+  }
+  return default_crossover(session.backend());
+}
+
+void sgemm_auto(ComputeSession& session, size_t m, size_t n, size_t k,
+                float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                float beta, float* c, size_t ldc)
+{
+  if (m == 0 || n == 0 || k == 0) {
+    session.sgemm(Transpose::No, Transpose::No, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+    return;
+  }
+
+  std::atomic<size_t> nonzeros{0};
+  {
+    COMPUTE_TRACE_SCOPE("convert", "density", sizeof(float) * m * k, 0);
+    parallel_chunks(m, [&](size_t begin, size_t end) {
+      size_t count = 0;
+      for (size_t i = begin; i < end; i++) {
+        const float* row = a + i * lda;
+        count += static_cast<size_t>(std::count_if(row, row + k, [](float x) { return x != 0.0f; }));
+      }
+      nonzeros += count;
+    });
+  }
+
+  const double density = static_cast<double>(nonzeros) / m / k;
+  if (density >= sparse_crossover(session)) {
+    session.sgemm(Transpose::No, Transpose::No, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+    return;
+  }
+  session.spmm(alpha, CsrMatrix::from_dense(m, k, a, lda), b, ldb, n, beta, c, ldc);
+}
+
+void sgemm_auto(size_t m, size_t n, size_t k, float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                float beta, float* c, size_t ldc)
+{
+  sgemm_auto(default_session(), m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "compute_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+///
+/// @brief Row panels of C shared between heterogeneous workers
+///
+/// The rows are cut in panels and each worker first gets a contiguous run
+/// of them in proportion to its throughput (rows per second measured by the
+/// previous calls, the average of the others when unknown). A worker takes its own
+/// panels from the front of its run, then steals from the back of the run
+/// with the most panels left, so that a slow or overestimated device does
+/// not hold up the call.
+///
+class PanelScheduler
+{
+public:
+  PanelScheduler(size_t rows, size_t panel, const std::vector<double>& rates)
+    : _rows(rows), _panel(panel), _runs(rates.size())
+  {
+    const size_t panels = (rows + panel - 1) / panel;
+    // a worker not measured yet counts as the average of the others
+    double known = 0.0;
+    size_t measured = 0;
+    for (double rate : rates) {
+      if (rate > 0.0) {
+        known += rate;
+        measured++;
+      }
+    }
+    const double unknown = measured > 0 ? known / static_cast<double>(measured) : 1.0;
+    const double total = known + unknown * static_cast<double>(rates.size() - measured);
+
+    size_t begin = 0;
+    double share = 0.0;
+    for (size_t w = 0; w < rates.size(); w++) {
+      share += (rates[w] > 0.0 ? rates[w] : unknown) / total;
+      const size_t end = w + 1 == rates.size() ? panels : std::min(panels, static_cast<size_t>(share * panels + 0.5));
+      _runs[w] = {begin, std::max(begin, end)};
+      begin = std::max(begin, end);
+    }
+  }
+
+  /// next panel of worker w, false once every panel is taken
+  bool next(size_t w, size_t& row0, size_t& rows)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    size_t index;
+    if (_runs[w].begin < _runs[w].end) {
+      index = _runs[w].begin++;
+    } else {
+      Run* victim = nullptr;
+      for (Run& run : _runs) {
+        if (run.end > run.begin && (!victim || run.end - run.begin > victim->end - victim->begin)) {
+          victim = &run;
+        }
+      }
+      if (!victim) {
+        return false;
+      }
+      index = --victim->end;
+    }
+    row0 = index * _panel;
+    rows = std::min(_panel, _rows - row0);
+    return true;
+  }
+
+private:
+  struct Run
+  {
+    size_t begin;
+    size_t end;
+  };
+
+  size_t _rows;
+  size_t _panel;
+  std::mutex _mutex;
+  std::vector<Run> _runs;
+};
+
+/// Runs worker w = 0..rates.size() - 1 as a task of the pool (persistent
+/// threads, one per worker for the workers to run together):
+/// - prepare(w) once (uploads shared by the panels of a device)
+/// - compute(w, row0, rows) on each panel it gets from the scheduler
+/// The rates are then updated with the throughput of each worker (rows per
+/// second of busy time, averaged with the previous calls). Returns the rows
+/// computed by each worker. The first exception thrown by a worker is
+/// rethrown once they are all back, its panels left to the others.
+inline std::vector<size_t> run_split(WorkerPool& pool, size_t rows, size_t panel, std::vector<double>& rates,
+                                     const std::function<void(size_t w)>& prepare,
+                                     const std::function<void(size_t w, size_t row0, size_t rows)>& compute)
+{
+  PanelScheduler scheduler(rows, panel, rates);
+  std::vector<size_t> done(rates.size(), 0);
+  std::vector<double> busy(rates.size(), 0.0);
+
+  auto work = [&](size_t w) {
+    const auto begin = std::chrono::steady_clock::now();
+    prepare(w);
+    size_t row0 = 0;
+    size_t count = 0;
+    while (scheduler.next(w, row0, count)) {
+      compute(w, row0, count);
+      done[w] += count;
+    }
+    busy[w] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  };
+
+  pool.run(rates.size(), work);
+
+  for (size_t w = 0; w < rates.size(); w++) {
+    if (done[w] > 0 && busy[w] > 0.0) {
+      const double rate = static_cast<double>(done[w]) / busy[w];
+      rates[w] = rates[w] > 0.0 ? 0.5 * (rates[w] + rate) : rate;
+    }
+  }
+  return done;
+}
@@ -0,0 +1,391 @@
+#include "compute_strassen.h"
+#include "compute_trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+// Strassen-Winograd recursion over the sgemm of any backend
+
+namespace
+{
+  const size_t kDefaultCutoff = 1024;
+
+  // floats rounded up to a cache line, every block of the arena is aligned
+  size_t block(size_t rows, size_t cols)
+  {
+    return (rows * cols + 15) / 16 * 16;
+  }
+
+  bool is_base(size_t m, size_t n, size_t k, size_t cutoff)
+  {
+    return m <= cutoff || n <= cutoff || k <= cutoff;
+  }
+
+  // arena of the serial recursion: X (mh x max(kh, nh)) and Y (kh x nh)
+  // per level
+  size_t serial_floats(size_t m, size_t n, size_t k, size_t cutoff)
+  {
+    if (is_base(m, n, k, cutoff)) {
+      return 0;
+    }
+    const size_t mh = m / 2, nh = n / 2, kh = k / 2;
+    return block(mh, std::max(kh, nh)) + block(kh, nh) + serial_floats(mh, nh, kh, cutoff);
+  }
+
+  // first level with concurrent products: S1..S4, T1..T4, P1, P6, P7 and a
+  // serial arena per worker
+  size_t top_floats(size_t m, size_t n, size_t k, size_t cutoff, size_t workers)
+  {
+    if (workers < 2 || is_base(m, n, k, cutoff)) {
+      return serial_floats(m, n, k, cutoff);
+    }
+    const size_t mh = m / 2, nh = n / 2, kh = k / 2;
+    return 4 * block(mh, kh) + 4 * block(kh, nh) + 3 * block(mh, nh) + workers * serial_floats(mh, nh, kh, cutoff);
+  }
+
+  // out = x + scale * y on rows x cols, out may be x or y
+  void add(size_t rows, size_t cols, const float* x, size_t ldx, const float* y, size_t ldy, float scale,
+           float* out, size_t ldo)
+  {
+    COMPUTE_TRACE_SCOPE("kernel", "strassen add", 3.0 * sizeof(float) * rows * cols, 2.0 * rows * cols);
+    parallel_chunks(rows, [=](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        const float* xr = x + i * ldx;
+        const float* yr = y + i * ldy;
+        float* o = out + i * ldo;
+        for (size_t j = 0; j < cols; j++) {
+          o[j] = xr[j] + scale * yr[j];
+        }
+      }
+    });
+  }
+
+  // quadrants of a matrix cut after h rows and w columns
+  struct Quadrants
+  {
+    Quadrants(const float* p, size_t ld, size_t h, size_t w)
+      : q11(p), q12(p + w), q21(p + h * ld), q22(p + h * ld + w)
+    {
+    }
+
+    const float* q11;
+    const float* q12;
+    const float* q21;
+    const float* q22;
+  };
+
+  // the last depth, column and row of odd dimensions, left out of the
+  // quadrants: C = alpha * A * B on them with sgemm
+  void peel(ComputeSession& session, size_t m, size_t n, size_t k, float alpha,
+            const float* a, size_t lda, const float* b, size_t ldb, float* c, size_t ldc)
+  {
+    const size_t me = m & ~size_t{1}, ne = n & ~size_t{1}, ke = k & ~size_t{1};
+    if (k != ke) {
+      session.sgemm(Transpose::No, Transpose::No, me, ne, 1, alpha, a + ke, lda, b + ke * ldb, ldb, 1.0f, c, ldc);
+    }
+    if (n != ne) {
+      session.sgemm(Transpose::No, Transpose::No, m, 1, k, alpha, a, lda, b + ne, ldb, 0.0f, c + ne, ldc);
+    }
+    if (m != me) {
+      session.sgemm(Transpose::No, Transpose::No, 1, ne, k, alpha, a + me * lda, lda, b, ldb, 0.0f, c + me * ldc, ldc);
+    }
+  }
+
+  // C = alpha * A * B, one product after the other with two temporaries:
+  // the schedule of Boyer, Dumas, Pernet and Zhou (Memory efficient
+  // scheduling of Strassen-Winograd's matrix multiplication algorithm,
+  // ISSAC 2009), the products are written in the quadrants of C
+  void winograd(ComputeSession& session, size_t cutoff, size_t m, size_t n, size_t k, float alpha,
+                const float* a, size_t lda, const float* b, size_t ldb, float* c, size_t ldc, float* ws)
+  {
+    if (is_base(m, n, k, cutoff)) {
+      session.sgemm(Transpose::No, Transpose::No, m, n, k, alpha, a, lda, b, ldb, 0.0f, c, ldc);
+      return;
+    }
+    const size_t mh = m / 2, nh = n / 2, kh = k / 2;
+    const Quadrants qa(a, lda, mh, kh);
+    const Quadrants qb(b, ldb, kh, nh);
+    float* c11 = c;
+    float* c12 = c + nh;
+    float* c21 = c + mh * ldc;
+    float* c22 = c + mh * ldc + nh;
+
+    const size_t ldx = std::max(kh, nh);
+    float* x = ws;
+    float* y = x + block(mh, ldx);
+    float* child = y + block(kh, nh);
+    auto product = [&](const float* p, size_t ldp, const float* q, size_t ldq, float* out) {
+      winograd(session, cutoff, mh, nh, kh, alpha, p, ldp, q, ldq, out, out == x ? ldx : ldc, child);
+    };
+
+    add(mh, kh, qa.q11, lda, qa.q21, lda, -1.0f, x, ldx);  // S3 = A11 - A21
+    add(kh, nh, qb.q22, ldb, qb.q12, ldb, -1.0f, y, nh);   // T3 = B22 - B12
+    product(x, ldx, y, nh, c21);                           // P7 = S3 T3
+    add(mh, kh, qa.q21, lda, qa.q22, lda, 1.0f, x, ldx);   // S1 = A21 + A22
+    add(kh, nh, qb.q12, ldb, qb.q11, ldb, -1.0f, y, nh);   // T1 = B12 - B11
+    product(x, ldx, y, nh, c22);                           // P5 = S1 T1
+    add(mh, kh, x, ldx, qa.q11, lda, -1.0f, x, ldx);       // S2 = S1 - A11
+    add(kh, nh, qb.q22, ldb, y, nh, -1.0f, y, nh);         // T2 = B22 - T1
+    product(x, ldx, y, nh, c12);                           // P6 = S2 T2
+    add(mh, kh, qa.q12, lda, x, ldx, -1.0f, x, ldx);       // S4 = A12 - S2
+    product(x, ldx, qb.q22, ldb, c11);                     // P3 = S4 B22
+    product(qa.q11, lda, qb.q11, ldb, x);                  // P1 = A11 B11
+    add(mh, nh, x, ldx, c12, ldc, 1.0f, c12, ldc);         // U2 = P1 + P6
+    add(mh, nh, c12, ldc, c21, ldc, 1.0f, c21, ldc);       // U3 = U2 + P7
+    add(mh, nh, c12, ldc, c22, ldc, 1.0f, c12, ldc);       // U4 = U2 + P5
+    add(mh, nh, c21, ldc, c22, ldc, 1.0f, c22, ldc);       // C22 = U3 + P5
+    add(mh, nh, c12, ldc, c11, ldc, 1.0f, c12, ldc);       // C12 = U4 + P3
+    add(kh, nh, y, nh, qb.q21, ldb, -1.0f, y, nh);         // T4 = T2 - B21
+    product(qa.q22, lda, y, nh, c11);                      // P4 = A22 T4
+    add(mh, nh, c21, ldc, c11, ldc, -1.0f, c21, ldc);      // C21 = U3 - P4
+    product(qa.q12, lda, qb.q21, ldb, c11);                // P2 = A12 B21
+    add(mh, nh, x, ldx, c11, ldc, 1.0f, c11, ldc);         // C11 = P1 + P2
+
+    peel(session, m, n, k, alpha, a, lda, b, ldb, c, ldc);
+  }
+
+  // first level with the 7 products spread over the sessions, each worker
+  // recursing serially in its own part of the arena
+  void winograd_parallel(const std::vector<ComputeSession*>& sessions, size_t cutoff, size_t m, size_t n, size_t k,
+                         float alpha, const float* a, size_t lda, const float* b, size_t ldb, float* c, size_t ldc,
+                         float* ws)
+  {
+    const size_t mh = m / 2, nh = n / 2, kh = k / 2;
+    const Quadrants qa(a, lda, mh, kh);
+    const Quadrants qb(b, ldb, kh, nh);
+    float* c11 = c;
+    float* c12 = c + nh;
+    float* c21 = c + mh * ldc;
+    float* c22 = c + mh * ldc + nh;
+
+    float* s[4];
+    float* t[4];
+    for (size_t i = 0; i < 4; i++) {
+      s[i] = ws;
+      ws += block(mh, kh);
+    }
+    for (size_t i = 0; i < 4; i++) {
+      t[i] = ws;
+      ws += block(kh, nh);
+    }
+    float* p1 = ws;
+    float* p6 = p1 + block(mh, nh);
+    float* p7 = p6 + block(mh, nh);
+    float* children = p7 + block(mh, nh);
+    const size_t childFloats = serial_floats(mh, nh, kh, cutoff);
+
+    add(mh, kh, qa.q21, lda, qa.q22, lda, 1.0f, s[0], kh);  // S1 = A21 + A22
+    add(mh, kh, s[0], kh, qa.q11, lda, -1.0f, s[1], kh);    // S2 = S1 - A11
+    add(mh, kh, qa.q11, lda, qa.q21, lda, -1.0f, s[2], kh); // S3 = A11 - A21
+    add(mh, kh, qa.q12, lda, s[1], kh, -1.0f, s[3], kh);    // S4 = A12 - S2
+    add(kh, nh, qb.q12, ldb, qb.q11, ldb, -1.0f, t[0], nh); // T1 = B12 - B11
+    add(kh, nh, qb.q22, ldb, t[0], nh, -1.0f, t[1], nh);    // T2 = B22 - T1
+    add(kh, nh, qb.q22, ldb, qb.q12, ldb, -1.0f, t[2], nh); // T3 = B22 - B12
+    add(kh, nh, t[1], nh, qb.q21, ldb, -1.0f, t[3], nh);    // T4 = T2 - B21
+
+    struct Product
+    {
+      const float* p;
+      size_t ldp;
+      const float* q;
+      size_t ldq;
+      float* out;
+      size_t ldo;
+    };
+    const Product products[7] = {
+      {qa.q11, lda, qb.q11, ldb, p1, nh},    // P1 = A11 B11
+      {qa.q12, lda, qb.q21, ldb, c11, ldc},  // P2 = A12 B21
+      {s[3], kh, qb.q22, ldb, c12, ldc},     // P3 = S4 B22
+      {qa.q22, lda, t[3], nh, c21, ldc},     // P4 = A22 T4
+      {s[0], kh, t[0], nh, c22, ldc},        // P5 = S1 T1
+      {s[1], kh, t[1], nh, p6, nh},          // P6 = S2 T2
+      {s[2], kh, t[2], nh, p7, nh},          // P7 = S3 T3
+    };
+
+    std::atomic<size_t> next{0};
+    auto work = [&](size_t w) {
+      for (size_t i = next++; i < 7; i = next++) {
+        const Product& p = products[i];
+        winograd(*sessions[w], cutoff, mh, nh, kh, alpha, p.p, p.ldp, p.q, p.ldq, p.out, p.ldo,
+                 children + w * childFloats);
+      }
+    };
+    std::vector<std::thread> threads;
+    for (size_t w = 1; w < sessions.size(); w++) {
+      threads.emplace_back(work, w);
+    }
+    work(0);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    add(mh, nh, p1, nh, p6, nh, 1.0f, p6, nh);          // U2 = P1 + P6
+    add(mh, nh, p6, nh, p7, nh, 1.0f, p7, nh);          // U3 = U2 + P7
+    add(mh, nh, c12, ldc, p6, nh, 1.0f, c12, ldc);      // P3 + U2
+    add(mh, nh, c12, ldc, c22, ldc, 1.0f, c12, ldc);    // C12 = P3 + U2 + P5
+    add(mh, nh, p7, nh, c22, ldc, 1.0f, c22, ldc);      // C22 = U3 + P5
+    add(mh, nh, p7, nh, c21, ldc, -1.0f, c21, ldc);     // C21 = U3 - P4
+    add(mh, nh, p1, nh, c11, ldc, 1.0f, c11, ldc);      // C11 = P1 + P2
+
+    peel(*sessions[0], m, n, k, alpha, a, lda, b, ldb, c, ldc);
+  }
+
+  // error bound of the recursion for C = alpha * A * B, in units of
+  // 2^-24 |alpha| max|A| max|B|
+  double winograd_bound(size_t m, size_t n, size_t k, size_t cutoff)
+  {
+    const double classic = static_cast<double>(k) * static_cast<double>(k + 1);
+    if (is_base(m, n, k, cutoff)) {
+      return classic;
+    }
+    const size_t kh = k / 2;
+    // the products of norm growth s t, on inputs rounded once per addition
+    // of their S (T): P1, P2 1 x 1, P3, P4 4 x 1 (S4, T4 off by 9), P5, P7
+    // 2 x 2 (off by 2), P6 3 x 3 (off by 5), then the additions of the
+    // combination, 89 kh on C12 and C21
+    double bound = 18.0 * winograd_bound(m / 2, n / 2, kh, cutoff) + 89.0 * static_cast<double>(kh);
+    if (k % 2 != 0) {
+      // rank one update of the odd depth
+      bound += static_cast<double>(k + 1);
+    }
+    // the peeled row and column are computed by sgemm alone
+    return std::max(bound, classic);
+  }
+}
+
+StrassenMultiplier::StrassenMultiplier(ComputeSession& session, const StrassenOptions& options)
+  : _session(session), _options(options), _tuning(std::string("strassen ") + session.backend())
+{
+  for (size_t w = 1; w < workers(); w++) {
+    _sessions.emplace_back(new ComputeSession());
+  }
+}
+
+StrassenMultiplier::~StrassenMultiplier() = default;
+
+size_t StrassenMultiplier::workers() const
+{
+  // one per product of the first level at most
+  if (_options.workers > 0) {
+    return std::min<size_t>(_options.workers, 7);
+  }
+  // the host backends already use every thread in each product
+  return std::strcmp(_session.backend(), "cpu") == 0 || std::strcmp(_session.backend(), "wasm") == 0 ? 1 : 2;
+}
+
+void StrassenMultiplier::reserve(size_t m, size_t n, size_t k)
+{
+  if (is_base(m, n, k, cutoff(m, n, k))) {
+    return;
+  }
+  arena(block(m, n) + top_floats(m, n, k, cutoff(m, n, k), workers()));
+}
+
+float* StrassenMultiplier::arena(size_t floats)
+{
+  if (_arena.size() < floats) {
+    // rows of 4096 floats, first touched in parallel
+    COMPUTE_TRACE_SCOPE("alloc", "strassen arena", sizeof(float) * floats, 0);
+    _arena = Matrix<float>((floats + 4095) / 4096, 4096);
+  }
+  return _arena.data();
+}
+
+size_t StrassenMultiplier::cutoff(size_t m, size_t n, size_t k)
+{
+  if (_options.cutoff > 0) {
+    return _options.cutoff;
+  }
+  const std::string shape = shape_class(false, false, m, n, k);
+  auto it = _cutoffs.find(shape);
+  if (it == _cutoffs.end()) {
+    TuneConfig config;
+    const size_t tuned = _tuning.find(shape, config) ? tune_value(config, "cutoff", kDefaultCutoff) : kDefaultCutoff;
+    it = _cutoffs.insert(std::make_pair(shape, tuned)).first;
+  }
+  return it->second;
+}
+
+void StrassenMultiplier::sgemm(size_t m, size_t n, size_t k, float alpha, const float* a, size_t lda,
+                               const float* b, size_t ldb, float beta, float* c, size_t ldc)
+{
+  const size_t cut = cutoff(m, n, k);
+  if (is_base(m, n, k, cut)) {
+    _session.sgemm(Transpose::No, Transpose::No, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+    return;
+  }
+  COMPUTE_TRACE_SCOPE("kernel", "strassen", 0, 2.0 * m * n * k);
+
+  // the products overwrite C: with beta, the result goes through the arena
+  const bool accumulate = beta != 0.0f;
+  const size_t workers = this->workers();
+  float* ws = arena((accumulate ? block(m, n) : 0) + top_floats(m, n, k, cut, workers));
+  float* out = c;
+  size_t ldo = ldc;
+  if (accumulate) {
+    out = ws;
+    ldo = n;
+    ws += block(m, n);
+  }
+
+  if (workers < 2) {
+    winograd(_session, cut, m, n, k, alpha, a, lda, b, ldb, out, ldo, ws);
+  } else {
+    std::vector<ComputeSession*> sessions{&_session};
+    for (size_t w = 1; w < workers; w++) {
+      sessions.push_back(_sessions[w - 1].get());
+    }
+    winograd_parallel(sessions, cut, m, n, k, alpha, a, lda, b, ldb, out, ldo, ws);
+  }
+
+  if (accumulate) {
+    add(m, n, out, ldo, c, ldc, beta, c, ldc);
+  }
+}
+
+TuneResult StrassenMultiplier::tune(size_t m, size_t n, size_t k)
+{
+  COMPUTE_TRACE_SCOPE("setup", "autotune", 0, 0);
+  Matrix<float> a(m, k), b(k, n), c(m, n);
+  a.fill_uniform(1, -1.0, 1.0);
+  b.fill_uniform(2, -1.0, 1.0);
+
+  // the cutoffs giving a different recursion depth, the smallest dimension
+  // for sgemm alone
+  const size_t smallest = std::min(m, std::min(n, k));
+  std::vector<TuneConfig> candidates;
+  for (size_t cut = 256; cut < smallest; cut *= 2) {
+    candidates.push_back(TuneConfig{{"cutoff", cut}});
+  }
+  candidates.push_back(TuneConfig{{"cutoff", std::max<size_t>(smallest, 1)}});
+
+  const StrassenOptions options = _options;
+  const TuneResult best = pick_fastest(candidates, 2.0 * m * n * k, [&](const TuneConfig& config) {
+    _options.cutoff = tune_value(config, "cutoff", kDefaultCutoff);
+    sgemm(m, n, k, 1.0f, a.data(), k, b.data(), n, 0.0f, c.data(), n);
+    return true;
+  });
+  _options = options;
+
+  if (best.gflops > 0.0) {
+    const std::string shape = shape_class(false, false, m, n, k);
+    _tuning.store(shape, best);
+    _cutoffs.erase(shape);
+  }
+  return best;
+}
+
+double strassen_error_bound(size_t m, size_t n, size_t k, size_t cutoff, bool withBeta)
+{
+  // the final C = W + beta C0 adds one rounding of |alpha A B| <= k |alpha| max|A| max|B|
+  return winograd_bound(m, n, k, cutoff) + (withBeta ? static_cast<double>(k) : 0.0);
+}
+
+void sgemm_strassen(size_t m, size_t n, size_t k, float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                    float beta, float* c, size_t ldc)
+{
+  static StrassenMultiplier multiplier(default_session());
+  multiplier.sgemm(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+}
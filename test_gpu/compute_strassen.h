@@ -0,0 +1,96 @@
+#pragma once
+
+#include "compute.h"
+#include "compute_tune.h"
+#include "matrix.h"
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// recursion of StrassenMultiplier
+struct StrassenOptions
+{
+  /// the recursion stops once m, n or k is at most cutoff, so the base
+  /// products are in (cutoff / 2, cutoff]. 0: the cutoff tuned for the
+  /// shape class (tune), 1024 when it was never tuned
+  size_t cutoff{0};
+  /// sub-products of the first level computed concurrently, each worker on
+  /// a session of its own. 0: 1 on the native cpu backend (its kernels
+  /// already use every core), 2 on the devices (the copies of a product
+  /// overlap the kernels of another)
+  size_t workers{0};
+};
+
+///
+/// @brief Strassen-Winograd multiplication over the sgemm of a session
+///
+/// Each level of the recursion splits A, B and C in quadrants and computes
+/// C with 7 multiplications of halves and 15 additions instead of 8
+/// multiplications (odd dimensions peel their last row/column/depth, done
+/// by sgemm), down to the cutoff where the sgemm of the backend takes over:
+/// the work shrinks by 7/8 per level. The levels run the schedule of
+/// Boyer et al. with two temporaries, out of a workspace arena allocated
+/// once for the largest shape seen (reserve), so the recursion itself does
+/// not allocate. With several workers the 7 products of the first level are
+/// computed concurrently, with separate temporaries.
+///
+/// The result is less accurate than sgemm: the error is only bounded in
+/// norm, relative to max|A| max|B| (strassen_error_bound) instead of
+/// element by element, and grows by about 18 per level in the worst case
+/// (a few in practice, see README). Opt in for large multiplications where
+/// it wins and the accuracy is enough.
+///
+class StrassenMultiplier
+{
+public:
+  explicit StrassenMultiplier(ComputeSession& session, const StrassenOptions& options = StrassenOptions());
+  ~StrassenMultiplier();
+
+  StrassenMultiplier(const StrassenMultiplier&) = delete;
+  StrassenMultiplier& operator=(const StrassenMultiplier&) = delete;
+
+  /// C = alpha * A * B + beta * C, row major like sgemm (no transposes),
+  /// A is m x k, B k x n and C m x n
+  void sgemm(size_t m, size_t n, size_t k, float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+             float beta, float* c, size_t ldc);
+
+  /// grows the arena for shapes up to m x n x k (beta not 0 included),
+  /// sgemm grows it on demand otherwise
+  void reserve(size_t m, size_t n, size_t k);
+  size_t workspace_bytes() const { return _arena.bytes(); }
+
+  /// cutoff used for the shape
+  size_t cutoff(size_t m, size_t n, size_t k);
+  /// Times the cutoffs of the shape class (powers of two from 256, and no
+  /// recursion) on m x n x k and stores the fastest in the tuning cache
+  /// (compute_tune.h), device "strassen <backend>", for the next runs
+  TuneResult tune(size_t m, size_t n, size_t k);
+
+private:
+  size_t workers() const;
+  // the arena grown to floats
+  float* arena(size_t floats);
+
+  ComputeSession& _session;
+  StrassenOptions _options;
+  // sessions of the workers after the first one
+  std::vector<std::unique_ptr<ComputeSession>> _sessions;
+  Matrix<float> _arena;
+  TuningTable _tuning;
+  std::map<std::string, size_t> _cutoffs;
+};
+
+/// First order bound E of the error of StrassenMultiplier::sgemm with the
+/// cutoff, from the rounding of the additions and of the base sgemm
+/// (worst case dot products, k^2 + k):
+/// max|C - computed| <= (E |alpha| max|A| max|B| + 2 |beta| max|C0|) 2^-24
+/// Each level gives E = 18 E(half) + 89 k/2, the worst case of sgemm alone
+/// is k^2 + k.
+double strassen_error_bound(size_t m, size_t n, size_t k, size_t cutoff, bool withBeta = false);
+
+/// StrassenMultiplier::sgemm on the default session (default options)
+void sgemm_strassen(size_t m, size_t n, size_t k, float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                    float beta, float* c, size_t ldc);
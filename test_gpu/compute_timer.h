@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+
+///
+/// @brief Host side timer adding the elapsed time of a phase to a counter
+///
+/// The caller is responsible for synchronizing the device before the timer
+/// goes out of scope when the phase is asynchronous.
+///
+class PhaseTimer
+{
+public:
+  explicit PhaseTimer(double& seconds)
+    : _seconds(seconds), _begin(std::chrono::steady_clock::now())
+  {
+  }
+
+  ~PhaseTimer()
+  {
+    _seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - _begin).count();
+  }
+
+  PhaseTimer(const PhaseTimer&) = delete;
+  PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+  double& _seconds;
+  std::chrono::steady_clock::time_point _begin;
+};
@@ -0,0 +1,216 @@
+#include "compute_trace.h"
+
+#ifdef COMPUTE_TRACE
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+  // a long run keeps the first phases only, the rest are counted
+  const size_t kMaxEvents = 1 << 20;
+
+  // json string content (the names are plain ascii, escaped anyway)
+  std::string escape(const std::string& text)
+  {
+    std::string res;
+    for (char ch : text) {
+      if (ch == '"' || ch == '\\') {
+        res += '\\';
+        res += ch;
+      } else if (static_cast<unsigned char>(ch) < 0x20) {
+        char code[8];
+        std::snprintf(code, sizeof(code), "\\u%04x", ch);
+        res += code;
+      } else {
+        res += ch;
+      }
+    }
+    return res;
+  }
+
+  // rates over a duration in microseconds: bytes/us = MB/s, flops/us = Mflop/s
+  double giga_per_second(double count, double duration)
+  {
+    return duration > 0.0 ? count / duration * 1e-3 : 0.0;
+  }
+
+  struct TraceEvent
+  {
+    std::string category;
+    std::string name;
+    double begin;
+    double duration;
+    double bytes;
+    double flops;
+    size_t lane;
+  };
+
+  // the lanes are numbered in order of appearance, the host threads get
+  // theirs on their first phase
+  struct Tracer
+  {
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+    std::vector<std::string> lanes;
+    std::map<std::string, size_t> laneIds;
+    size_t dropped{0};
+    size_t hostThreads{0};
+
+    ~Tracer()
+    {
+      if (events.empty()) {
+        return;
+      }
+      const char* env = std::getenv("COMPUTE_TRACE_FILE");
+      const std::string path = env ? env : "compute_trace.json";
+      if (write(path)) {
+        std::cerr << "compute trace: " << events.size() << " phases written to " << path << std::endl;
+        summary(std::cerr);
+      }
+    }
+
+    // chrome trace json: one complete (X) event per phase, the lanes are
+    // the threads of the process
+    bool write(const std::string& path) const
+    {
+      std::ofstream fout(path);
+      fout << std::fixed << std::setprecision(3);
+      fout << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+      for (size_t lane = 0; lane < lanes.size(); lane++) {
+        fout << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << lane
+             << ", \"args\": {\"name\": \"" << escape(lanes[lane]) << "\"}},\n";
+      }
+      for (size_t i = 0; i < events.size(); i++) {
+        const TraceEvent& event = events[i];
+        fout << "{\"name\": \"" << escape(event.name) << "\", \"cat\": \"" << escape(event.category)
+             << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.lane
+             << ", \"ts\": " << event.begin << ", \"dur\": " << event.duration << ", \"args\": {";
+        const char* sep = "";
+        if (event.bytes > 0.0) {
+          fout << "\"bytes\": " << event.bytes << ", \"GB/s\": " << giga_per_second(event.bytes, event.duration);
+          sep = ", ";
+        }
+        if (event.flops > 0.0) {
+          fout << sep << "\"flops\": " << event.flops << ", \"GFLOP/s\": " << giga_per_second(event.flops, event.duration);
+        }
+        fout << "}}" << (i + 1 < events.size() ? ",\n" : "\n");
+      }
+      fout << "], \"otherData\": {\"dropped\": " << dropped << "}}\n";
+      return static_cast<bool>(fout);
+    }
+
+    void summary(std::ostream& out) const
+    {
+      struct Total
+      {
+        size_t calls{0};
+        double duration{0.0};
+        double bytes{0.0};
+        double flops{0.0};
+      };
+
+      std::map<std::string, Total> totals;
+      for (const TraceEvent& event : events) {
+        Total& total = totals[event.category + ' ' + event.name];
+        total.calls++;
+        total.duration += event.duration;
+        total.bytes += event.bytes;
+        total.flops += event.flops;
+      }
+
+      const std::ios_base::fmtflags flags = out.flags();
+      out << std::fixed << std::setprecision(3);
+      for (auto it = totals.begin(); it != totals.end(); ++it) {
+        const Total& total = it->second;
+        out << "  " << std::left << std::setw(32) << it->first << std::right
+            << std::setw(8) << total.calls << " calls " << std::setw(12) << total.duration * 1e-3 << " ms";
+        if (total.bytes > 0.0) {
+          out << std::setw(10) << giga_per_second(total.bytes, total.duration) << " GB/s";
+        }
+        if (total.flops > 0.0) {
+          out << std::setw(10) << giga_per_second(total.flops, total.duration) << " GFLOP/s";
+        }
+        out << '\n';
+      }
+      if (dropped > 0) {
+        out << "  " << dropped << " phases dropped (trace full)\n";
+      }
+      out.flags(flags);
+    }
+
+    size_t lane(const std::string& name)
+    {
+      auto it = laneIds.find(name);
+      if (it == laneIds.end()) {
+        it = laneIds.insert(std::make_pair(name, lanes.size())).first;
+        lanes.push_back(name);
+      }
+      return it->second;
+    }
+  };
+
+  Tracer& tracer()
+  {
+    static Tracer instance;
+    return instance;
+  }
+
+  const std::chrono::steady_clock::time_point& origin()
+  {
+    static const std::chrono::steady_clock::time_point instance = std::chrono::steady_clock::now();
+    return instance;
+  }
+}
+
+double trace_now()
+{
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin()).count();
+}
+
+void trace_record(const char* category, const char* name, double begin, double duration,
+                  double bytes, double flops, const char* lane)
+{
+  thread_local std::string hostLane;
+  Tracer& t = tracer();
+  std::lock_guard<std::mutex> lock(t.mutex);
+  if (t.events.size() >= kMaxEvents) {
+    t.dropped++;
+    return;
+  }
+  if (!lane && hostLane.empty()) {
+    hostLane = "host thread " + std::to_string(t.hostThreads++);
+  }
+  t.events.push_back(TraceEvent{category, name, begin, duration, bytes, flops, t.lane(lane ? lane : hostLane)});
+}
+
+bool trace_write(const std::string& path)
+{
+  Tracer& t = tracer();
+  std::lock_guard<std::mutex> lock(t.mutex);
+  return t.write(path);
+}
+
+void trace_summary(std::ostream& out)
+{
+  Tracer& t = tracer();
+  std::lock_guard<std::mutex> lock(t.mutex);
+  t.summary(out);
+}
+
+void trace_clear()
+{
+  Tracer& t = tracer();
+  std::lock_guard<std::mutex> lock(t.mutex);
+  t.events.clear();
+  t.dropped = 0;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+
+// Phase tracing, compiled in with -DCOMPUTE_TRACE (cmake -DENABLE_TRACE=ON)
+//
+// The backends record each phase of a call: session setup and teardown,
+// device allocations, host to device copies, kernels and device to host
+// copies, with the bytes moved and the flops computed. Device phases come
+// from the device clocks (OpenCL profiling events, CUDA events), the
+// others from host timers. The trace is written at exit as Chrome trace
+// json (chrome://tracing, https://ui.perfetto.dev) to $COMPUTE_TRACE_FILE,
+// compute_trace.json by default, with a per phase summary on stderr.
+//
+// Without COMPUTE_TRACE the macros expand to nothing.
+
+#ifdef COMPUTE_TRACE
+
+#include <iosfwd>
+#include <string>
+
+/// microseconds since the first trace call, the timeline of the trace
+double trace_now();
+
+/// One phase of begin/duration microseconds. The category is the kind of
+/// phase (setup, alloc, h2d, kernel, d2h, teardown), the lane the row of
+/// the timeline (a device queue/stream, the calling thread when null).
+/// The strings are copied.
+void trace_record(const char* category, const char* name, double begin, double duration,
+                  double bytes = 0.0, double flops = 0.0, const char* lane = nullptr);
+
+/// writes the phases recorded so far, false when the file cannot be written
+bool trace_write(const std::string& path);
+/// calls, total time and achieved rates per phase
+void trace_summary(std::ostream& out);
+void trace_clear();
+
+///
+/// @brief Records the host time of a scope as one phase
+///
+/// Like PhaseTimer, the device has to be synchronized before the scope
+/// ends for an asynchronous phase.
+///
+class TraceScope
+{
+public:
+  TraceScope(const char* category, const char* name, double bytes = 0.0, double flops = 0.0)
+    : _category(category), _name(name), _bytes(bytes), _flops(flops), _begin(trace_now())
+  {
+  }
+
+  ~TraceScope()
+  {
+    trace_record(_category, _name, _begin, trace_now() - _begin, _bytes, _flops);
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  const char* _category;
+  const char* _name;
+  double _bytes;
+  double _flops;
+  double _begin;
+};
+
+#define COMPUTE_TRACE_JOIN2(a, b) a##b
+#define COMPUTE_TRACE_JOIN(a, b) COMPUTE_TRACE_JOIN2(a, b)
+
+/// phase from here to the end of the enclosing scope
+#define COMPUTE_TRACE_SCOPE(category, name, bytes, flops) \
+  TraceScope COMPUTE_TRACE_JOIN(traceScope, __LINE__)(category, name, bytes, flops)
+
+#else
+
+#define COMPUTE_TRACE_SCOPE(category, name, bytes, flops) static_cast<void>(0)
+
+#endif
@@ -0,0 +1,234 @@
+#include "compute_tune.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// Tuning cache shared by every backend
+
+namespace
+{
+  const char kTuneEnv[] = "COMPUTE_TUNE_FILE";
+
+  size_t class_extent(size_t size)
+  {
+    size_t extent = 64;
+    while (extent < size && extent < 4096) {
+      extent *= 2;
+    }
+    return extent;
+  }
+
+  // mkdir -p, errors show up when the file is written
+  void make_directories(const std::string& path)
+  {
+    for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+      mkdir(path.substr(0, pos).c_str(), 0755);
+      if (pos == std::string::npos) {
+        break;
+      }
+    }
+  }
+}
+
+size_t tune_value(const TuneConfig& config, const std::string& name, size_t fallback)
+{
+  auto it = config.find(name);
+  return it == config.end() ? fallback : it->second;
+}
+
+std::string to_string(const TuneConfig& config)
+{
+  std::ostringstream out;
+  for (auto it = config.begin(); it != config.end(); ++it) {
+    out << (it == config.begin() ? "" : " ") << it->first << "=" << it->second;
+  }
+  return out.str();
+}
+
+TuneConfig parse_tune_config(const std::string& text)
+{
+  TuneConfig config;
+  std::istringstream in(text);
+  std::string item;
+  while (in >> item) {
+    const size_t eq = item.find('=');
+    if (eq != std::string::npos) {
+      config[item.substr(0, eq)] = std::strtoull(item.c_str() + eq + 1, nullptr, 10);
+    }
+  }
+  return config;
+}
+
+std::string shape_class(bool transA, bool transB, size_t m, size_t n, size_t k)
+{
+  std::ostringstream out;
+  out << (transA ? 't' : 'n') << (transB ? 't' : 'n') << ' '
+      << class_extent(m) << "x" << class_extent(n) << "x" << class_extent(k);
+  return out.str();
+}
+
+size_t tuning_extent(size_t size, size_t cap)
+{
+  return std::min(class_extent(size), cap);
+}
+
+TuningCache::TuningCache(const std::string& path)
+  : _path(path)
+{
+  load();
+}
+
+void TuningCache::load()
+{
+  std::ifstream fin(_path);
+  std::string line;
+  while (std::getline(fin, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    std::string device, shape, config, gflops;
+    if (std::getline(fields, device, '\t') && std::getline(fields, shape, '\t') &&
+        std::getline(fields, config, '\t')) {
+      std::getline(fields, gflops, '\t');
+      _entries[device + '\t' + shape] = Entry{parse_tune_config(config), std::atof(gflops.c_str())};
+    }
+  }
+}
+
+bool TuningCache::find(const std::string& device, const std::string& shape, TuneConfig& config) const
+{
+  auto it = _entries.find(device + '\t' + shape);
+  if (it == _entries.end()) {
+    return false;
+  }
+  config = it->second.config;
+  return true;
+}
+
+void TuningCache::store(const std::string& device, const std::string& shape, const TuneConfig& config, double gflops)
+{
+  const size_t slash = _path.rfind('/');
+  if (slash != std::string::npos && slash > 0) {
+    make_directories(_path.substr(0, slash));
+  }
+
+  // the runs storing at the same time take turns, each one rewrites the
+  // file with the entries of the others
+  const std::string lockPath = _path + ".lock";
+  const int lock = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (lock < 0 || flock(lock, LOCK_EX) != 0) {
+    std::cerr << "cannot lock the tuning cache " << lockPath << ", storing without the lock" << std::endl;
+  }
+
+  // keep the entries written by other runs since the file was read
+  load();
+  _entries[device + '\t' + shape] = Entry{config, gflops};
+
+  // own temporary file of the process and call, renamed over the cache
+  static std::atomic<unsigned> counter{0};
+  const std::string tmp = _path + "." + std::to_string(getpid()) + "." + std::to_string(counter++) + ".tmp";
+  bool written = false;
+  {
+    std::ofstream fout(tmp);
+    fout << "# device\tshape (m x n x k class)\tconfiguration\tgflops\n";
+    for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+      fout << it->first << '\t' << to_string(it->second.config) << '\t' << it->second.gflops << '\n';
+    }
+    written = static_cast<bool>(fout.flush());
+  }
+  if (!written) {
+    std::cerr << "cannot write the tuning cache " << tmp << std::endl;
+    std::remove(tmp.c_str());
+  } else if (std::rename(tmp.c_str(), _path.c_str()) != 0) {
+    std::cerr << "cannot write the tuning cache " << _path << std::endl;
+    std::remove(tmp.c_str());
+  }
+
+  if (lock >= 0) {
+    close(lock);
+  }
+}
+
+std::string TuningCache::default_path()
+{
+  if (const char* path = std::getenv(kTuneEnv)) {
+    return path;
+  }
+  if (const char* xdg = std::getenv("XDG_CACHE_HOME")) {
+    return std::string(xdg) + "/computeLib/tuning.txt";
+  }
+  if (const char* home = std::getenv("HOME")) {
+    return std::string(home) + "/.cache/computeLib/tuning.txt";
+  }
+  return "tuning.txt";
+}
+
+bool TuningTable::find(const std::string& shape, TuneConfig& config)
+{
+  auto it = _known.find(shape);
+  if (it == _known.end()) {
+    TuneConfig found;
+    cache().find(_device, shape, found);
+    it = _known.insert(std::make_pair(shape, found)).first;
+  }
+  config = it->second;
+  return !config.empty();
+}
+
+void TuningTable::store(const std::string& shape, const TuneResult& result)
+{
+  _known[shape] = result.config;
+  cache().store(_device, shape, result.config, result.gflops);
+  std::cout << "tuned " << _device << " " << shape << ": " << to_string(result.config)
+            << " (" << result.gflops << " gflops), saved to " << cache().path() << std::endl;
+}
+
+TuningCache& TuningTable::cache()
+{
+  if (!_cache) {
+    _cache.reset(new TuningCache);
+  }
+  return *_cache;
+}
+
+bool autotune_on_miss()
+{
+  const char* env = std::getenv("COMPUTE_AUTOTUNE");
+  return env && std::string(env) != "0";
+}
+
+TuneResult pick_fastest(const std::vector<TuneConfig>& candidates, double flops,
+                        const std::function<bool(const TuneConfig&)>& run, size_t reps)
+{
+  TuneResult best;
+  for (const TuneConfig& config : candidates) {
+    if (!run(config)) {
+      continue;
+    }
+    double seconds = 0.0;
+    for (size_t rep = 0; rep < reps; rep++) {
+      const auto begin = std::chrono::steady_clock::now();
+      run(config);
+      const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+      seconds = rep == 0 ? elapsed : std::min(seconds, elapsed);
+    }
+    const double gflops = seconds > 0.0 ? flops / seconds * 1e-9 : 0.0;
+    if (gflops > best.gflops) {
+      best.config = config;
+      best.gflops = gflops;
+    }
+  }
+  return best;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// knob name -> value of one kernel configuration (tile=64 vector=4 ...),
+/// each backend has its own knobs
+typedef std::map<std::string, size_t> TuneConfig;
+
+/// value of a knob, fallback when the configuration does not set it
+size_t tune_value(const TuneConfig& config, const std::string& name, size_t fallback);
+
+/// "name=value name=value", the format of the tuning cache
+std::string to_string(const TuneConfig& config);
+TuneConfig parse_tune_config(const std::string& text);
+
+/// shapes sharing a tuned configuration: the transposes and each dimension
+/// rounded up to a power of two in [64, 4096], "nt 512x512x256" (a 4096
+/// class covers the larger ones)
+std::string shape_class(bool transA, bool transB, size_t m, size_t n, size_t k);
+
+/// dimension benchmarked for a class, capped to keep the tuning short
+size_t tuning_extent(size_t size, size_t cap = 1024);
+
+struct TuneResult
+{
+  TuneConfig config;
+  double gflops{0.0};
+};
+
+///
+/// @brief Winning configurations per device and shape class, kept on disk
+///
+/// One line per entry: device, shape class, configuration and the measured
+/// gflops, tab separated. Storing an entry locks <path>.lock (flock), reads
+/// the file again and rewrites it as a whole through a temporary file of
+/// its own renamed over it, so that concurrent runs keep each other's
+/// entries and never see a partial file. The path is
+/// $COMPUTE_TUNE_FILE, else tuning.txt in $XDG_CACHE_HOME/computeLib or
+/// ~/.cache/computeLib.
+///
+class TuningCache
+{
+public:
+  explicit TuningCache(const std::string& path = default_path());
+
+  bool find(const std::string& device, const std::string& shape, TuneConfig& config) const;
+  void store(const std::string& device, const std::string& shape, const TuneConfig& config, double gflops);
+
+  const std::string& path() const { return _path; }
+  static std::string default_path();
+
+private:
+  void load();
+
+  struct Entry
+  {
+    TuneConfig config;
+    double gflops;
+  };
+
+  std::string _path;
+  // device + '\t' + shape
+  std::map<std::string, Entry> _entries;
+};
+
+///
+/// @brief Tuned configurations of one device, as seen by a session
+///
+/// The cache file is read on the first lookup and each shape class is
+/// looked up once.
+///
+class TuningTable
+{
+public:
+  explicit TuningTable(const std::string& device) : _device(device) {}
+
+  /// configuration of the shape class, false when it was never tuned
+  bool find(const std::string& shape, TuneConfig& config);
+  /// records the winner of a tuning, in the session and on disk
+  void store(const std::string& shape, const TuneResult& result);
+
+  const std::string& device() const { return _device; }
+
+private:
+  TuningCache& cache();
+
+  std::string _device;
+  std::unique_ptr<TuningCache> _cache;
+  // empty configuration for the classes not tuned
+  std::map<std::string, TuneConfig> _known;
+};
+
+/// true when sgemm tunes the shape classes missing from the cache on first
+/// use (COMPUTE_AUTOTUNE=1), otherwise only explicit autotune calls do
+bool autotune_on_miss();
+
+/// Times every candidate: run(config) computes one multiply of flops
+/// operations and returns false when the configuration is not supported by
+/// the device. One warm-up call, then the best of reps calls. Returns the
+/// fastest supported candidate (gflops 0 when none is).
+TuneResult pick_fastest(const std::vector<TuneConfig>& candidates, double flops,
+                        const std::function<bool(const TuneConfig&)>& run, size_t reps = 2);
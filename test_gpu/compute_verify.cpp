@@ -0,0 +1,114 @@
+#include "compute_verify.h"
+#include "compute_trace.h"
+#include "matrix.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Freivalds' verification of a multiply, backend independent
+
+namespace
+{
+  // out = op(M) v and outAbs = |op(M)| vAbs, op(M) is rows x cols,
+  // parallel over the rows of op(M)
+  void apply(bool trans, size_t rows, size_t cols, const float* mat, size_t ld,
+             const double* v, const double* vAbs, double* out, double* outAbs)
+  {
+    parallel_chunks(rows, [=](size_t begin, size_t end) {
+      if (!trans) {
+        for (size_t i = begin; i < end; i++) {
+          const float* row = mat + i * ld;
+          double sum = 0.0;
+          double sumAbs = 0.0;
+          for (size_t j = 0; j < cols; j++) {
+            sum += row[j] * v[j];
+            sumAbs += std::fabs(row[j]) * vAbs[j];
+          }
+          out[i] = sum;
+          outAbs[i] = sumAbs;
+        }
+      } else {
+        // M is stored cols x rows: the stored rows scaled by v, on the
+        // columns of the chunk
+        std::fill(out + begin, out + end, 0.0);
+        std::fill(outAbs + begin, outAbs + end, 0.0);
+        for (size_t j = 0; j < cols; j++) {
+          const float* row = mat + j * ld;
+          for (size_t i = begin; i < end; i++) {
+            out[i] += row[i] * v[j];
+            outAbs[i] += std::fabs(row[i]) * vAbs[j];
+          }
+        }
+      }
+    });
+  }
+}
+
+Verification verify_gemm(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                         float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                         float beta, const float* c0, size_t ldc0, const float* c, size_t ldc,
+                         const VerifyOptions& options)
+{
+  Verification res;
+  if (m == 0 || n == 0) {
+    return res;
+  }
+  COMPUTE_TRACE_SCOPE("verify", "freivalds", sizeof(float) * options.trials * (m * k + k * n + 2 * m * n),
+                      4.0 * options.trials * (m * k + k * n + 2 * m * n));
+
+  const bool tA = transA == Transpose::Yes;
+  const bool tB = transB == Transpose::Yes;
+  const bool readC0 = beta != 0.0f && c0;
+  const double bound = options.ulps * std::sqrt(static_cast<double>(k + 2)) * std::ldexp(1.0, -24) + options.relative;
+
+  std::vector<double> x(n), xAbs(n);
+  std::vector<double> y(k), yAbs(k);
+  std::vector<double> expected(m), magnitude(m);
+  std::vector<double> cx(m), cxAbs(m);
+  std::vector<double> c0x(m), c0xAbs(m);
+  std::vector<double> ratio(m);
+
+  for (size_t trial = 0; trial < options.trials; trial++) {
+    // uniform in [-1, 1), the same vector whatever the thread count
+    for (size_t j = 0; j < n; j++) {
+      x[j] = std::ldexp(static_cast<double>(counter_random(options.seed + trial, j) >> 11), -52) - 1.0;
+      xAbs[j] = std::fabs(x[j]);
+    }
+
+    apply(tB, k, n, b, ldb, x.data(), xAbs.data(), y.data(), yAbs.data());
+    apply(tA, m, k, a, lda, y.data(), yAbs.data(), expected.data(), magnitude.data());
+    apply(false, m, n, c, ldc, x.data(), xAbs.data(), cx.data(), cxAbs.data());
+    if (readC0) {
+      apply(false, m, n, c0, ldc0, x.data(), xAbs.data(), c0x.data(), c0xAbs.data());
+    }
+
+    parallel_chunks(m, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        double want = alpha * expected[i];
+        double scale = std::fabs(alpha) * magnitude[i];
+        if (readC0) {
+          want += beta * c0x[i];
+          scale += std::fabs(beta) * c0xAbs[i];
+        }
+        const double error = std::fabs(cx[i] - want);
+        const double tolerance = bound * scale;
+        // nan and any error on a zero magnitude row fail, an exact zero row passes
+        if (error <= tolerance) {
+          ratio[i] = tolerance > 0.0 ? error / tolerance : 0.0;
+        } else {
+          ratio[i] = tolerance > 0.0 && !std::isnan(error) ? error / tolerance : HUGE_VAL;
+        }
+      }
+    });
+
+    for (size_t i = 0; i < m; i++) {
+      if (ratio[i] > res.worst) {
+        res.worst = ratio[i];
+        res.row = i;
+      }
+    }
+  }
+  res.passed = res.worst <= 1.0;
+  return res;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "compute.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/// tolerances and cost of verify_gemm
+struct VerifyOptions
+{
+  /// random vectors, each one costs about 4 * (m*k + k*n + 2*m*n) flops
+  size_t trials{2};
+  /// rounding allowed on an inner product of length k, in units of
+  /// sqrt(k + 2) * 2^-24 relative to its magnitude: the probabilistic bound
+  /// of a float sum, independent errors of random sign. The worst case of a
+  /// sum in any order needs k + 2 units, this bound gives it up to catch
+  /// errors about sqrt(k) times smaller.
+  double ulps{4.0};
+  /// relative error allowed on top, e.g. 2^-8 for bfloat16 operands
+  double relative{0.0};
+  uint64_t seed{0x5eed};
+};
+
+struct Verification
+{
+  bool passed{true};
+  /// largest |C x - expected| / tolerance over the rows and trials, the
+  /// check fails above 1
+  double worst{0.0};
+  /// row of the worst ratio
+  size_t row{0};
+};
+
+/// Checks that c holds alpha * op(A) * op(B) + beta * C0 (the C given to
+/// the multiply, read when beta is not 0, same layout as sgemm) without
+/// recomputing the product: Freivalds' check, C x is compared with
+/// alpha * op(A) * (op(B) x) + beta * C0 x for random x, O(m*k + k*n + m*n)
+/// per trial instead of O(m*n*k). The products are computed in double and
+/// in parallel, each row gets the tolerance of its magnitude
+/// |alpha| |op(A)| |op(B)| |x| + |beta| |C0| |x|, so that reassociated sums
+/// (blocked kernels, cuBLAS) pass. A wrong element shows up in the check of
+/// its row unless it is within the tolerance of the whole row, the random
+/// vectors make cancelling errors unlikely to go unnoticed.
+Verification verify_gemm(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                         float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                         float beta, const float* c0, size_t ldc0, const float* c, size_t ldc,
+                         const VerifyOptions& options = VerifyOptions());
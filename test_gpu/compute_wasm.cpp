@@ -0,0 +1,579 @@
+#include "compute.h"
+#include "compute_pool.h"
+#include "compute_timer.h"
+#include "compute_trace.h"
+#include "compute_widen.h"
+#include "compute_worker.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+// WebAssembly backend (Emscripten pthreads): the tiles of C are shared by
+// the threads of the WorkerPool, web workers started with the module on a
+// SharedArrayBuffer memory. Each tile is packed and multiplied by a 4x8
+// SIMD128 micro-kernel (plain loops without -msimd128). It also builds
+// natively, with std::thread workers, to check it without a browser.
+
+namespace
+{
+  // micro-kernel tile, and depth of the packed panels
+  constexpr size_t kMr = 4;
+  constexpr size_t kNr = 8;
+  constexpr size_t kKc = 256;
+
+  // C tile of a task, mc x nc (multiples of kMr and kNr)
+  struct tiling
+  {
+    size_t mc{64};
+    size_t nc{256};
+  };
+
+  tiling make_tiling(const TuneConfig& config)
+  {
+    tiling t;
+    t.mc = tune_value(config, "mc", t.mc);
+    t.nc = tune_value(config, "nc", t.nc);
+    return t;
+  }
+
+  std::vector<TuneConfig> tuning_candidates()
+  {
+    std::vector<TuneConfig> candidates;
+    for (size_t mc : {32, 64, 128}) {
+      for (size_t nc : {128, 256, 512}) {
+        candidates.push_back({{"mc", mc}, {"nc", nc}});
+      }
+    }
+    return candidates;
+  }
+
+  // C = alpha * op(A) * op(B) + beta * C then the epilogue, op(A)(i, p) at
+  // a[i * rsa + p * csa] and op(B)(p, j) at b[p * rsb + j * csb]
+  struct gemm_args
+  {
+    size_t m, n, k;
+    float alpha;
+    const float* a;
+    size_t rsa, csa;
+    const float* b;
+    size_t rsb, csb;
+    float beta;
+    float* c;
+    size_t ldc;
+    const Epilogue* epilogue;
+  };
+
+  gemm_args make_args(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                      float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                      float beta, float* c, size_t ldc, const Epilogue* epilogue)
+  {
+    const bool tA = transA == Transpose::Yes;
+    const bool tB = transB == Transpose::Yes;
+    return gemm_args{m, n, k, alpha, a, tA ? 1 : lda, tA ? lda : 1, b, tB ? 1 : ldb, tB ? ldb : 1,
+                     beta, c, ldc, epilogue};
+  }
+
+  // mc x kc block of op(A) in panels of kMr rows, p major, zero padded
+  void pack_a(const gemm_args& g, size_t i0, size_t mc, size_t p0, size_t kc, float* out)
+  {
+    for (size_t ir = 0; ir < mc; ir += kMr) {
+      const size_t mr = std::min(kMr, mc - ir);
+      for (size_t p = 0; p < kc; p++) {
+        const float* src = g.a + (i0 + ir) * g.rsa + (p0 + p) * g.csa;
+        for (size_t r = 0; r < kMr; r++) {
+          *out++ = r < mr ? src[r * g.rsa] : 0.0f;
+        }
+      }
+    }
+  }
+
+  // kc x nc block of op(B) in panels of kNr columns, p major, zero padded
+  void pack_b(const gemm_args& g, size_t p0, size_t kc, size_t j0, size_t nc, float* out)
+  {
+    for (size_t jr = 0; jr < nc; jr += kNr) {
+      const size_t nr = std::min(kNr, nc - jr);
+      for (size_t p = 0; p < kc; p++) {
+        const float* src = g.b + (p0 + p) * g.rsb + (j0 + jr) * g.csb;
+        for (size_t q = 0; q < kNr; q++) {
+          *out++ = q < nr ? src[q * g.csb] : 0.0f;
+        }
+      }
+    }
+  }
+
+#ifdef __wasm_simd128__
+  // acc = A panel * B panel: 8 accumulators, A broadcast, 2 vectors of B
+  void ukernel(size_t kc, const float* a, const float* b, float* acc)
+  {
+    v128_t sum[kMr][2];
+    for (size_t r = 0; r < kMr; r++) {
+      sum[r][0] = wasm_f32x4_splat(0.0f);
+      sum[r][1] = sum[r][0];
+    }
+    for (size_t p = 0; p < kc; p++, a += kMr, b += kNr) {
+      const v128_t b0 = wasm_v128_load(b);
+      const v128_t b1 = wasm_v128_load(b + 4);
+      for (size_t r = 0; r < kMr; r++) {
+        const v128_t ar = wasm_f32x4_splat(a[r]);
+        sum[r][0] = wasm_f32x4_add(sum[r][0], wasm_f32x4_mul(ar, b0));
+        sum[r][1] = wasm_f32x4_add(sum[r][1], wasm_f32x4_mul(ar, b1));
+      }
+    }
+    for (size_t r = 0; r < kMr; r++) {
+      wasm_v128_store(acc + r * kNr, sum[r][0]);
+      wasm_v128_store(acc + r * kNr + 4, sum[r][1]);
+    }
+  }
+#else
+  void ukernel(size_t kc, const float* a, const float* b, float* acc)
+  {
+    float sum[kMr][kNr] = {};
+    for (size_t p = 0; p < kc; p++, a += kMr, b += kNr) {
+      for (size_t r = 0; r < kMr; r++) {
+        for (size_t q = 0; q < kNr; q++) {
+          sum[r][q] += a[r] * b[q];
+        }
+      }
+    }
+    std::copy(&sum[0][0], &sum[0][0] + kMr * kNr, acc);
+  }
+#endif
+
+  // C = alpha * acc + beta * C on the mr x nr corner of a tile, C is not
+  // read when beta is 0 (blas semantic)
+  void store_tile(const float* acc, size_t mr, size_t nr, float alpha, float beta, float* c, size_t ldc)
+  {
+    for (size_t r = 0; r < mr; r++) {
+      float* row = c + r * ldc;
+      for (size_t q = 0; q < nr; q++) {
+        const float x = alpha * acc[r * kNr + q];
+        row[q] = beta == 0.0f ? x : x + beta * row[q];
+      }
+    }
+  }
+
+  // x = activation(scale * x + bias[col] + D[row * ldd + col]) on the
+  // mc x nc tile at (i0, j0), still in cache
+  void apply_epilogue(const Epilogue& e, size_t i0, size_t j0, size_t mc, size_t nc, float* c, size_t ldc)
+  {
+    const bool relu = e.activation == Activation::Relu;
+    for (size_t i = i0; i < i0 + mc; i++) {
+      float* row = c + i * ldc;
+      for (size_t j = j0; j < j0 + nc; j++) {
+        float x = e.scale * row[j];
+        if (e.bias) {
+          x += e.bias[j];
+        }
+        if (e.addend) {
+          x += e.addend[i * e.ldd + j];
+        }
+        row[j] = relu && x < 0.0f ? 0.0f : x;
+      }
+    }
+  }
+
+  // the mc x nc tile of C at (i0, j0), all of k, on the calling thread
+  void gemm_tile(const gemm_args& g, size_t i0, size_t j0, size_t mc, size_t nc)
+  {
+    // packed panels of the thread, kept between the calls
+    thread_local std::vector<float> packedA;
+    thread_local std::vector<float> packedB;
+    const size_t kc = std::min(kKc, g.k);
+    packedA.resize((mc + kMr - 1) / kMr * kMr * kc);
+    packedB.resize((nc + kNr - 1) / kNr * kNr * kc);
+
+    alignas(16) float acc[kMr * kNr];
+    for (size_t p0 = 0; p0 < g.k; p0 += kKc) {
+      const size_t pc = std::min(kKc, g.k - p0);
+      pack_a(g, i0, mc, p0, pc, packedA.data());
+      pack_b(g, p0, pc, j0, nc, packedB.data());
+      // the first block applies beta, the next ones accumulate
+      const float beta = p0 == 0 ? g.beta : 1.0f;
+      for (size_t jr = 0; jr < nc; jr += kNr) {
+        for (size_t ir = 0; ir < mc; ir += kMr) {
+          ukernel(pc, packedA.data() + ir * pc, packedB.data() + jr * pc, acc);
+          store_tile(acc, std::min(kMr, mc - ir), std::min(kNr, nc - jr), g.alpha, beta,
+                     g.c + (i0 + ir) * g.ldc + j0 + jr, g.ldc);
+        }
+      }
+    }
+    if (g.epilogue && !g.epilogue->empty()) {
+      apply_epilogue(*g.epilogue, i0, j0, mc, nc, g.c, g.ldc);
+    }
+  }
+
+  // nothing to multiply (k = 0), C = epilogue(beta * C)
+  void scale(const gemm_args& g)
+  {
+    for (size_t i = 0; i < g.m; i++) {
+      float* row = g.c + i * g.ldc;
+      for (size_t j = 0; j < g.n; j++) {
+        row[j] = g.beta == 0.0f ? 0.0f : g.beta * row[j];
+      }
+    }
+    if (g.epilogue && !g.epilogue->empty()) {
+      apply_epilogue(*g.epilogue, 0, 0, g.m, g.n, g.c, g.ldc);
+    }
+  }
+
+  // The tiles go to the threads of the pool one at a time. Smaller tiles
+  // than tuned when there are too few of them to keep every thread busy.
+  // Called from a task of the pool (batches), everything runs on the
+  // calling thread.
+  void tiled_gemm(const gemm_args& g, tiling t)
+  {
+    if (g.m == 0 || g.n == 0) {
+      return;
+    }
+    if (g.k == 0) {
+      scale(g);
+      return;
+    }
+
+    WorkerPool& pool = WorkerPool::instance();
+    auto tiles = [&g](const tiling& tile) { return ((g.m + tile.mc - 1) / tile.mc) * ((g.n + tile.nc - 1) / tile.nc); };
+    while (tiles(t) < 2 * pool.threads() && (t.mc > 4 * kMr || t.nc > 8 * kNr)) {
+      if (t.mc > 4 * kMr) {
+        t.mc /= 2;
+      } else {
+        t.nc /= 2;
+      }
+    }
+
+    const size_t cols = (g.n + t.nc - 1) / t.nc;
+    pool.run(tiles(t), [&](size_t tile) {
+      const size_t i0 = tile / cols * t.mc;
+      const size_t j0 = tile % cols * t.nc;
+      gemm_tile(g, i0, j0, std::min(t.mc, g.m - i0), std::min(t.nc, g.n - j0));
+    });
+  }
+
+  // the items on the threads when they are enough to keep them busy, the
+  // tiles of each item otherwise
+  template <typename Item>
+  void gemm_batched(size_t batch, const tiling& t, Item item)
+  {
+    WorkerPool& pool = WorkerPool::instance();
+    if (batch >= pool.threads()) {
+      pool.run(batch, [&](size_t i) { tiled_gemm(item(i), t); });
+    } else {
+      for (size_t i = 0; i < batch; i++) {
+        tiled_gemm(item(i), t);
+      }
+    }
+  }
+
+  // C rows [row0, row1) = beta * C rows, nothing read when beta is 0
+  void scale_rows(size_t row0, size_t row1, size_t n, float beta, float* c, size_t ldc)
+  {
+    for (size_t i = row0; i < row1; i++) {
+      float* row = c + i * ldc;
+      for (size_t j = 0; j < n; j++) {
+        row[j] = beta == 0.0f ? 0.0f : beta * row[j];
+      }
+    }
+  }
+
+  // row of C += value * row of B
+  inline void axpy(size_t n, float value, const float* __restrict__ b, float* __restrict__ c)
+  {
+    for (size_t j = 0; j < n; j++) {
+      c[j] += value * b[j];
+    }
+  }
+
+  // rows (block rows) go to the threads by groups of grain, one group at a
+  // time since their nonzeros vary
+  void spmm_rows(size_t count, size_t grain, const std::function<void(size_t first, size_t last)>& rows)
+  {
+    WorkerPool::instance().run((count + grain - 1) / grain, [&](size_t group) {
+      rows(group * grain, std::min(count, (group + 1) * grain));
+    });
+  }
+}
+
+struct ComputeSession::Impl
+{
+  ComputeTimings timings;
+
+  // tuned tile per shape class, decoded once
+  TuningTable tuningTable{"wasm"};
+  std::map<std::string, tiling> tilings;
+
+  // created on first use, destroyed first
+  std::unique_ptr<AsyncWorker> worker;
+
+  const tiling& tiling_for(const std::string& shape)
+  {
+    auto it = tilings.find(shape);
+    if (it == tilings.end()) {
+      TuneConfig config;
+      tiling t = tuningTable.find(shape, config) ? make_tiling(config) : tiling();
+      it = tilings.insert(std::make_pair(shape, t)).first;
+    }
+    return it->second;
+  }
+
+  AsyncWorker& async_worker()
+  {
+    if (!worker) {
+      worker.reset(new AsyncWorker);
+    }
+    return *worker;
+  }
+};
+
+ComputeSession::ComputeSession()
+{
+  COMPUTE_TRACE_SCOPE("setup", "session", 0, 0);
+  _impl.reset(new Impl);
+#ifdef __wasm_simd128__
+  static const char* const kernel = "simd128";
+#else
+  static const char* const kernel = "generic";
+#endif
+  static bool once = (std::cout << "using wasm (" << kernel << ", " << WorkerPool::instance().threads()
+                                << " threads)" << std::endl, true);
+  (void)once;
+}
+
+ComputeSession::~ComputeSession()
+{
+  COMPUTE_TRACE_SCOPE("teardown", "session", 0, 0);
+  _impl.reset();
+}
+
+const char* ComputeSession::backend() const
+{
+  return "wasm";
+}
+
+bool ComputeSession::has_external_lib() const
+{
+  return false;
+}
+
+const ComputeTimings& ComputeSession::last_timings() const
+{
+  return _impl->timings;
+}
+
+// the operands are in the memory of the module, no transfer phase
+void ComputeSession::compute_with_acc_wrapper(float* a, float* b, float* c, size_t count)
+{
+  _impl->timings = {};
+  // a*b + a*b, the doubling is fused in the store
+  Epilogue twice;
+  twice.scale = 2.0f;
+
+  PhaseTimer timer(_impl->timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "sgemm", 0, 2.0 * count * count * count);
+  tiled_gemm(make_args(Transpose::No, Transpose::No, count, count, count, 1.0f, a, count, b, count, 0.0f, c, count, &twice),
+       tiling());
+}
+
+void ComputeSession::sgemm(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                           float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                           float beta, float* c, size_t ldc, const Epilogue& epilogue)
+{
+  Impl& s = *_impl;
+  const std::string shape = shape_class(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k);
+  TuneConfig config;
+  if (autotune_on_miss() && !s.tuningTable.find(shape, config)) {
+    autotune(transA, transB, m, n, k);
+  }
+
+  s.timings = {};
+  PhaseTimer timer(s.timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "sgemm", 0, 2.0 * m * n * k);
+  tiled_gemm(make_args(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, &epilogue), s.tiling_for(shape));
+}
+
+// the knobs are the tile of C given to a thread (mc x nc), the candidates
+// run on copies of the class shape (capped at 1024)
+TuneResult ComputeSession::autotune(Transpose transA, Transpose transB, size_t m, size_t n, size_t k)
+{
+  Impl& s = *_impl;
+  COMPUTE_TRACE_SCOPE("setup", "autotune", 0, 0);
+  const size_t tm = tuning_extent(m);
+  const size_t tn = tuning_extent(n);
+  const size_t tk = tuning_extent(k);
+  std::vector<float> a(tm * tk, 1.0f);
+  std::vector<float> b(tk * tn, 1.0f);
+  std::vector<float> c(tm * tn);
+
+  const gemm_args g = make_args(transA, transB, tm, tn, tk, 1.0f, a.data(), transA == Transpose::No ? tk : tm,
+                                b.data(), transB == Transpose::No ? tn : tk, 0.0f, c.data(), tn, nullptr);
+  const TuneResult best = pick_fastest(tuning_candidates(), 2.0 * tm * tn * tk, [&](const TuneConfig& config) {
+    tiled_gemm(g, make_tiling(config));
+    return true;
+  });
+
+  if (best.gflops > 0.0) {
+    const std::string shape = shape_class(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k);
+    s.tuningTable.store(shape, best);
+    s.tilings.erase(shape);
+  }
+  return best;
+}
+
+TuneConfig ComputeSession::tuned_config(Transpose transA, Transpose transB, size_t m, size_t n, size_t k)
+{
+  TuneConfig config;
+  _impl->tuningTable.find(shape_class(transA == Transpose::Yes, transB == Transpose::Yes, m, n, k), config);
+  return config;
+}
+
+void ComputeSession::sgemm_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                   float alpha, const float* const* a, size_t lda, const float* const* b, size_t ldb,
+                                   float beta, float* const* c, size_t ldc, size_t batch)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  PhaseTimer timer(s.timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "sgemm batched", 0, 2.0 * m * n * k * batch);
+  gemm_batched(batch, tiling(), [&](size_t i) {
+    return make_args(transA, transB, m, n, k, alpha, a[i], lda, b[i], ldb, beta, c[i], ldc, nullptr);
+  });
+}
+
+void ComputeSession::sgemm_strided_batched(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const float* a, size_t lda, size_t strideA,
+                                           const float* b, size_t ldb, size_t strideB,
+                                           float beta, float* c, size_t ldc, size_t strideC, size_t batch)
+{
+  Impl& s = *_impl;
+  s.timings = {};
+  PhaseTimer timer(s.timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "sgemm batched", 0, 2.0 * m * n * k * batch);
+  gemm_batched(batch, tiling(), [&](size_t i) {
+    return make_args(transA, transB, m, n, k, alpha, a + i * strideA, lda, b + i * strideB, ldb,
+                     beta, c + i * strideC, ldc, nullptr);
+  });
+}
+
+// the worker thread shares the pool with the caller: its tiles run on the
+// worker alone while a call of the caller holds the pool
+std::future<ComputeTimings> ComputeSession::sgemm_async(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                                        float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                                        float beta, float* c, size_t ldc)
+{
+  return _impl->async_worker().submit([=]() {
+    ComputeTimings timings;
+    {
+      PhaseTimer timer(timings.compute);
+      COMPUTE_TRACE_SCOPE("kernel", "sgemm async", 0, 2.0 * m * n * k);
+      tiled_gemm(make_args(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, nullptr), tiling());
+    }
+    return timings;
+  });
+}
+
+// the workers are the only device, sgemm already uses all of them
+void ComputeSession::sgemm_split(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                 float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                 float beta, float* c, size_t ldc)
+{
+  sgemm(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+}
+
+// rows of C by groups of 16, a row of B per nonzero
+void ComputeSession::spmm(float alpha, const CsrMatrix& a, const float* b, size_t ldb, size_t n,
+                          float beta, float* c, size_t ldc)
+{
+  _impl->timings = {};
+  if (a.rows == 0 || n == 0) {
+    return;
+  }
+
+  PhaseTimer timer(_impl->timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "spmm csr", 0, 2.0 * a.nnz() * n);
+  spmm_rows(a.rows, 16, [&](size_t first, size_t last) {
+    scale_rows(first, last, n, beta, c, ldc);
+    for (size_t i = first; i < last; i++) {
+      for (uint32_t nz = a.rowPtr[i]; nz < a.rowPtr[i + 1]; nz++) {
+        axpy(n, alpha * a.values[nz], b + a.colIdx[nz] * ldb, c + i * ldc);
+      }
+    }
+  });
+}
+
+// block rows by groups of 4, the padding of the blocks skipped
+void ComputeSession::spmm(float alpha, const BsrMatrix& a, const float* b, size_t ldb, size_t n,
+                          float beta, float* c, size_t ldc)
+{
+  _impl->timings = {};
+  if (a.rows == 0 || n == 0) {
+    return;
+  }
+
+  PhaseTimer timer(_impl->timings.compute);
+  COMPUTE_TRACE_SCOPE("kernel", "spmm bsr", 0, 2.0 * a.values.size() * n);
+  const size_t br = a.blockRows;
+  const size_t bc = a.blockCols;
+  spmm_rows(a.block_rows(), 4, [&](size_t first, size_t last) {
+    scale_rows(first * br, std::min(a.rows, last * br), n, beta, c, ldc);
+    for (size_t blockRow = first; blockRow < last; blockRow++) {
+      const size_t rows = std::min(br, a.rows - blockRow * br);
+      for (uint32_t block = a.rowPtr[blockRow]; block < a.rowPtr[blockRow + 1]; block++) {
+        const size_t col0 = a.colIdx[block] * bc;
+        const size_t cols = std::min(bc, a.cols - col0);
+        const float* values = a.values.data() + block * br * bc;
+        for (size_t r = 0; r < rows; r++) {
+          float* row = c + (blockRow * br + r) * ldc;
+          for (size_t q = 0; q < cols; q++) {
+            if (values[r * bc + q] != 0.0f) {
+              axpy(n, alpha * values[r * bc + q], b + (col0 + q) * ldb, row);
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+// no reduced precision kernels: float goes straight to sgemm, the others
+// are widened (compute_widen.h)
+template <>
+void ComputeSession::gemm<float, float>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                        float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+                                        float beta, float* c, size_t ldc, const Scales& scales)
+{
+  if (scales.row || scales.col) {
+    gemm_widened(*this, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
+  } else {
+    sgemm(transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+  }
+}
+
+template <>
+void ComputeSession::gemm<BFloat16, float>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const BFloat16* a, size_t lda, const BFloat16* b, size_t ldb,
+                                           float beta, float* c, size_t ldc, const Scales& scales)
+{
+  gemm_widened(*this, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
+}
+
+template <>
+void ComputeSession::gemm<int8_t, int32_t>(Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                                           float alpha, const int8_t* a, size_t lda, const int8_t* b, size_t ldb,
+                                           float beta, float* c, size_t ldc, const Scales& scales)
+{
+  gemm_widened(*this, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, scales);
+}
+
+void ComputeSession::test_mul_from_external_lib(float* a, float* b, float* c, size_t count)
+{
+  _impl->timings = {};
+  std::cout << "no external lib in wasm, using the wasm sgemm" << std::endl;
+  compute_with_acc_wrapper(a, b, c, count);
+}
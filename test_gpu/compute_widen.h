@@ -0,0 +1,57 @@
+#pragma once
+
+#include "compute.h"
+
+#include <vector>
+
+///
+/// @brief Reduced precision gemm of the backends without native kernels
+///
+/// The stored operands are widened to float on the host as they are and
+/// multiplied by the session sgemm, the scales are applied to the product
+/// (row i times scales.row[i], column j times scales.col[j]). The products
+/// of int8 values and their sums stay integers, exact while the sums stay
+/// below 2^24.
+///
+template <typename T>
+void gemm_widened(ComputeSession& session, Transpose transA, Transpose transB, size_t m, size_t n, size_t k,
+                  float alpha, const T* a, size_t lda, const T* b, size_t ldb,
+                  float beta, float* c, size_t ldc, const Scales& scales)
+{
+  // stored shapes, op(A) row i is a stored column when A is transposed
+  const size_t rowsA = transA == Transpose::No ? m : k;
+  const size_t colsA = transA == Transpose::No ? k : m;
+  const size_t rowsB = transB == Transpose::No ? k : n;
+  const size_t colsB = transB == Transpose::No ? n : k;
+
+  std::vector<float> wa(rowsA * colsA);
+  for (size_t r = 0; r < rowsA; r++) {
+    for (size_t q = 0; q < colsA; q++) {
+      wa[r * colsA + q] = static_cast<float>(a[r * lda + q]);
+    }
+  }
+
+  std::vector<float> wb(rowsB * colsB);
+  for (size_t r = 0; r < rowsB; r++) {
+    for (size_t q = 0; q < colsB; q++) {
+      wb[r * colsB + q] = static_cast<float>(b[r * ldb + q]);
+    }
+  }
+
+  if (!scales.row && !scales.col) {
+    session.sgemm(transA, transB, m, n, k, alpha, wa.data(), colsA, wb.data(), colsB, beta, c, ldc);
+    return;
+  }
+
+  // unscaled product, dequantized into C (not read when beta is 0)
+  std::vector<float> product(m * n);
+  session.sgemm(transA, transB, m, n, k, 1.0f, wa.data(), colsA, wb.data(), colsB, 0.0f, product.data(), n);
+  for (size_t i = 0; i < m; i++) {
+    const float rowScale = alpha * (scales.row ? scales.row[i] : 1.0f);
+    for (size_t j = 0; j < n; j++) {
+      const float x = rowScale * (scales.col ? scales.col[j] : 1.0f) * product[i * n + j];
+      float& out = c[i * ldc + j];
+      out = beta == 0.0f ? x : x + beta * out;
+    }
+  }
+}
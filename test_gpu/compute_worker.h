@@ -0,0 +1,74 @@
+#pragma once
+
+#include "compute.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+///
+/// @brief Background thread running the asynchronous calls of a session
+///
+/// The calls run one after the other in submission order, so that they can
+/// share the buffers of the session without locking. The destructor
+/// completes the pending calls.
+///
+class AsyncWorker
+{
+public:
+  AsyncWorker() : _thread([this] { run(); }) {}
+
+  ~AsyncWorker()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _done = true;
+    }
+    _cv.notify_one();
+    _thread.join();
+  }
+
+  AsyncWorker(const AsyncWorker&) = delete;
+  AsyncWorker& operator=(const AsyncWorker&) = delete;
+
+  std::future<ComputeTimings> submit(std::function<ComputeTimings()> call)
+  {
+    auto task = std::make_shared<std::packaged_task<ComputeTimings()>>(std::move(call));
+    std::future<ComputeTimings> res = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _tasks.push_back([task] { (*task)(); });
+    }
+    _cv.notify_one();
+    return res;
+  }
+
+private:
+  void run()
+  {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this] { return _done || !_tasks.empty(); });
+        if (_tasks.empty()) {
+          return;
+        }
+        task = std::move(_tasks.front());
+        _tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<std::function<void()>> _tasks;
+  bool _done{false};
+  // last, started once the other members are constructed
+  std::thread _thread;
+};
@@ -1,77 +1,616 @@
 #include "compute.h"
+#include "compute_strassen.h"
+#include "compute_verify.h"
+#include "matrix.h"
+#include "matrix_file.h"
+
+#include <unistd.h>
 
 #include <iostream>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
 
-int main(int argc, char** argv)
+namespace
 {
-  std::cout << "testing GPU computation" << std::endl;
+  // C = alpha * op(A) * op(B) + beta * C on odd shapes stored in padded
+  // buffers (sub-views), the padding must be left untouched
+  bool check_sgemm()
+  {
+    const uint64_t m = 37, n = 53, k = 29, pad = 3;
+    const float alpha = 0.5f, beta = 2.0f;
 
-  const uint64_t kCount = 1024;
-  // we want to compute with addition and multiplication kernel
-  // a*b + a*b = 2*a*b
-  float* a = new float[kCount * kCount];
-  float* b = new float[kCount * kCount];
-  float* c = new float[kCount * kCount];
-  float* d = new float[kCount * kCount];
-  float* expected = new float[kCount * kCount];
+    for (Transpose transA : {Transpose::No, Transpose::Yes})
+    {
+      for (Transpose transB : {Transpose::No, Transpose::Yes})
+      {
+        const uint64_t lda = (transA == Transpose::No ? k : m) + pad;
+        const uint64_t ldb = (transB == Transpose::No ? n : k) + pad;
+        const uint64_t ldc = n + pad;
+        std::vector<float> a((transA == Transpose::No ? m : k) * lda);
+        std::vector<float> b((transB == Transpose::No ? k : n) * ldb);
+        std::vector<float> c(m * ldc);
+        for (auto& v : a) v = rand() % 16;
+        for (auto& v : b) v = rand() % 16;
+        for (auto& v : c) v = rand() % 16;
+        std::vector<float> expected(c);
+
+        for (uint64_t row = 0; row < m; row++)
+        {
+          for (uint64_t col = 0; col < n; col++)
+          {
+            float res{};
+            for (uint64_t s = 0; s < k; s++)
+            {
+              const float av = transA == Transpose::No ? a[row * lda + s] : a[s * lda + row];
+              const float bv = transB == Transpose::No ? b[s * ldb + col] : b[col * ldb + s];
+              res += av * bv;
+            }
+            expected[row * ldc + col] = alpha * res + beta * expected[row * ldc + col];
+          }
+        }
 
-  for (uint64_t i = 0; i < kCount; i++)
+        sgemm(transA, transB, m, n, k, alpha, a.data(), lda, b.data(), ldb, beta, c.data(), ldc);
+
+        for (uint64_t i = 0; i < c.size(); i++)
+        {
+          if (std::fabs(c[i] - expected[i]) > 1e-5f * std::fabs(expected[i]))
+          {
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  // batches of small matrices, strided and pointer-array variants must
+  // match sgemm item by item
+  bool check_batched()
   {
-    for (uint64_t j = 0; j < kCount; j++)
+    const uint64_t batch = 100, ld = 35;
+    const float alpha = 0.5f, beta = 2.0f;
+
+    // 16: fixed shape kernels of the cpu backend, 29: general path
+    for (uint64_t size : {16, 29})
     {
-      a[i * kCount + j] = rand() % 1024;
-      b[i * kCount + j] = rand() % 1024;
+      const uint64_t stride = size * ld + 7;
+      std::vector<float> a(batch * stride), b(batch * stride), c(batch * stride);
+      for (auto& v : a) v = rand() % 16;
+      for (auto& v : b) v = rand() % 16;
+      for (auto& v : c) v = rand() % 16;
+      std::vector<float> expected(c), strided(c), pointers(c);
+
+      std::vector<const float*> pa, pb;
+      std::vector<float*> pc;
+      for (uint64_t i = 0; i < batch; i++)
+      {
+        sgemm(Transpose::No, Transpose::No, size, size, size, alpha, &a[i * stride], ld, &b[i * stride], ld,
+              beta, &expected[i * stride], ld);
+        pa.push_back(&a[i * stride]);
+        pb.push_back(&b[i * stride]);
+        pc.push_back(&pointers[i * stride]);
+      }
+
+      sgemm_strided_batched(Transpose::No, Transpose::No, size, size, size, alpha, a.data(), ld, stride,
+                            b.data(), ld, stride, beta, strided.data(), ld, stride, batch);
+      sgemm_batched(Transpose::No, Transpose::No, size, size, size, alpha, pa.data(), ld, pb.data(), ld,
+                    beta, pc.data(), ld, batch);
+
+      for (uint64_t i = 0; i < c.size(); i++)
+      {
+        if (std::fabs(strided[i] - expected[i]) > 1e-5f * std::fabs(expected[i]) ||
+            std::fabs(pointers[i] - expected[i]) > 1e-5f * std::fabs(expected[i]))
+        {
+          return false;
+        }
+      }
     }
+    return true;
   }
 
-  // should use google micro benchmark
-  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-  compute_with_acc_wrapper(a, b, c, kCount);
-  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-  std::cout << "Time difference (Pure GPU) = " << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << "[ms]" << std::endl;
-  begin = std::chrono::steady_clock::now();
-  test_mul_from_external_lib(a, b, d, kCount);
-  end = std::chrono::steady_clock::now();
-  std::cout << "Time difference (Library) = " << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << "[ms]" << std::endl;
-  std::cout << "Time difference (Library) = " << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << "[ucro]" << std::endl;
+  // the pipelined row tiles of sgemm_async must match sgemm
+  bool check_async()
+  {
+    const uint64_t m = 300, n = 70, k = 45;
+    const float alpha = 0.5f, beta = 2.0f;
+
+    // A is transposed (k x m) so that the tiles are columns of the stored A
+    std::vector<float> a(k * m), b(k * n), c(m * n);
+    for (auto& v : a) v = rand() % 16;
+    for (auto& v : b) v = rand() % 16;
+    for (auto& v : c) v = rand() % 16;
+    std::vector<float> expected(c);
+
+    sgemm(Transpose::Yes, Transpose::No, m, n, k, alpha, a.data(), m, b.data(), n, beta, expected.data(), n);
+    std::future<ComputeTimings> done = sgemm_async(Transpose::Yes, Transpose::No, m, n, k, alpha, a.data(), m,
+                                                   b.data(), n, beta, c.data(), n);
+    done.wait();
+
+    for (uint64_t i = 0; i < c.size(); i++)
+    {
+      if (std::fabs(c[i] - expected[i]) > 1e-5f * std::fabs(expected[i]))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // tunes a small shape class (the winner goes to a temporary tuning
+  // cache), then a new session loads it for an sgemm of the class
+  bool check_autotune()
+  {
+    const uint64_t m = 50, n = 60, k = 40;
+    std::vector<float> a(k * m), b(k * n), c(m * n), expected(m * n);
+    for (auto& v : a) v = rand() % 16;
+    for (auto& v : b) v = rand() % 16;
+
+    // keeps the tuning cache of the user out of the check
+    const char* tmp = std::getenv("TMPDIR");
+    const std::string path = std::string(tmp ? tmp : "/tmp") + "/compute_check_" + std::to_string(getpid()) + "_tuning.txt";
+    const char* userPath = std::getenv("COMPUTE_TUNE_FILE");
+    const std::string saved = userPath ? userPath : "";
+    setenv("COMPUTE_TUNE_FILE", path.c_str(), 1);
+
+    TuneConfig tuned;
+    {
+      ComputeSession session;
+      tuned = session.autotune(Transpose::Yes, Transpose::No, m, n, k).config;
+    }
+    ComputeSession session;
+    const bool loaded = !tuned.empty() && session.tuned_config(Transpose::Yes, Transpose::No, m, n, k) == tuned;
+    session.sgemm(Transpose::Yes, Transpose::No, m, n, k, 1.0f, a.data(), m, b.data(), n, 0.0f, c.data(), n);
+
+    if (userPath) {
+      setenv("COMPUTE_TUNE_FILE", saved.c_str(), 1);
+    } else {
+      unsetenv("COMPUTE_TUNE_FILE");
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".lock").c_str());
+    if (!loaded)
+    {
+      return false;
+    }
+
+    for (uint64_t row = 0; row < m; row++)
+    {
+      for (uint64_t col = 0; col < n; col++)
+      {
+        float res{};
+        for (uint64_t s = 0; s < k; s++)
+        {
+          res += a[s * m + row] * b[s * n + col];
+        }
+        if (c[row * n + col] != res)
+        {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // split sgemm against the single call, on every transpose (rows not a
+  // multiple of the panels, two calls so that the measured rates are used)
+  bool check_split()
+  {
+    const uint64_t m = 1000, n = 90, k = 33;
+    const float alpha = 1.5f, beta = 0.5f;
+
+    for (Transpose tA : {Transpose::No, Transpose::Yes})
+    {
+      for (Transpose tB : {Transpose::No, Transpose::Yes})
+      {
+        std::vector<float> a(m * k), b(k * n), c(m * n);
+        for (auto& v : a) v = rand() % 16;
+        for (auto& v : b) v = rand() % 16;
+        for (auto& v : c) v = rand() % 16;
+        const uint64_t lda = tA == Transpose::No ? k : m;
+        const uint64_t ldb = tB == Transpose::No ? n : k;
+
+        std::vector<float> expected(c);
+        sgemm(tA, tB, m, n, k, alpha, a.data(), lda, b.data(), ldb, beta, expected.data(), n);
+        for (int call = 0; call < 2; call++)
+        {
+          std::vector<float> res(c);
+          sgemm_split(tA, tB, m, n, k, alpha, a.data(), lda, b.data(), ldb, beta, res.data(), n);
+          for (uint64_t i = 0; i < res.size(); i++)
+          {
+            if (std::fabs(res[i] - expected[i]) > 1e-5f * std::fabs(expected[i]))
+            {
+              return false;
+            }
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  // stored copy of the rows x cols row major matrix x, transposed or not,
+  // with row stride ld. convert(value, row, col) gives the stored element.
+  template <typename T, typename F>
+  std::vector<T> store(const std::vector<float>& x, uint64_t rows, uint64_t cols, Transpose trans, uint64_t ld,
+                       F convert)
+  {
+    std::vector<T> res((trans == Transpose::No ? rows : cols) * ld);
+    for (uint64_t r = 0; r < rows; r++)
+    {
+      for (uint64_t q = 0; q < cols; q++)
+      {
+        res[trans == Transpose::No ? r * ld + q : q * ld + r] = convert(x[r * cols + q], r, q);
+      }
+    }
+    return res;
+  }
+
+  // verify_gemm accepts the results of sgemm on every transpose with beta,
+  // and catches a single wrong element
+  bool check_verify()
+  {
+    const uint64_t m = 150, n = 170, k = 130;
+    const float alpha = 0.5f, beta = -1.5f;
+
+    for (Transpose transA : {Transpose::No, Transpose::Yes})
+    {
+      for (Transpose transB : {Transpose::No, Transpose::Yes})
+      {
+        const uint64_t lda = transA == Transpose::No ? k : m;
+        const uint64_t ldb = transB == Transpose::No ? n : k;
+        std::vector<float> a(m * k), b(k * n), c0(m * n);
+        for (auto& v : a) v = static_cast<float>(rand()) / RAND_MAX - 0.5f;
+        for (auto& v : b) v = static_cast<float>(rand()) / RAND_MAX - 0.5f;
+        for (auto& v : c0) v = static_cast<float>(rand()) / RAND_MAX - 0.5f;
+        std::vector<float> c(c0);
+
+        sgemm(transA, transB, m, n, k, alpha, a.data(), lda, b.data(), ldb, beta, c.data(), n);
+        if (!verify_gemm(transA, transB, m, n, k, alpha, a.data(), lda, b.data(), ldb,
+                         beta, c0.data(), n, c.data(), n).passed)
+        {
+          return false;
+        }
 
-  // OpenMP
-  #pragma omp parallel for default(none) shared(a,b,expected)
-  for (uint64_t row = 0; row < kCount; row++)
+        c[(m / 2) * n + n / 3] += 1e-2f;
+        if (verify_gemm(transA, transB, m, n, k, alpha, a.data(), lda, b.data(), ldb,
+                        beta, c0.data(), n, c.data(), n).passed)
+        {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // Strassen-Winograd on odd shapes (peeled row, column and depth at every
+  // level) in padded buffers, serial and with concurrent products, within
+  // the documented bound of the difference with the fp32 sgemm
+  bool check_strassen()
   {
-    for (uint64_t col = 0; col < kCount; col++)
+    const uint64_t m = 151, n = 149, k = 153, pad = 5, cutoff = 40;
+    const float alpha = 0.5f;
+
+    for (float beta : {0.0f, 1.5f})
     {
-      float res{};
-      for (uint64_t s = 0; s < kCount; s++)
+      for (uint64_t workers : {1, 3})
       {
-        res += a[row * kCount + s] * b[s * kCount + col];
+        const uint64_t lda = k + pad, ldb = n + pad, ldc = n + pad;
+        std::vector<float> a(m * lda), b(k * ldb), c(m * ldc);
+        for (auto& v : a) v = static_cast<float>(rand()) / RAND_MAX * 2.0f - 1.0f;
+        for (auto& v : b) v = static_cast<float>(rand()) / RAND_MAX * 2.0f - 1.0f;
+        for (auto& v : c) v = static_cast<float>(rand()) / RAND_MAX * 2.0f - 1.0f;
+        std::vector<float> expected(c);
+
+        StrassenOptions options;
+        options.cutoff = cutoff;
+        options.workers = workers;
+        StrassenMultiplier strassen(default_session(), options);
+        strassen.sgemm(m, n, k, alpha, a.data(), lda, b.data(), ldb, beta, c.data(), ldc);
+        sgemm(Transpose::No, Transpose::No, m, n, k, alpha, a.data(), lda, b.data(), ldb, beta, expected.data(), ldc);
+
+        // both errors, max|A| = max|B| = max|C0| = 1
+        const double bound = (alpha * (strassen_error_bound(m, n, k, cutoff, beta != 0.0f) + k * (k + 1.0)) +
+                              4.0 * beta) * std::ldexp(1.0, -24);
+        for (uint64_t i = 0; i < c.size(); i++)
+        {
+          const bool padding = i % ldc >= n;
+          if ((padding && c[i] != expected[i]) || std::fabs(c[i] - expected[i]) > bound)
+          {
+            return false;
+          }
+        }
       }
-      expected[row * kCount + col] = 2 * res;
     }
+    return true;
+  }
+
+  // out-of-core multiply of matrix files through a working set far smaller
+  // than the operands (many panels of A, B and C), the product read back
+  // from the reopened file
+  bool check_out_of_core()
+  {
+    const uint64_t m = 300, n = 200, k = 500;
+    const float alpha = 0.5f, beta = -1.5f;
+    const char* tmp = std::getenv("TMPDIR");
+    const std::string prefix = std::string(tmp ? tmp : "/tmp") + "/compute_check_" + std::to_string(getpid());
+
+    bool res = false;
+    {
+      MatrixFile a, b, c;
+      if (!a.create(prefix + "_a.mat", m, k) || !b.create(prefix + "_b.mat", k, n) || !c.create(prefix + "_c.mat", m, n))
+      {
+        return false;
+      }
+      for (uint64_t i = 0; i < m * k; i++) a.data_as<float>()[i] = static_cast<float>(rand()) / RAND_MAX - 0.5f;
+      for (uint64_t i = 0; i < k * n; i++) b.data_as<float>()[i] = static_cast<float>(rand()) / RAND_MAX - 0.5f;
+      for (uint64_t i = 0; i < m * n; i++) c.data_as<float>()[i] = static_cast<float>(rand()) / RAND_MAX - 0.5f;
+      const std::vector<float> c0(c.data_as<float>(), c.data_as<float>() + m * n);
+
+      OutOfCoreOptions options;
+      options.memory = 256 * 1024;
+      if (sgemm_out_of_core(alpha, a, b, beta, c, options) && c.flush())
+      {
+        c.close();
+        MatrixFile product;
+        res = product.open(prefix + "_c.mat") && product.rows() == m && product.cols() == n &&
+              product.type() == ElementType::Float32 && product.layout() == Layout::RowMajor &&
+              verify_gemm(Transpose::No, Transpose::No, m, n, k, alpha, a.data_as<float>(), k, b.data_as<float>(), n,
+                          beta, c0.data(), n, product.data_as<float>(), n).passed;
+      }
+    }
+    for (const char* name : {"_a.mat", "_b.mat", "_c.mat"})
+    {
+      std::remove((prefix + name).c_str());
+    }
+    return res;
   }
 
-  for (uint64_t i = 0; i < kCount; ++i)
+  // CSR, BSR (edge blocks) and sgemm_auto (both sides of the crossover) on
+  // padded odd shapes against sgemm on the dense matrix. The tall shape has
+  // more than 65535 rows and block rows, the launches of the cuda backend
+  // are split there
+  bool check_spmm()
   {
-    for (uint64_t j = 0; j < kCount; ++j)
+    struct Shape
+    {
+      uint64_t m, n, k, blockRows, blockCols;
+      std::vector<double> densities;
+    };
+    const float alpha = 0.5f;
+    const uint64_t pad = 3;
+
+    for (const Shape& shape : {Shape{131, 83, 97, 4, 5, {0.05, 0.5}}, Shape{70001, 7, 29, 1, 4, {0.05}}})
     {
-      if (c[i * kCount + j] != expected[i * kCount + j]) {
-          std::cout << "there is an error in c" << std::endl;
-          exit(1);
+      const uint64_t m = shape.m, n = shape.n, k = shape.k;
+      const double bound = (alpha * k * (k + 1.0) + 4.0) * std::ldexp(1.0, -24);
+      for (double density : shape.densities)
+      {
+        const uint64_t lda = k + pad, ldb = n + pad, ldc = n + pad;
+        std::vector<float> a(m * lda), b(k * ldb), c0(m * ldc);
+        for (auto& v : a) v = static_cast<float>(rand()) / RAND_MAX < density ? static_cast<float>(rand()) / RAND_MAX * 2.0f - 1.0f : 0.0f;
+        for (auto& v : b) v = static_cast<float>(rand()) / RAND_MAX * 2.0f - 1.0f;
+        for (auto& v : c0) v = static_cast<float>(rand()) / RAND_MAX * 2.0f - 1.0f;
+        const CsrMatrix csr = CsrMatrix::from_dense(m, k, a.data(), lda);
+        const BsrMatrix bsr = BsrMatrix::from_dense(m, k, a.data(), lda, shape.blockRows, shape.blockCols);
+
+        for (float beta : {0.0f, 1.5f})
+        {
+          std::vector<float> expected(c0);
+          sgemm(Transpose::No, Transpose::No, m, n, k, alpha, a.data(), lda, b.data(), ldb, beta, expected.data(), ldc);
+
+          for (int variant = 0; variant < 3; variant++)
+          {
+            std::vector<float> c(c0);
+            if (variant == 0) spmm(alpha, csr, b.data(), ldb, n, beta, c.data(), ldc);
+            if (variant == 1) spmm(alpha, bsr, b.data(), ldb, n, beta, c.data(), ldc);
+            if (variant == 2) sgemm_auto(m, n, k, alpha, a.data(), lda, b.data(), ldb, beta, c.data(), ldc);
+            for (uint64_t i = 0; i < c.size(); i++)
+            {
+              const bool padding = i % ldc >= n;
+              if ((padding && c[i] != c0[i]) || std::fabs(c[i] - expected[i]) > bound)
+              {
+                return false;
+              }
+            }
+          }
+        }
       }
+    }
+    return true;
+  }
+
+  // bfloat16 and int8 (per row/column quantized) multiplications against the
+  // fp32 reference, within the error bound of the rounding/quantization of
+  // the operands plus the float summation
+  bool check_reduced_precision()
+  {
+    const uint64_t m = 37, n = 53, k = 131, pad = 3;  // odd k: padded pair
+    const float alpha = 0.5f, beta = 2.0f;
+    const double bf16Unit = std::ldexp(1.0, -8);
+    const double fp32Unit = std::ldexp(1.0, -24);
 
-      if (d[i * kCount + j] != expected[i * kCount + j]) {
-          std::cout << "there is an error in d" << std::endl;
-          exit(1);
+    for (Transpose transA : {Transpose::No, Transpose::Yes})
+    {
+      for (Transpose transB : {Transpose::No, Transpose::Yes})
+      {
+        // op(A) and op(B), row major
+        std::vector<float> a(m * k), b(k * n), c(m * n);
+        for (auto& v : a) v = (rand() % 2001 - 1000) / 1000.0f;
+        for (auto& v : b) v = (rand() % 2001 - 1000) / 1000.0f;
+        for (auto& v : c) v = (rand() % 2001 - 1000) / 1000.0f;
+
+        std::vector<float> rowScale(m, 1e-30f), colScale(n, 1e-30f);
+        for (uint64_t i = 0; i < m; i++)
+        {
+          for (uint64_t p = 0; p < k; p++)
+          {
+            rowScale[i] = std::fmax(rowScale[i], std::fabs(a[i * k + p]) / 127.0f);
+          }
+        }
+        for (uint64_t p = 0; p < k; p++)
+        {
+          for (uint64_t j = 0; j < n; j++)
+          {
+            colScale[j] = std::fmax(colScale[j], std::fabs(b[p * n + j]) / 127.0f);
+          }
+        }
+
+        const uint64_t lda = (transA == Transpose::No ? k : m) + pad;
+        const uint64_t ldb = (transB == Transpose::No ? n : k) + pad;
+        auto toBf16 = [](float v, uint64_t, uint64_t) { return BFloat16(v); };
+        const auto ah = store<BFloat16>(a, m, k, transA, lda, toBf16);
+        const auto bh = store<BFloat16>(b, k, n, transB, ldb, toBf16);
+        const auto aq = store<int8_t>(a, m, k, transA, lda, [&](float v, uint64_t i, uint64_t) {
+          return static_cast<int8_t>(std::lround(v / rowScale[i]));
+        });
+        const auto bq = store<int8_t>(b, k, n, transB, ldb, [&](float v, uint64_t, uint64_t j) {
+          return static_cast<int8_t>(std::lround(v / colScale[j]));
+        });
+
+        std::vector<float> ch(c), cq(c);
+        gemm<BFloat16>(transA, transB, m, n, k, alpha, ah.data(), lda, bh.data(), ldb, beta, ch.data(), n);
+        Scales scales;
+        scales.row = rowScale.data();
+        scales.col = colScale.data();
+        gemm<int8_t>(transA, transB, m, n, k, alpha, aq.data(), lda, bq.data(), ldb, beta, cq.data(), n, scales);
+
+        for (uint64_t i = 0; i < m; i++)
+        {
+          for (uint64_t j = 0; j < n; j++)
+          {
+            double exact{}, absSum{}, quantError{};
+            for (uint64_t p = 0; p < k; p++)
+            {
+              const double av = a[i * k + p], bv = b[p * n + j];
+              exact += av * bv;
+              absSum += std::fabs(av * bv);
+              // |a - sa * qa| <= sa / 2, |b - sb * qb| <= sb / 2
+              quantError += std::fabs(av) * colScale[j] / 2 + rowScale[i] / 2 * (std::fabs(bv) + colScale[j] / 2);
+            }
+            const double expected = alpha * exact + beta * c[i * n + j];
+            const double roundoff = (k + 4) * fp32Unit * alpha * (absSum + quantError) +
+                                    4 * fp32Unit * std::fabs(beta * c[i * n + j]);
+
+            if (std::fabs(ch[i * n + j] - expected) > alpha * (2 * bf16Unit + bf16Unit * bf16Unit) * absSum + roundoff ||
+                std::fabs(cq[i * n + j] - expected) > alpha * quantError + roundoff)
+            {
+              return false;
+            }
+          }
+        }
       }
     }
+    return true;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  std::cout << "testing GPU computation" << std::endl;
+
+  const uint64_t kCount = 1024;
+  // we want to compute with addition and multiplication kernel
+  // a*b + a*b = 2*a*b
+  // aligned, on huge pages, first touched and filled in parallel
+  Matrix<float> a(kCount, kCount);
+  Matrix<float> b(kCount, kCount);
+  Matrix<float> c(kCount, kCount);
+  Matrix<float> d(kCount, kCount);
+  a.fill_random(1, 0, 1024);
+  b.fill_random(2, 0, 1024);
+
+  // should use google micro benchmark
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  compute_with_acc_wrapper(a.data(), b.data(), c.data(), kCount);
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  std::cout << "Time difference (Pure GPU) = " << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << "[ms]" << std::endl;
+  // the default session is now warm (device, programs, handles, buffers)
+  begin = std::chrono::steady_clock::now();
+  compute_with_acc_wrapper(a.data(), b.data(), c.data(), kCount);
+  end = std::chrono::steady_clock::now();
+  std::cout << "Time difference (Pure GPU, warm session) = " << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << "[ms]" << std::endl;
+  // d is only written by the backends with an external library
+  const bool hasLib = default_session().has_external_lib();
+  if (hasLib) {
+    begin = std::chrono::steady_clock::now();
+    test_mul_from_external_lib(a.data(), b.data(), d.data(), kCount);
+    end = std::chrono::steady_clock::now();
+    std::cout << "Time difference (Library) = " << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << "[ms]" << std::endl;
+    std::cout << "Time difference (Library) = " << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << "[ucro]" << std::endl;
+  }
+
+  if (!check_sgemm()) {
+    std::cout << "there is an error in sgemm" << std::endl;
+    exit(1);
+  }
+
+  if (!check_batched()) {
+    std::cout << "there is an error in batched sgemm" << std::endl;
+    exit(1);
+  }
+
+  if (!check_async()) {
+    std::cout << "there is an error in async sgemm" << std::endl;
+    exit(1);
+  }
+
+  if (!check_autotune()) {
+    std::cout << "there is an error in autotuned sgemm" << std::endl;
+    exit(1);
+  }
+
+  if (!check_split()) {
+    std::cout << "there is an error in split sgemm" << std::endl;
+    exit(1);
   }
 
-  delete [] a;
-  delete [] b;
-  delete [] c;
-  delete [] d;
-  delete [] expected;
+  if (!check_verify()) {
+    std::cout << "there is an error in verify_gemm" << std::endl;
+    exit(1);
+  }
+
+  if (!check_strassen()) {
+    std::cout << "there is an error in strassen sgemm" << std::endl;
+    exit(1);
+  }
+
+  if (!check_out_of_core()) {
+    std::cout << "there is an error in out-of-core sgemm" << std::endl;
+    exit(1);
+  }
+
+  if (!check_spmm()) {
+    std::cout << "there is an error in sparse spmm" << std::endl;
+    exit(1);
+  }
+
+  if (!check_reduced_precision()) {
+    std::cout << "there is an error in reduced precision gemm" << std::endl;
+    exit(1);
+  }
+
+  // c = d = 2 * a * b, checked against random vectors in O(n^2) with the
+  // rounding of a float sum as tolerance
+  const Verification checkC = verify_gemm(Transpose::No, Transpose::No, kCount, kCount, kCount, 2.0f,
+                                          a.data(), kCount, b.data(), kCount, 0.0f, nullptr, 0, c.data(), kCount);
+  if (!checkC.passed) {
+    std::cout << "there is an error in c (row " << checkC.row << ", " << checkC.worst << " x tolerance)" << std::endl;
+    exit(1);
+  }
+
+  if (hasLib) {
+    const Verification checkD = verify_gemm(Transpose::No, Transpose::No, kCount, kCount, kCount, 2.0f,
+                                            a.data(), kCount, b.data(), kCount, 0.0f, nullptr, 0, d.data(), kCount);
+    if (!checkD.passed) {
+      std::cout << "there is an error in d (row " << checkD.row << ", " << checkD.worst << " x tolerance)" << std::endl;
+      exit(1);
+    }
+  }
 
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "matrix.h"
+#include "compute_pool.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Host memory of the Matrix container, shared by every backend
+
+namespace
+{
+  constexpr size_t kHugePage = size_t{2} * 1024 * 1024;
+
+  size_t round_up(size_t value, size_t multiple)
+  {
+    return (value + multiple - 1) / multiple * multiple;
+  }
+
+  // below one huge page the heap is good enough. Only depends on the size:
+  // the backing reported for a heap block is None, free_pages must still
+  // find the heap for it
+  bool use_heap(size_t bytes)
+  {
+    return bytes < kHugePage;
+  }
+
+  // 2M aligned anonymous mapping (the extra head/tail are unmapped), so
+  // that every page of the block can be promoted
+  void* map_aligned(size_t bytes)
+  {
+    void* raw = mmap(nullptr, bytes + kHugePage, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+      return nullptr;
+    }
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(raw);
+    const uintptr_t aligned = round_up(begin, kHugePage);
+    if (aligned > begin) {
+      munmap(raw, aligned - begin);
+    }
+    const uintptr_t end = begin + bytes + kHugePage;
+    if (end > aligned + bytes) {
+      munmap(reinterpret_cast<void*>(aligned + bytes), end - aligned - bytes);
+    }
+    return reinterpret_cast<void*>(aligned);
+  }
+}
+
+void* allocate_pages(size_t bytes, HugePages& pages)
+{
+  if (use_heap(bytes)) {
+    pages = HugePages::None;
+    void* p = std::aligned_alloc(64, round_up(bytes, 64));
+    if (!p) {
+      throw std::bad_alloc();
+    }
+    return p;
+  }
+
+  const size_t mapped = round_up(bytes, kHugePage);
+  if (pages == HugePages::Explicit) {
+#ifdef MAP_HUGETLB
+    void* p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      return p;
+    }
+#endif
+    static bool once = (std::cerr << "no explicit huge pages available (vm.nr_hugepages), using transparent ones"
+                                  << std::endl, true);
+    (void)once;
+    pages = HugePages::Transparent;
+  }
+
+  void* p = map_aligned(mapped);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+#ifdef MADV_HUGEPAGE
+  // also opts out explicitly, for the comparison when thp is always on
+  madvise(p, mapped, pages == HugePages::Transparent ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+#else
+  pages = HugePages::None;
+#endif
+  return p;
+}
+
+void free_pages(void* p, size_t bytes)
+{
+  if (use_heap(bytes)) {
+    std::free(p);
+  } else {
+    munmap(p, round_up(bytes, kHugePage));
+  }
+}
+
+void parallel_chunks(size_t count, const std::function<void(size_t begin, size_t end)>& f)
+{
+#ifdef _OPENMP
+  // the same threads (and binding) as the compute loops
+#pragma omp parallel
+  {
+    const size_t threads = static_cast<size_t>(omp_get_num_threads());
+    const size_t id = static_cast<size_t>(omp_get_thread_num());
+    const size_t begin = count * id / threads;
+    const size_t end = count * (id + 1) / threads;
+    if (begin < end) {
+      f(begin, end);
+    }
+  }
+#else
+  // the persistent workers, no thread started per call
+  WorkerPool& pool = WorkerPool::instance();
+  const size_t threads = std::min(pool.threads(), std::max<size_t>(count, 1));
+  pool.run(threads, [&f, count, threads](size_t id) {
+    f(count * id / threads, count * (id + 1) / threads);
+  });
+#endif
+}
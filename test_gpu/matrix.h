@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+/// page backing of a Matrix
+enum class HugePages
+{
+  None,         // regular 4k pages
+  Transparent,  // madvise(MADV_HUGEPAGE), the kernel promotes when it can
+  Explicit      // MAP_HUGETLB from the vm.nr_hugepages pool
+};
+
+/// 64 bytes aligned, zeroed memory with the requested page backing. Large
+/// blocks are mapped untouched, pages is updated with the backing really
+/// obtained (explicit huge pages fall back to transparent ones).
+void* allocate_pages(size_t bytes, HugePages& pages);
+void free_pages(void* p, size_t bytes);
+
+/// f(begin, end) on static contiguous chunks of [0, count), one per thread
+/// (OpenMP when the backend has it, the WorkerPool of compute_pool.h
+/// otherwise). The chunks are the ones of a schedule(static) loop, so a
+/// first touch done through it places the pages on the node of the thread
+/// that computes them later (with OpenMP).
+void parallel_chunks(size_t count, const std::function<void(size_t begin, size_t end)>& f);
+
+/// counter based random bits: element i of a fill gets the hash of
+/// (seed, i), so the values do not depend on the number of threads
+inline uint64_t counter_random(uint64_t seed, uint64_t index)
+{
+  // splitmix64 finalizer
+  uint64_t z = seed + (index + 1) * 0x9e3779b97f4a7c15ull;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+///
+/// @brief Row major rows x cols host matrix shared by computeLib and its callers
+///
+/// The storage is 64 bytes aligned (one cache line, one zmm), on huge
+/// pages when requested (fewer TLB misses on large operands) and first
+/// touched in parallel by rows, so that on a NUMA host each block of rows
+/// lands on the node of the thread working on it instead of all of them on
+/// the node of the allocating thread. Run the compute threads with
+/// OMP_PROC_BIND=close so that they keep the same placement.
+///
+template <typename T>
+class Matrix
+{
+public:
+  Matrix() = default;
+
+  Matrix(size_t rows, size_t cols, HugePages pages = HugePages::Transparent)
+    : _rows(rows), _cols(cols), _pages(pages)
+  {
+    if (size() == 0) {
+      return;
+    }
+    _data = static_cast<T*>(allocate_pages(bytes(), _pages));
+    fill(T());
+  }
+
+  ~Matrix()
+  {
+    if (_data) {
+      free_pages(_data, bytes());
+    }
+  }
+
+  Matrix(Matrix&& other) noexcept
+  {
+    swap(other);
+  }
+
+  Matrix& operator=(Matrix&& other) noexcept
+  {
+    Matrix tmp(std::move(other));
+    swap(tmp);
+    return *this;
+  }
+
+  Matrix(const Matrix&) = delete;
+  Matrix& operator=(const Matrix&) = delete;
+
+  T* data() { return _data; }
+  const T* data() const { return _data; }
+  size_t rows() const { return _rows; }
+  size_t cols() const { return _cols; }
+  size_t size() const { return _rows * _cols; }
+  size_t bytes() const { return size() * sizeof(T); }
+  /// backing really obtained
+  HugePages pages() const { return _pages; }
+
+  T& operator()(size_t row, size_t col) { return _data[row * _cols + col]; }
+  const T& operator()(size_t row, size_t col) const { return _data[row * _cols + col]; }
+
+  /// in parallel, by blocks of rows
+  void fill(T value)
+  {
+    for_each_row([this, value](size_t row) {
+      T* out = _data + row * _cols;
+      for (size_t col = 0; col < _cols; col++) {
+        out[col] = value;
+      }
+    });
+  }
+
+  /// integer values uniform in [low, high)
+  void fill_random(uint64_t seed, int64_t low, int64_t high)
+  {
+    const uint64_t range = static_cast<uint64_t>(high - low);
+    for_each_row([this, seed, low, range](size_t row) {
+      T* out = _data + row * _cols;
+      for (size_t col = 0; col < _cols; col++) {
+        // multiply-shift instead of a 64 bits modulo
+        const uint64_t r = counter_random(seed, row * _cols + col);
+        const int64_t v = low + static_cast<int64_t>((static_cast<unsigned __int128>(r) * range) >> 64);
+        out[col] = static_cast<T>(static_cast<float>(v));
+      }
+    });
+  }
+
+  /// real values uniform in [low, high)
+  void fill_uniform(uint64_t seed, double low, double high)
+  {
+    for_each_row([this, seed, low, high](size_t row) {
+      T* out = _data + row * _cols;
+      for (size_t col = 0; col < _cols; col++) {
+        // 53 random bits in [0, 1)
+        const double u = static_cast<double>(counter_random(seed, row * _cols + col) >> 11) / 9007199254740992.0;
+        out[col] = static_cast<T>(static_cast<float>(low + u * (high - low)));
+      }
+    });
+  }
+
+private:
+  template <typename F>
+  void for_each_row(F f)
+  {
+    parallel_chunks(_rows, [&f](size_t begin, size_t end) {
+      for (size_t row = begin; row < end; row++) {
+        f(row);
+      }
+    });
+  }
+
+  void swap(Matrix& other) noexcept
+  {
+    std::swap(_data, other._data);
+    std::swap(_rows, other._rows);
+    std::swap(_cols, other._cols);
+    std::swap(_pages, other._pages);
+  }
+
+  T* _data{nullptr};
+  size_t _rows{0};
+  size_t _cols{0};
+  HugePages _pages{HugePages::None};
+};
@@ -0,0 +1,426 @@
+#include "matrix_file.h"
+#include "compute_timer.h"
+#include "compute_trace.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <utility>
+
+// Matrix files and the out-of-core multiplication, backend independent
+
+namespace
+{
+  const char kMagic[8] = {'C', 'M', 'A', 'T', 'R', 'I', 'X', '\0'};
+  const uint32_t kVersion = 1;
+  const size_t kDataOffset = 4096;
+
+  size_t page_size()
+  {
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+  }
+
+  bool valid_type(uint32_t type)
+  {
+    return type == static_cast<uint32_t>(ElementType::Float32) || type == static_cast<uint32_t>(ElementType::BFloat16) ||
+           type == static_cast<uint32_t>(ElementType::Int8);
+  }
+
+  // rows * cols * size without overflow, false for an unknown element (size 0)
+  bool data_bytes(uint64_t rows, uint64_t cols, size_t size, size_t& bytes)
+  {
+    const uint64_t max = std::numeric_limits<size_t>::max() - kDataOffset;
+    if (size == 0 || (rows != 0 && cols > max / size / rows)) {
+      return false;
+    }
+    bytes = static_cast<size_t>(rows * cols * size);
+    return true;
+  }
+
+  // one read per page, so that the faults are taken by the calling thread
+  void touch(const char* p, size_t length)
+  {
+    const size_t page = page_size();
+    char sink = 0;
+    for (size_t offset = 0; offset < length; offset += page) {
+      sink ^= static_cast<const volatile char*>(p)[offset];
+    }
+    static_cast<void>(sink);
+  }
+}
+
+size_t element_size(ElementType type)
+{
+  switch (type) {
+    case ElementType::Float32: return 4;
+    case ElementType::BFloat16: return 2;
+    case ElementType::Int8: return 1;
+  }
+  return 0;
+}
+
+MatrixFile::~MatrixFile()
+{
+  close();
+}
+
+MatrixFile::MatrixFile(MatrixFile&& other) noexcept
+{
+  *this = std::move(other);
+}
+
+MatrixFile& MatrixFile::operator=(MatrixFile&& other) noexcept
+{
+  if (this != &other) {
+    close();
+    std::swap(_path, other._path);
+    std::swap(_fd, other._fd);
+    std::swap(_base, other._base);
+    std::swap(_length, other._length);
+    std::swap(_data, other._data);
+    std::swap(_rows, other._rows);
+    std::swap(_cols, other._cols);
+    std::swap(_type, other._type);
+    std::swap(_layout, other._layout);
+    std::swap(_writable, other._writable);
+  }
+  return *this;
+}
+
+bool MatrixFile::create(const std::string& path, size_t rows, size_t cols, ElementType type, Layout layout)
+{
+  close();
+  if (!valid_type(static_cast<uint32_t>(type))) {
+    std::cerr << "matrix file " << path << ": unsupported element type " << static_cast<uint32_t>(type) << std::endl;
+    return false;
+  }
+  size_t bytes = 0;
+  if (!data_bytes(rows, cols, element_size(type), bytes)) {
+    std::cerr << "matrix file " << path << ": " << rows << " x " << cols << " is too large" << std::endl;
+    return false;
+  }
+
+  const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::cerr << "cannot create the matrix file " << path << ": " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  const size_t length = kDataOffset + bytes;
+  if (ftruncate(fd, static_cast<off_t>(length)) != 0) {
+    std::cerr << "cannot size the matrix file " << path << ": " << std::strerror(errno) << std::endl;
+    ::close(fd);
+    return false;
+  }
+  _path = path;
+  if (!map(fd, length, true)) {
+    return false;
+  }
+
+  MatrixFileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.type = static_cast<uint32_t>(type);
+  header.layout = static_cast<uint32_t>(layout);
+  header.elementSize = static_cast<uint32_t>(element_size(type));
+  header.rows = rows;
+  header.cols = cols;
+  header.offset = kDataOffset;
+  std::memcpy(_base, &header, sizeof(header));
+
+  _rows = rows;
+  _cols = cols;
+  _type = type;
+  _layout = layout;
+  _data = _base + kDataOffset;
+  return true;
+}
+
+bool MatrixFile::open(const std::string& path, bool writable)
+{
+  close();
+  const int fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "cannot open the matrix file " << path << ": " << std::strerror(errno) << std::endl;
+    return false;
+  }
+
+  struct stat info;
+  MatrixFileHeader header;
+  if (fstat(fd, &info) != 0 || pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+      std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    std::cerr << path << " is not a matrix file" << std::endl;
+    ::close(fd);
+    return false;
+  }
+
+  // the element type first: its size divides in data_bytes
+  size_t bytes = 0;
+  const bool valid = header.version == kVersion && valid_type(header.type) &&
+                     header.elementSize == element_size(static_cast<ElementType>(header.type)) &&
+                     header.layout <= static_cast<uint32_t>(Layout::ColMajor) &&
+                     header.offset >= sizeof(header) && header.offset % kDataOffset == 0 &&
+                     data_bytes(header.rows, header.cols, header.elementSize, bytes) &&
+                     header.offset <= std::numeric_limits<size_t>::max() - bytes &&
+                     static_cast<uint64_t>(info.st_size) >= header.offset + bytes;
+  if (!valid) {
+    std::cerr << "matrix file " << path << ": unsupported version " << header.version
+              << " or inconsistent header / size" << std::endl;
+    ::close(fd);
+    return false;
+  }
+
+  _path = path;
+  if (!map(fd, static_cast<size_t>(header.offset) + bytes, writable)) {
+    return false;
+  }
+  _rows = static_cast<size_t>(header.rows);
+  _cols = static_cast<size_t>(header.cols);
+  _type = static_cast<ElementType>(header.type);
+  _layout = static_cast<Layout>(header.layout);
+  _data = _base + header.offset;
+  return true;
+}
+
+bool MatrixFile::map(int fd, size_t length, bool writable)
+{
+  void* p = mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    std::cerr << "cannot map the matrix file " << _path << ": " << std::strerror(errno) << std::endl;
+    ::close(fd);
+    return false;
+  }
+  _fd = fd;
+  _base = static_cast<char*>(p);
+  _length = length;
+  _writable = writable;
+  return true;
+}
+
+void MatrixFile::close()
+{
+  if (_base) {
+    munmap(_base, _length);
+  }
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+  _fd = -1;
+  _base = nullptr;
+  _length = 0;
+  _data = nullptr;
+  _rows = 0;
+  _cols = 0;
+  _writable = false;
+}
+
+bool MatrixFile::flush()
+{
+  if (!_base || !_writable) {
+    return true;
+  }
+  if (msync(_base, _length, MS_SYNC) != 0) {
+    std::cerr << "cannot write the matrix file " << _path << ": " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool MatrixFile::row_range(size_t begin, size_t end, char*& first, size_t& length) const
+{
+  end = std::min(end, _layout == Layout::RowMajor ? _rows : _cols);
+  if (!_base || begin >= end) {
+    return false;
+  }
+  const size_t row = ld() * element_size(_type);
+  const uintptr_t from = reinterpret_cast<uintptr_t>(static_cast<char*>(_data) + begin * row);
+  const uintptr_t to = reinterpret_cast<uintptr_t>(static_cast<char*>(_data) + end * row);
+  const uintptr_t aligned = from / page_size() * page_size();
+  first = reinterpret_cast<char*>(aligned);
+  length = std::min<uintptr_t>(to - aligned, reinterpret_cast<uintptr_t>(_base + _length) - aligned);
+  return true;
+}
+
+void MatrixFile::will_need(size_t begin, size_t end) const
+{
+  char* first;
+  size_t length;
+  if (row_range(begin, end, first, length)) {
+    madvise(first, length, MADV_WILLNEED);
+  }
+}
+
+void MatrixFile::release(size_t begin, size_t end) const
+{
+  char* first;
+  size_t length;
+  if (!row_range(begin, end, first, length)) {
+    return;
+  }
+  // unmapping moves the dirty bits of the mapping to the page cache, the
+  // writeback is then started without waiting for it
+  madvise(first, length, MADV_DONTNEED);
+#ifdef SYNC_FILE_RANGE_WRITE
+  if (_writable) {
+    sync_file_range(_fd, static_cast<off_t>(first - _base), static_cast<off_t>(length), SYNC_FILE_RANGE_WRITE);
+  }
+#endif
+}
+
+namespace
+{
+  // block of stored rows of a float matrix file
+  struct StoredRows
+  {
+    const MatrixFile* file;
+    size_t begin;
+    size_t end;
+
+    const char* first() const { return static_cast<const char*>(file->data()) + begin * file->ld() * sizeof(float); }
+    size_t bytes() const { return (end - begin) * file->ld() * sizeof(float); }
+  };
+
+  // panels of rows of A/C (mb) and of B (kb) filling the working set:
+  // current and next panel of A and C, current and next panel of B (a
+  // single one when B fits whole)
+  void plan_panels(size_t m, size_t n, size_t k, size_t memory, size_t& mb, size_t& kb)
+  {
+    const size_t elements = memory / sizeof(float);
+    if (m * k + k * n + m * n <= elements) {
+      mb = m;
+      kb = k;
+      return;
+    }
+    // a quarter for B, the multiplications stay large enough to be efficient
+    kb = std::min(k, std::max<size_t>(1, elements / (8 * n)));
+    if (kb > 64 && kb < k) {
+      kb -= kb % 64;
+    }
+    const size_t bElements = (kb == k ? 1 : 2) * kb * n;
+    mb = elements > bElements ? (elements - bElements) / (2 * (k + n)) : 0;
+    mb = std::min(m, std::max<size_t>(1, mb));
+    if (mb > 64 && mb < m) {
+      mb -= mb % 64;
+    }
+  }
+}
+
+bool sgemm_out_of_core(ComputeSession& session, float alpha, const MatrixFile& a, const MatrixFile& b,
+                       float beta, MatrixFile& c, const OutOfCoreOptions& options, ComputeTimings* timings)
+{
+  for (const MatrixFile* file : {&a, &b, static_cast<const MatrixFile*>(&c)}) {
+    if (!file->is_open() || file->type() != ElementType::Float32 || file->layout() != Layout::RowMajor) {
+      std::cerr << "sgemm_out_of_core: the operands must be open float row major matrix files" << std::endl;
+      return false;
+    }
+  }
+  const size_t m = a.rows();
+  const size_t k = a.cols();
+  const size_t n = b.cols();
+  if (b.rows() != k || c.rows() != m || c.cols() != n || !c.writable()) {
+    std::cerr << "sgemm_out_of_core: " << m << " x " << k << " times " << b.rows() << " x " << n
+              << " into " << c.rows() << " x " << c.cols() << (c.writable() ? "" : " (read only)") << std::endl;
+    return false;
+  }
+
+  ComputeTimings local;
+  ComputeTimings& res = timings ? *timings : local;
+  res = ComputeTimings();
+  if (m == 0 || n == 0) {
+    return true;
+  }
+
+  size_t mb, kb;
+  plan_panels(m, n, k, options.memory, mb, kb);
+  const size_t rowPanels = (m + mb - 1) / mb;
+  const size_t depthPanels = k == 0 ? 1 : (k + kb - 1) / kb;
+  const bool readC = beta != 0.0f;
+
+  // everything the step multiplying row panel i by depth panel p reads,
+  // mapped before the step when called ahead
+  auto prefetch = [&](size_t i, size_t p) {
+    const size_t row = i * mb;
+    const size_t rows = std::min(mb, m - row);
+    StoredRows ranges[3];
+    size_t count = 0;
+    if (p == 0) {
+      ranges[count++] = StoredRows{&a, row, row + rows};
+      if (readC) {
+        ranges[count++] = StoredRows{&c, row, row + rows};
+      }
+    }
+    // a single panel of B stays mapped
+    if (depthPanels > 1 || (i == 0 && p == 0)) {
+      ranges[count++] = StoredRows{&b, p * kb, std::min(k, p * kb + kb)};
+    }
+
+    double bytes = 0.0;
+    for (size_t r = 0; r < count; r++) {
+      ranges[r].file->will_need(ranges[r].begin, ranges[r].end);
+      bytes += static_cast<double>(ranges[r].bytes());
+    }
+    COMPUTE_TRACE_SCOPE("io", "read ahead", bytes, 0.0);
+    for (size_t r = 0; r < count; r++) {
+      touch(ranges[r].first(), ranges[r].bytes());
+    }
+  };
+
+  {
+    PhaseTimer timer(res.transfer);
+    prefetch(0, 0);
+  }
+
+  const float* pa = a.data_as<float>();
+  const float* pb = b.data_as<float>();
+  float* pc = c.data_as<float>();
+  for (size_t i = 0; i < rowPanels; i++) {
+    const size_t row = i * mb;
+    const size_t rows = std::min(mb, m - row);
+    for (size_t p = 0; p < depthPanels; p++) {
+      const size_t depth = std::min(kb, k - p * kb);
+      const bool last = i + 1 == rowPanels && p + 1 == depthPanels;
+
+      // the next panels are read while this one is multiplied
+      std::future<void> ahead;
+      if (!last) {
+        const size_t nextI = p + 1 < depthPanels ? i : i + 1;
+        const size_t nextP = p + 1 < depthPanels ? p + 1 : 0;
+        ahead = std::async(std::launch::async, prefetch, nextI, nextP);
+      }
+
+      {
+        PhaseTimer timer(res.compute);
+        session.sgemm(Transpose::No, Transpose::No, rows, n, depth, alpha, pa + row * k + p * kb, k,
+                      pb + p * kb * n, n, p == 0 ? beta : 1.0f, pc + row * n, n);
+      }
+
+      PhaseTimer timer(res.transfer);
+      if (ahead.valid()) {
+        ahead.get();
+      }
+      if (depthPanels > 1) {
+        b.release(p * kb, p * kb + depth);
+      }
+    }
+    a.release(row, row + rows);
+    c.release(row, row + rows);
+  }
+  if (depthPanels == 1) {
+    b.release(0, k);
+  }
+  return true;
+}
+
+bool sgemm_out_of_core(float alpha, const MatrixFile& a, const MatrixFile& b, float beta, MatrixFile& c,
+                       const OutOfCoreOptions& options, ComputeTimings* timings)
+{
+  return sgemm_out_of_core(default_session(), alpha, a, b, beta, c, options, timings);
+}
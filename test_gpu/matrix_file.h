@@ -0,0 +1,153 @@
+#pragma once
+
+#include "compute.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Matrices kept in files and mapped in memory, and the multiplication of
+// operands larger than the host memory
+//
+// File layout (native byte order, little endian on every supported host):
+//   64 bytes header (MatrixFileHeader)
+//   padding up to the data offset, a multiple of 4096
+//   rows * cols elements, stored row by row (RowMajor) or column by column
+//   (ColMajor), without padding
+
+/// element type of a matrix file
+enum class ElementType : uint32_t
+{
+  Float32 = 1,
+  BFloat16 = 2,
+  Int8 = 3
+};
+
+/// storage order of a matrix file
+enum class Layout : uint32_t
+{
+  RowMajor = 0,
+  ColMajor = 1
+};
+
+/// bytes of one element, 0 for an unknown type
+size_t element_size(ElementType type);
+
+struct MatrixFileHeader
+{
+  char magic[8];         // "CMATRIX\0"
+  uint32_t version;      // 1
+  uint32_t type;         // ElementType
+  uint32_t layout;       // Layout
+  uint32_t elementSize;  // bytes, checked against type
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t offset;  // of the data from the start of the file
+  uint64_t reserved[2];
+};
+static_assert(sizeof(MatrixFileHeader) == 64, "the header is part of the file format");
+
+///
+/// @brief Matrix file mapped in memory
+///
+/// The whole file is mapped shared, the pages are read on first access and
+/// written back by the kernel, so a matrix can be larger than the host
+/// memory as long as the accesses are by blocks of stored rows: will_need
+/// starts reading a block ahead (readahead, asynchronous), release drops a
+/// block the caller is done with from the process (the written pages are
+/// queued for writeback first). Errors are reported on stderr and leave the
+/// file closed.
+///
+class MatrixFile
+{
+public:
+  MatrixFile() = default;
+  ~MatrixFile();
+
+  MatrixFile(MatrixFile&& other) noexcept;
+  MatrixFile& operator=(MatrixFile&& other) noexcept;
+
+  MatrixFile(const MatrixFile&) = delete;
+  MatrixFile& operator=(const MatrixFile&) = delete;
+
+  /// creates or truncates path for rows x cols elements, mapped writable,
+  /// the data reads as zeros (sparse file until written)
+  bool create(const std::string& path, size_t rows, size_t cols,
+              ElementType type = ElementType::Float32, Layout layout = Layout::RowMajor);
+  /// maps an existing file, read only unless writable
+  bool open(const std::string& path, bool writable = false);
+  /// unmaps, the written pages are left to the kernel writeback (see flush)
+  void close();
+  /// writes the modified pages to disk and waits for them
+  bool flush();
+
+  bool is_open() const { return _base != nullptr; }
+  bool writable() const { return _writable; }
+  size_t rows() const { return _rows; }
+  size_t cols() const { return _cols; }
+  ElementType type() const { return _type; }
+  Layout layout() const { return _layout; }
+  /// elements of a stored row: cols for RowMajor, rows for ColMajor
+  size_t ld() const { return _layout == Layout::RowMajor ? _cols : _rows; }
+  size_t bytes() const { return _rows * _cols * element_size(_type); }
+
+  /// 4096 bytes aligned elements, typed access to check the element type
+  void* data() { return _data; }
+  const void* data() const { return _data; }
+  template <typename T>
+  T* data_as() { return static_cast<T*>(_data); }
+  template <typename T>
+  const T* data_as() const { return static_cast<const T*>(_data); }
+
+  /// stored rows [begin, end) will be read soon: readahead is started,
+  /// returns at once
+  void will_need(size_t begin, size_t end) const;
+  /// stored rows [begin, end) are not needed for now: the modified pages
+  /// are queued for writeback and the pages are unmapped from the process
+  /// (they stay in the page cache while memory allows, a later access
+  /// reads them again)
+  void release(size_t begin, size_t end) const;
+
+private:
+  bool map(int fd, size_t length, bool writable);
+  // page aligned byte range of stored rows [begin, end)
+  bool row_range(size_t begin, size_t end, char*& first, size_t& length) const;
+
+  std::string _path;
+  int _fd{-1};
+  char* _base{nullptr};
+  size_t _length{0};
+  void* _data{nullptr};
+  size_t _rows{0};
+  size_t _cols{0};
+  ElementType _type{ElementType::Float32};
+  Layout _layout{Layout::RowMajor};
+  bool _writable{false};
+};
+
+/// working set of sgemm_out_of_core
+struct OutOfCoreOptions
+{
+  /// bytes of the operands mapped at once (panels of A, B and C, the ones
+  /// read ahead included), 1 GiB by default
+  size_t memory{size_t{1} << 30};
+};
+
+/// C = alpha * A * B + beta * C on float row major matrix files, A m x k,
+/// B k x n and C m x n (writable), by panels fitting in options.memory:
+/// for each panel of rows of A and C, the panels of rows of B are streamed
+/// through session.sgemm, directly from the mappings. The next panels are
+/// read ahead by a background thread while the current one is multiplied,
+/// and the panels done with are released, so that the process memory stays
+/// bounded and the multiply runs at the disk bandwidth when the devices are
+/// faster. A and C are read once, B once per panel of rows. The timings get
+/// the time spent waiting for the panels not read ahead in time and
+/// releasing the ones done with (transfer) and the multiplications
+/// (compute). False, with a message on stderr, when the files do not match
+/// (shapes, float row major, C writable).
+bool sgemm_out_of_core(ComputeSession& session, float alpha, const MatrixFile& a, const MatrixFile& b,
+                       float beta, MatrixFile& c, const OutOfCoreOptions& options = OutOfCoreOptions(),
+                       ComputeTimings* timings = nullptr);
+/// same on the default session
+bool sgemm_out_of_core(float alpha, const MatrixFile& a, const MatrixFile& b, float beta, MatrixFile& c,
+                       const OutOfCoreOptions& options = OutOfCoreOptions(), ComputeTimings* timings = nullptr);
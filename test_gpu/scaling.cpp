@@ -0,0 +1,95 @@
+#include "compute.h"
+#include "compute_verify.h"
+#include "matrix.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// sgemm gflops of the session backend from 1 to N threads (see README)
+//
+// $ ./scaling [N, default all the cores] [sizes, default 256 512 1024]
+// $ node scaling.js 8 512 1024    # emscripten build
+
+namespace
+{
+  // best of the repetitions, after a warm-up call
+  double best_seconds(size_t count, const Matrix<float>& a, const Matrix<float>& b, Matrix<float>& c)
+  {
+    sgemm(Transpose::No, Transpose::No, count, count, count, 1.0f, a.data(), count, b.data(), count,
+          0.0f, c.data(), count);
+    double best = 1e30;
+    for (int rep = 0; rep < 5; rep++)
+    {
+      const auto begin = std::chrono::steady_clock::now();
+      sgemm(Transpose::No, Transpose::No, count, count, count, 1.0f, a.data(), count, b.data(), count,
+            0.0f, c.data(), count);
+      best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+    }
+    return best;
+  }
+
+  // 1, 2, 4 ... and max
+  std::vector<size_t> thread_counts(size_t max)
+  {
+    std::vector<size_t> counts;
+    for (size_t t = 1; t < max; t *= 2)
+    {
+      counts.push_back(t);
+    }
+    counts.push_back(max);
+    return counts;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const size_t maxThreads = argc > 1 ? std::max(1, std::atoi(argv[1])) : compute_threads();
+  std::vector<size_t> sizes;
+  for (int i = 2; i < argc; i++)
+  {
+    sizes.push_back(std::max(1, std::atoi(argv[i])));
+  }
+  if (sizes.empty())
+  {
+    sizes = {256, 512, 1024};
+  }
+
+  std::cout << default_session().backend() << ", 1 to " << maxThreads << " threads" << std::endl;
+  std::printf("%8s %8s %10s %10s %8s %10s\n", "size", "threads", "ms", "gflops", "speedup", "efficiency");
+  for (size_t count : sizes)
+  {
+    Matrix<float> a(count, count);
+    Matrix<float> b(count, count);
+    Matrix<float> c(count, count);
+    a.fill_random(1, 0, 1024);
+    b.fill_random(2, 0, 1024);
+
+    double single = 0.0;
+    for (size_t threads : thread_counts(maxThreads))
+    {
+      set_compute_threads(threads);
+      const double seconds = best_seconds(count, a, b, c);
+      if (threads == 1)
+      {
+        single = seconds;
+      }
+      const double speedup = single / seconds;
+      std::printf("%8zu %8zu %10.3f %10.2f %8.2f %9.0f%%\n", count, threads, 1e3 * seconds,
+                  2.0 * count * count * count / seconds * 1e-9, speedup, 100.0 * speedup / threads);
+    }
+
+    // the tiles of all the threads put together
+    if (!verify_gemm(Transpose::No, Transpose::No, count, count, count, 1.0f, a.data(), count, b.data(), count,
+                     0.0f, nullptr, count, c.data(), count).passed)
+    {
+      std::cout << "there is an error in sgemm " << count << " with " << maxThreads << " threads" << std::endl;
+      return 1;
+    }
+  }
+  set_compute_threads(0);
+  return 0;
+}
@@ -0,0 +1,155 @@
+// Array kernels of calc (SIMD128 and scalar builds) against one call of the
+// scalar exports per element, under Node:
+// > node bench.mjs [build directory, default build]
+
+import { readFile } from 'node:fs/promises';
+import { performance } from 'node:perf_hooks';
+import { loadCalc } from './calc.mjs';
+
+const dir = process.argv[2] ?? 'build';
+
+async function load(file) {
+  let bytes;
+  try {
+    bytes = await readFile(`${dir}/${file}`);
+  } catch {
+    console.log(`${dir}/${file} not found, skipped`);
+    return null;
+  }
+  return loadCalc(bytes);
+}
+
+// best time of a call in ms, calls repeated for about 100 ms
+function time(fn) {
+  fn();
+  let best = Infinity;
+  const end = performance.now() + 100;
+  do {
+    const start = performance.now();
+    fn();
+    best = Math.min(best, performance.now() - start);
+  } while (performance.now() < end);
+  return Number(best.toPrecision(3));
+}
+
+function random(view, integers) {
+  for (let i = 0; i < view.length; i++) {
+    view[i] = integers ? (Math.random() * 2000 - 1000) | 0 : Math.random() * 2 - 1;
+  }
+}
+
+// inputs and output in the arena of the module
+function arrays(calc, n) {
+  calc.reset();
+  const a = calc.array(Int32Array, n);
+  const b = calc.array(Int32Array, n);
+  const out = calc.array(Int32Array, n);
+  const buffer = calc.memory.buffer;
+  return {
+    pa: a.offset, pb: b.offset, pout: out.offset,
+    ia: a.view, ib: b.view, iout: out.view,
+    fa: new Float32Array(buffer, a.offset, n), fb: new Float32Array(buffer, b.offset, n),
+  };
+}
+
+function benchArrays(builds, n) {
+  const rows = {};
+  const row = (name, ms) => {
+    rows[name] = { ...rows[name], ...ms };
+  };
+
+  for (const [build, calc] of Object.entries(builds)) {
+    const exports = calc.exports;
+    const x = arrays(calc, n);
+    random(x.ia, true);
+    random(x.ib, true);
+    // per element: the scalar add of the module, once per value
+    if (build === 'simd') {
+      row('add i32, add() per element', {
+        [build]: time(() => {
+          for (let i = 0; i < n; i++) {
+            x.iout[i] = exports.add(x.ia[i], x.ib[i]);
+          }
+        }),
+      });
+    }
+    row('add i32', { [build]: time(() => exports.calc_add_i32(x.pa, x.pb, x.pout, n)) });
+    row('mul i32', { [build]: time(() => exports.calc_mul_i32(x.pa, x.pb, x.pout, n)) });
+    row('sum i32', { [build]: time(() => exports.calc_sum_i32(x.pa, n)) });
+
+    random(x.fa, false);
+    random(x.fb, false);
+    row('add f32', { [build]: time(() => exports.calc_add_f32(x.pa, x.pb, x.pout, n)) });
+    row('mul f32', { [build]: time(() => exports.calc_mul_f32(x.pa, x.pb, x.pout, n)) });
+    row('dot f32', { [build]: time(() => exports.calc_dot_f32(x.pa, x.pb, n)) });
+    row('sum f32', { [build]: time(() => exports.calc_sum_f32(x.pa, n)) });
+    row('min f32', { [build]: time(() => exports.calc_min_f32(x.pa, n)) });
+  }
+
+  // the same in JS, for reference
+  const fa = new Float32Array(n);
+  const fb = new Float32Array(n);
+  random(fa, false);
+  random(fb, false);
+  row('dot f32', {
+    js: time(() => {
+      let sum = 0;
+      for (let i = 0; i < n; i++) {
+        sum += fa[i] * fb[i];
+      }
+      return sum;
+    }),
+  });
+
+  console.log(`\n${n} elements, ms`);
+  console.table(rows);
+}
+
+function benchSgemm(builds, size) {
+  const rows = {};
+  for (const [build, calc] of Object.entries(builds)) {
+    const exports = calc.exports;
+    calc.reset();
+    const a = calc.array(Float32Array, size * size);
+    const b = calc.array(Float32Array, size * size);
+    const c = calc.array(Float32Array, size * size);
+    random(a.view, false);
+    random(b.view, false);
+    const ms = time(() => exports.calc_sgemm(size, size, size, 1.0, a.offset, size, b.offset, size, 0.0, c.offset, size));
+    rows[build] = { ms, gflops: Number(((2 * size ** 3) / ms / 1e6).toPrecision(3)) };
+
+    // checked against a JS loop
+    for (let check = 0; check < 16; check++) {
+      const i = (Math.random() * size) | 0;
+      const j = (Math.random() * size) | 0;
+      let expected = 0;
+      for (let p = 0; p < size; p++) {
+        expected += a.view[i * size + p] * b.view[p * size + j];
+      }
+      if (Math.abs(c.view[i * size + j] - expected) > 1e-4 * size) {
+        console.log(`there is an error in calc_sgemm (${build}) at ${i}, ${j}: ${c.view[i * size + j]} instead of ${expected}`);
+        process.exit(1);
+      }
+    }
+  }
+  console.log(`\nsgemm ${size}`);
+  console.table(rows);
+}
+
+const builds = {};
+for (const [build, file] of [['simd', 'calc.wasm'], ['scalar', 'calc_scalar.wasm']]) {
+  const calc = await load(file);
+  if (calc) {
+    builds[build] = calc;
+  }
+}
+if (Object.keys(builds).length === 0) {
+  process.exit(1);
+}
+
+for (const n of [1024, 65536, 1 << 20]) {
+  benchArrays(builds, n);
+}
+for (const size of [64, 256]) {
+  benchSgemm(builds, size);
+}
@@ -1,4 +1,131 @@
-extern "C" 
+#include "calc.hpp"
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+namespace
+{
+    // scalar loops, the whole fallback build and the tails of the SIMD one
+    template <typename T, typename Op>
+    void map_scalar(const T* a, const T* b, T* out, int begin, int n, Op op)
+    {
+        for (int i = begin; i < n; i++) {
+            out[i] = op(a[i], b[i]);
+        }
+    }
+
+    constexpr float kInfinity = __builtin_inff();
+
+    // C row block [i0, i1) x [j0, j1), i-p-j loops
+    void sgemm_scalar(int i0, int i1, int j0, int j1, int k, float alpha, const float* a, int lda,
+                      const float* b, int ldb, float beta, float* c, int ldc)
+    {
+        for (int i = i0; i < i1; i++) {
+            float* row = c + i * ldc;
+            for (int j = j0; j < j1; j++) {
+                row[j] = beta == 0.0f ? 0.0f : beta * row[j];
+            }
+            for (int p = 0; p < k; p++) {
+                const float ap = alpha * a[i * lda + p];
+                const float* brow = b + p * ldb;
+                for (int j = j0; j < j1; j++) {
+                    row[j] += ap * brow[j];
+                }
+            }
+        }
+    }
+
+#ifdef __wasm_simd128__
+    template <typename Op>
+    void map_i32(const int* a, const int* b, int* out, int n, Op op)
+    {
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            wasm_v128_store(out + i, op(wasm_v128_load(a + i), wasm_v128_load(b + i)));
+        }
+        map_scalar(a, b, out, i, n, [op](int x, int y) {
+            return wasm_i32x4_extract_lane(op(wasm_i32x4_splat(x), wasm_i32x4_splat(y)), 0);
+        });
+    }
+
+    template <typename Op>
+    void map_f32(const float* a, const float* b, float* out, int n, Op op)
+    {
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            wasm_v128_store(out + i, op(wasm_v128_load(a + i), wasm_v128_load(b + i)));
+        }
+        map_scalar(a, b, out, i, n, [op](float x, float y) {
+            return wasm_f32x4_extract_lane(op(wasm_f32x4_splat(x), wasm_f32x4_splat(y)), 0);
+        });
+    }
+
+    // 4 accumulators of 4 lanes, then the lanes and the tail
+    template <typename Load, typename Op>
+    float reduce_f32(int n, float init, Load load, Op op)
+    {
+        v128_t acc0 = wasm_f32x4_splat(init);
+        v128_t acc1 = acc0;
+        v128_t acc2 = acc0;
+        v128_t acc3 = acc0;
+        int i = 0;
+        for (; i + 16 <= n; i += 16) {
+            acc0 = op(acc0, load(i));
+            acc1 = op(acc1, load(i + 4));
+            acc2 = op(acc2, load(i + 8));
+            acc3 = op(acc3, load(i + 12));
+        }
+        for (; i + 4 <= n; i += 4) {
+            acc0 = op(acc0, load(i));
+        }
+        const v128_t acc = op(op(acc0, acc1), op(acc2, acc3));
+        v128_t lanes = op(acc, wasm_i32x4_shuffle(acc, acc, 2, 3, 0, 1));
+        lanes = op(lanes, wasm_i32x4_shuffle(lanes, lanes, 1, 0, 3, 2));
+        float result = wasm_f32x4_extract_lane(lanes, 0);
+        for (; i < n; i++) {
+            result = wasm_f32x4_extract_lane(op(wasm_f32x4_splat(result), load(i, true)), 0);
+        }
+        return result;
+    }
+
+    // C[4 x 8] tile at (i, j): 8 accumulators, A broadcast, 2 vectors of B
+    void sgemm_tile(int i, int j, int k, float alpha, const float* a, int lda,
+                    const float* b, int ldb, float beta, float* c, int ldc)
+    {
+        v128_t acc[4][2];
+        for (int r = 0; r < 4; r++) {
+            acc[r][0] = wasm_f32x4_splat(0.0f);
+            acc[r][1] = acc[r][0];
+        }
+        const float* bp = b + j;
+        for (int p = 0; p < k; p++, bp += ldb) {
+            const v128_t b0 = wasm_v128_load(bp);
+            const v128_t b1 = wasm_v128_load(bp + 4);
+            for (int r = 0; r < 4; r++) {
+                const v128_t ar = wasm_f32x4_splat(a[(i + r) * lda + p]);
+                acc[r][0] = wasm_f32x4_add(acc[r][0], wasm_f32x4_mul(ar, b0));
+                acc[r][1] = wasm_f32x4_add(acc[r][1], wasm_f32x4_mul(ar, b1));
+            }
+        }
+
+        const v128_t va = wasm_f32x4_splat(alpha);
+        const v128_t vb = wasm_f32x4_splat(beta);
+        for (int r = 0; r < 4; r++) {
+            float* row = c + (i + r) * ldc + j;
+            for (int h = 0; h < 2; h++) {
+                v128_t result = wasm_f32x4_mul(va, acc[r][h]);
+                if (beta != 0.0f) {
+                    result = wasm_f32x4_add(result, wasm_f32x4_mul(vb, wasm_v128_load(row + 4 * h)));
+                }
+                wasm_v128_store(row + 4 * h, result);
+            }
+        }
+    }
+#endif
+}
+
+extern "C"
 {
     int add(int a, int b)
     {
@@ -8,4 +135,173 @@ extern "C"
     {
         return a - b;
     }
-}
\ No newline at end of file
+
+#ifdef __wasm_simd128__
+    void calc_add_i32(const int* a, const int* b, int* out, int n)
+    {
+        map_i32(a, b, out, n, [](v128_t x, v128_t y) { return wasm_i32x4_add(x, y); });
+    }
+    void calc_sub_i32(const int* a, const int* b, int* out, int n)
+    {
+        map_i32(a, b, out, n, [](v128_t x, v128_t y) { return wasm_i32x4_sub(x, y); });
+    }
+    void calc_mul_i32(const int* a, const int* b, int* out, int n)
+    {
+        map_i32(a, b, out, n, [](v128_t x, v128_t y) { return wasm_i32x4_mul(x, y); });
+    }
+    void calc_add_f32(const float* a, const float* b, float* out, int n)
+    {
+        map_f32(a, b, out, n, [](v128_t x, v128_t y) { return wasm_f32x4_add(x, y); });
+    }
+    void calc_sub_f32(const float* a, const float* b, float* out, int n)
+    {
+        map_f32(a, b, out, n, [](v128_t x, v128_t y) { return wasm_f32x4_sub(x, y); });
+    }
+    void calc_mul_f32(const float* a, const float* b, float* out, int n)
+    {
+        map_f32(a, b, out, n, [](v128_t x, v128_t y) { return wasm_f32x4_mul(x, y); });
+    }
+
+    // tail lanes (single) are loaded alone, the others stay neutral
+    float calc_dot_f32(const float* a, const float* b, int n)
+    {
+        return reduce_f32(n, 0.0f, [a, b](int i, bool single = false) {
+            return single ? wasm_f32x4_make(a[i] * b[i], 0.0f, 0.0f, 0.0f)
+                          : wasm_f32x4_mul(wasm_v128_load(a + i), wasm_v128_load(b + i));
+        }, [](v128_t x, v128_t y) { return wasm_f32x4_add(x, y); });
+    }
+    int calc_sum_i32(const int* a, int n)
+    {
+        v128_t acc = wasm_i32x4_splat(0);
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            acc = wasm_i32x4_add(acc, wasm_v128_load(a + i));
+        }
+        // wrapping like i32x4.add
+        acc = wasm_i32x4_add(acc, wasm_i32x4_shuffle(acc, acc, 2, 3, 0, 1));
+        acc = wasm_i32x4_add(acc, wasm_i32x4_shuffle(acc, acc, 1, 0, 3, 2));
+        unsigned sum = static_cast<unsigned>(wasm_i32x4_extract_lane(acc, 0));
+        for (; i < n; i++) {
+            sum += static_cast<unsigned>(a[i]);
+        }
+        return static_cast<int>(sum);
+    }
+    float calc_sum_f32(const float* a, int n)
+    {
+        return reduce_f32(n, 0.0f, [a](int i, bool single = false) {
+            return single ? wasm_f32x4_make(a[i], 0.0f, 0.0f, 0.0f) : wasm_v128_load(a + i);
+        }, [](v128_t x, v128_t y) { return wasm_f32x4_add(x, y); });
+    }
+    // pmin/pmax: b < a ? b : a, a NaN in b is skipped
+    float calc_min_f32(const float* a, int n)
+    {
+        return reduce_f32(n, kInfinity, [a](int i, bool single = false) {
+            return single ? wasm_f32x4_splat(a[i]) : wasm_v128_load(a + i);
+        }, [](v128_t x, v128_t y) { return wasm_f32x4_pmin(x, y); });
+    }
+    float calc_max_f32(const float* a, int n)
+    {
+        return reduce_f32(n, -kInfinity, [a](int i, bool single = false) {
+            return single ? wasm_f32x4_splat(a[i]) : wasm_v128_load(a + i);
+        }, [](v128_t x, v128_t y) { return wasm_f32x4_pmax(x, y); });
+    }
+
+    void calc_sgemm(int m, int n, int k, float alpha, const float* a, int lda,
+                    const float* b, int ldb, float beta, float* c, int ldc)
+    {
+        const int m4 = m / 4 * 4;
+        const int n8 = n / 8 * 8;
+        for (int i = 0; i < m4; i += 4) {
+            for (int j = 0; j < n8; j += 8) {
+                sgemm_tile(i, j, k, alpha, a, lda, b, ldb, beta, c, ldc);
+            }
+        }
+        // right columns, then bottom rows
+        sgemm_scalar(0, m4, n8, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+        sgemm_scalar(m4, m, 0, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+    }
+
+    int calc_simd()
+    {
+        return 1;
+    }
+#else
+    void calc_add_i32(const int* a, const int* b, int* out, int n)
+    {
+        map_scalar(a, b, out, 0, n, [](int x, int y) { return x + y; });
+    }
+    void calc_sub_i32(const int* a, const int* b, int* out, int n)
+    {
+        map_scalar(a, b, out, 0, n, [](int x, int y) { return x - y; });
+    }
+    void calc_mul_i32(const int* a, const int* b, int* out, int n)
+    {
+        // wrapping like i32x4.mul
+        map_scalar(a, b, out, 0, n, [](int x, int y) { return static_cast<int>(static_cast<unsigned>(x) * static_cast<unsigned>(y)); });
+    }
+    void calc_add_f32(const float* a, const float* b, float* out, int n)
+    {
+        map_scalar(a, b, out, 0, n, [](float x, float y) { return x + y; });
+    }
+    void calc_sub_f32(const float* a, const float* b, float* out, int n)
+    {
+        map_scalar(a, b, out, 0, n, [](float x, float y) { return x - y; });
+    }
+    void calc_mul_f32(const float* a, const float* b, float* out, int n)
+    {
+        map_scalar(a, b, out, 0, n, [](float x, float y) { return x * y; });
+    }
+
+    float calc_dot_f32(const float* a, const float* b, int n)
+    {
+        float sum = 0.0f;
+        for (int i = 0; i < n; i++) {
+            sum += a[i] * b[i];
+        }
+        return sum;
+    }
+    int calc_sum_i32(const int* a, int n)
+    {
+        unsigned sum = 0;
+        for (int i = 0; i < n; i++) {
+            sum += static_cast<unsigned>(a[i]);
+        }
+        return static_cast<int>(sum);
+    }
+    float calc_sum_f32(const float* a, int n)
+    {
+        float sum = 0.0f;
+        for (int i = 0; i < n; i++) {
+            sum += a[i];
+        }
+        return sum;
+    }
+    float calc_min_f32(const float* a, int n)
+    {
+        float result = kInfinity;
+        for (int i = 0; i < n; i++) {
+            result = a[i] < result ? a[i] : result;
+        }
+        return result;
+    }
+    float calc_max_f32(const float* a, int n)
+    {
+        float result = -kInfinity;
+        for (int i = 0; i < n; i++) {
+            result = result < a[i] ? a[i] : result;
+        }
+        return result;
+    }
+
+    void calc_sgemm(int m, int n, int k, float alpha, const float* a, int lda,
+                    const float* b, int ldb, float beta, float* c, int ldc)
+    {
+        sgemm_scalar(0, m, 0, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+    }
+
+    int calc_simd()
+    {
+        return 0;
+    }
+#endif
+}
@@ -1,5 +1,55 @@
-extern "C" 
+#pragma once
+
+#include <stddef.h>
+
+// exported by the module (kept alive when not a side module)
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#define CALC_EXPORT EMSCRIPTEN_KEEPALIVE
+#else
+#define CALC_EXPORT
+#endif
+
+extern "C"
 {
-    int add(int a, int b);
-    int sub(int a, int b);
-}
\ No newline at end of file
+    CALC_EXPORT int add(int a, int b);
+    CALC_EXPORT int sub(int a, int b);
+
+    // Array kernels, on buffers of the linear memory (pointers are offsets
+    // in memory.buffer for JS). SIMD128 when built with -msimd128, scalar
+    // otherwise; out may be one of the inputs.
+
+    // out[i] = a[i] op b[i], i < n
+    CALC_EXPORT void calc_add_i32(const int* a, const int* b, int* out, int n);
+    CALC_EXPORT void calc_sub_i32(const int* a, const int* b, int* out, int n);
+    CALC_EXPORT void calc_mul_i32(const int* a, const int* b, int* out, int n);
+    CALC_EXPORT void calc_add_f32(const float* a, const float* b, float* out, int n);
+    CALC_EXPORT void calc_sub_f32(const float* a, const float* b, float* out, int n);
+    CALC_EXPORT void calc_mul_f32(const float* a, const float* b, float* out, int n);
+
+    // sum of a[i] * b[i]
+    CALC_EXPORT float calc_dot_f32(const float* a, const float* b, int n);
+    // reductions, min/max of nothing are +/-infinity, NaNs are skipped
+    CALC_EXPORT int calc_sum_i32(const int* a, int n);
+    CALC_EXPORT float calc_sum_f32(const float* a, int n);
+    CALC_EXPORT float calc_min_f32(const float* a, int n);
+    CALC_EXPORT float calc_max_f32(const float* a, int n);
+
+    // C = alpha * A * B + beta * C, row major, A m x k, B k x n, C m x n
+    // (test_gpu sgemm without transposes)
+    CALC_EXPORT void calc_sgemm(int m, int n, int k, float alpha, const float* a, int lda,
+                                const float* b, int ldb, float beta, float* c, int ldc);
+
+    // 1 when built with SIMD128
+    CALC_EXPORT int calc_simd();
+
+    // Memory for the arrays of JS (calc.mjs), 16 bytes aligned, 0 when the
+    // memory cannot grow.
+    // long-lived buffers, free lists of power of 2 sizes
+    CALC_EXPORT void* calc_malloc(size_t bytes);
+    CALC_EXPORT void calc_free(void* ptr);
+    // arena: everything allocated is freed at once by calc_reset (the
+    // chunks are kept), not by calc_free
+    CALC_EXPORT void* calc_alloc(size_t bytes);
+    CALC_EXPORT void calc_reset();
+}
@@ -0,0 +1,90 @@
+// Loading of calc.wasm and typed arrays in its memory, for browsers and Node:
+//
+//   const calc = await loadCalc(fetch('build/calc.wasm'));  // or the bytes
+//   const a = calc.array(Float32Array, n);                  // arena
+//   a.view.set(values);                                     // in place
+//   calc.exports.calc_sum_f32(a.offset, n);
+//   calc.reset();                                           // frees the arena
+//
+// The views are created again when the memory grew (its ArrayBuffer is then
+// detached): use `.view` after any call that can allocate, do not keep it.
+
+// Typed array at an offset of the memory of the module
+export class CalcArray {
+  constructor(calc, Type, offset, length, longLived) {
+    this.calc = calc;
+    this.Type = Type;
+    this.offset = offset;
+    this.length = length;
+    this.longLived = longLived;
+    this._view = new Type(calc.memory.buffer, offset, length);
+  }
+
+  // view on the current buffer of the memory
+  get view() {
+    if (this._view.buffer !== this.calc.memory.buffer) {
+      this._view = new this.Type(this.calc.memory.buffer, this.offset, this.length);
+    }
+    return this._view;
+  }
+
+  // long-lived arrays only, the arena ones go with calc.reset()
+  free() {
+    if (!this.longLived) {
+      throw new Error('arena arrays are freed by reset()');
+    }
+    this.calc.exports.calc_free(this.offset);
+    this._view = null;
+  }
+}
+
+export class Calc {
+  constructor(instance) {
+    this.exports = instance.exports;
+    this.memory = instance.exports.memory;
+  }
+
+  // Type (Float32Array, Int32Array...) of length elements in the arena,
+  // valid until reset()
+  array(Type, length) {
+    return this._allocate(Type, length, false);
+  }
+
+  // the same, until free()
+  buffer(Type, length) {
+    return this._allocate(Type, length, true);
+  }
+
+  reset() {
+    this.exports.calc_reset();
+  }
+
+  _allocate(Type, length, longLived) {
+    const bytes = Type.BYTES_PER_ELEMENT * length;
+    const allocate = longLived ? this.exports.calc_malloc : this.exports.calc_alloc;
+    // offsets above 2 GB come back negative (i32)
+    const offset = allocate(bytes) >>> 0;
+    if (offset === 0) {
+      throw new RangeError(`cannot allocate ${bytes} bytes in the calc memory`);
+    }
+    return new CalcArray(this, Type, offset, length, longLived);
+  }
+}
+
+// source: bytes (Node), or a Response or a promise of one (fetch)
+export async function loadCalc(source) {
+  const module = source instanceof ArrayBuffer || ArrayBuffer.isView(source)
+    ? await WebAssembly.compile(source)
+    : await WebAssembly.compileStreaming(source);
+  // the runtime imports of the standalone module (if any) are unused
+  const imports = {};
+  for (const { module: name, name: field, kind } of WebAssembly.Module.imports(module)) {
+    if (kind === 'function') {
+      (imports[name] ??= {})[field] = () => 0;
+    }
+  }
+  const instance = await WebAssembly.instantiate(module, imports);
+  // constructors, the allocator included
+  instance.exports._initialize?.();
+  return new Calc(instance);
+}
@@ -0,0 +1,210 @@
+#include "calc.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+// Memory of the module for JS: calc_malloc/calc_free (free lists) for the
+// long-lived buffers, calc_alloc/calc_reset (arena) for the per call ones.
+// The heap starts at __heap_base and grows with memory.grow; pages grown by
+// someone else are skipped.
+
+namespace
+{
+    constexpr std::size_t kAlign = 16;
+    constexpr std::size_t kPage = 65536;
+    // block sizes 16 << class, up to 2 GB
+    constexpr int kClasses = 28;
+    // arena chunks, larger allocations get a chunk of their own
+    constexpr std::size_t kChunk = 1 << 20;
+
+    constexpr std::size_t align(std::size_t bytes)
+    {
+        return (bytes + kAlign - 1) & ~(kAlign - 1);
+    }
+
+    // before each calc_malloc block, 16 bytes to keep the payload aligned
+    struct alignas(kAlign) Block
+    {
+        Block* next;
+        int sizeClass;
+    };
+
+    // arena chunk, in a calc_malloc block
+    struct alignas(kAlign) Chunk
+    {
+        Chunk* next;
+        std::size_t bytes;
+    };
+
+#ifdef __wasm__
+    extern "C" unsigned char __heap_base;
+
+    std::size_t memory_end()
+    {
+        return __builtin_wasm_memory_size(0) * kPage;
+    }
+
+    // start of the pages added, 0 if the memory cannot grow
+    std::size_t grow(std::size_t pages)
+    {
+        const std::ptrdiff_t old = __builtin_wasm_memory_grow(0, pages);
+        return old < 0 ? 0 : static_cast<std::size_t>(old) * kPage;
+    }
+
+    std::size_t heap_base()
+    {
+        return reinterpret_cast<std::size_t>(&__heap_base);
+    }
+#else
+    // native builds (checks): a fixed pool
+    alignas(kAlign) unsigned char pool[64 << 20];
+    std::size_t poolPages = 1;
+
+    std::size_t memory_end()
+    {
+        return reinterpret_cast<std::size_t>(pool) + poolPages * kPage;
+    }
+
+    std::size_t grow(std::size_t pages)
+    {
+        if ((poolPages + pages) * kPage > sizeof(pool)) {
+            return 0;
+        }
+        const std::size_t start = memory_end();
+        poolPages += pages;
+        return start;
+    }
+
+    std::size_t heap_base()
+    {
+        return reinterpret_cast<std::size_t>(pool);
+    }
+#endif
+
+    class Heap
+    {
+    public:
+        // the memory at instantiation, before JS could grow it
+        Heap() : _top(align(heap_base())), _end(memory_end())
+        {
+        }
+
+        void* malloc(std::size_t bytes)
+        {
+            int sizeClass = 0;
+            while ((kAlign << sizeClass) < bytes) {
+                if (++sizeClass == kClasses) {
+                    return nullptr;
+                }
+            }
+            Block* block = _free[sizeClass];
+            if (block) {
+                _free[sizeClass] = block->next;
+            } else {
+                block = static_cast<Block*>(take(sizeof(Block) + (kAlign << sizeClass)));
+                if (!block) {
+                    return nullptr;
+                }
+                block->sizeClass = sizeClass;
+            }
+            return block + 1;
+        }
+
+        void free(void* ptr)
+        {
+            if (!ptr) {
+                return;
+            }
+            Block* block = static_cast<Block*>(ptr) - 1;
+            block->next = _free[block->sizeClass];
+            _free[block->sizeClass] = block;
+        }
+
+        void* alloc(std::size_t bytes)
+        {
+            bytes = align(bytes);
+            for (;;) {
+                if (_chunk && _chunk->bytes - _used >= bytes) {
+                    void* ptr = reinterpret_cast<unsigned char*>(_chunk + 1) + _used;
+                    _used += bytes;
+                    return ptr;
+                }
+
+                // next chunk large enough, or a new one after the current
+                Chunk** link = _chunk ? &_chunk->next : &_chunks;
+                while (*link && (*link)->bytes < bytes) {
+                    link = &(*link)->next;
+                }
+                if (!*link) {
+                    const std::size_t size = bytes > kChunk - sizeof(Chunk) ? bytes : kChunk - sizeof(Chunk);
+                    Chunk* chunk = static_cast<Chunk*>(malloc(sizeof(Chunk) + size));
+                    if (!chunk) {
+                        return nullptr;
+                    }
+                    chunk->bytes = size;
+                    chunk->next = nullptr;
+                    *link = chunk;
+                }
+                // chunks skipped (too small) stay for the next reset
+                _chunk = *link;
+                _used = 0;
+            }
+        }
+
+        void reset()
+        {
+            _chunk = _chunks;
+            _used = 0;
+        }
+
+    private:
+        // bytes at the top of the heap, grown when needed
+        void* take(std::size_t bytes)
+        {
+            if (_end - _top < bytes) {
+                const std::size_t pages = (bytes + kPage - 1) / kPage;
+                const std::size_t start = grow(pages);
+                if (!start) {
+                    return nullptr;
+                }
+                // grown by JS in between: the end of our pages is lost
+                if (start != _end) {
+                    _top = start;
+                }
+                _end = start + pages * kPage;
+            }
+            void* ptr = reinterpret_cast<void*>(_top);
+            _top += bytes;
+            return ptr;
+        }
+
+        std::size_t _top;
+        std::size_t _end;
+        Block* _free[kClasses] = {};
+        Chunk* _chunks{nullptr};
+        Chunk* _chunk{nullptr};
+        std::size_t _used{0};
+    };
+
+    Heap heap;
+}
+
+extern "C"
+{
+    void* calc_malloc(std::size_t bytes)
+    {
+        return heap.malloc(bytes);
+    }
+    void calc_free(void* ptr)
+    {
+        heap.free(ptr);
+    }
+    void* calc_alloc(std::size_t bytes)
+    {
+        return heap.alloc(bytes);
+    }
+    void calc_reset()
+    {
+        heap.reset();
+    }
+}
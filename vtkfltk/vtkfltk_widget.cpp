@@ -15,8 +15,31 @@
 #include <vtkRendererCollection.h>
 #include <vtkVersion.h>
 
+#include <algorithm>
+#include <chrono>
+
 namespace tailor::ks
 {
+  namespace
+  {
+    // the Render() calls made while it lives are deferred to the next frame
+    struct DeferRenders
+    {
+      int& depth;
+      explicit DeferRenders(int& d) : depth(d) { ++depth; }
+      ~DeferRenders() { --depth; }
+    };
+  }
+
+  void OnFrameGlobal(void* p)
+  {
+    if (p) { ((VtkFLTKWidget*)p)->OnFrame(); }
+  }
+
+  void OnIdleGlobal(void* p)
+  {
+    if (p) { ((VtkFLTKWidget*)p)->OnIdle(); }
+  }
 
   VtkFLTKWidget::VtkFLTKWidget(int lx, int ly, int lw, int lh, const char* ll)
     : Fl_Gl_Window(lx, ly, lw, lh, ll), vtkRenderWindowInteractor()
@@ -30,6 +53,8 @@ namespace tailor::ks
 
   VtkFLTKWidget::~VtkFLTKWidget()
   {
+    Fl::remove_timeout(OnFrameGlobal, (void*)this);
+    Fl::remove_timeout(OnIdleGlobal, (void*)this);
     if (parent())
     {
       ((Fl_Group*)parent())->remove(*(Fl_Gl_Window*)this);
@@ -64,6 +89,27 @@ namespace tailor::ks
     // std::cout << "display id = " << fl_display << std::endl;
   }
 
+  void VtkFLTKWidget::renderNow()
+  {
+    if (!m_isReadyForRendering)
+    {
+      // no window to draw to yet, the plain interactor render
+      vtkRenderWindowInteractor::Render();
+      return;
+    }
+    renderFrame(false);
+  }
+
+  void VtkFLTKWidget::setFrameBudget(double seconds)
+  {
+    m_frameBudget = std::max(0.0, seconds);
+  }
+
+  void VtkFLTKWidget::setIdleDelay(double seconds)
+  {
+    m_idleDelay = std::max(0.0, seconds);
+  }
+
   void VtkFLTKWidget::Initialize()
   {
     if (!RenderWindow)
@@ -192,6 +238,7 @@ namespace tailor::ks
   void VtkFLTKWidget::OnTimer(void)
   {
     if (!Enabled) { return; }
+    DeferRenders defer(m_deferRenders);
     // this is all we need to do, InteractorStyle is stateful and will
     // continue with whatever it's busy
     this->InvokeEvent(vtkCommand::TimerEvent, NULL);
@@ -199,9 +246,75 @@ namespace tailor::ks
 
   void VtkFLTKWidget::TerminateApp() {}
 
+  void VtkFLTKWidget::Render()
+  {
+    if (m_deferRenders > 0) { requestRender(); }
+    else { renderNow(); }
+  }
+
+  void VtkFLTKWidget::requestRender()
+  {
+    m_renderPending = true;
+    scheduleFrame();
+  }
+
+  void VtkFLTKWidget::scheduleFrame()
+  {
+    if (m_frameScheduled) { return; }
+    m_frameScheduled = true;
+
+    // one frame budget after the last render, right away if it is older
+    const double elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - m_lastRender).count();
+    Fl::add_timeout(std::max(0.0, m_frameBudget - elapsed), OnFrameGlobal,
+                    (void*)this);
+  }
+
+  void VtkFLTKWidget::OnFrame(void)
+  {
+    // the interactor style renders from the move: its Render() calls only
+    // mark the frame in progress
+    dispatchPendingMove();
+    m_frameScheduled = false;
+
+    // FLTK draws it once the pending events are handled
+    if (m_renderPending && m_isReadyForRendering && shown()) { redraw(); }
+  }
+
+  void VtkFLTKWidget::beginInteraction()
+  {
+    m_interacting = true;
+    Fl::remove_timeout(OnIdleGlobal, (void*)this);
+    Fl::add_timeout(m_idleDelay, OnIdleGlobal, (void*)this);
+  }
+
+  void VtkFLTKWidget::endInteraction()
+  {
+    Fl::remove_timeout(OnIdleGlobal, (void*)this);
+    m_interacting = false;
+    // the last frame was a reduced quality one
+    if (m_stillRenderNeeded) { requestRender(); }
+  }
+
+  void VtkFLTKWidget::OnIdle(void) { endInteraction(); }
+
+  void VtkFLTKWidget::dispatchPendingMove()
+  {
+    if (!m_movePending) { return; }
+    m_movePending = false;
+    DeferRenders defer(m_deferRenders);
+
+    // the style gets the whole motion since the previous move it was sent
+    this->SetEventInformation(m_moveX, m_moveY, m_moveCtrl, m_moveShift,
+                              m_moveKey, 1, NULL);
+    this->InvokeEvent(vtkCommand::MouseMoveEvent, NULL);
+  }
+
   void VtkFLTKWidget::flush(void) { draw(); }
 
-  void VtkFLTKWidget::draw(void)
+  void VtkFLTKWidget::draw(void) { renderFrame(m_interacting); }
+
+  void VtkFLTKWidget::renderFrame(bool interactive)
   {
     if (RenderWindow)
     {
@@ -216,8 +329,15 @@ namespace tailor::ks
       // see Fl_Gl_Window::show()
       make_current();
 
+      // reduced quality (LOD) while the user interacts, full once idle
+      RenderWindow->SetDesiredUpdateRate(interactive ? DesiredUpdateRate
+                                                     : StillUpdateRate);
+      m_stillRenderNeeded = interactive;
+      m_renderPending = false;
+      m_lastRender = std::chrono::steady_clock::now();
+
       // get vtk to render to the Fl_Gl_Window
-      Render();
+      vtkRenderWindowInteractor::Render();
     }
   }
 
@@ -254,6 +374,30 @@ namespace tailor::ks
   int VtkFLTKWidget::handle(int event)
   {
     if (!Enabled) { return 0; }
+    DeferRenders defer(m_deferRenders);
+
+    // we test for both of these, as fltk classifies mouse moves as with
+    // or without button press whereas vtk wants all mouse movement
+    // (this bug took a while to find :)
+    // Only the last one of a frame is sent (at the frame), so that a fast
+    // mouse does not queue a render per event
+    if (event == FL_DRAG || event == FL_MOVE)
+    {
+      m_movePending = true;
+      m_moveX = Fl::event_x();
+      m_moveY = this->h() - Fl::event_y() - 1;
+      m_moveCtrl = Fl::event_state(FL_CTRL);
+      m_moveShift = Fl::event_state(FL_SHIFT);
+      m_moveKey = Fl::event_key();
+      // a drag goes on with the interaction of the press, a hover (no
+      // button) renders at full quality
+      if (event == FL_DRAG) { beginInteraction(); }
+      scheduleFrame();
+      return 1;
+    }
+
+    // the other events come after the pending move
+    dispatchPendingMove();
 
     // setup for new style
     // SEI(x, y, ctrl, shift, keycode, repeatcount, keysym)
@@ -269,6 +413,7 @@ namespace tailor::ks
         break;
 
       case FL_KEYBOARD:  // keypress
+        beginInteraction();
         // new style
         this->InvokeEvent(vtkCommand::MouseMoveEvent, NULL);
         this->InvokeEvent(vtkCommand::KeyPressEvent, NULL);
@@ -285,6 +430,7 @@ namespace tailor::ks
 
       case FL_PUSH:            // mouse down
         this->take_focus();  // this allows key events to work
+        beginInteraction();
         switch (Fl::event_button())
         {
           case FL_LEFT_MOUSE:
@@ -309,15 +455,6 @@ namespace tailor::ks
         break;  // this break should be here, at least according to
       // vtkXRenderWindowInteractor
 
-      // we test for both of these, as fltk classifies mouse moves as with
-      // or without button press whereas vtk wants all mouse movement
-      // (this bug took a while to find :)
-      case FL_DRAG:
-      case FL_MOVE:
-        // new style
-        this->InvokeEvent(vtkCommand::MouseMoveEvent, NULL);
-        break;
-
       case FL_RELEASE:  // mouse up
         switch (Fl::event_button())
         {
@@ -336,6 +473,8 @@ namespace tailor::ks
                               NULL);
             break;
         }
+        // full quality right away, no need to wait for the idle delay
+        endInteraction();
         break;
 
       default:  // let the base class handle everything else
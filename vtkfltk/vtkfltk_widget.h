@@ -7,12 +7,23 @@
 #include <vtkRenderWindowInteractor.h>
 #include <vtkSmartPointer.h>
 
+#include <chrono>
+
 class vtkRenderWindow;
 class vtkImageViewer2;
 
 ///
 /// @brief Custom implementation equivalent to QVtkWidget for FLTK
 ///
+/// Renders on demand: the Render() calls made while the widget dispatches
+/// its events (the interactor styles render on each mouse move) only mark
+/// the view dirty, and the mouse moves are coalesced, so that there is at
+/// most one render per frame budget however fast the events come. While
+/// the user interacts (button pressed, keys) the render window gets the
+/// DesiredUpdateRate of the interactor (the LOD actors and volume mappers
+/// lower their quality to keep up), a full quality render (StillUpdateRate)
+/// follows once the interaction stops.
+///
 class VtkFLTKWidget : public Fl_Gl_Window, public vtkRenderWindowInteractor
 {
 public:
@@ -26,6 +37,15 @@ public:
   void makeReadyForFirstRender();
   void resetCamera();
   void checkState() const;
+  /// renders at full quality before returning, e.g. before reading the
+  /// frame back (vtkWindowToImageFilter), the pending frame is dropped
+  void renderNow();
+
+  /// minimum time between two renders in seconds, 1/60 by default
+  void setFrameBudget(double seconds);
+  /// time without input after which the interaction is over, 0.2 s by
+  /// default (a button release ends it at once)
+  void setIdleDelay(double seconds);
 
   // vtkRenderWindowInteractor overrides
   void Initialize() override;
@@ -37,7 +57,13 @@ public:
   int CreateTimer(int timertype) override;
   int DestroyTimer() override;
   void OnTimer(void);
+  // render scheduler timeouts
+  void OnFrame(void);
+  void OnIdle(void);
   void TerminateApp() override;
+  // deferred to the next frame when called from the event handling of the
+  // widget, renderNow() otherwise: the frame is complete when it returns
+  void Render() override;
   vtkRenderWindow* GetRenderWindow();
 
   void hide() override;
@@ -51,7 +77,34 @@ protected:
   int handle(int event) override;
 
 private:
+  void requestRender();
+  void renderFrame(bool interactive);
+  void scheduleFrame();
+  void beginInteraction();
+  void endInteraction();
+  void dispatchPendingMove();
+
   bool m_isReadyForRendering{false};
+
+  // render scheduler
+  double m_frameBudget{1.0 / 60.0};
+  double m_idleDelay{0.2};
+  bool m_renderPending{false};
+  bool m_frameScheduled{false};
+  bool m_interacting{false};
+  // > 0 while the events are dispatched, Render() is deferred
+  int m_deferRenders{0};
+  // the last render was a reduced quality one
+  bool m_stillRenderNeeded{false};
+  std::chrono::steady_clock::time_point m_lastRender;
+
+  // last FL_DRAG/FL_MOVE not sent yet
+  bool m_movePending{false};
+  int m_moveX{0};
+  int m_moveY{0};
+  int m_moveCtrl{0};
+  int m_moveShift{0};
+  int m_moveKey{0};
 };
 
 struct VtkFLTKWidgetDeleter